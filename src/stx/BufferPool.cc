@@ -0,0 +1,108 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <thread>
+#include "stx/BufferPool.h"
+
+namespace stx {
+
+BufferPool::BufferPool(
+    size_t buffer_size,
+    size_t max_buffers,
+    size_t num_shards /* = kDefaultNumShards */) :
+    buffer_size_(buffer_size) {
+  num_shards = std::max(std::min(num_shards, max_buffers), size_t(1));
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard());
+    shards_.back()->max_buffers =
+        max_buffers / num_shards + (i < max_buffers % num_shards ? 1 : 0);
+  }
+}
+
+// each thread starts with the same shard every time
+size_t BufferPool::homeShard() const {
+  return std::hash<std::thread::id>()(std::this_thread::get_id()) %
+      shards_.size();
+}
+
+bool BufferPool::acquire(Buffer* buf) {
+  if (buf->allocSize() >= buffer_size_) {
+    return true;
+  }
+
+  if (buf->allocSize() == 0) {
+    auto home = homeShard();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      auto shard = shards_[(home + i) % shards_.size()].get();
+
+      // don't wait for the other shards, a new allocation is cheaper
+      std::unique_lock<std::mutex> lk(shard->mutex, std::defer_lock);
+      if (i == 0) {
+        lk.lock();
+      } else if (!lk.try_lock()) {
+        continue;
+      }
+
+      if (!shard->buffers.empty()) {
+        *buf = std::move(shard->buffers.back());
+        shard->buffers.pop_back();
+        return true;
+      }
+    }
+  }
+
+  buf->reserve(buffer_size_ - buf->allocSize());
+  return false;
+}
+
+void BufferPool::release(Buffer* buf) {
+  if (buf->size() > 0 || buf->allocSize() == 0) {
+    return;
+  }
+
+  Buffer memory(std::move(*buf));
+  if (memory.allocSize() != buffer_size_) {
+    return;
+  }
+
+  memory.clear();
+
+  auto home = homeShard();
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    auto shard = shards_[(home + i) % shards_.size()].get();
+
+    std::unique_lock<std::mutex> lk(shard->mutex, std::defer_lock);
+    if (i == 0) {
+      lk.lock();
+    } else if (!lk.try_lock()) {
+      continue;
+    }
+
+    if (shard->buffers.size() < shard->max_buffers) {
+      shard->buffers.emplace_back(std::move(memory));
+      return;
+    }
+  }
+}
+
+size_t BufferPool::bufferSize() const {
+  return buffer_size_;
+}
+
+size_t BufferPool::size() const {
+  size_t size = 0;
+  for (const auto& shard : shards_) {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+    size += shard->buffers.size();
+  }
+
+  return size;
+}
+
+}
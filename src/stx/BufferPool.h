@@ -0,0 +1,81 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_BUFFERPOOL_H
+#define _STX_BUFFERPOOL_H
+#include <mutex>
+#include "stx/stdtypes.h"
+#include "stx/buffer.h"
+
+namespace stx {
+
+/**
+ * A pool of equally sized buffer allocations.
+ *
+ * Objects that only need a buffer while data is in flight (like keep-alive
+ * connections) borrow the backing memory from the pool and return it once the
+ * buffer is empty, so that idle objects don't hold on to memory. At most
+ * max_buffers allocations are kept for reuse, everything else is freed.
+ *
+ * The allocations are spread over num_shards independently locked shards and
+ * each thread starts with its own shard, so threads only contend for a lock
+ * if their shard runs empty or full and they have to borrow from another one.
+ *
+ * All methods are thread safe.
+ */
+class BufferPool {
+public:
+  static const size_t kDefaultNumShards = 16;
+
+  BufferPool(
+      size_t buffer_size,
+      size_t max_buffers,
+      size_t num_shards = kDefaultNumShards);
+
+  BufferPool(const BufferPool& other) = delete;
+  BufferPool& operator=(const BufferPool& other) = delete;
+
+  /**
+   * Make sure that buf has backing memory of at least buffer_size bytes.
+   * If buf has no backing memory yet, a pooled allocation is moved into it or,
+   * if the pool is empty, a new one is made. Returns false if a new allocation
+   * was made
+   */
+  bool acquire(Buffer* buf);
+
+  /**
+   * Take the backing memory of buf if buf is empty. The memory is kept for
+   * reuse if it has exactly buffer_size bytes and the pool is not full,
+   * otherwise it is freed. Buffers that still contain data are left alone
+   */
+  void release(Buffer* buf);
+
+  size_t bufferSize() const;
+
+  /**
+   * Returns the number of allocations that are currently kept for reuse
+   */
+  size_t size() const;
+
+protected:
+
+  struct Shard {
+    Vector<Buffer> buffers;
+    size_t max_buffers;
+    mutable std::mutex mutex;
+  };
+
+  size_t homeShard() const;
+
+  size_t buffer_size_;
+  Vector<ScopedPtr<Shard>> shards_;
+};
+
+}
+#endif
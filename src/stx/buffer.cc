@@ -42,7 +42,11 @@ Buffer::Buffer(
 
 Buffer::Buffer(const String& string) : Buffer(string.data(), string.size()) {}
 
-Buffer::Buffer(const Buffer& copy) : size_(copy.size_), alloc_(copy.size_) {
+Buffer::Buffer(
+    const Buffer& copy) :
+    size_(copy.size_),
+    alloc_(copy.size_),
+    mark_(copy.mark_) {
   data_ = malloc(size_);
 
   if (data_ == nullptr) {
@@ -59,6 +63,7 @@ Buffer& Buffer::operator=(const Buffer& copy) {
 
   size_ = copy.size_;
   alloc_ = copy.size_;
+  mark_ = copy.mark_;
   data_ = malloc(alloc_);
 
   if (data_ == nullptr) {
@@ -70,17 +75,18 @@ Buffer& Buffer::operator=(const Buffer& copy) {
 }
 
 Buffer::Buffer(
-    Buffer&& move) :
+    Buffer&& move) noexcept :
     data_(move.data_),
     size_(move.size_),
     alloc_(move.alloc_),
-    mark_(0) {
+    mark_(move.mark_) {
   move.data_ = nullptr;
   move.size_ = 0;
   move.alloc_ = 0;
+  move.mark_ = 0;
 }
 
-Buffer& Buffer::operator=(Buffer&& move) {
+Buffer& Buffer::operator=(Buffer&& move) noexcept {
   if (data_ != nullptr) {
     free(data_);
   }
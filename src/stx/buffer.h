@@ -91,11 +91,15 @@ public:
    * acutally move the backing memory allocation so it is very cheap).
    *
    * This operation will preserve both the size _and_ the capacity of the buffer
+   *
+   * The move operations never throw, so containers like Vector<Buffer> move
+   * their elements when they grow instead of copying them (and dropping their
+   * capacity)
    */
-  Buffer(Buffer&& move);
+  Buffer(Buffer&& move) noexcept;
 
   Buffer& operator=(const Buffer& copy);
-  Buffer& operator=(Buffer&& move);
+  Buffer& operator=(Buffer&& move) noexcept;
 
   ~Buffer();
 
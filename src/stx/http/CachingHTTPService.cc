@@ -0,0 +1,127 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/logging.h>
+#include <stx/http/CachingHTTPService.h>
+
+namespace stx {
+namespace http {
+
+CachingHTTPService::CachingHTTPService(
+    HTTPService* service,
+    HTTPResponseCache* cache) :
+    service_(service),
+    cache_(cache) {}
+
+void CachingHTTPService::handleHTTPRequest(
+    RefPtr<HTTPRequestStream> req_stream,
+    RefPtr<HTTPResponseStream> res_stream) {
+  const auto& req = req_stream->request();
+
+  if (!HTTPResponseCache::isCacheable(req)) {
+    service_->handleHTTPRequest(req_stream, res_stream);
+    return;
+  }
+
+  auto key = cache_->cacheKey(req);
+  bool fetch = false;
+
+  auto cached = cache_->lookup(
+      key,
+      [this, req_stream, res_stream] (
+          RefPtr<HTTPResponseCache::CachedResponse> cached) {
+        try {
+          if (cached.get() == nullptr) {
+            fetchUncached(req_stream, res_stream);
+          } else {
+            writeResponse(req_stream->request(), cached, res_stream);
+          }
+        } catch (const std::exception& e) {
+          logError("http.server", e, "Error while writing cached response");
+        }
+      },
+      &fetch);
+
+  if (cached.get() != nullptr) {
+    writeResponse(req, cached, res_stream);
+    return;
+  }
+
+  // another request is already fetching the response
+  if (!fetch) {
+    return;
+  }
+
+  HTTPResponse res;
+  res.populateFromRequest(req);
+
+  try {
+    service_->handleHTTPRequest(const_cast<HTTPRequest*>(&req), &res);
+  } catch (const std::exception& e) {
+    cache_->abandon(key);
+    throw;
+  }
+
+  auto body_size = res.body().size();
+  if (body_size > 0) {
+    res.setHeader("Content-Length", StringUtil::toString(body_size));
+  }
+
+  writeResponse(req, cache_->complete(key, res), res_stream);
+}
+
+void CachingHTTPService::fetchUncached(
+    RefPtr<HTTPRequestStream> req_stream,
+    RefPtr<HTTPResponseStream> res_stream) {
+  const auto& req = req_stream->request();
+  HTTPResponse res;
+  res.populateFromRequest(req);
+
+  try {
+    service_->handleHTTPRequest(const_cast<HTTPRequest*>(&req), &res);
+  } catch (const std::exception& e) {
+    logError("http.server", e, "Error while processing HTTP request");
+    res = HTTPResponse();
+    res.populateFromRequest(req);
+    res.setStatus(kStatusInternalServerError);
+    res.addBody("server error");
+  }
+
+  auto body_size = res.body().size();
+  if (body_size > 0) {
+    res.setHeader("Content-Length", StringUtil::toString(body_size));
+  }
+
+  res_stream->writeResponse(res);
+}
+
+void CachingHTTPService::writeResponse(
+    const HTTPRequest& req,
+    RefPtr<HTTPResponseCache::CachedResponse> cached,
+    RefPtr<HTTPResponseStream> res_stream) {
+  if (!cached->etag.empty() &&
+      HTTPResponseCache::matchesETag(req, cached->etag)) {
+    cache_->stats()->not_modified.incr(1);
+
+    HTTPResponse res;
+    res.populateFromRequest(req);
+    res.setStatus(kStatusNotModified);
+    res.setHeader("ETag", cached->etag);
+    res_stream->writeResponse(res);
+    return;
+  }
+
+  auto res = cached->response;
+  res.removeHeader("Connection");
+  res.populateFromRequest(req);
+  res_stream->writeResponse(res);
+}
+
+}
+}
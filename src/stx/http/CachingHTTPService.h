@@ -0,0 +1,64 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_CACHINGHTTPSERVICE_H
+#define _STX_HTTP_CACHINGHTTPSERVICE_H
+#include <stx/http/httpservice.h>
+#include <stx/http/HTTPResponseCache.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * Serves responses of the wrapped HTTPService from a HTTPResponseCache.
+ * Concurrent requests for the same uncached resource are coalesced into a
+ * single call to the wrapped service. If that call fails or its response must
+ * not be cached, the coalesced requests call the wrapped service themselves,
+ * one after another on the thread of the first request. Cached responses
+ * carry an ETag and requests with a matching If-None-Match header receive a
+ * 304.
+ *
+ * Usage:
+ *
+ *   HTTPResponseCache cache;
+ *   CachingHTTPService cached_service(&my_service, &cache);
+ *   router.addRouteByPrefixMatch("/api", &cached_service, &thread_pool);
+ *
+ */
+class CachingHTTPService : public StreamingHTTPService {
+public:
+
+  CachingHTTPService(HTTPService* service, HTTPResponseCache* cache);
+
+  void handleHTTPRequest(
+      RefPtr<HTTPRequestStream> req,
+      RefPtr<HTTPResponseStream> res) override;
+
+  bool isStreaming() override {
+    return false;
+  }
+
+protected:
+
+  void fetchUncached(
+      RefPtr<HTTPRequestStream> req_stream,
+      RefPtr<HTTPResponseStream> res_stream);
+
+  void writeResponse(
+      const HTTPRequest& req,
+      RefPtr<HTTPResponseCache::CachedResponse> cached,
+      RefPtr<HTTPResponseStream> res_stream);
+
+  HTTPService* service_;
+  HTTPResponseCache* cache_;
+};
+
+}
+}
+#endif
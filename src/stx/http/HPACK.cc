@@ -0,0 +1,537 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/exception.h>
+#include <stx/stringutil.h>
+#include <stx/http/HPACK.h>
+
+namespace stx {
+namespace http {
+
+static const Pair<String, String> kHPACKStaticTable[] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" }
+};
+
+/**
+ * The HPACK Huffman code (RFC 7541 Appendix B) as (code, bit length), indexed
+ * by symbol. Symbol 256 is EOS
+ */
+static const struct {
+  uint32_t code;
+  uint8_t bits;
+} kHPACKHuffmanCodes[] = {
+  { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 },
+  { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+  { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 },
+  { 0x18, 6 }, { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 },
+  { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 },
+  { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+  { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 },
+  { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 }, { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 },
+  { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 },
+  { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 },
+  { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+  { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 }, { 0x7ffd, 15 },
+  { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 },
+  { 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 },
+  { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 },
+  { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 }, { 0x79, 7 },
+  { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+  { 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 },
+  { 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 },
+  { 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+  { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 },
+  { 0xffffeb, 24 }, { 0x7fffdf, 23 }, { 0xffffec, 24 }, { 0xffffed, 24 },
+  { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+  { 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 },
+  { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 },
+  { 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+  { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 },
+  { 0x7fffe9, 23 }, { 0x1fffde, 21 }, { 0x7fffea, 23 }, { 0x3fffdd, 22 },
+  { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+  { 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 },
+  { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 },
+  { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+  { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 },
+  { 0x3fffe6, 22 }, { 0x7ffff1, 23 }, { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 },
+  { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+  { 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 },
+  { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 },
+  { 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+  { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 },
+  { 0x7ffffe2, 27 }, { 0xfffff2, 24 }, { 0x1fffe4, 21 }, { 0x1fffe5, 21 },
+  { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+  { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 },
+  { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 },
+  { 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+  { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 },
+  { 0x3ffffea, 26 }, { 0x7ffff4, 23 }, { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 },
+  { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+  { 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 },
+  { 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 },
+  { 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 }
+};
+
+/**
+ * Binary decoding tree for kHPACKHuffmanCodes. Built once on first use
+ */
+class HPACKHuffmanTree {
+public:
+  static const int16_t kNoSymbol = -1;
+
+  struct Node {
+    uint16_t next[2];
+    int16_t symbol;
+  };
+
+  static const HPACKHuffmanTree& get() {
+    static HPACKHuffmanTree tree;
+    return tree;
+  }
+
+  const Node& node(size_t index) const {
+    return nodes_[index];
+  }
+
+protected:
+
+  HPACKHuffmanTree() {
+    nodes_.emplace_back(Node { { 0, 0 }, kNoSymbol });
+
+    for (int16_t sym = 0; sym <= 256; ++sym) {
+      const auto& code = kHPACKHuffmanCodes[sym];
+      size_t cur = 0;
+      for (int bit = code.bits - 1; bit >= 0; --bit) {
+        auto b = (code.code >> bit) & 1;
+        if (nodes_[cur].next[b] == 0) {
+          nodes_[cur].next[b] = nodes_.size();
+          nodes_.emplace_back(Node { { 0, 0 }, kNoSymbol });
+        }
+
+        cur = nodes_[cur].next[b];
+      }
+
+      nodes_[cur].symbol = sym;
+    }
+  }
+
+  Vector<Node> nodes_;
+};
+
+HPACKTable::HPACKTable(
+    size_t max_size /* = kDefaultMaxSize */) :
+    size_(0),
+    max_size_(max_size) {}
+
+const Pair<String, String>& HPACKTable::get(size_t index) const {
+  if (index == 0) {
+    RAISE(kIndexError, "invalid HPACK index: 0");
+  }
+
+  if (index <= kStaticTableSize) {
+    return kHPACKStaticTable[index - 1];
+  }
+
+  index -= kStaticTableSize + 1;
+  if (index >= entries_.size()) {
+    RAISEF(kIndexError, "invalid HPACK index: $0", index + kStaticTableSize + 1);
+  }
+
+  return entries_[index];
+}
+
+size_t HPACKTable::find(
+    const String& name,
+    const String& value,
+    bool* exact) const {
+  size_t name_match = 0;
+  *exact = false;
+
+  for (size_t i = 0; i < kStaticTableSize; ++i) {
+    if (kHPACKStaticTable[i].first != name) {
+      continue;
+    }
+
+    if (kHPACKStaticTable[i].second == value) {
+      *exact = true;
+      return i + 1;
+    }
+
+    if (name_match == 0) {
+      name_match = i + 1;
+    }
+  }
+
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].first != name) {
+      continue;
+    }
+
+    if (entries_[i].second == value) {
+      *exact = true;
+      return i + kStaticTableSize + 1;
+    }
+
+    if (name_match == 0) {
+      name_match = i + kStaticTableSize + 1;
+    }
+  }
+
+  return name_match;
+}
+
+void HPACKTable::add(const String& name, const String& value) {
+  auto entry_size = name.size() + value.size() + kEntryOverhead;
+
+  // an entry larger than the table empties the table (RFC 7541 4.4)
+  if (entry_size > max_size_) {
+    evict(0);
+    return;
+  }
+
+  evict(max_size_ - entry_size);
+  entries_.emplace_front(name, value);
+  size_ += entry_size;
+}
+
+void HPACKTable::setMaxSize(size_t max_size) {
+  max_size_ = max_size;
+  evict(max_size_);
+}
+
+size_t HPACKTable::maxSize() const {
+  return max_size_;
+}
+
+size_t HPACKTable::size() const {
+  return size_;
+}
+
+size_t HPACKTable::numEntries() const {
+  return entries_.size();
+}
+
+void HPACKTable::evict(size_t max_size) {
+  while (size_ > max_size && !entries_.empty()) {
+    const auto& entry = entries_.back();
+    size_ -= entry.first.size() + entry.second.size() + kEntryOverhead;
+    entries_.pop_back();
+  }
+}
+
+HPACKEncoder::HPACKEncoder(
+    size_t max_table_size /* = HPACKTable::kDefaultMaxSize */) :
+    table_(max_table_size),
+    table_size_changed_(false) {}
+
+void HPACKEncoder::encode(
+    const HTTPMessage::HeaderList& headers,
+    Buffer* out) {
+  if (table_size_changed_) {
+    encodeInteger(table_.maxSize(), 5, 0x20, out);
+    table_size_changed_ = false;
+  }
+
+  for (const auto& header : headers) {
+    auto name = header.first;
+    StringUtil::toLower(&name);
+    const auto& value = header.second;
+
+    bool exact;
+    auto index = table_.find(name, value, &exact);
+    if (exact) {
+      encodeInteger(index, 7, 0x80, out);
+      continue;
+    }
+
+    // credentials must not end up in a (shared) compression context
+    if (name == "authorization" ||
+        name == "proxy-authorization" ||
+        name == "cookie" ||
+        name == "set-cookie") {
+      encodeInteger(index, 4, 0x10, out);
+      if (index == 0) {
+        encodeString(name, out);
+      }
+
+      encodeString(value, out);
+      continue;
+    }
+
+    encodeInteger(index, 6, 0x40, out);
+    if (index == 0) {
+      encodeString(name, out);
+    }
+
+    encodeString(value, out);
+    table_.add(name, value);
+  }
+}
+
+void HPACKEncoder::setMaxTableSize(size_t max_size) {
+  table_.setMaxSize(max_size);
+  table_size_changed_ = true;
+}
+
+void HPACKEncoder::encodeInteger(
+    uint64_t value,
+    uint8_t prefix_bits,
+    uint8_t first_byte,
+    Buffer* out) {
+  uint64_t max_prefix = (1 << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out->append((char) (first_byte | value));
+    return;
+  }
+
+  out->append((char) (first_byte | max_prefix));
+  value -= max_prefix;
+  while (value >= 128) {
+    out->append((char) ((value % 128) + 128));
+    value /= 128;
+  }
+
+  out->append((char) value);
+}
+
+void HPACKEncoder::encodeString(const String& str, Buffer* out) {
+  encodeInteger(str.size(), 7, 0x00, out);
+  out->append(str.data(), str.size());
+}
+
+HPACKDecoder::HPACKDecoder(
+    size_t max_table_size /* = HPACKTable::kDefaultMaxSize */) :
+    table_(max_table_size),
+    max_table_size_(max_table_size) {}
+
+void HPACKDecoder::decode(
+    const void* data,
+    size_t size,
+    HTTPMessage::HeaderList* headers) {
+  auto cur = (const char*) data;
+  auto end = cur + size;
+
+  while (cur < end) {
+    uint8_t first_byte = *cur;
+
+    // indexed header field
+    if (first_byte & 0x80) {
+      auto index = decodeInteger(&cur, end, 7);
+      if (index == 0) {
+        RAISE(kParseError, "invalid HPACK index: 0");
+      }
+
+      headers->emplace_back(table_.get(index));
+      continue;
+    }
+
+    // dynamic table size update
+    if ((first_byte & 0xe0) == 0x20) {
+      auto max_size = decodeInteger(&cur, end, 5);
+      if (max_size > max_table_size_) {
+        RAISEF(kParseError, "invalid HPACK table size: $0", max_size);
+      }
+
+      table_.setMaxSize(max_size);
+      continue;
+    }
+
+    // literal header field with incremental indexing (01xxxxxx), without
+    // indexing (0000xxxx) or never indexed (0001xxxx)
+    bool add_to_table = (first_byte & 0xc0) == 0x40;
+    auto index = decodeInteger(&cur, end, add_to_table ? 6 : 4);
+
+    String name;
+    if (index == 0) {
+      name = decodeString(&cur, end);
+    } else {
+      name = table_.get(index).first;
+    }
+
+    auto value = decodeString(&cur, end);
+    if (add_to_table) {
+      table_.add(name, value);
+    }
+
+    headers->emplace_back(name, value);
+  }
+}
+
+void HPACKDecoder::setMaxTableSize(size_t max_size) {
+  max_table_size_ = max_size;
+  if (table_.maxSize() > max_size) {
+    table_.setMaxSize(max_size);
+  }
+}
+
+uint64_t HPACKDecoder::decodeInteger(
+    const char** cur,
+    const char* end,
+    uint8_t prefix_bits) {
+  if (*cur >= end) {
+    RAISE(kParseError, "truncated HPACK integer");
+  }
+
+  uint64_t max_prefix = (1 << prefix_bits) - 1;
+  uint64_t value = *((const uint8_t*) (*cur)++) & max_prefix;
+  if (value < max_prefix) {
+    return value;
+  }
+
+  for (int shift = 0; ; shift += 7) {
+    if (*cur >= end) {
+      RAISE(kParseError, "truncated HPACK integer");
+    }
+
+    if (shift > 56) {
+      RAISE(kParseError, "HPACK integer overflow");
+    }
+
+    uint8_t byte = *((const uint8_t*) (*cur)++);
+    value += (uint64_t) (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+}
+
+String HPACKDecoder::decodeString(const char** cur, const char* end) {
+  if (*cur >= end) {
+    RAISE(kParseError, "truncated HPACK string");
+  }
+
+  bool huffman = (**cur & 0x80) != 0;
+  auto len = decodeInteger(cur, end, 7);
+  if (len > (uint64_t) (end - *cur)) {
+    RAISE(kParseError, "truncated HPACK string");
+  }
+
+  if (huffman) {
+    auto str = decodeHuffman(*cur, len);
+    *cur += len;
+    return str;
+  }
+
+  String str(*cur, len);
+  *cur += len;
+  return str;
+}
+
+String HPACKDecoder::decodeHuffman(const char* data, size_t size) {
+  const auto& tree = HPACKHuffmanTree::get();
+
+  String str;
+  str.reserve(size + size / 2);
+
+  size_t node = 0;
+  size_t pending_bits = 0;
+  bool pending_ones = true;
+  for (size_t i = 0; i < size; ++i) {
+    uint8_t byte = data[i];
+    for (int bit = 7; bit >= 0; --bit) {
+      auto b = (byte >> bit) & 1;
+      node = tree.node(node).next[b];
+      ++pending_bits;
+      pending_ones = pending_ones && b;
+
+      auto symbol = tree.node(node).symbol;
+      if (symbol == HPACKHuffmanTree::kNoSymbol) {
+        continue;
+      }
+
+      if (symbol == 256) {
+        RAISE(kParseError, "EOS in huffman encoded HPACK string");
+      }
+
+      str += (char) symbol;
+      node = 0;
+      pending_bits = 0;
+      pending_ones = true;
+    }
+  }
+
+  // the padding must be a prefix of EOS, i.e. at most 7 one bits (RFC 7541
+  // 5.2)
+  if (pending_bits > 7 || !pending_ones) {
+    RAISE(kParseError, "invalid huffman padding in HPACK string");
+  }
+
+  return str;
+}
+
+}
+}
@@ -0,0 +1,143 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HPACK_H
+#define _STX_HTTP_HPACK_H
+#include <stx/stdtypes.h>
+#include <stx/buffer.h>
+#include <stx/http/httpmessage.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * The HPACK (RFC 7541) header table: the 61 entry static table followed by
+ * the dynamic table. Indexes are 1-based, the most recently added dynamic
+ * entry has index 62.
+ */
+class HPACKTable {
+public:
+  static const size_t kStaticTableSize = 61;
+  static const size_t kDefaultMaxSize = 4096;
+  static const size_t kEntryOverhead = 32;
+
+  HPACKTable(size_t max_size = kDefaultMaxSize);
+
+  /**
+   * Returns the entry for the provided index or throws a kIndexError
+   */
+  const Pair<String, String>& get(size_t index) const;
+
+  /**
+   * Returns the index of the entry with the provided name and value or of the
+   * first entry with the provided name, or 0 if there is none. Sets exact to
+   * true if the value matched, too
+   */
+  size_t find(const String& name, const String& value, bool* exact) const;
+
+  /**
+   * Add an entry to the dynamic table, evicting the oldest entries to make
+   * room for it
+   */
+  void add(const String& name, const String& value);
+
+  void setMaxSize(size_t max_size);
+  size_t maxSize() const;
+
+  /**
+   * The size of the dynamic table as defined in RFC 7541 4.1
+   */
+  size_t size() const;
+
+  /**
+   * The number of entries in the dynamic table
+   */
+  size_t numEntries() const;
+
+protected:
+  void evict(size_t max_size);
+
+  Deque<Pair<String, String>> entries_;
+  size_t size_;
+  size_t max_size_;
+};
+
+/**
+ * Encodes header lists into HPACK header blocks. Header names are lowercased.
+ * Credentials and cookies are sent as never indexed literals, everything
+ * else is added to the dynamic table. String literals are never Huffman
+ * encoded.
+ */
+class HPACKEncoder {
+public:
+
+  HPACKEncoder(size_t max_table_size = HPACKTable::kDefaultMaxSize);
+
+  void encode(const HTTPMessage::HeaderList& headers, Buffer* out);
+
+  /**
+   * Shrink (or grow) the dynamic table, e.g. after the peer sent a
+   * SETTINGS_HEADER_TABLE_SIZE. The size update is signalled at the start of
+   * the next header block
+   */
+  void setMaxTableSize(size_t max_size);
+
+  static void encodeInteger(
+      uint64_t value,
+      uint8_t prefix_bits,
+      uint8_t first_byte,
+      Buffer* out);
+
+  static void encodeString(const String& str, Buffer* out);
+
+protected:
+  HPACKTable table_;
+  bool table_size_changed_;
+};
+
+/**
+ * Decodes HPACK header blocks into header lists, including Huffman encoded
+ * string literals. Throws a kParseError on malformed input
+ */
+class HPACKDecoder {
+public:
+
+  HPACKDecoder(size_t max_table_size = HPACKTable::kDefaultMaxSize);
+
+  void decode(
+      const void* data,
+      size_t size,
+      HTTPMessage::HeaderList* headers);
+
+  /**
+   * The upper bound for table size updates sent by the peer, i.e. our
+   * SETTINGS_HEADER_TABLE_SIZE
+   */
+  void setMaxTableSize(size_t max_size);
+
+  static uint64_t decodeInteger(
+      const char** cur,
+      const char* end,
+      uint8_t prefix_bits);
+
+  static String decodeString(const char** cur, const char* end);
+
+  /**
+   * Decode a Huffman encoded string literal (RFC 7541 5.2 and Appendix B)
+   */
+  static String decodeHuffman(const char* data, size_t size);
+
+protected:
+  HPACKTable table_;
+  size_t max_table_size_;
+};
+
+}
+}
+#endif
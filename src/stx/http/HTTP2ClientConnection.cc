@@ -0,0 +1,644 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <time.h>
+#include <stx/exception.h>
+#include <stx/logging.h>
+#include <stx/http/HTTP2ClientConnection.h>
+
+namespace stx {
+namespace http {
+
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static Exception mkIOError(const String& message) {
+  Exception e(message);
+  e.setTypeName(kIOError);
+  return e;
+}
+
+/**
+ * Connection specific headers are not allowed in HTTP/2 (RFC 7540 8.1.2.2),
+ * the Host header is sent as the :authority pseudo header instead
+ */
+static bool isHopByHopHeader(const String& name) {
+  return
+      name == "connection" ||
+      name == "host" ||
+      name == "http2-settings" ||
+      name == "keep-alive" ||
+      name == "proxy-connection" ||
+      name == "te" ||
+      name == "transfer-encoding" ||
+      name == "upgrade";
+}
+
+static Vector<Pair<HTTP2Setting, uint32_t>> clientSettings() {
+  Vector<Pair<HTTP2Setting, uint32_t>> settings;
+  settings.emplace_back(
+      HTTP2Setting::MAX_CONCURRENT_STREAMS,
+      HTTP2Session::kDefaultMaxConcurrentStreams);
+  settings.emplace_back(
+      HTTP2Setting::INITIAL_WINDOW_SIZE,
+      HTTP2Session::kReceiveWindowSize);
+  settings.emplace_back(HTTP2Setting::ENABLE_PUSH, 0);
+  return settings;
+}
+
+HTTP2ClientConnection::PendingRequest::PendingRequest() :
+    handler(nullptr),
+    head(false),
+    response_started(false),
+    content_encoding(ContentEncoding::IDENTITY) {}
+
+RefPtr<HTTP2ClientConnection> HTTP2ClientConnection::start(
+    ScopedPtr<net::TCPConnection> conn,
+    TaskScheduler* scheduler,
+    HTTPClientStats* stats,
+    bool upgrade) {
+  RefPtr<HTTP2ClientConnection> session(
+      new HTTP2ClientConnection(std::move(conn), scheduler, stats, upgrade));
+
+  // an upgrading connection starts the session once the server switched
+  // protocols
+  if (!upgrade) {
+    std::unique_lock<std::recursive_mutex> lk(session->mutex_);
+    session->startSession();
+    session->started_ = true;
+  }
+
+  return session;
+}
+
+HTTP2ClientConnection::HTTP2ClientConnection(
+    ScopedPtr<net::TCPConnection> conn,
+    TaskScheduler* scheduler,
+    HTTPClientStats* stats,
+    bool upgrade) :
+    HTTP2Session(std::move(conn), scheduler, false),
+    stats_(stats),
+    upgrade_(upgrade),
+    upgrade_sent_(false),
+    started_(false),
+    next_stream_id_(1),
+    next_ping_id_(1),
+    idle_notified_(true) {
+  if (stats_ != nullptr) {
+    stats_->http2_connections.incr(1);
+    received_bytes_ = &stats_->received_bytes;
+    sent_bytes_ = &stats_->sent_bytes;
+  }
+}
+
+HTTP2ClientConnection::~HTTP2ClientConnection() {}
+
+void HTTP2ClientConnection::executeRequest(
+    const HTTPRequest& request,
+    HTTPResponseHandler* response_handler) {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+
+  if (closed_ || goaway_sent_ || goaway_received_) {
+    RAISE(
+        kIllegalStateError,
+        "executeRequest called on closed HTTP/2 connection");
+  }
+
+  if (next_stream_id_ > kMaxStreamID) {
+    RAISE(kIllegalStateError, "HTTP/2 connection ran out of stream ids");
+  }
+
+  ScopedPtr<PendingRequest> pending(new PendingRequest());
+  pending->handler = response_handler;
+  pending->head = request.method() == HTTPRequest::M_HEAD;
+
+  auto& headers = pending->headers;
+  headers.emplace_back(":method", StringUtil::toString(request.method()));
+  headers.emplace_back(":scheme", "http");
+  if (request.hasHeader("Host")) {
+    headers.emplace_back(":authority", request.getHeader("Host"));
+  }
+
+  headers.emplace_back(":path", request.uri());
+
+  for (const auto& header : request.headers()) {
+    auto name = header.first;
+    StringUtil::toLower(&name);
+    if (!isHopByHopHeader(name)) {
+      headers.emplace_back(name, header.second);
+    }
+  }
+
+  const auto& body = request.body();
+  if (body.size() > 0) {
+    if (!request.hasHeader("Content-Length")) {
+      headers.emplace_back(
+          "content-length",
+          StringUtil::toString(body.size()));
+    }
+
+    pending->body = BufferRef(new Buffer(body));
+  }
+
+  if (stats_ != nullptr) {
+    stats_->current_requests.incr(1);
+    stats_->total_requests.incr(1);
+  }
+
+  idle_notified_ = false;
+
+  if (upgrade_ && !upgrade_sent_) {
+    startUpgrade(request, std::move(pending));
+    return;
+  }
+
+  queued_.emplace_back(std::move(pending));
+  startRequests();
+}
+
+bool HTTP2ClientConnection::canExecute() const {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  return
+      !closed_ &&
+      !goaway_sent_ &&
+      !goaway_received_ &&
+      next_stream_id_ <= kMaxStreamID;
+}
+
+size_t HTTP2ClientConnection::numPendingRequests() const {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  return
+      requests_.size() +
+      queued_.size() +
+      (upgrade_request_.get() && upgrade_request_->handler ? 1 : 0);
+}
+
+Future<Duration> HTTP2ClientConnection::ping() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  Promise<Duration> promise;
+
+  if (closed_) {
+    promise.failure(mkIOError("HTTP/2 connection is closed"));
+    return promise.future();
+  }
+
+  auto id = next_ping_id_++;
+  Buffer payload;
+  for (int i = HTTP2Frame::kPingPayloadSize - 1; i >= 0; --i) {
+    payload.append((char) ((id >> (i * 8)) & 0xff));
+  }
+
+  pings_.emplace(id, PendingPing { monotonicMicros(), promise });
+
+  // PINGs are only allowed once the session started, they are sent along
+  // with the upgraded connection's preface otherwise
+  if (started_) {
+    writePing(payload);
+  }
+
+  return promise.future();
+}
+
+Wakeup* HTTP2ClientConnection::onReady() {
+  return &on_ready_;
+}
+
+// precondition: must hold mutex
+void HTTP2ClientConnection::startUpgrade(
+    const HTTPRequest& request,
+    ScopedPtr<PendingRequest> pending) {
+  upgrade_sent_ = true;
+
+  // the upgrade request can't carry a body, the server would have to read
+  // it before it switches protocols. send a bodiless request instead and the
+  // actual request as the first HTTP/2 stream
+  String method = StringUtil::toString(request.method());
+  String uri = request.uri();
+  if (pending->body.get()) {
+    method = "OPTIONS";
+    uri = "*";
+    queued_.emplace_back(std::move(pending));
+    pending.reset(new PendingRequest());
+  }
+
+  upgrade_request_ = std::move(pending);
+
+  Buffer buf;
+  buf.append(StringUtil::format("$0 $1 HTTP/1.1\r\n", method, uri));
+  if (request.hasHeader("Host")) {
+    buf.append(
+        StringUtil::format("Host: $0\r\n", request.getHeader("Host")));
+  }
+
+  buf.append("Connection: Upgrade, HTTP2-Settings\r\n");
+  buf.append("Upgrade: h2c\r\n");
+  buf.append(
+      StringUtil::format(
+          "HTTP2-Settings: $0\r\n",
+          HTTP2Frame::encodeSettingsHeader(clientSettings())));
+
+  if (upgrade_request_->handler) {
+    for (const auto& header : request.headers()) {
+      auto name = header.first;
+      StringUtil::toLower(&name);
+      if (!isHopByHopHeader(name)) {
+        buf.append(
+            StringUtil::format("$0: $1\r\n", header.first, header.second));
+      }
+    }
+  }
+
+  buf.append("\r\n");
+
+  writeRaw(buf.data(), buf.size());
+  awaitRead();
+}
+
+// precondition: must hold mutex
+void HTTP2ClientConnection::startRequests() {
+  if (!started_ || closed_) {
+    return;
+  }
+
+  while (!queued_.empty() &&
+      !goaway_received_ &&
+      streams_.size() < peer_max_concurrent_streams_) {
+    if (next_stream_id_ > kMaxStreamID) {
+      failQueuedRequests("HTTP/2 connection ran out of stream ids");
+      return;
+    }
+
+    auto stream_id = next_stream_id_;
+    next_stream_id_ += 2;
+
+    auto pending = queued_.front().get();
+    requests_[stream_id] = std::move(queued_.front());
+    queued_.pop_front();
+
+    auto has_body = pending->body.get() != nullptr;
+    openStream(stream_id);
+    writeHeaders(stream_id, pending->headers, !has_body);
+    if (has_body) {
+      writeData(stream_id, pending->body, true, nullptr);
+    }
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2ClientConnection::completeRequest(uint32_t stream_id) {
+  auto iter = requests_.find(stream_id);
+  if (iter == requests_.end()) {
+    return;
+  }
+
+  ScopedPtr<PendingRequest> pending(std::move(iter->second));
+  requests_.erase(iter);
+
+  auto handler = pending->handler;
+  if (handler == nullptr) {
+    return; // the OPTIONS request we upgraded with
+  }
+
+  if (stats_ != nullptr) {
+    stats_->current_requests.decr(1);
+
+    auto decoder = pending->decoder.get();
+    if (decoder) {
+      stats_->decompressed_responses.incr(1);
+      stats_->decompression_bytes_in.incr(decoder->bytesIn());
+      stats_->decompression_bytes_out.incr(decoder->bytesOut());
+      stats_->decompression_cpu_micros.incr(decoder->cpuTimeMicros());
+    }
+  }
+
+  // N.B. like on a HTTP/1.1 connection, the owner is woken up before the
+  // last response completes, so that the connection can be reused by then
+  runDeferred([this, handler] {
+    notifyIdle();
+    handler->onResponseComplete();
+  });
+}
+
+// precondition: must hold mutex
+void HTTP2ClientConnection::failRequest(
+    ScopedPtr<PendingRequest> pending,
+    const String& message) {
+  auto handler = pending->handler;
+  if (handler == nullptr) {
+    return;
+  }
+
+  if (stats_ != nullptr) {
+    stats_->current_requests.decr(1);
+  }
+
+  auto e = mkIOError(message);
+  runDeferred([this, handler, e] {
+    notifyIdle();
+    handler->onError(e);
+  });
+}
+
+// precondition: must hold mutex
+void HTTP2ClientConnection::failQueuedRequests(const String& message) {
+  Deque<ScopedPtr<PendingRequest>> queued;
+  queued.swap(queued_);
+
+  for (auto& pending : queued) {
+    failRequest(std::move(pending), message);
+  }
+}
+
+// precondition: must hold mutex
+bool HTTP2ClientConnection::isIdleImpl() const {
+  return
+      requests_.empty() &&
+      queued_.empty() &&
+      upgrade_request_.get() == nullptr;
+}
+
+void HTTP2ClientConnection::notifyIdle() {
+  {
+    std::unique_lock<std::recursive_mutex> lk(mutex_);
+
+    // a new request may have been started in the meantime, and only the
+    // first of several requests that completed at once wakes up the owner
+    if (!isIdleImpl() || idle_notified_) {
+      return;
+    }
+
+    idle_notified_ = true;
+  }
+
+  on_ready_.wakeup();
+}
+
+void HTTP2ClientConnection::onHeaders(
+    uint32_t stream_id,
+    const HTTPMessage::HeaderList& headers,
+    bool end_stream) {
+  auto iter = requests_.find(stream_id);
+  if (iter == requests_.end()) {
+    return;
+  }
+
+  auto pending = iter->second.get();
+
+  // trailers are not passed on
+  if (pending->response_started) {
+    if (end_stream) {
+      completeRequest(stream_id);
+    }
+
+    return;
+  }
+
+  int status = 0;
+  for (const auto& header : headers) {
+    if (header.first == ":status") {
+      try {
+        status = std::stoi(header.second);
+      } catch (const std::exception& e) {
+        status = 0;
+      }
+    }
+  }
+
+  if (status < 100 || status > 999) {
+    resetStream(stream_id, HTTP2ErrorCode::PROTOCOL_ERROR);
+    return;
+  }
+
+  // informational responses are skipped, the final response follows
+  if (status < 200) {
+    return;
+  }
+
+  pending->response_started = true;
+
+  for (const auto& header : headers) {
+    if (header.first == "content-encoding") {
+      pending->content_encoding = HTTPContentEncoder::fromString(
+          header.second);
+    }
+  }
+
+  auto handler = pending->handler;
+  if (handler) {
+    auto decode = pending->content_encoding != ContentEncoding::IDENTITY;
+
+    handler->onVersion("HTTP/2.0");
+    handler->onStatusCode(status);
+    handler->onStatusName("");
+
+    for (const auto& header : headers) {
+      if (StringUtil::beginsWith(header.first, ":")) {
+        continue;
+      }
+
+      // decompressed responses don't have the original length and encoding
+      if (decode &&
+          (header.first == "content-encoding" ||
+           header.first == "content-length")) {
+        continue;
+      }
+
+      handler->onHeader(header.first, header.second);
+    }
+
+    if (decode) {
+      pending->decoder.reset(new HTTPContentDecoder(pending->content_encoding));
+    }
+
+    handler->onHeadersComplete();
+  }
+
+  if (end_stream) {
+    completeRequest(stream_id);
+  }
+}
+
+void HTTP2ClientConnection::onData(
+    uint32_t stream_id,
+    const char* data,
+    size_t size,
+    bool end_stream) {
+  consumeData(stream_id, size);
+
+  auto iter = requests_.find(stream_id);
+  if (iter == requests_.end()) {
+    return;
+  }
+
+  auto pending = iter->second.get();
+  if (!pending->response_started) {
+    resetStream(stream_id, HTTP2ErrorCode::PROTOCOL_ERROR);
+    return;
+  }
+
+  auto handler = pending->handler;
+  if (handler && size > 0) {
+    try {
+      if (pending->decoder.get()) {
+        pending->decoder->decode(
+            data,
+            size,
+            [handler] (const char* data, size_t size) {
+          handler->onBodyChunk(data, size);
+        });
+      } else {
+        handler->onBodyChunk(data, size);
+      }
+    } catch (const Exception& e) {
+      ScopedPtr<PendingRequest> failed(std::move(iter->second));
+      requests_.erase(iter);
+      failRequest(std::move(failed), e.getMessage());
+      resetStream(stream_id, HTTP2ErrorCode::CANCEL);
+      return;
+    }
+  }
+
+  if (end_stream) {
+    completeRequest(stream_id);
+  }
+}
+
+void HTTP2ClientConnection::onStreamClosed(
+    uint32_t stream_id,
+    HTTP2ErrorCode error) {
+  auto iter = requests_.find(stream_id);
+  if (iter != requests_.end()) {
+    ScopedPtr<PendingRequest> pending(std::move(iter->second));
+    requests_.erase(iter);
+
+    // the server didn't process a refused stream, so it is safe to retry
+    // (RFC 7540 8.1.4)
+    if (error == HTTP2ErrorCode::REFUSED_STREAM &&
+        !pending->response_started &&
+        !goaway_received_) {
+      queued_.emplace_front(std::move(pending));
+    } else {
+      failRequest(
+          std::move(pending),
+          StringUtil::format(
+              "HTTP/2 stream was reset by peer (error code $0)",
+              (uint32_t) error));
+    }
+  }
+
+  startRequests();
+}
+
+void HTTP2ClientConnection::onSessionClosed(const std::exception& e) {
+  std::map<uint32_t, ScopedPtr<PendingRequest>> requests;
+  requests.swap(requests_);
+  ScopedPtr<PendingRequest> upgrade_request(std::move(upgrade_request_));
+
+  String message = e.what();
+  for (auto& request : requests) {
+    failRequest(std::move(request.second), message);
+  }
+
+  if (upgrade_request.get()) {
+    failRequest(std::move(upgrade_request), message);
+  }
+
+  failQueuedRequests(message);
+
+  for (auto& ping : pings_) {
+    auto promise = ping.second.promise;
+    runDeferred([promise, message] () mutable {
+      promise.failure(mkIOError(message));
+    });
+  }
+
+  pings_.clear();
+}
+
+void HTTP2ClientConnection::onSettings() {
+  startRequests();
+}
+
+void HTTP2ClientConnection::onGoAway(
+    uint32_t last_stream_id,
+    HTTP2ErrorCode error) {
+  failQueuedRequests("HTTP/2 connection is going away");
+}
+
+void HTTP2ClientConnection::onPingAck(const Buffer& payload) {
+  uint64_t id = 0;
+  auto data = (const unsigned char*) payload.data();
+  for (size_t i = 0; i < HTTP2Frame::kPingPayloadSize; ++i) {
+    id = (id << 8) | data[i];
+  }
+
+  auto iter = pings_.find(id);
+  if (iter == pings_.end()) {
+    return;
+  }
+
+  auto promise = iter->second.promise;
+  auto rtt = monotonicMicros() - iter->second.sent_at;
+  pings_.erase(iter);
+
+  runDeferred([promise, rtt] () mutable {
+    promise.success(Duration(rtt));
+  });
+}
+
+ssize_t HTTP2ClientConnection::onPreamble(const char* data, size_t size) {
+  if (!upgrade_) {
+    return 0;
+  }
+
+  static const char kHeaderEnd[] = "\r\n\r\n";
+  auto end = std::search(data, data + size, kHeaderEnd, kHeaderEnd + 4);
+  if (end == data + size) {
+    if (size > kMaxUpgradeResponseSize) {
+      closeImpl(mkIOError("invalid HTTP/1.1 upgrade response"));
+    }
+
+    return -1;
+  }
+
+  static const char kSwitchingProtocols[] = "HTTP/1.1 101";
+  if (size < sizeof(kSwitchingProtocols) - 1 ||
+      memcmp(data, kSwitchingProtocols, sizeof(kSwitchingProtocols) - 1)) {
+    closeImpl(mkIOError("server didn't switch to HTTP/2 (h2c)"));
+    return -1;
+  }
+
+  startSession();
+  started_ = true;
+
+  // the upgrade request is stream 1, half closed by us
+  openStream(1);
+  streams_[1].local_closed = true;
+  requests_[1] = std::move(upgrade_request_);
+  next_stream_id_ = 3;
+
+  for (const auto& ping : pings_) {
+    Buffer payload;
+    for (int i = HTTP2Frame::kPingPayloadSize - 1; i >= 0; --i) {
+      payload.append((char) ((ping.first >> (i * 8)) & 0xff));
+    }
+
+    writePing(payload);
+  }
+
+  startRequests();
+  return (end - data) + 4;
+}
+
+}
+}
@@ -0,0 +1,177 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTP2CLIENTCONNECTION_H
+#define _STX_HTTP_HTTP2CLIENTCONNECTION_H
+#include <map>
+#include <stx/duration.h>
+#include <stx/stdtypes.h>
+#include <stx/http/HTTP2Session.h>
+#include <stx/http/HTTPContentEncoding.h>
+#include <stx/http/httprequest.h>
+#include <stx/http/httpresponsehandler.h>
+#include <stx/http/httpstats.h>
+#include <stx/thread/future.h>
+#include <stx/thread/wakeup.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * The client side of a HTTP/2 over cleartext (h2c) connection. Requests are
+ * multiplexed onto the connection, each one on its own stream, and may
+ * complete in any order.
+ *
+ * With prior knowledge the connection preface is sent right away. Otherwise
+ * the first request is sent as a HTTP/1.1 "Upgrade: h2c" request (or an
+ * "OPTIONS *" request if the first request has a body) and all other
+ * requests wait for the 101 response. If the server doesn't switch
+ * protocols, all requests fail with an IOError.
+ *
+ * Requests beyond the server's SETTINGS_MAX_CONCURRENT_STREAMS are queued.
+ * Requests that the server refused before it processed them are retried
+ * on a new stream unless the server is going away.
+ *
+ * The response handler is called like on a HTTP/1.1 connection: the version
+ * is "HTTP/2.0", the status name is empty (HTTP/2 has no reason phrase) and
+ * gzip or deflate responses are decompressed transparently. The body chunks
+ * are passed as they arrive, onResponseComplete and onError are called from
+ * the task scheduler.
+ */
+class HTTP2ClientConnection : public HTTP2Session {
+public:
+  static const size_t kMaxUpgradeResponseSize = 64 * 1024;
+  static const uint32_t kMaxStreamID = 0x7fffffff;
+
+  /**
+   * Start a HTTP/2 connection on conn. If upgrade is true, the connection
+   * is upgraded from HTTP/1.1 with the first request
+   */
+  static RefPtr<HTTP2ClientConnection> start(
+      ScopedPtr<net::TCPConnection> conn,
+      TaskScheduler* scheduler,
+      HTTPClientStats* stats,
+      bool upgrade);
+
+  ~HTTP2ClientConnection();
+
+  /**
+   * Execute a request on a new stream. Raises an IllegalStateError if the
+   * connection is closed or going away
+   */
+  void executeRequest(
+      const HTTPRequest& request,
+      HTTPResponseHandler* response_handler);
+
+  /**
+   * Returns true if new requests can be executed on this connection
+   */
+  bool canExecute() const;
+
+  /**
+   * Returns the number of requests that didn't complete yet, including the
+   * queued ones
+   */
+  size_t numPendingRequests() const;
+
+  /**
+   * Send a PING. The returned future resolves with the round trip time once
+   * the server acknowledged it and fails if the connection closes first
+   */
+  Future<Duration> ping();
+
+  /**
+   * Woken up each time the last outstanding request completed (or failed).
+   * The response handler of the last request is called after the wakeup
+   * callbacks
+   */
+  Wakeup* onReady();
+
+protected:
+
+  struct PendingRequest {
+    PendingRequest();
+
+    HTTPResponseHandler* handler;
+    bool head;
+    HTTPMessage::HeaderList headers;
+    BufferRef body;
+    bool response_started;
+    ContentEncoding content_encoding;
+    ScopedPtr<HTTPContentDecoder> decoder;
+  };
+
+  struct PendingPing {
+    uint64_t sent_at;
+    Promise<Duration> promise;
+  };
+
+  HTTP2ClientConnection(
+      ScopedPtr<net::TCPConnection> conn,
+      TaskScheduler* scheduler,
+      HTTPClientStats* stats,
+      bool upgrade);
+
+  // precondition: must hold mutex
+  void startUpgrade(
+      const HTTPRequest& request,
+      ScopedPtr<PendingRequest> pending);
+
+  // precondition: must hold mutex
+  void startRequests();
+
+  // precondition: must hold mutex
+  void completeRequest(uint32_t stream_id);
+
+  // precondition: must hold mutex
+  void failRequest(ScopedPtr<PendingRequest> request, const String& message);
+
+  // precondition: must hold mutex
+  void failQueuedRequests(const String& message);
+
+  // precondition: must hold mutex
+  bool isIdleImpl() const;
+
+  void notifyIdle();
+
+  void onHeaders(
+      uint32_t stream_id,
+      const HTTPMessage::HeaderList& headers,
+      bool end_stream) override;
+
+  void onData(
+      uint32_t stream_id,
+      const char* data,
+      size_t size,
+      bool end_stream) override;
+
+  void onStreamClosed(uint32_t stream_id, HTTP2ErrorCode error) override;
+  void onSessionClosed(const std::exception& e) override;
+  void onSettings() override;
+  void onGoAway(uint32_t last_stream_id, HTTP2ErrorCode error) override;
+  void onPingAck(const Buffer& payload) override;
+  ssize_t onPreamble(const char* data, size_t size) override;
+
+  HTTPClientStats* stats_;
+  bool upgrade_;
+  bool upgrade_sent_;
+  bool started_;
+  uint32_t next_stream_id_;
+  std::map<uint32_t, ScopedPtr<PendingRequest>> requests_;
+  Deque<ScopedPtr<PendingRequest>> queued_;
+  ScopedPtr<PendingRequest> upgrade_request_;
+  uint64_t next_ping_id_;
+  std::map<uint64_t, PendingPing> pings_;
+  bool idle_notified_;
+  Wakeup on_ready_;
+};
+
+}
+}
+#endif
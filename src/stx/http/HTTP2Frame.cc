@@ -0,0 +1,301 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <ctype.h>
+#include <stx/exception.h>
+#include <stx/util/Base64.h>
+#include <stx/http/HTTP2Frame.h>
+
+namespace stx {
+namespace http {
+
+const char HTTP2Frame::kConnectionPreface[] =
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t HTTP2Frame::kConnectionPrefaceSize;
+
+static void writeUInt32(uint32_t value, Buffer* out) {
+  out->append((char) (value >> 24));
+  out->append((char) (value >> 16));
+  out->append((char) (value >> 8));
+  out->append((char) value);
+}
+
+static uint32_t readUInt32(const char* data) {
+  auto bytes = (const uint8_t*) data;
+  return
+      ((uint32_t) bytes[0] << 24) |
+      ((uint32_t) bytes[1] << 16) |
+      ((uint32_t) bytes[2] << 8) |
+      (uint32_t) bytes[3];
+}
+
+HTTP2Frame HTTP2Frame::mkSettings(
+    const Vector<Pair<HTTP2Setting, uint32_t>>& settings) {
+  HTTP2Frame frame(HTTP2FrameType::SETTINGS, 0, 0);
+  for (const auto& setting : settings) {
+    frame.payload.append((char) ((uint16_t) setting.first >> 8));
+    frame.payload.append((char) setting.first);
+    writeUInt32(setting.second, &frame.payload);
+  }
+
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::mkSettingsAck() {
+  return HTTP2Frame(HTTP2FrameType::SETTINGS, kFlagAck, 0);
+}
+
+String HTTP2Frame::encodeSettingsHeader(
+    const Vector<Pair<HTTP2Setting, uint32_t>>& settings) {
+  if (settings.empty()) {
+    return "";
+  }
+
+  auto frame = mkSettings(settings);
+  auto value = util::Base64::encode(frame.payload.data(), frame.payload.size());
+
+  // base64url without padding
+  String header;
+  for (auto c : value) {
+    switch (c) {
+      case '+': header += '-'; break;
+      case '/': header += '_'; break;
+      case '=': break;
+      default: header += c; break;
+    }
+  }
+
+  return header;
+}
+
+Vector<Pair<HTTP2Setting, uint32_t>> HTTP2Frame::decodeSettingsHeader(
+    const String& value) {
+  String base64;
+  for (auto c : value) {
+    switch (c) {
+      case '-': base64 += '+'; break;
+      case '_': base64 += '/'; break;
+      case '=': break;
+      default:
+        if (!isalnum(c)) {
+          RAISE(kParseError, "invalid HTTP2-Settings header");
+        }
+
+        base64 += c;
+        break;
+    }
+  }
+
+  HTTP2Frame frame(HTTP2FrameType::SETTINGS, 0, 0);
+  String payload;
+  util::Base64::decode(base64, &payload);
+  frame.payload.append(payload.data(), payload.size());
+  return frame.settings();
+}
+
+HTTP2Frame HTTP2Frame::mkWindowUpdate(uint32_t stream_id, uint32_t increment) {
+  HTTP2Frame frame(HTTP2FrameType::WINDOW_UPDATE, 0, stream_id);
+  writeUInt32(increment & 0x7fffffff, &frame.payload);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::mkPing(const Buffer& payload, bool ack) {
+  if (payload.size() != kPingPayloadSize) {
+    RAISE(kIllegalArgumentError, "PING payload must be 8 bytes");
+  }
+
+  HTTP2Frame frame(HTTP2FrameType::PING, ack ? kFlagAck : 0, 0);
+  frame.payload.append(payload);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::mkRstStream(uint32_t stream_id, HTTP2ErrorCode error) {
+  HTTP2Frame frame(HTTP2FrameType::RST_STREAM, 0, stream_id);
+  writeUInt32((uint32_t) error, &frame.payload);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::mkGoAway(
+    uint32_t last_stream_id,
+    HTTP2ErrorCode error,
+    const String& debug_data /* = "" */) {
+  HTTP2Frame frame(HTTP2FrameType::GOAWAY, 0, 0);
+  writeUInt32(last_stream_id & 0x7fffffff, &frame.payload);
+  writeUInt32((uint32_t) error, &frame.payload);
+  frame.payload.append(debug_data.data(), debug_data.size());
+  return frame;
+}
+
+HTTP2Frame::HTTP2Frame() :
+    type(HTTP2FrameType::DATA),
+    flags(0),
+    stream_id(0) {}
+
+HTTP2Frame::HTTP2Frame(
+    HTTP2FrameType _type,
+    uint8_t _flags,
+    uint32_t _stream_id) :
+    type(_type),
+    flags(_flags),
+    stream_id(_stream_id) {}
+
+void HTTP2Frame::writeHeader(
+    size_t size,
+    HTTP2FrameType type,
+    uint8_t flags,
+    uint32_t stream_id,
+    Buffer* out) {
+  out->append((char) (size >> 16));
+  out->append((char) (size >> 8));
+  out->append((char) size);
+  out->append((char) type);
+  out->append((char) flags);
+  writeUInt32(stream_id & 0x7fffffff, out);
+}
+
+void HTTP2Frame::writeTo(Buffer* out) const {
+  writeHeader(payload.size(), type, flags, stream_id, out);
+  out->append(payload);
+}
+
+Vector<Pair<HTTP2Setting, uint32_t>> HTTP2Frame::settings() const {
+  if (payload.size() % 6 != 0) {
+    RAISE(kParseError, "invalid SETTINGS frame size");
+  }
+
+  Vector<Pair<HTTP2Setting, uint32_t>> settings;
+  auto data = (const char*) payload.data();
+  for (size_t pos = 0; pos < payload.size(); pos += 6) {
+    auto id = ((uint8_t) data[pos] << 8) | (uint8_t) data[pos + 1];
+    settings.emplace_back(
+        (HTTP2Setting) id,
+        readUInt32(data + pos + 2));
+  }
+
+  return settings;
+}
+
+uint32_t HTTP2Frame::windowIncrement() const {
+  if (payload.size() != 4) {
+    RAISE(kParseError, "invalid WINDOW_UPDATE frame size");
+  }
+
+  return readUInt32((const char*) payload.data()) & 0x7fffffff;
+}
+
+HTTP2ErrorCode HTTP2Frame::errorCode() const {
+  auto data = (const char*) payload.data();
+  switch (type) {
+    case HTTP2FrameType::RST_STREAM:
+      if (payload.size() != 4) {
+        RAISE(kParseError, "invalid RST_STREAM frame size");
+      }
+
+      return (HTTP2ErrorCode) readUInt32(data);
+
+    case HTTP2FrameType::GOAWAY:
+      if (payload.size() < 8) {
+        RAISE(kParseError, "invalid GOAWAY frame size");
+      }
+
+      return (HTTP2ErrorCode) readUInt32(data + 4);
+
+    default:
+      RAISE(kIllegalStateError, "frame has no error code");
+  }
+}
+
+uint32_t HTTP2Frame::lastStreamID() const {
+  if (type != HTTP2FrameType::GOAWAY || payload.size() < 8) {
+    RAISE(kParseError, "invalid GOAWAY frame size");
+  }
+
+  return readUInt32((const char*) payload.data()) & 0x7fffffff;
+}
+
+void HTTP2Frame::data(const char** begin, size_t* size) const {
+  auto cur = (const char*) payload.data();
+  auto end = cur + payload.size();
+
+  size_t padding = 0;
+  if (hasFlag(kFlagPadded)) {
+    if (cur == end) {
+      RAISE(kParseError, "invalid padding");
+    }
+
+    padding = (uint8_t) *cur++;
+  }
+
+  if (type == HTTP2FrameType::HEADERS && hasFlag(kFlagPriority)) {
+    cur += 5;
+  }
+
+  if (cur > end || padding > (size_t) (end - cur)) {
+    RAISE(kParseError, "invalid padding");
+  }
+
+  *begin = cur;
+  *size = (end - cur) - padding;
+}
+
+bool HTTP2Frame::hasFlag(uint8_t flag) const {
+  return (flags & flag) == flag;
+}
+
+HTTP2FrameParser::HTTP2FrameParser(
+    size_t max_frame_size /* = HTTP2Frame::kDefaultMaxFrameSize */) :
+    max_frame_size_(max_frame_size) {}
+
+void HTTP2FrameParser::onFrame(Function<void (const HTTP2Frame& frame)> fn) {
+  on_frame_ = fn;
+}
+
+void HTTP2FrameParser::parse(const char* data, size_t size) {
+  buf_.append(data, size);
+
+  size_t pos = 0;
+  auto begin = (const char*) buf_.data();
+  while (buf_.size() - pos >= HTTP2Frame::kHeaderSize) {
+    auto hdr = (const uint8_t*) begin + pos;
+    size_t len = (hdr[0] << 16) | (hdr[1] << 8) | hdr[2];
+    if (len > max_frame_size_) {
+      RAISEF(kParseError, "HTTP/2 frame too large: $0", len);
+    }
+
+    if (buf_.size() - pos < HTTP2Frame::kHeaderSize + len) {
+      break;
+    }
+
+    HTTP2Frame frame(
+        (HTTP2FrameType) hdr[3],
+        hdr[4],
+        readUInt32((const char*) hdr + 5) & 0x7fffffff);
+
+    frame.payload.append(begin + pos + HTTP2Frame::kHeaderSize, len);
+    pos += HTTP2Frame::kHeaderSize + len;
+
+    if (on_frame_) {
+      on_frame_(frame);
+    }
+  }
+
+  if (pos == buf_.size()) {
+    buf_.clear();
+  } else if (pos > 0) {
+    Buffer rest(begin + pos, buf_.size() - pos);
+    buf_ = rest;
+  }
+}
+
+void HTTP2FrameParser::setMaxFrameSize(size_t max_frame_size) {
+  max_frame_size_ = max_frame_size;
+}
+
+}
+}
@@ -0,0 +1,192 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTP2FRAME_H
+#define _STX_HTTP_HTTP2FRAME_H
+#include <stx/stdtypes.h>
+#include <stx/buffer.h>
+
+namespace stx {
+namespace http {
+
+enum class HTTP2FrameType : uint8_t {
+  DATA = 0x0,
+  HEADERS = 0x1,
+  PRIORITY = 0x2,
+  RST_STREAM = 0x3,
+  SETTINGS = 0x4,
+  PUSH_PROMISE = 0x5,
+  PING = 0x6,
+  GOAWAY = 0x7,
+  WINDOW_UPDATE = 0x8,
+  CONTINUATION = 0x9
+};
+
+enum class HTTP2Setting : uint16_t {
+  HEADER_TABLE_SIZE = 0x1,
+  ENABLE_PUSH = 0x2,
+  MAX_CONCURRENT_STREAMS = 0x3,
+  INITIAL_WINDOW_SIZE = 0x4,
+  MAX_FRAME_SIZE = 0x5,
+  MAX_HEADER_LIST_SIZE = 0x6
+};
+
+enum class HTTP2ErrorCode : uint32_t {
+  NO_ERROR = 0x0,
+  PROTOCOL_ERROR = 0x1,
+  INTERNAL_ERROR = 0x2,
+  FLOW_CONTROL_ERROR = 0x3,
+  SETTINGS_TIMEOUT = 0x4,
+  STREAM_CLOSED = 0x5,
+  FRAME_SIZE_ERROR = 0x6,
+  REFUSED_STREAM = 0x7,
+  CANCEL = 0x8,
+  COMPRESSION_ERROR = 0x9,
+  CONNECT_ERROR = 0xa,
+  ENHANCE_YOUR_CALM = 0xb,
+  INADEQUATE_SECURITY = 0xc,
+  HTTP_1_1_REQUIRED = 0xd
+};
+
+/**
+ * A HTTP/2 (RFC 7540) frame
+ */
+struct HTTP2Frame {
+  static const size_t kHeaderSize = 9;
+  static const size_t kDefaultMaxFrameSize = 16384;
+  static const uint32_t kDefaultWindowSize = 65535;
+  static const uint32_t kMaxWindowSize = 0x7fffffff;
+  static const size_t kMaxFrameSizeLimit = 16777215;
+  static const size_t kPingPayloadSize = 8;
+  static const uint8_t kFlagEndStream = 0x1;
+  static const uint8_t kFlagAck = 0x1;
+  static const uint8_t kFlagEndHeaders = 0x4;
+  static const uint8_t kFlagPadded = 0x8;
+  static const uint8_t kFlagPriority = 0x20;
+
+  /**
+   * The client connection preface "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+   */
+  static const char kConnectionPreface[];
+  static const size_t kConnectionPrefaceSize = 24;
+
+  static HTTP2Frame mkSettings(
+      const Vector<Pair<HTTP2Setting, uint32_t>>& settings);
+
+  static HTTP2Frame mkSettingsAck();
+
+  /**
+   * Encode and decode the HTTP2-Settings header of an "Upgrade: h2c"
+   * request, i.e. a SETTINGS payload in base64url without padding
+   * (RFC 7540 3.2.1). Decoding throws a kParseError if the value is malformed
+   */
+  static String encodeSettingsHeader(
+      const Vector<Pair<HTTP2Setting, uint32_t>>& settings);
+
+  static Vector<Pair<HTTP2Setting, uint32_t>> decodeSettingsHeader(
+      const String& value);
+
+  static HTTP2Frame mkWindowUpdate(uint32_t stream_id, uint32_t increment);
+
+  /**
+   * The payload of a PING frame must be exactly kPingPayloadSize bytes. The
+   * ACK echoes the payload of the PING it answers
+   */
+  static HTTP2Frame mkPing(const Buffer& payload, bool ack);
+
+  static HTTP2Frame mkRstStream(uint32_t stream_id, HTTP2ErrorCode error);
+
+  static HTTP2Frame mkGoAway(
+      uint32_t last_stream_id,
+      HTTP2ErrorCode error,
+      const String& debug_data = "");
+
+  HTTP2Frame();
+  HTTP2Frame(HTTP2FrameType type, uint8_t flags, uint32_t stream_id);
+
+  /**
+   * Append a frame header for a payload of size bytes to out. The caller
+   * appends the payload itself, so that large DATA payloads are only copied
+   * once
+   */
+  static void writeHeader(
+      size_t size,
+      HTTP2FrameType type,
+      uint8_t flags,
+      uint32_t stream_id,
+      Buffer* out);
+
+  /**
+   * Append the frame header and payload to out
+   */
+  void writeTo(Buffer* out) const;
+
+  /**
+   * Decode the payload of a SETTINGS frame. Throws a kParseError if the
+   * payload is malformed
+   */
+  Vector<Pair<HTTP2Setting, uint32_t>> settings() const;
+
+  /**
+   * Decode the payload of a WINDOW_UPDATE frame
+   */
+  uint32_t windowIncrement() const;
+
+  /**
+   * Decode the error code of a RST_STREAM or GOAWAY frame
+   */
+  HTTP2ErrorCode errorCode() const;
+
+  /**
+   * Decode the last stream id of a GOAWAY frame
+   */
+  uint32_t lastStreamID() const;
+
+  /**
+   * Returns the payload of a DATA or HEADERS frame without padding and
+   * priority fields
+   */
+  void data(const char** begin, size_t* size) const;
+
+  bool hasFlag(uint8_t flag) const;
+
+  HTTP2FrameType type;
+  uint8_t flags;
+  uint32_t stream_id;
+  Buffer payload;
+};
+
+/**
+ * Incremental HTTP/2 frame parser. Calls the onFrame callback for each
+ * complete frame and buffers partial frames internally. Throws a kParseError
+ * if a frame exceeds the maximum frame size
+ */
+class HTTP2FrameParser {
+public:
+
+  HTTP2FrameParser(size_t max_frame_size = HTTP2Frame::kDefaultMaxFrameSize);
+
+  void onFrame(Function<void (const HTTP2Frame& frame)> fn);
+
+  void parse(const char* data, size_t size);
+
+  /**
+   * Our SETTINGS_MAX_FRAME_SIZE
+   */
+  void setMaxFrameSize(size_t max_frame_size);
+
+protected:
+  size_t max_frame_size_;
+  Function<void (const HTTP2Frame& frame)> on_frame_;
+  Buffer buf_;
+};
+
+}
+}
+#endif
@@ -0,0 +1,619 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/exception.h>
+#include <stx/logging.h>
+#include <stx/http/HTTP2ServerConnection.h>
+
+namespace stx {
+namespace http {
+
+static const char kSwitchingProtocols[] =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Connection: Upgrade\r\n"
+    "Upgrade: h2c\r\n\r\n";
+
+static bool parseMethod(
+    const String& str,
+    HTTPMessage::kHTTPMethod* method) {
+  static const HTTPMessage::kHTTPMethod kMethods[] = {
+    HTTPMessage::M_CONNECT,
+    HTTPMessage::M_DELETE,
+    HTTPMessage::M_GET,
+    HTTPMessage::M_HEAD,
+    HTTPMessage::M_OPTIONS,
+    HTTPMessage::M_POST,
+    HTTPMessage::M_PUT,
+    HTTPMessage::M_TRACE
+  };
+
+  for (auto m : kMethods) {
+    if (StringUtil::toString(m) == str) {
+      *method = m;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Connection specific headers are not allowed in HTTP/2 (RFC 7540 8.1.2.2)
+ */
+static void addResponseHeader(
+    const String& key,
+    const String& value,
+    HTTPMessage::HeaderList* headers) {
+  auto name = key;
+  StringUtil::toLower(&name);
+
+  if (name == "connection" ||
+      name == "keep-alive" ||
+      name == "proxy-connection" ||
+      name == "transfer-encoding" ||
+      name == "upgrade") {
+    return;
+  }
+
+  headers->emplace_back(name, value);
+}
+
+void HTTP2ServerConnection::start(
+    HTTPHandlerFactory* handler_factory,
+    ScopedPtr<net::TCPConnection> conn,
+    TaskScheduler* scheduler,
+    const HTTPServerOptions* opts,
+    HTTPServerStats* stats,
+    HTTPResponseBufferBudget* response_budget,
+    ScopedPtr<HTTPRequest> upgrade_request,
+    const Buffer& input) {
+  auto session = new HTTP2ServerConnection(
+      handler_factory,
+      std::move(conn),
+      scheduler,
+      opts,
+      stats,
+      response_budget);
+
+  // N.B. we don't leak the connection here. it releases this reference once
+  // it is closed
+  session->incRef();
+
+  std::unique_lock<std::recursive_mutex> lk(session->mutex_);
+  if (upgrade_request.get()) {
+    session->upgrade(std::move(upgrade_request));
+  } else {
+    session->startSession(opts->http2_max_concurrent_streams);
+  }
+
+  session->processInput((const char*) input.data(), input.size());
+}
+
+HTTP2ServerConnection::HTTP2ServerConnection(
+    HTTPHandlerFactory* handler_factory,
+    ScopedPtr<net::TCPConnection> conn,
+    TaskScheduler* scheduler,
+    const HTTPServerOptions* opts,
+    HTTPServerStats* stats,
+    HTTPResponseBufferBudget* response_budget) :
+    HTTP2Session(std::move(conn), scheduler, true),
+    handler_factory_(handler_factory),
+    opts_(opts),
+    stats_(stats),
+    response_budget_(response_budget) {
+  logTrace("http.server", "New HTTP/2 connection: $0", (void*) this);
+  stats_->http2_connections.incr(1);
+  received_bytes_ = &stats_->received_bytes;
+  sent_bytes_ = &stats_->sent_bytes;
+}
+
+HTTP2ServerConnection::~HTTP2ServerConnection() {
+  // the HTTP/1.1 connection passed its slot in current_connections on to us
+  stats_->current_connections.decr(1);
+}
+
+// precondition: must hold mutex
+void HTTP2ServerConnection::upgrade(ScopedPtr<HTTPRequest> request) {
+  writeRaw(kSwitchingProtocols, sizeof(kSwitchingProtocols) - 1);
+  startSession(opts_->http2_max_concurrent_streams);
+
+  // the HTTP2-Settings header replaces the client's first SETTINGS frame
+  try {
+    applySettings(
+        HTTP2Frame::decodeSettingsHeader(
+            request->getHeader("HTTP2-Settings")));
+  } catch (const Exception& e) {
+    connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, e.getMessage());
+  }
+
+  if (closed_) {
+    return;
+  }
+
+  // the upgrade request is stream 1, which the client already half-closed
+  request->setVersion("HTTP/2.0");
+  request->removeHeader("Connection");
+  request->removeHeader("Upgrade");
+  request->removeHeader("HTTP2-Settings");
+
+  last_peer_stream_id_ = 1;
+  openStream(1);
+  streams_[1].remote_closed = true;
+  startRequest(1, std::move(request), true);
+}
+
+// precondition: must hold mutex
+void HTTP2ServerConnection::startRequest(
+    uint32_t stream_id,
+    ScopedPtr<HTTPRequest> request,
+    bool end_stream) {
+  stats_->http2_streams.incr(1);
+
+  RefPtr<HTTP2ServerStream> stream(
+      new HTTP2ServerStream(this, stream_id, std::move(request)));
+  stream->body_complete_ = end_stream;
+  requests_.emplace(stream_id, stream);
+
+  try {
+    stream->dispatch();
+  } catch (const std::exception& e) {
+    logError("http.server", e, "Error while dispatching HTTP/2 request");
+    resetStream(stream_id, HTTP2ErrorCode::INTERNAL_ERROR);
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2ServerConnection::onHeaders(
+    uint32_t stream_id,
+    const HTTPMessage::HeaderList& headers,
+    bool end_stream) {
+  // trailers are dropped, the request was dispatched with the first block
+  if (requests_.count(stream_id) > 0) {
+    return;
+  }
+
+  ScopedPtr<HTTPRequest> request(new HTTPRequest());
+  request->setVersion("HTTP/2.0");
+
+  String method;
+  String path;
+  String authority;
+  for (const auto& header : headers) {
+    if (!StringUtil::beginsWith(header.first, ":")) {
+      request->addHeader(header.first, header.second);
+      continue;
+    }
+
+    if (header.first == ":method") {
+      method = header.second;
+    } else if (header.first == ":path") {
+      path = header.second;
+    } else if (header.first == ":authority") {
+      authority = header.second;
+    } else if (header.first != ":scheme") {
+      resetStream(stream_id, HTTP2ErrorCode::PROTOCOL_ERROR);
+      return;
+    }
+  }
+
+  HTTPMessage::kHTTPMethod m;
+  if (path.empty() || !parseMethod(method, &m)) {
+    resetStream(stream_id, HTTP2ErrorCode::PROTOCOL_ERROR);
+    return;
+  }
+
+  request->setMethod(m);
+  request->setURI(path);
+  if (!authority.empty() && !request->hasHeader("Host")) {
+    request->addHeader("Host", authority);
+  }
+
+  startRequest(stream_id, std::move(request), end_stream);
+}
+
+// precondition: must hold mutex
+void HTTP2ServerConnection::onData(
+    uint32_t stream_id,
+    const char* data,
+    size_t size,
+    bool end_stream) {
+  auto iter = requests_.find(stream_id);
+  if (iter != requests_.end()) {
+    iter->second->onBodyData(data, size, end_stream);
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2ServerConnection::onStreamClosed(
+    uint32_t stream_id,
+    HTTP2ErrorCode error) {
+  auto iter = requests_.find(stream_id);
+  if (iter == requests_.end()) {
+    return;
+  }
+
+  auto stream = iter->second;
+  requests_.erase(iter);
+  stream->onClosed(error);
+}
+
+// precondition: must hold mutex
+void HTTP2ServerConnection::onSessionClosed(const std::exception& e) {
+  logTrace("http.server", "HTTP/2 connection close: $0", (void*) this);
+
+  auto requests = std::move(requests_);
+  requests_.clear();
+  for (auto& request : requests) {
+    request.second->onClosed(HTTP2ErrorCode::CANCEL);
+  }
+
+  runDeferred([this] {
+    decRef();
+  });
+}
+
+HTTP2ServerStream::HTTP2ServerStream(
+    HTTP2ServerConnection* session,
+    uint32_t stream_id,
+    ScopedPtr<HTTPRequest> request) :
+    HTTPServerConnection(
+        session->handler_factory_,
+        session->scheduler_,
+        session->opts_,
+        session->stats_,
+        session->response_budget_,
+        std::move(request)),
+    session_(session),
+    stream_id_(stream_id),
+    stream_closed_(false),
+    headers_sent_(false),
+    failed_(false),
+    response_finished_(false),
+    released_(false),
+    body_bytes_(0),
+    body_credit_(0) {
+  // released once the response is finished or failed, see release()
+  incRef();
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::dispatch() {
+  startRequest();
+  cur_handler_ = handler_factory_->getHandler(this, cur_request_.get());
+  cur_handler_->handleHTTPRequest();
+}
+
+void HTTP2ServerStream::readRequestBody(
+    Function<void (const void*, size_t, bool)> callback,
+    Function<void()> on_error) {
+  // like the HTTP/1.1 connection, pass copies of the chunks from the task
+  // scheduler
+  auto scheduler = scheduler_;
+  streamRequestBody([scheduler, callback] (
+      const void* data,
+      size_t size,
+      bool last_chunk) {
+    if (last_chunk) {
+      callback(nullptr, 0, true);
+      return;
+    }
+
+    BufferRef chunk(new Buffer(data, size));
+    scheduler->runAsync([callback, chunk] {
+      callback(chunk->data(), chunk->size(), false);
+    });
+  }, on_error);
+}
+
+void HTTP2ServerStream::streamRequestBody(
+    Function<void (const void*, size_t, bool)> callback,
+    Function<void()> on_error) {
+  RefPtr<HTTP2ServerStream> self(this);
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+
+  if (failed_) {
+    failWrite(on_error);
+    return;
+  }
+
+  body_claimed_ = true;
+  body_callback_ = callback;
+  on_error_cb_ = on_error;
+  deliverBody();
+}
+
+void HTTP2ServerStream::pauseRequestBody() {
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+  body_paused_ = true;
+}
+
+void HTTP2ServerStream::resumeRequestBody() {
+  RefPtr<HTTP2ServerStream> self(this);
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+  if (!body_paused_) {
+    return;
+  }
+
+  body_paused_ = false;
+  if (failed_) {
+    return;
+  }
+
+  // the client may send more once the consumer caught up
+  if (body_credit_ > 0) {
+    session_->consumeData(stream_id_, body_credit_);
+    body_credit_ = 0;
+  }
+
+  deliverBody();
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::onBodyData(
+    const char* data,
+    size_t size,
+    bool end_stream) {
+  body_bytes_ += size;
+  body_buf_.append(data, size);
+  if (end_stream) {
+    body_complete_ = true;
+  }
+
+  deliverBody();
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::deliverBody() {
+  if (!body_callback_ || body_paused_) {
+    return;
+  }
+
+  if (body_buf_.size() > 0) {
+    Buffer chunk(std::move(body_buf_));
+    body_buf_.clear();
+
+    auto callback = body_callback_;
+    callback(chunk.data(), chunk.size(), false);
+
+    // a paused consumer didn't process the chunk yet, so the window is only
+    // replenished once it resumes
+    if (body_paused_) {
+      body_credit_ += chunk.size();
+    } else {
+      session_->consumeData(stream_id_, chunk.size());
+    }
+  }
+
+  if (!body_complete_ || body_paused_ || !body_callback_) {
+    return;
+  }
+
+  // the last chunk callback usually writes the response, so it must not run
+  // with the connection locked. the error callback belongs to the body unless
+  // a write is pending
+  auto callback = body_callback_;
+  body_callback_ = nullptr;
+  if (!on_write_completed_cb_) {
+    on_error_cb_ = nullptr;
+  }
+
+  session_->runDeferred([callback] {
+    callback(nullptr, 0, true);
+  });
+}
+
+void HTTP2ServerStream::writeResponse(
+    const HTTPResponse& resp,
+    Function<void()> ready_callback,
+    Function<void()> on_error) {
+  RefPtr<HTTP2ServerStream> self(this);
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+
+  if (response_finished_) {
+    RAISE(kIllegalStateError, "response is already finished");
+  }
+
+  if (failed_) {
+    failWrite(on_error);
+    return;
+  }
+
+  HTTPMessage::HeaderList headers;
+  headers.emplace_back(":status", StringUtil::toString(resp.statusCode()));
+  for (const auto& header : resp.headers()) {
+    addResponseHeader(header.first, header.second, &headers);
+  }
+
+  if (resp.headerTemplate()) {
+    for (const auto& header : resp.headerTemplate()->headers()) {
+      addResponseHeader(header.first, header.second, &headers);
+    }
+  }
+
+  startWrite(ready_callback, on_error);
+  session_->writeHeaders(stream_id_, headers, false);
+  headers_sent_ = true;
+
+  response_body_bytes_ += resp.body().size();
+  if (resp.body().size() > 0 &&
+      cur_request_->method() != HTTPMessage::M_HEAD) {
+    session_->writeData(
+        stream_id_,
+        BufferRef(new Buffer(resp.body())),
+        false,
+        [self] { self->writeCompleted(); });
+  } else {
+    session_->runDeferred([self] { self->writeCompleted(); });
+  }
+}
+
+void HTTP2ServerStream::writeResponseBody(
+    const void* data,
+    size_t size,
+    Function<void()> ready_callback,
+    Function<void()> on_error) {
+  writeResponseBody(
+      BufferRef(new Buffer(data, size)),
+      ready_callback,
+      on_error);
+}
+
+void HTTP2ServerStream::writeResponseBody(
+    BufferRef chunk,
+    Function<void()> ready_callback,
+    Function<void()> on_error) {
+  RefPtr<HTTP2ServerStream> self(this);
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+
+  if (response_finished_ || !headers_sent_) {
+    RAISE(kIllegalStateError, "can't write body without an open response");
+  }
+
+  if (failed_) {
+    failWrite(on_error);
+    return;
+  }
+
+  startWrite(ready_callback, on_error);
+  response_body_bytes_ += chunk->size();
+  if (cur_request_->method() == HTTPMessage::M_HEAD) {
+    session_->runDeferred([self] { self->writeCompleted(); });
+  } else {
+    session_->writeData(
+        stream_id_,
+        chunk,
+        false,
+        [self] { self->writeCompleted(); });
+  }
+}
+
+void HTTP2ServerStream::finishResponse() {
+  RefPtr<HTTP2ServerStream> self(this);
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+
+  if (response_finished_) {
+    return;
+  }
+
+  response_finished_ = true;
+  recordRouteStats(body_bytes_);
+
+  // nothing is read or written anymore, so no callback must be called
+  body_callback_ = nullptr;
+  on_write_completed_cb_ = nullptr;
+  on_error_cb_ = nullptr;
+
+  if (!failed_) {
+    if (headers_sent_) {
+      session_->writeData(stream_id_, BufferRef(), true, nullptr);
+    } else {
+      session_->resetStream(stream_id_, HTTP2ErrorCode::INTERNAL_ERROR);
+    }
+  }
+
+  release();
+}
+
+void HTTP2ServerStream::rejectRequest(const HTTPResponse& resp) {
+  // the client stops sending the body once we reset the stream after the
+  // response (see HTTP2Session::maybeCloseStream)
+  RefPtr<HTTP2ServerStream> self(this);
+  writeResponse(resp, [self] {
+    self->finishResponse();
+  }, [] {});
+}
+
+bool HTTP2ServerStream::isClosed() const {
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+  return stream_closed_ || failed_;
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::onClosed(HTTP2ErrorCode error) {
+  stream_closed_ = true;
+  if (!response_finished_) {
+    logDebug(
+        "http.server",
+        "HTTP/2 stream $0 closed before the response was finished: $1",
+        stream_id_,
+        (uint32_t) error);
+
+    fail();
+  }
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::fail() {
+  if (failed_) {
+    return;
+  }
+
+  failed_ = true;
+  body_callback_ = nullptr;
+  body_buf_.clear();
+  on_write_completed_cb_ = nullptr;
+
+  auto on_error = on_error_cb_;
+  on_error_cb_ = nullptr;
+  if (on_error) {
+    session_->runDeferred(on_error);
+    release();
+  }
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::failWrite(Function<void()> on_error) {
+  if (on_error) {
+    session_->runDeferred(on_error);
+  }
+
+  release();
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::startWrite(
+    Function<void()> ready_callback,
+    Function<void()> on_error) {
+  markFirstByte();
+  on_write_completed_cb_ = ready_callback;
+  on_error_cb_ = on_error;
+}
+
+void HTTP2ServerStream::writeCompleted() {
+  std::unique_lock<std::recursive_mutex> lk(session_->mutex_);
+  auto callback = on_write_completed_cb_;
+  on_write_completed_cb_ = nullptr;
+  if (callback) {
+    on_error_cb_ = nullptr;
+  }
+
+  lk.unlock();
+  if (callback) {
+    callback();
+  }
+}
+
+// precondition: must hold session mutex
+void HTTP2ServerStream::release() {
+  if (released_) {
+    return;
+  }
+
+  released_ = true;
+  stats_->current_requests.decr(1);
+
+  // N.B. the caller may still use the stream, so we don't drop the last
+  // reference in place
+  session_->runDeferred([this] {
+    decRef();
+  });
+}
+
+}
+}
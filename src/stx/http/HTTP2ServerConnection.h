@@ -0,0 +1,199 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTP2SERVERCONNECTION_H
+#define _STX_HTTP_HTTP2SERVERCONNECTION_H
+#include <map>
+#include <stx/autoref.h>
+#include <stx/stdtypes.h>
+#include <stx/http/HTTP2Session.h>
+#include <stx/http/httpserverconnection.h>
+
+namespace stx {
+namespace http {
+
+class HTTP2ServerStream;
+
+/**
+ * The server side of a HTTP/2 over cleartext (h2c) connection. Started by
+ * HTTPServerConnection once a client sent the connection preface or an
+ * "Upgrade: h2c" request.
+ *
+ * Each stream is passed to the handler factory as a HTTP2ServerStream, which
+ * implements the HTTPServerConnection interface for a single request, so
+ * existing handlers work unchanged. The stream is a ref counted
+ * HTTPServerConnection of its own and stays valid until the response was
+ * finished or an error callback was called.
+ *
+ * The connection frees itself once it is closed.
+ */
+class HTTP2ServerConnection : public HTTP2Session {
+  friend class HTTP2ServerStream;
+public:
+
+  /**
+   * Start a HTTP/2 connection on conn. input is what the HTTP/1.1 connection
+   * already read from the socket, starting with the connection preface. If
+   * upgrade_request is set, the connection sends a 101 response first and
+   * answers the request on stream 1
+   */
+  static void start(
+      HTTPHandlerFactory* handler_factory,
+      ScopedPtr<net::TCPConnection> conn,
+      TaskScheduler* scheduler,
+      const HTTPServerOptions* opts,
+      HTTPServerStats* stats,
+      HTTPResponseBufferBudget* response_budget,
+      ScopedPtr<HTTPRequest> upgrade_request,
+      const Buffer& input);
+
+  ~HTTP2ServerConnection();
+
+protected:
+
+  HTTP2ServerConnection(
+      HTTPHandlerFactory* handler_factory,
+      ScopedPtr<net::TCPConnection> conn,
+      TaskScheduler* scheduler,
+      const HTTPServerOptions* opts,
+      HTTPServerStats* stats,
+      HTTPResponseBufferBudget* response_budget);
+
+  // precondition: must hold mutex
+  void upgrade(ScopedPtr<HTTPRequest> request);
+
+  // precondition: must hold mutex
+  void startRequest(
+      uint32_t stream_id,
+      ScopedPtr<HTTPRequest> request,
+      bool end_stream);
+
+  void onHeaders(
+      uint32_t stream_id,
+      const HTTPMessage::HeaderList& headers,
+      bool end_stream) override;
+
+  void onData(
+      uint32_t stream_id,
+      const char* data,
+      size_t size,
+      bool end_stream) override;
+
+  void onStreamClosed(uint32_t stream_id, HTTP2ErrorCode error) override;
+  void onSessionClosed(const std::exception& e) override;
+
+  HTTPHandlerFactory* handler_factory_;
+  const HTTPServerOptions* opts_;
+  HTTPServerStats* stats_;
+  HTTPResponseBufferBudget* response_budget_;
+  std::map<uint32_t, RefPtr<HTTP2ServerStream>> requests_;
+};
+
+/**
+ * A single request on a HTTP2ServerConnection. All methods lock the
+ * connection.
+ *
+ * Request body DATA is passed to the streamRequestBody callback as it
+ * arrives. While the body is paused or not claimed yet, it is buffered and
+ * the stream's receive window is not replenished, so the client stops
+ * sending once the window is exhausted.
+ *
+ * Each write calls exactly one of its callbacks. If the stream is reset or
+ * the connection closes, the pending error callback is called from the task
+ * scheduler. Writes on a failed stream call their error callback right away.
+ */
+class HTTP2ServerStream : public HTTPServerConnection {
+  friend class HTTP2ServerConnection;
+public:
+
+  void readRequestBody(
+      Function<void (
+          const void* data,
+          size_t size,
+          bool last_chunk)> callback,
+      Function<void()> on_error) override;
+
+  void streamRequestBody(
+      Function<void (
+          const void* data,
+          size_t size,
+          bool last_chunk)> callback,
+      Function<void()> on_error) override;
+
+  void pauseRequestBody() override;
+  void resumeRequestBody() override;
+
+  void writeResponse(
+      const HTTPResponse& resp,
+      Function<void()> ready_callback,
+      Function<void()> on_error) override;
+
+  void writeResponseBody(
+      const void* data,
+      size_t size,
+      Function<void()> ready_callback,
+      Function<void()> on_error) override;
+
+  void writeResponseBody(
+      BufferRef chunk,
+      Function<void()> ready_callback,
+      Function<void()> on_error) override;
+
+  void finishResponse() override;
+
+  void rejectRequest(const HTTPResponse& resp) override;
+
+  bool isClosed() const override;
+
+protected:
+
+  HTTP2ServerStream(
+      HTTP2ServerConnection* session,
+      uint32_t stream_id,
+      ScopedPtr<HTTPRequest> request);
+
+  // precondition: must hold session mutex
+  void dispatch();
+
+  // precondition: must hold session mutex
+  void onBodyData(const char* data, size_t size, bool end_stream);
+
+  // precondition: must hold session mutex
+  void onClosed(HTTP2ErrorCode error);
+
+  // precondition: must hold session mutex
+  void deliverBody();
+
+  // precondition: must hold session mutex
+  void fail();
+
+  // precondition: must hold session mutex
+  void failWrite(Function<void()> on_error);
+
+  // precondition: must hold session mutex
+  void startWrite(Function<void()> ready_callback, Function<void()> on_error);
+  void writeCompleted();
+
+  // precondition: must hold session mutex
+  void release();
+
+  RefPtr<HTTP2ServerConnection> session_;
+  uint32_t stream_id_;
+  bool stream_closed_;
+  bool headers_sent_;
+  bool failed_;
+  bool response_finished_;
+  bool released_;
+  size_t body_bytes_;
+  size_t body_credit_;
+};
+
+}
+}
+#endif
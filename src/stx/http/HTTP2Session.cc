@@ -0,0 +1,1026 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <stx/exception.h>
+#include <stx/logging.h>
+#include <stx/http/HTTP2Session.h>
+
+namespace stx {
+namespace http {
+
+const size_t HTTP2Session::kReadBufferSize;
+const size_t HTTP2Session::kMaxWriteBufferSize;
+const uint32_t HTTP2Session::kReceiveWindowSize;
+const uint32_t HTTP2Session::kDefaultMaxConcurrentStreams;
+const size_t HTTP2Session::kMaxHeaderBlockSize;
+
+static Exception mkIOError(const String& message) {
+  Exception e(message);
+  e.setTypeName(kIOError);
+  return e;
+}
+
+static void consumeInput(Buffer* buf, size_t size) {
+  if (size >= buf->size()) {
+    buf->clear();
+    return;
+  }
+
+  Buffer rest(((const char*) buf->data()) + size, buf->size() - size);
+  *buf = std::move(rest);
+}
+
+HTTP2Session::StreamState::StreamState() :
+    send_window(HTTP2Frame::kDefaultWindowSize),
+    recv_window(HTTP2Session::kReceiveWindowSize),
+    recv_unacked(0),
+    local_closed(false),
+    remote_closed(false) {}
+
+HTTP2Session::HTTP2Session(
+    ScopedPtr<net::TCPConnection> conn,
+    TaskScheduler* scheduler,
+    bool is_server) :
+    conn_(std::move(conn)),
+    scheduler_(scheduler),
+    is_server_(is_server),
+    reading_(false),
+    writing_(false),
+    closed_(false),
+    goaway_sent_(false),
+    goaway_received_(false),
+    preamble_done_(false),
+    preface_received_(!is_server),
+    send_window_(HTTP2Frame::kDefaultWindowSize),
+    recv_window_(HTTP2Frame::kDefaultWindowSize),
+    recv_unacked_(0),
+    peer_initial_window_(HTTP2Frame::kDefaultWindowSize),
+    peer_max_frame_size_(HTTP2Frame::kDefaultMaxFrameSize),
+    peer_max_concurrent_streams_(std::numeric_limits<uint32_t>::max()),
+    max_concurrent_streams_(kDefaultMaxConcurrentStreams),
+    last_peer_stream_id_(0),
+    header_stream_id_(0),
+    header_end_stream_(false),
+    received_bytes_(nullptr),
+    sent_bytes_(nullptr) {
+  conn_->setNonblocking(true);
+  conn_->setNoDelay(true);
+  read_buf_.reserve(kReadBufferSize);
+
+  parser_.onFrame(
+      std::bind(&HTTP2Session::processFrame, this, std::placeholders::_1));
+}
+
+HTTP2Session::~HTTP2Session() {}
+
+// precondition: must hold mutex
+void HTTP2Session::startSession(
+    uint32_t max_concurrent_streams /* = kDefaultMaxConcurrentStreams */) {
+  max_concurrent_streams_ = max_concurrent_streams;
+
+  if (!is_server_) {
+    writeRaw(
+        HTTP2Frame::kConnectionPreface,
+        HTTP2Frame::kConnectionPrefaceSize);
+  }
+
+  Vector<Pair<HTTP2Setting, uint32_t>> settings;
+  settings.emplace_back(
+      HTTP2Setting::MAX_CONCURRENT_STREAMS,
+      max_concurrent_streams);
+  settings.emplace_back(HTTP2Setting::INITIAL_WINDOW_SIZE, kReceiveWindowSize);
+  if (!is_server_) {
+    settings.emplace_back(HTTP2Setting::ENABLE_PUSH, 0);
+  }
+
+  HTTP2Frame::mkSettings(settings).writeTo(&write_buf_);
+
+  // the connection window can only be raised with a WINDOW_UPDATE
+  HTTP2Frame::mkWindowUpdate(
+      0,
+      kReceiveWindowSize - HTTP2Frame::kDefaultWindowSize)
+      .writeTo(&write_buf_);
+  recv_window_ = kReceiveWindowSize;
+
+  awaitRead();
+  awaitWrite();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::openStream(uint32_t stream_id) {
+  auto& stream = streams_[stream_id];
+  stream.send_window = peer_initial_window_;
+}
+
+// precondition: must hold mutex
+bool HTTP2Session::hasStream(uint32_t stream_id) const {
+  return streams_.count(stream_id) > 0;
+}
+
+// precondition: must hold mutex
+void HTTP2Session::writeHeaders(
+    uint32_t stream_id,
+    const HTTPMessage::HeaderList& headers,
+    bool end_stream) {
+  auto iter = streams_.find(stream_id);
+  if (iter == streams_.end() || iter->second.local_closed) {
+    RAISEF(kIllegalStateError, "HTTP/2 stream $0 is closed", stream_id);
+  }
+
+  Buffer block;
+  encoder_.encode(headers, &block);
+
+  size_t pos = 0;
+  auto type = HTTP2FrameType::HEADERS;
+  do {
+    auto len = std::min(block.size() - pos, peer_max_frame_size_);
+    uint8_t flags = 0;
+    if (pos + len == block.size()) {
+      flags |= HTTP2Frame::kFlagEndHeaders;
+    }
+
+    if (type == HTTP2FrameType::HEADERS && end_stream) {
+      flags |= HTTP2Frame::kFlagEndStream;
+    }
+
+    HTTP2Frame::writeHeader(len, type, flags, stream_id, &write_buf_);
+    write_buf_.append(((const char*) block.data()) + pos, len);
+    pos += len;
+    type = HTTP2FrameType::CONTINUATION;
+  } while (pos < block.size());
+
+  awaitWrite();
+
+  if (end_stream) {
+    iter->second.local_closed = true;
+    maybeCloseStream(stream_id);
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2Session::writeData(
+    uint32_t stream_id,
+    BufferRef data,
+    bool end_stream,
+    Function<void ()> on_written) {
+  auto iter = streams_.find(stream_id);
+  if (iter == streams_.end() || iter->second.local_closed) {
+    RAISEF(kIllegalStateError, "HTTP/2 stream $0 is closed", stream_id);
+  }
+
+  OutputChunk chunk;
+  chunk.data = data;
+  chunk.pos = 0;
+  chunk.end_stream = end_stream;
+  chunk.on_written = on_written;
+  iter->second.output.emplace_back(chunk);
+  iter->second.local_closed = end_stream;
+
+  frameData();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::resetStream(uint32_t stream_id, HTTP2ErrorCode error) {
+  auto iter = streams_.find(stream_id);
+  if (iter == streams_.end()) {
+    return;
+  }
+
+  streams_.erase(iter);
+  HTTP2Frame::mkRstStream(stream_id, error).writeTo(&write_buf_);
+  awaitWrite();
+
+  onStreamClosed(stream_id, error);
+  maybeFinishShutdown();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::consumeData(uint32_t stream_id, size_t size) {
+  auto iter = streams_.find(stream_id);
+  if (iter == streams_.end()) {
+    return;
+  }
+
+  auto& stream = iter->second;
+  stream.recv_unacked += size;
+  if (stream.remote_closed || stream.recv_unacked < kReceiveWindowSize / 2) {
+    return;
+  }
+
+  HTTP2Frame::mkWindowUpdate(stream_id, stream.recv_unacked)
+      .writeTo(&write_buf_);
+  stream.recv_window += stream.recv_unacked;
+  stream.recv_unacked = 0;
+  awaitWrite();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::writePing(const Buffer& payload) {
+  HTTP2Frame::mkPing(payload, false).writeTo(&write_buf_);
+  awaitWrite();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::writeRaw(const void* data, size_t size) {
+  write_buf_.append(data, size);
+  awaitWrite();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::connectionError(
+    HTTP2ErrorCode error,
+    const String& message) {
+  if (closed_) {
+    return;
+  }
+
+  logDebug("http.h2", "HTTP/2 connection error: $0, closing...", message);
+
+  if (!goaway_sent_) {
+    goaway_sent_ = true;
+    HTTP2Frame::mkGoAway(last_peer_stream_id_, error, message)
+        .writeTo(&write_buf_);
+  }
+
+  // best effort, we don't wait for the GOAWAY to be written
+  auto pending = pendingWriteBytes();
+  if (pending > 0) {
+    conn_->tryWrite(
+        ((const char*) write_buf_.data()) + write_buf_.mark(),
+        pending);
+  }
+
+  closeImpl(mkIOError("HTTP/2 connection error: " + message));
+}
+
+// precondition: must hold mutex
+void HTTP2Session::processInput(const char* data, size_t size) {
+  if (closed_) {
+    return;
+  }
+
+  try {
+    if (preamble_done_ && preface_received_) {
+      parser_.parse(data, size);
+      return;
+    }
+
+    input_buf_.append(data, size);
+
+    if (!preamble_done_) {
+      auto consumed = onPreamble(
+          (const char*) input_buf_.data(),
+          input_buf_.size());
+
+      if (consumed < 0 || closed_) {
+        return;
+      }
+
+      preamble_done_ = true;
+      consumeInput(&input_buf_, consumed);
+    }
+
+    if (!preface_received_) {
+      auto len = std::min(
+          input_buf_.size(),
+          HTTP2Frame::kConnectionPrefaceSize);
+
+      if (memcmp(input_buf_.data(), HTTP2Frame::kConnectionPreface, len)) {
+        connectionError(
+            HTTP2ErrorCode::PROTOCOL_ERROR,
+            "invalid connection preface");
+        return;
+      }
+
+      if (len < HTTP2Frame::kConnectionPrefaceSize) {
+        return;
+      }
+
+      preface_received_ = true;
+      consumeInput(&input_buf_, len);
+    }
+
+    Buffer input(std::move(input_buf_));
+    input_buf_.clear();
+    parser_.parse((const char*) input.data(), input.size());
+  } catch (const Exception& e) {
+    connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, e.getMessage());
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2Session::applySettings(
+    const Vector<Pair<HTTP2Setting, uint32_t>>& settings) {
+  for (const auto& setting : settings) {
+    auto value = setting.second;
+
+    switch (setting.first) {
+
+      case HTTP2Setting::HEADER_TABLE_SIZE:
+        encoder_.setMaxTableSize(
+            std::min<size_t>(value, size_t(HPACKTable::kDefaultMaxSize)));
+        break;
+
+      case HTTP2Setting::ENABLE_PUSH:
+        if (value > 1) {
+          connectionError(
+              HTTP2ErrorCode::PROTOCOL_ERROR,
+              "invalid SETTINGS_ENABLE_PUSH");
+          return;
+        }
+        break;
+
+      case HTTP2Setting::MAX_CONCURRENT_STREAMS:
+        peer_max_concurrent_streams_ = value;
+        break;
+
+      case HTTP2Setting::INITIAL_WINDOW_SIZE: {
+        if (value > HTTP2Frame::kMaxWindowSize) {
+          connectionError(
+              HTTP2ErrorCode::FLOW_CONTROL_ERROR,
+              "invalid SETTINGS_INITIAL_WINDOW_SIZE");
+          return;
+        }
+
+        // the change applies to all open streams (RFC 7540 6.9.2)
+        auto delta = (int64_t) value - peer_initial_window_;
+        peer_initial_window_ = value;
+        for (auto& stream : streams_) {
+          stream.second.send_window += delta;
+          if (stream.second.send_window > HTTP2Frame::kMaxWindowSize) {
+            connectionError(
+                HTTP2ErrorCode::FLOW_CONTROL_ERROR,
+                "stream window overflow");
+            return;
+          }
+        }
+        break;
+      }
+
+      case HTTP2Setting::MAX_FRAME_SIZE:
+        if (value < HTTP2Frame::kDefaultMaxFrameSize ||
+            value > HTTP2Frame::kMaxFrameSizeLimit) {
+          connectionError(
+              HTTP2ErrorCode::PROTOCOL_ERROR,
+              "invalid SETTINGS_MAX_FRAME_SIZE");
+          return;
+        }
+
+        peer_max_frame_size_ = value;
+        break;
+
+      // unknown settings must be ignored
+      default:
+        break;
+
+    }
+  }
+
+  frameData();
+}
+
+void HTTP2Session::runDeferred(Function<void ()> fn) {
+  RefPtr<HTTP2Session> self(this);
+  scheduler_->runAsync([self, fn] {
+    fn();
+  });
+}
+
+// precondition: must hold mutex
+void HTTP2Session::awaitRead() {
+  if (reading_ || closed_) {
+    return;
+  }
+
+  reading_ = true;
+  RefPtr<HTTP2Session> self(this);
+  scheduler_->runOnReadable([self] {
+    self->read();
+  }, *conn_);
+}
+
+// precondition: must hold mutex
+void HTTP2Session::awaitWrite() {
+  if (writing_ || closed_ || pendingWriteBytes() == 0) {
+    return;
+  }
+
+  writing_ = true;
+  RefPtr<HTTP2Session> self(this);
+  scheduler_->runOnWritable([self] {
+    self->write();
+  }, *conn_);
+}
+
+void HTTP2Session::read() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  reading_ = false;
+  if (closed_) {
+    return;
+  }
+
+  auto res = conn_->tryRead(read_buf_.data(), read_buf_.allocSize());
+  if (res.wouldBlock()) {
+    awaitRead();
+    return;
+  }
+
+  if (res.failed()) {
+    auto e = res.toException("read() failed");
+    logDebug("http.h2", e, "read() failed, closing...");
+    closeImpl(e);
+    return;
+  }
+
+  if (res.eof() || res.bytes == 0) {
+    closeImpl(mkIOError("connection closed by peer"));
+    return;
+  }
+
+  if (received_bytes_) {
+    received_bytes_->incr(res.bytes);
+  }
+
+  processInput((const char*) read_buf_.data(), res.bytes);
+  awaitRead();
+}
+
+void HTTP2Session::write() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  writing_ = false;
+  if (closed_) {
+    return;
+  }
+
+  auto size = pendingWriteBytes();
+  if (size > 0) {
+    auto res = conn_->tryWrite(
+        ((const char*) write_buf_.data()) + write_buf_.mark(),
+        size);
+
+    if (res.wouldBlock()) {
+      awaitWrite();
+      return;
+    }
+
+    if (res.failed()) {
+      auto e = res.toException("write() failed");
+      logDebug("http.h2", e, "write() failed, closing...");
+      closeImpl(e);
+      return;
+    }
+
+    if (sent_bytes_) {
+      sent_bytes_->incr(res.bytes);
+    }
+
+    if (res.bytes < size) {
+      write_buf_.setMark(write_buf_.mark() + res.bytes);
+    } else {
+      write_buf_.clear();
+    }
+  }
+
+  // frame more DATA now that there is room in the write buffer
+  frameData();
+  awaitWrite();
+  maybeFinishShutdown();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::processFrame(const HTTP2Frame& frame) {
+  if (closed_) {
+    return;
+  }
+
+  // a header block must not be interleaved with any other frame
+  if (header_stream_id_ != 0 &&
+      (frame.type != HTTP2FrameType::CONTINUATION ||
+       frame.stream_id != header_stream_id_)) {
+    connectionError(
+        HTTP2ErrorCode::PROTOCOL_ERROR,
+        "expected CONTINUATION frame");
+    return;
+  }
+
+  switch (frame.type) {
+
+    case HTTP2FrameType::HEADERS: {
+      if (frame.stream_id == 0) {
+        connectionError(
+            HTTP2ErrorCode::PROTOCOL_ERROR,
+            "HEADERS frame on stream 0");
+        return;
+      }
+
+      const char* data;
+      size_t size;
+      frame.data(&data, &size);
+      header_block_.clear();
+      header_block_.append(data, size);
+      header_stream_id_ = frame.stream_id;
+      header_end_stream_ = frame.hasFlag(HTTP2Frame::kFlagEndStream);
+      if (frame.hasFlag(HTTP2Frame::kFlagEndHeaders)) {
+        processHeaderBlock();
+      }
+      break;
+    }
+
+    case HTTP2FrameType::CONTINUATION:
+      if (header_stream_id_ == 0) {
+        connectionError(
+            HTTP2ErrorCode::PROTOCOL_ERROR,
+            "unexpected CONTINUATION frame");
+        return;
+      }
+
+      header_block_.append(frame.payload);
+      if (header_block_.size() > kMaxHeaderBlockSize) {
+        connectionError(
+            HTTP2ErrorCode::ENHANCE_YOUR_CALM,
+            "header block too large");
+        return;
+      }
+
+      if (frame.hasFlag(HTTP2Frame::kFlagEndHeaders)) {
+        processHeaderBlock();
+      }
+      break;
+
+    case HTTP2FrameType::DATA:
+      processData(frame);
+      break;
+
+    case HTTP2FrameType::RST_STREAM: {
+      if (frame.stream_id == 0) {
+        connectionError(
+            HTTP2ErrorCode::PROTOCOL_ERROR,
+            "RST_STREAM frame on stream 0");
+        return;
+      }
+
+      auto error = frame.errorCode();
+      auto iter = streams_.find(frame.stream_id);
+      if (iter != streams_.end()) {
+        streams_.erase(iter);
+        onStreamClosed(frame.stream_id, error);
+        maybeFinishShutdown();
+      }
+      break;
+    }
+
+    case HTTP2FrameType::SETTINGS:
+      processSettings(frame);
+      break;
+
+    case HTTP2FrameType::PUSH_PROMISE:
+      connectionError(
+          HTTP2ErrorCode::PROTOCOL_ERROR,
+          "unexpected PUSH_PROMISE frame");
+      break;
+
+    case HTTP2FrameType::PING:
+      if (frame.stream_id != 0 ||
+          frame.payload.size() != HTTP2Frame::kPingPayloadSize) {
+        connectionError(
+            HTTP2ErrorCode::PROTOCOL_ERROR,
+            "invalid PING frame");
+        return;
+      }
+
+      if (frame.hasFlag(HTTP2Frame::kFlagAck)) {
+        onPingAck(frame.payload);
+      } else {
+        HTTP2Frame::mkPing(frame.payload, true).writeTo(&write_buf_);
+        awaitWrite();
+      }
+      break;
+
+    case HTTP2FrameType::GOAWAY: {
+      auto last_stream_id = frame.lastStreamID();
+      auto error = frame.errorCode();
+      goaway_received_ = true;
+
+      // our streams above the last stream id were never seen by the peer
+      Vector<uint32_t> refused;
+      for (const auto& stream : streams_) {
+        auto is_local = (stream.first % 2 == 1) != is_server_;
+        if (is_local && stream.first > last_stream_id) {
+          refused.emplace_back(stream.first);
+        }
+      }
+
+      for (auto stream_id : refused) {
+        streams_.erase(stream_id);
+        onStreamClosed(stream_id, HTTP2ErrorCode::REFUSED_STREAM);
+      }
+
+      onGoAway(last_stream_id, error);
+      maybeFinishShutdown();
+      break;
+    }
+
+    case HTTP2FrameType::WINDOW_UPDATE:
+      processWindowUpdate(frame);
+      break;
+
+    // PRIORITY is advisory and unknown frame types must be ignored
+    default:
+      break;
+
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2Session::processHeaderBlock() {
+  auto stream_id = header_stream_id_;
+  auto end_stream = header_end_stream_;
+  header_stream_id_ = 0;
+
+  // the block must be decoded even if we drop the stream, the HPACK dynamic
+  // table is shared by all streams
+  HTTPMessage::HeaderList headers;
+  try {
+    decoder_.decode(header_block_.data(), header_block_.size(), &headers);
+  } catch (const Exception& e) {
+    connectionError(HTTP2ErrorCode::COMPRESSION_ERROR, e.getMessage());
+    return;
+  }
+
+  header_block_.clear();
+
+  if (!hasStream(stream_id)) {
+    // e.g. a response to a stream we reset
+    if (!is_server_) {
+      return;
+    }
+
+    if (stream_id % 2 == 0) {
+      connectionError(
+          HTTP2ErrorCode::PROTOCOL_ERROR,
+          "invalid stream id");
+      return;
+    }
+
+    // trailers of a stream that was already closed
+    if (stream_id <= last_peer_stream_id_) {
+      return;
+    }
+
+    last_peer_stream_id_ = stream_id;
+
+    // the peer didn't know about our GOAWAY yet
+    if (goaway_sent_) {
+      return;
+    }
+
+    if (streams_.size() >= max_concurrent_streams_) {
+      HTTP2Frame::mkRstStream(stream_id, HTTP2ErrorCode::REFUSED_STREAM)
+          .writeTo(&write_buf_);
+      awaitWrite();
+      return;
+    }
+
+    openStream(stream_id);
+    streams_[stream_id].remote_closed = end_stream;
+  }
+
+  onHeaders(stream_id, headers, end_stream);
+
+  auto iter = streams_.find(stream_id);
+  if (end_stream && iter != streams_.end()) {
+    iter->second.remote_closed = true;
+    maybeCloseStream(stream_id);
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2Session::processData(const HTTP2Frame& frame) {
+  auto stream_id = frame.stream_id;
+  if (stream_id == 0) {
+    connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "DATA frame on stream 0");
+    return;
+  }
+
+  // the whole frame including padding counts against the windows
+  auto len = frame.payload.size();
+  if ((int64_t) len > recv_window_) {
+    connectionError(
+        HTTP2ErrorCode::FLOW_CONTROL_ERROR,
+        "connection receive window exceeded");
+    return;
+  }
+
+  recv_window_ -= len;
+  recv_unacked_ += len;
+  if (recv_unacked_ >= kReceiveWindowSize / 2) {
+    HTTP2Frame::mkWindowUpdate(0, recv_unacked_).writeTo(&write_buf_);
+    recv_window_ += recv_unacked_;
+    recv_unacked_ = 0;
+    awaitWrite();
+  }
+
+  const char* data;
+  size_t size;
+  frame.data(&data, &size);
+
+  // DATA on a stream we already closed or reset is dropped
+  auto iter = streams_.find(stream_id);
+  if (iter == streams_.end() || iter->second.remote_closed) {
+    return;
+  }
+
+  auto& stream = iter->second;
+  if ((int64_t) len > stream.recv_window) {
+    resetStream(stream_id, HTTP2ErrorCode::FLOW_CONTROL_ERROR);
+    return;
+  }
+
+  stream.recv_window -= len;
+  if (len > size) {
+    consumeData(stream_id, len - size);
+  }
+
+  auto end_stream = frame.hasFlag(HTTP2Frame::kFlagEndStream);
+  stream.remote_closed = end_stream;
+
+  onData(stream_id, data, size, end_stream);
+
+  if (end_stream) {
+    maybeCloseStream(stream_id);
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2Session::processWindowUpdate(const HTTP2Frame& frame) {
+  auto increment = frame.windowIncrement();
+
+  if (frame.stream_id == 0) {
+    if (increment == 0) {
+      connectionError(
+          HTTP2ErrorCode::PROTOCOL_ERROR,
+          "invalid WINDOW_UPDATE increment");
+      return;
+    }
+
+    if (send_window_ + increment > HTTP2Frame::kMaxWindowSize) {
+      connectionError(
+          HTTP2ErrorCode::FLOW_CONTROL_ERROR,
+          "connection window overflow");
+      return;
+    }
+
+    send_window_ += increment;
+  } else {
+    auto iter = streams_.find(frame.stream_id);
+    if (iter == streams_.end()) {
+      return;
+    }
+
+    if (increment == 0) {
+      resetStream(frame.stream_id, HTTP2ErrorCode::PROTOCOL_ERROR);
+      return;
+    }
+
+    if (iter->second.send_window + increment > HTTP2Frame::kMaxWindowSize) {
+      resetStream(frame.stream_id, HTTP2ErrorCode::FLOW_CONTROL_ERROR);
+      return;
+    }
+
+    iter->second.send_window += increment;
+  }
+
+  frameData();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::processSettings(const HTTP2Frame& frame) {
+  if (frame.stream_id != 0) {
+    connectionError(
+        HTTP2ErrorCode::PROTOCOL_ERROR,
+        "SETTINGS frame on a stream");
+    return;
+  }
+
+  if (frame.hasFlag(HTTP2Frame::kFlagAck)) {
+    if (frame.payload.size() > 0) {
+      connectionError(
+          HTTP2ErrorCode::FRAME_SIZE_ERROR,
+          "invalid SETTINGS ACK");
+    }
+
+    return;
+  }
+
+  applySettings(frame.settings());
+  if (closed_) {
+    return;
+  }
+
+  HTTP2Frame::mkSettingsAck().writeTo(&write_buf_);
+  awaitWrite();
+  onSettings();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::frameData() {
+  if (closed_) {
+    return;
+  }
+
+  // one frame per stream and round, so that a large response doesn't starve
+  // the other streams
+  Vector<uint32_t> ended;
+  auto progress = true;
+  while (progress && pendingWriteBytes() < kMaxWriteBufferSize) {
+    progress = false;
+
+    for (auto& iter : streams_) {
+      auto& stream = iter.second;
+      if (stream.output.empty()) {
+        continue;
+      }
+
+      auto& chunk = stream.output.front();
+      auto chunk_size = chunk.data.get() ? chunk.data->size() : 0;
+      auto len = chunk_size - chunk.pos;
+      if (len > 0) {
+        auto window = std::min(send_window_, stream.send_window);
+        if (window <= 0) {
+          continue;
+        }
+
+        len = std::min(len, (size_t) window);
+        len = std::min(len, peer_max_frame_size_);
+      }
+
+      auto last = chunk.pos + len == chunk_size;
+      if (len > 0 || (last && chunk.end_stream)) {
+        uint8_t flags = 0;
+        if (last && chunk.end_stream) {
+          flags |= HTTP2Frame::kFlagEndStream;
+        }
+
+        HTTP2Frame::writeHeader(
+            len,
+            HTTP2FrameType::DATA,
+            flags,
+            iter.first,
+            &write_buf_);
+
+        if (len > 0) {
+          write_buf_.append(
+              ((const char*) chunk.data->data()) + chunk.pos,
+              len);
+        }
+      }
+
+      chunk.pos += len;
+      send_window_ -= len;
+      stream.send_window -= len;
+      progress = true;
+
+      if (last) {
+        if (chunk.on_written) {
+          runDeferred(chunk.on_written);
+        }
+
+        if (chunk.end_stream) {
+          ended.emplace_back(iter.first);
+        }
+
+        stream.output.pop_front();
+      }
+
+      if (pendingWriteBytes() >= kMaxWriteBufferSize) {
+        break;
+      }
+    }
+  }
+
+  awaitWrite();
+
+  for (auto stream_id : ended) {
+    maybeCloseStream(stream_id);
+  }
+}
+
+// precondition: must hold mutex
+void HTTP2Session::maybeCloseStream(uint32_t stream_id) {
+  auto iter = streams_.find(stream_id);
+  if (iter == streams_.end()) {
+    return;
+  }
+
+  auto& stream = iter->second;
+  if (!stream.local_closed || !stream.output.empty()) {
+    return;
+  }
+
+  if (!stream.remote_closed) {
+    if (!is_server_) {
+      return;
+    }
+
+    // the response is complete but the client is still sending, e.g. a
+    // request body the handler didn't read. tell it to stop
+    HTTP2Frame::mkRstStream(stream_id, HTTP2ErrorCode::NO_ERROR)
+        .writeTo(&write_buf_);
+    awaitWrite();
+  }
+
+  streams_.erase(iter);
+  onStreamClosed(stream_id, HTTP2ErrorCode::NO_ERROR);
+  maybeFinishShutdown();
+}
+
+// precondition: must hold mutex
+void HTTP2Session::maybeFinishShutdown() {
+  if (closed_ ||
+      !(goaway_sent_ || goaway_received_) ||
+      !streams_.empty() ||
+      pendingWriteBytes() > 0) {
+    return;
+  }
+
+  closeImpl(mkIOError("HTTP/2 connection was shut down"));
+}
+
+// precondition: must hold mutex
+void HTTP2Session::closeImpl(const std::exception& e) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  streams_.clear();
+  header_stream_id_ = 0;
+  onSessionClosed(e);
+
+  // N.B. this may run on a thread other than the event loop's, so the fd is
+  // cancelled from the scheduler instead of blocking on it with the lock held
+  RefPtr<HTTP2Session> self(this);
+  scheduler_->runAsync([self] {
+    self->scheduler_->cancelFD(self->conn_->fd());
+    self->conn_->close();
+  });
+}
+
+// precondition: must hold mutex
+size_t HTTP2Session::pendingWriteBytes() const {
+  return write_buf_.size() - write_buf_.mark();
+}
+
+bool HTTP2Session::isClosed() const {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  return closed_;
+}
+
+bool HTTP2Session::isGoingAway() const {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  return goaway_sent_ || goaway_received_;
+}
+
+size_t HTTP2Session::numStreams() const {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  return streams_.size();
+}
+
+void HTTP2Session::shutdown() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  if (closed_ || goaway_sent_) {
+    return;
+  }
+
+  goaway_sent_ = true;
+  HTTP2Frame::mkGoAway(last_peer_stream_id_, HTTP2ErrorCode::NO_ERROR)
+      .writeTo(&write_buf_);
+  awaitWrite();
+}
+
+void HTTP2Session::close() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  closeImpl(mkIOError("HTTP/2 connection was closed"));
+}
+
+void HTTP2Session::onGoAway(uint32_t last_stream_id, HTTP2ErrorCode error) {}
+
+void HTTP2Session::onPingAck(const Buffer& payload) {}
+
+void HTTP2Session::onSettings() {}
+
+ssize_t HTTP2Session::onPreamble(const char* data, size_t size) {
+  return 0;
+}
+
+}
+}
@@ -0,0 +1,314 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTP2SESSION_H
+#define _STX_HTTP_HTTP2SESSION_H
+#include <map>
+#include <mutex>
+#include <stx/autoref.h>
+#include <stx/buffer.h>
+#include <stx/stdtypes.h>
+#include <stx/http/HPACK.h>
+#include <stx/http/HTTP2Frame.h>
+#include <stx/http/httpmessage.h>
+#include <stx/net/tcpconnection.h>
+#include <stx/stats/counter.h>
+#include <stx/thread/taskscheduler.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * The connection level part of HTTP/2 (RFC 7540) that clients and servers
+ * share: framing, HPACK, SETTINGS, PING, GOAWAY and flow control.
+ * HTTP2ServerConnection and HTTP2ClientConnection map the streams onto
+ * requests and responses.
+ *
+ * Clients open streams with openStream, streams that the peer starts are
+ * opened before onHeaders is called. Streams are written with writeHeaders
+ * and writeData. DATA frames are only sent while both the connection and the
+ * stream send window allow it, streams that are blocked on flow control
+ * don't hold up the others. Received DATA is credited back to the peer's
+ * connection window right away and to the stream window once the
+ * application consumed it (see consumeData), so a stream whose consumer
+ * doesn't keep up stops the peer from sending on that stream only.
+ *
+ * All methods lock the session. The hooks are called with the lock held and
+ * must not block; callbacks into user code that may re-enter the session or
+ * release the last reference to it are deferred with runDeferred.
+ *
+ * The session needs a TaskScheduler that supports runOnReadable and
+ * runOnWritable, i.e. an EventLoop.
+ */
+class HTTP2Session : public RefCounted {
+public:
+  static const size_t kReadBufferSize = 64 * 1024;
+  static const size_t kMaxWriteBufferSize = 64 * 1024;
+  static const uint32_t kReceiveWindowSize = 1024 * 1024;
+  static const uint32_t kDefaultMaxConcurrentStreams = 100;
+  static const size_t kMaxHeaderBlockSize = 256 * 1024;
+
+  virtual ~HTTP2Session();
+
+  /**
+   * Returns true once the connection was closed
+   */
+  bool isClosed() const;
+
+  /**
+   * Returns true if either side sent a GOAWAY. No new streams can be started
+   * on the connection
+   */
+  bool isGoingAway() const;
+
+  /**
+   * Returns the number of streams that were opened and are not closed yet
+   */
+  size_t numStreams() const;
+
+  /**
+   * Send a GOAWAY and close the connection once all open streams are
+   * finished
+   */
+  void shutdown();
+
+  /**
+   * Close the connection immediately. Streams that are still open fail
+   */
+  void close();
+
+protected:
+
+  /**
+   * A chunk of DATA queued on a stream. on_written is called once the chunk
+   * was completely framed into the connection's write buffer
+   */
+  struct OutputChunk {
+    BufferRef data;
+    size_t pos;
+    bool end_stream;
+    Function<void ()> on_written;
+  };
+
+  struct StreamState {
+    StreamState();
+
+    int64_t send_window;
+    int64_t recv_window;
+    size_t recv_unacked;
+    Deque<OutputChunk> output;
+    bool local_closed;
+    bool remote_closed;
+  };
+
+  HTTP2Session(
+      ScopedPtr<net::TCPConnection> conn,
+      TaskScheduler* scheduler,
+      bool is_server);
+
+  /**
+   * Queue our SETTINGS and raise the connection receive window. A server
+   * waits for the client preface before it parses any frames and refuses
+   * streams beyond max_concurrent_streams
+   */
+  // precondition: must hold mutex
+  void startSession(
+      uint32_t max_concurrent_streams = kDefaultMaxConcurrentStreams);
+
+  // precondition: must hold mutex
+  void openStream(uint32_t stream_id);
+
+  // precondition: must hold mutex
+  bool hasStream(uint32_t stream_id) const;
+
+  /**
+   * Encode and queue a header block, split into HEADERS and CONTINUATION
+   * frames if it exceeds the peer's SETTINGS_MAX_FRAME_SIZE
+   */
+  // precondition: must hold mutex
+  void writeHeaders(
+      uint32_t stream_id,
+      const HTTPMessage::HeaderList& headers,
+      bool end_stream);
+
+  /**
+   * Queue DATA on a stream. An empty chunk with end_stream ends the stream
+   * after the data that was queued before
+   */
+  // precondition: must hold mutex
+  void writeData(
+      uint32_t stream_id,
+      BufferRef data,
+      bool end_stream,
+      Function<void ()> on_written);
+
+  /**
+   * Send a RST_STREAM and drop the stream's queued output. Calls
+   * onStreamClosed
+   */
+  // precondition: must hold mutex
+  void resetStream(uint32_t stream_id, HTTP2ErrorCode error);
+
+  /**
+   * The application consumed size bytes of received DATA on the stream.
+   * Sends a WINDOW_UPDATE once half of the stream window was consumed
+   */
+  // precondition: must hold mutex
+  void consumeData(uint32_t stream_id, size_t size);
+
+  /**
+   * Queue a PING. The payload must be kPingPayloadSize bytes
+   */
+  // precondition: must hold mutex
+  void writePing(const Buffer& payload);
+
+  /**
+   * Queue raw bytes, e.g. the HTTP/1.1 part of an upgrade
+   */
+  // precondition: must hold mutex
+  void writeRaw(const void* data, size_t size);
+
+  /**
+   * Send a GOAWAY with the error and close the connection
+   */
+  // precondition: must hold mutex
+  void connectionError(HTTP2ErrorCode error, const String& message);
+
+  /**
+   * Parse input that was already read from the socket, e.g. by the HTTP/1.1
+   * connection before an upgrade
+   */
+  // precondition: must hold mutex
+  void processInput(const char* data, size_t size);
+
+  // precondition: must hold mutex
+  void applySettings(const Vector<Pair<HTTP2Setting, uint32_t>>& settings);
+
+  /**
+   * Run the callback from the task scheduler, i.e. without the session lock
+   * held. The session is kept alive until the callback returned
+   */
+  void runDeferred(Function<void ()> fn);
+
+  // precondition: must hold mutex
+  void awaitRead();
+
+  // precondition: must hold mutex
+  void awaitWrite();
+
+  /**
+   * Called for each complete header block, i.e. after the last CONTINUATION
+   */
+  virtual void onHeaders(
+      uint32_t stream_id,
+      const HTTPMessage::HeaderList& headers,
+      bool end_stream) = 0;
+
+  virtual void onData(
+      uint32_t stream_id,
+      const char* data,
+      size_t size,
+      bool end_stream) = 0;
+
+  /**
+   * Called once both sides ended the stream or it was reset. The stream state
+   * is gone when this is called. error is NO_ERROR for streams that were
+   * ended normally
+   */
+  virtual void onStreamClosed(uint32_t stream_id, HTTP2ErrorCode error) = 0;
+
+  /**
+   * Called once when the connection is closed. Streams that are still open
+   * are closed without an onStreamClosed call
+   */
+  virtual void onSessionClosed(const std::exception& e) = 0;
+
+  /**
+   * The peer sent a GOAWAY. Our streams above last_stream_id were not
+   * processed by the peer, they are closed with REFUSED_STREAM before this is
+   * called
+   */
+  virtual void onGoAway(uint32_t last_stream_id, HTTP2ErrorCode error);
+
+  virtual void onPingAck(const Buffer& payload);
+
+  /**
+   * Called after the peer's SETTINGS were applied, e.g. a client may start
+   * more streams if SETTINGS_MAX_CONCURRENT_STREAMS was raised
+   */
+  virtual void onSettings();
+
+  /**
+   * Called for input before the first frame. Returns the number of bytes
+   * consumed or -1 if more input is required. Used by clients that upgrade
+   * from HTTP/1.1
+   */
+  virtual ssize_t onPreamble(const char* data, size_t size);
+
+  void read();
+  void write();
+
+  // precondition: must hold mutex
+  void processFrame(const HTTP2Frame& frame);
+  void processHeaderBlock();
+  void processData(const HTTP2Frame& frame);
+  void processWindowUpdate(const HTTP2Frame& frame);
+  void processSettings(const HTTP2Frame& frame);
+
+  // precondition: must hold mutex
+  void frameData();
+
+  // precondition: must hold mutex
+  void maybeCloseStream(uint32_t stream_id);
+
+  // precondition: must hold mutex
+  void maybeFinishShutdown();
+
+  // precondition: must hold mutex
+  void closeImpl(const std::exception& e);
+
+  // precondition: must hold mutex
+  size_t pendingWriteBytes() const;
+
+  ScopedPtr<net::TCPConnection> conn_;
+  TaskScheduler* scheduler_;
+  bool is_server_;
+  mutable std::recursive_mutex mutex_;
+  HTTP2FrameParser parser_;
+  HPACKEncoder encoder_;
+  HPACKDecoder decoder_;
+  Buffer read_buf_;
+  Buffer write_buf_;
+  Buffer input_buf_;
+  std::map<uint32_t, StreamState> streams_;
+  bool reading_;
+  bool writing_;
+  bool closed_;
+  bool goaway_sent_;
+  bool goaway_received_;
+  bool preamble_done_;
+  bool preface_received_;
+  int64_t send_window_;
+  int64_t recv_window_;
+  size_t recv_unacked_;
+  int64_t peer_initial_window_;
+  size_t peer_max_frame_size_;
+  uint32_t peer_max_concurrent_streams_;
+  uint32_t max_concurrent_streams_;
+  uint32_t last_peer_stream_id_;
+  Buffer header_block_;
+  uint32_t header_stream_id_;
+  bool header_end_stream_;
+  stats::Counter<uint64_t>* received_bytes_;
+  stats::Counter<uint64_t>* sent_bytes_;
+};
+
+}
+}
+#endif
@@ -0,0 +1,129 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <limits>
+#include <stx/wallclock.h>
+#include <stx/http/HTTPAdmissionController.h>
+
+namespace stx {
+namespace http {
+
+HTTPAdmissionControlOptions::HTTPAdmissionControlOptions() :
+    max_inflight_requests(kDefaultMaxInflightRequests),
+    target_queue_delay_micros(kDefaultTargetQueueDelayMicros),
+    interval_micros(kDefaultIntervalMicros),
+    retry_after_seconds(kDefaultRetryAfterSeconds) {}
+
+HTTPAdmissionController::HTTPAdmissionController(
+    const HTTPAdmissionControlOptions& opts) :
+    opts_(opts),
+    inflight_(0),
+    interval_end_(0),
+    interval_min_delay_(std::numeric_limits<uint64_t>::max()),
+    last_delay_(0),
+    overloaded_(false) {}
+
+bool HTTPAdmissionController::admit() {
+  return admit(WallClock::unixMicros());
+}
+
+bool HTTPAdmissionController::admit(uint64_t now) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  updateInterval(now);
+
+  if (opts_.max_inflight_requests > 0 &&
+      inflight_ >= opts_.max_inflight_requests) {
+    stats_.shed_inflight_limit.incr(1);
+    return false;
+  }
+
+  // while overloaded, the most recent queue delay is the best estimate of how
+  // long a new request would wait
+  if (overloaded_ && last_delay_ > opts_.target_queue_delay_micros * 2) {
+    stats_.shed_queue_delay.incr(1);
+    return false;
+  }
+
+  ++inflight_;
+  stats_.admitted_requests.incr(1);
+  stats_.inflight_requests.incr(1);
+  return true;
+}
+
+bool HTTPAdmissionController::dequeue(uint64_t queue_delay) {
+  return dequeue(queue_delay, WallClock::unixMicros());
+}
+
+bool HTTPAdmissionController::dequeue(uint64_t queue_delay, uint64_t now) {
+  if (opts_.target_queue_delay_micros == 0) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  updateInterval(now);
+
+  last_delay_ = queue_delay;
+  if (queue_delay < interval_min_delay_) {
+    interval_min_delay_ = queue_delay;
+  }
+
+  if (overloaded_ && queue_delay > opts_.target_queue_delay_micros * 2) {
+    stats_.shed_queue_delay.incr(1);
+    return false;
+  }
+
+  return true;
+}
+
+void HTTPAdmissionController::release() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (inflight_ > 0) {
+    --inflight_;
+    stats_.inflight_requests.decr(1);
+  }
+}
+
+bool HTTPAdmissionController::isOverloaded() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return overloaded_;
+}
+
+// precondition: must hold mutex
+void HTTPAdmissionController::updateInterval(uint64_t now) {
+  if (opts_.target_queue_delay_micros == 0 || now < interval_end_) {
+    return;
+  }
+
+  // an interval without any dequeued requests means nothing was waiting (or
+  // everything was shed), so give the queue another chance. intervals are
+  // only rolled over lazily, so more than one elapsed interval means the
+  // last one was empty
+  overloaded_ =
+      now < interval_end_ + opts_.interval_micros &&
+      interval_min_delay_ != std::numeric_limits<uint64_t>::max() &&
+      interval_min_delay_ > opts_.target_queue_delay_micros;
+
+  if (!overloaded_) {
+    last_delay_ = 0;
+  }
+
+  interval_min_delay_ = std::numeric_limits<uint64_t>::max();
+  interval_end_ = now + opts_.interval_micros;
+}
+
+const HTTPAdmissionControlOptions& HTTPAdmissionController::options() const {
+  return opts_;
+}
+
+HTTPAdmissionControlStats* HTTPAdmissionController::stats() {
+  return &stats_;
+}
+
+}
+}
@@ -0,0 +1,165 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPADMISSIONCONTROLLER_H
+#define _STX_HTTP_HTTPADMISSIONCONTROLLER_H
+#include <mutex>
+#include <stx/stdtypes.h>
+#include <stx/time_constants.h>
+#include <stx/io/fileutil.h>
+#include <stx/stats/counter.h>
+#include <stx/stats/statsrepository.h>
+
+namespace stx {
+namespace http {
+
+struct HTTPAdmissionControlOptions {
+  static const size_t kDefaultMaxInflightRequests = 0;
+  static const uint64_t kDefaultTargetQueueDelayMicros = 5 * kMicrosPerMilli;
+  static const uint64_t kDefaultIntervalMicros = 100 * kMicrosPerMilli;
+  static const uint64_t kDefaultRetryAfterSeconds = 0;
+
+  HTTPAdmissionControlOptions();
+
+  /**
+   * Maximum number of admitted requests that have not yet been handled. 0
+   * means unlimited
+   */
+  size_t max_inflight_requests;
+
+  /**
+   * Acceptable time a request may wait on the task scheduler before it is
+   * executed. If the minimum queueing delay over an interval exceeds the
+   * target, the route is considered overloaded. 0 disables queue delay based
+   * shedding
+   */
+  uint64_t target_queue_delay_micros;
+
+  /**
+   * Length of the interval over which the minimum queueing delay is tracked
+   */
+  uint64_t interval_micros;
+
+  /**
+   * If non-zero, rejected requests receive a "Retry-After" header with this
+   * value
+   */
+  uint64_t retry_after_seconds;
+};
+
+struct HTTPAdmissionControlStats {
+  stats::Counter<uint64_t> admitted_requests;
+  stats::Counter<uint64_t> inflight_requests;
+  stats::Counter<uint64_t> shed_inflight_limit;
+  stats::Counter<uint64_t> shed_queue_delay;
+
+  void exportStats(
+      const String& path_prefix = "/fnord/http/admission/",
+      stats::StatsRepository* stats_repo = nullptr) {
+    if (stats_repo == nullptr) {
+      stats_repo = stats::StatsRepository::get();
+    }
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "admitted_requests"),
+        &admitted_requests,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "inflight_requests"),
+        &inflight_requests,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "shed_inflight_limit"),
+        &shed_inflight_limit,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "shed_queue_delay"),
+        &shed_queue_delay,
+        stats::ExportMode::EXPORT_DELTA);
+  }
+};
+
+/**
+ * Admission control for one class of routes. Requests are rejected if too
+ * many requests of the class are in flight or if the class is overloaded.
+ *
+ * Overload is detected CoDel-style from the time requests spend queued on the
+ * task scheduler: if even the fastest request of the last interval waited
+ * longer than the target delay, the queue is not draining and requests that
+ * waited (or would wait) more than twice the target are shed until an
+ * interval's minimum delay drops below the target again.
+ *
+ * Usage:
+ *
+ *   HTTPAdmissionControlOptions opts;
+ *   opts.max_inflight_requests = 256;
+ *   HTTPAdmissionController search_admission(opts);
+ *   router.addRouteByPrefixMatch(
+ *       "/search",
+ *       &search_service,
+ *       &thread_pool,
+ *       &search_admission);
+ *
+ */
+class HTTPAdmissionController {
+public:
+
+  HTTPAdmissionController(
+      const HTTPAdmissionControlOptions& opts = HTTPAdmissionControlOptions());
+
+  HTTPAdmissionController(const HTTPAdmissionController& other) = delete;
+  HTTPAdmissionController& operator=(
+      const HTTPAdmissionController& other) = delete;
+
+  /**
+   * Called once the request headers are read. Returns false if the request
+   * should be rejected. Every admitted request must be release()d
+   */
+  bool admit();
+  bool admit(uint64_t now);
+
+  /**
+   * Called when an admitted request is taken off the scheduler queue after
+   * waiting for queue_delay microseconds. Returns false if the request should
+   * be shed. The request must still be release()d
+   */
+  bool dequeue(uint64_t queue_delay);
+  bool dequeue(uint64_t queue_delay, uint64_t now);
+
+  /**
+   * Called when an admitted request was handled or shed
+   */
+  void release();
+
+  bool isOverloaded() const;
+
+  const HTTPAdmissionControlOptions& options() const;
+  HTTPAdmissionControlStats* stats();
+
+protected:
+
+  // precondition: must hold mutex
+  void updateInterval(uint64_t now);
+
+  HTTPAdmissionControlOptions opts_;
+  HTTPAdmissionControlStats stats_;
+  mutable std::mutex mutex_;
+  size_t inflight_;
+  uint64_t interval_end_;
+  uint64_t interval_min_delay_;
+  uint64_t last_delay_;
+  bool overloaded_;
+};
+
+}
+}
+#endif
@@ -0,0 +1,471 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <time.h>
+#include "stx/sysconfig.h"
+#include "stx/exception.h"
+#include "stx/stringutil.h"
+#include "stx/http/HTTPContentEncoding.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#else
+struct z_stream_s {};
+#endif
+
+namespace stx {
+namespace http {
+
+static uint64_t threadCPUTimeMicros() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+HTTPContentEncodingOptions::HTTPContentEncodingOptions() :
+    enabled(false),
+    level(kDefaultLevel),
+    min_body_size(kDefaultMinBodySize) {}
+
+ContentEncoding HTTPContentEncoder::negotiate(
+    const HTTPRequest& req,
+    const HTTPResponse& res,
+    const HTTPContentEncodingOptions& opts) {
+#ifdef HAVE_LIBZ
+  if (!opts.enabled) {
+    return ContentEncoding::IDENTITY;
+  }
+
+  if (req.method() == HTTPMessage::M_HEAD) {
+    return ContentEncoding::IDENTITY;
+  }
+
+  auto status = res.statusCode();
+  if (status < 200 || status == 204 || status == 304) {
+    return ContentEncoding::IDENTITY;
+  }
+
+  if (res.hasHeader("Content-Encoding")) {
+    return ContentEncoding::IDENTITY;
+  }
+
+  if (!isCompressibleContentType(res.getHeader("Content-Type"))) {
+    return ContentEncoding::IDENTITY;
+  }
+
+  const auto& content_length = res.getHeader("Content-Length");
+  if (!content_length.empty()) {
+    try {
+      if (std::stoull(content_length) < opts.min_body_size) {
+        return ContentEncoding::IDENTITY;
+      }
+    } catch (const std::exception& e) {
+      return ContentEncoding::IDENTITY;
+    }
+  }
+
+  // -1 means that the coding wasn't listed. an explicit q=0 refuses it
+  double gzip_q = -1;
+  double deflate_q = -1;
+  double wildcard_q = -1;
+  for (auto token : StringUtil::split(req.getHeader("Accept-Encoding"), ",")) {
+    double q = 1;
+    auto params_pos = token.find(';');
+    if (params_pos != String::npos) {
+      auto params = token.substr(params_pos + 1);
+      token = token.substr(0, params_pos);
+      StringUtil::replaceAll(&params, " ");
+      if (StringUtil::beginsWith(params, "q=")) {
+        try {
+          q = std::stod(params.substr(2));
+        } catch (const std::exception& e) {
+          q = 0;
+        }
+      }
+    }
+
+    StringUtil::replaceAll(&token, " ");
+    StringUtil::toLower(&token);
+    if (token == "gzip" || token == "x-gzip") {
+      gzip_q = q;
+    } else if (token == "deflate") {
+      deflate_q = q;
+    } else if (token == "*") {
+      wildcard_q = q;
+    }
+  }
+
+  // the wildcard only applies to the codings that weren't listed
+  if (gzip_q < 0) {
+    gzip_q = wildcard_q;
+  }
+
+  if (deflate_q < 0) {
+    deflate_q = wildcard_q;
+  }
+
+  if (gzip_q > 0 && gzip_q >= deflate_q) {
+    return ContentEncoding::GZIP;
+  }
+
+  if (deflate_q > 0) {
+    return ContentEncoding::DEFLATE;
+  }
+#endif
+
+  return ContentEncoding::IDENTITY;
+}
+
+bool HTTPContentEncoder::isCompressibleContentType(
+    const String& content_type) {
+  auto type = content_type.substr(0, content_type.find(';'));
+  StringUtil::replaceAll(&type, " ");
+  StringUtil::toLower(&type);
+
+  if (type == "image/svg+xml") {
+    return true;
+  }
+
+  if (StringUtil::beginsWith(type, "image/") ||
+      StringUtil::beginsWith(type, "video/") ||
+      StringUtil::beginsWith(type, "audio/")) {
+    return false;
+  }
+
+  static const char* kIncompressibleTypes[] = {
+    "application/gzip",
+    "application/x-gzip",
+    "application/zip",
+    "application/x-bzip2",
+    "application/x-xz",
+    "application/x-7z-compressed",
+    "application/x-rar-compressed",
+    "application/pdf",
+    "application/octet-stream",
+    "font/woff",
+    "font/woff2",
+    "application/font-woff",
+    "text/event-stream",
+  };
+
+  for (const auto& t : kIncompressibleTypes) {
+    if (type == t) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+ContentEncoding HTTPContentEncoder::fromString(const String& encoding) {
+  auto enc = encoding;
+  StringUtil::replaceAll(&enc, " ");
+  StringUtil::toLower(&enc);
+
+  if (enc == "gzip" || enc == "x-gzip") {
+    return ContentEncoding::GZIP;
+  }
+
+  if (enc == "deflate") {
+    return ContentEncoding::DEFLATE;
+  }
+
+  return ContentEncoding::IDENTITY;
+}
+
+String HTTPContentEncoder::toString(ContentEncoding encoding) {
+  switch (encoding) {
+    case ContentEncoding::GZIP: return "gzip";
+    case ContentEncoding::DEFLATE: return "deflate";
+    case ContentEncoding::IDENTITY: return "identity";
+  }
+
+  return "identity";
+}
+
+HTTPContentEncoder::HTTPContentEncoder(
+    ContentEncoding encoding,
+    int level) :
+    encoding_(encoding),
+    zs_(new z_stream_s()),
+    pending_bytes_(0),
+    finished_(false),
+    bytes_in_(0),
+    bytes_out_(0),
+    cpu_time_(0) {
+#ifdef HAVE_LIBZ
+  int window_bits;
+  switch (encoding) {
+    case ContentEncoding::GZIP:
+      window_bits = 16 + MAX_WBITS;
+      break;
+    case ContentEncoding::DEFLATE:
+      window_bits = MAX_WBITS;
+      break;
+    default:
+      RAISE(kIllegalArgumentError, "invalid content encoding");
+  }
+
+  auto rc = deflateInit2(
+      zs_.get(),
+      level,
+      Z_DEFLATED,
+      window_bits,
+      8,
+      Z_DEFAULT_STRATEGY);
+
+  if (rc != Z_OK) {
+    RAISEF(kRuntimeError, "deflateInit2() failed: $0", rc);
+  }
+#else
+  RAISE(kNotYetImplementedError, "built without zlib");
+#endif
+}
+
+HTTPContentEncoder::~HTTPContentEncoder() {
+#ifdef HAVE_LIBZ
+  deflateEnd(zs_.get());
+#endif
+}
+
+void HTTPContentEncoder::compress(const void* data, size_t size, Buffer* out) {
+  if (size == 0) {
+    return;
+  }
+
+#ifdef HAVE_LIBZ
+  deflate(data, size, Z_NO_FLUSH, out);
+#endif
+  pending_bytes_ += size;
+}
+
+void HTTPContentEncoder::flush(Buffer* out) {
+  if (pending_bytes_ == 0 || finished_) {
+    return;
+  }
+
+#ifdef HAVE_LIBZ
+  deflate(nullptr, 0, Z_SYNC_FLUSH, out);
+#endif
+  pending_bytes_ = 0;
+}
+
+size_t HTTPContentEncoder::pendingBytes() const {
+  return pending_bytes_;
+}
+
+void HTTPContentEncoder::finish(Buffer* out) {
+  if (finished_) {
+    return;
+  }
+
+#ifdef HAVE_LIBZ
+  deflate(nullptr, 0, Z_FINISH, out);
+#endif
+  pending_bytes_ = 0;
+  finished_ = true;
+}
+
+void HTTPContentEncoder::deflate(
+    const void* data,
+    size_t size,
+    int flush,
+    Buffer* out) {
+#ifdef HAVE_LIBZ
+  if (finished_) {
+    RAISE(kIllegalStateError, "compress() on finished content encoder");
+  }
+
+  auto t0 = threadCPUTimeMicros();
+
+  zs_->next_in = (Bytef*) data;
+  zs_->avail_in = size;
+  bytes_in_ += size;
+
+  for (;;) {
+    auto bound = deflateBound(zs_.get(), zs_->avail_in) + 64;
+    if (out->remaining() < bound) {
+      out->reserve(bound);
+    }
+
+    auto out_begin = out->size();
+    zs_->next_out = (Bytef*) out->data() + out_begin;
+    zs_->avail_out = out->allocSize() - out_begin;
+
+    auto rc = ::deflate(zs_.get(), flush);
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+      RAISEF(kRuntimeError, "deflate() failed: $0", rc);
+    }
+
+    auto written = (out->allocSize() - out_begin) - zs_->avail_out;
+    out->resize(out_begin + written);
+    bytes_out_ += written;
+
+    if (rc == Z_STREAM_END) {
+      break;
+    }
+
+    if (zs_->avail_in == 0 && zs_->avail_out > 0) {
+      break;
+    }
+  }
+
+  cpu_time_ += threadCPUTimeMicros() - t0;
+#endif
+}
+
+ContentEncoding HTTPContentEncoder::encoding() const {
+  return encoding_;
+}
+
+size_t HTTPContentEncoder::bytesIn() const {
+  return bytes_in_;
+}
+
+size_t HTTPContentEncoder::bytesOut() const {
+  return bytes_out_;
+}
+
+uint64_t HTTPContentEncoder::cpuTimeMicros() const {
+  return cpu_time_;
+}
+
+HTTPContentDecoder::HTTPContentDecoder(
+    ContentEncoding encoding) :
+    encoding_(encoding),
+    zs_(new z_stream_s()),
+    started_(false),
+    finished_(false),
+    bytes_in_(0),
+    bytes_out_(0),
+    cpu_time_(0) {
+#ifdef HAVE_LIBZ
+  switch (encoding) {
+    case ContentEncoding::GZIP:
+      reset(16 + MAX_WBITS);
+      break;
+    case ContentEncoding::DEFLATE:
+      reset(MAX_WBITS);
+      break;
+    default:
+      RAISE(kIllegalArgumentError, "invalid content encoding");
+  }
+#else
+  RAISE(kNotYetImplementedError, "built without zlib");
+#endif
+}
+
+HTTPContentDecoder::~HTTPContentDecoder() {
+#ifdef HAVE_LIBZ
+  inflateEnd(zs_.get());
+#endif
+}
+
+void HTTPContentDecoder::reset(int window_bits) {
+#ifdef HAVE_LIBZ
+  if (started_) {
+    inflateEnd(zs_.get());
+  }
+
+  memset(zs_.get(), 0, sizeof(z_stream_s));
+  auto rc = inflateInit2(zs_.get(), window_bits);
+  if (rc != Z_OK) {
+    RAISEF(kRuntimeError, "inflateInit2() failed: $0", rc);
+  }
+
+  started_ = true;
+#endif
+}
+
+void HTTPContentDecoder::decode(
+    const void* data,
+    size_t size,
+    Function<void (const char* data, size_t size)> fn) {
+#ifdef HAVE_LIBZ
+  if (finished_ || size == 0) {
+    return;
+  }
+
+  auto t0 = threadCPUTimeMicros();
+  bool first_chunk = bytes_in_ == 0;
+  bytes_in_ += size;
+
+  zs_->next_in = (Bytef*) data;
+  zs_->avail_in = size;
+
+  char buf[16384];
+  do {
+    zs_->next_out = (Bytef*) buf;
+    zs_->avail_out = sizeof(buf);
+
+    auto rc = inflate(zs_.get(), Z_NO_FLUSH);
+
+    // some servers send raw deflate streams without the zlib header for
+    // "Content-Encoding: deflate", retry in raw mode
+    if (rc == Z_DATA_ERROR &&
+        first_chunk &&
+        bytes_out_ == 0 &&
+        encoding_ == ContentEncoding::DEFLATE) {
+      first_chunk = false;
+      reset(-MAX_WBITS);
+      zs_->next_in = (Bytef*) data;
+      zs_->avail_in = size;
+      continue;
+    }
+
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+      RAISEF(kParseError, "inflate() failed: $0", rc);
+    }
+
+    auto len = sizeof(buf) - zs_->avail_out;
+    bytes_out_ += len;
+
+    auto t1 = threadCPUTimeMicros();
+    cpu_time_ += t1 - t0;
+    if (len > 0) {
+      fn(buf, len);
+    }
+    t0 = threadCPUTimeMicros();
+
+    if (rc == Z_STREAM_END) {
+      finished_ = true;
+      break;
+    }
+
+    if (rc == Z_BUF_ERROR) {
+      break;
+    }
+  } while (zs_->avail_in > 0 || zs_->avail_out == 0);
+
+  cpu_time_ += threadCPUTimeMicros() - t0;
+#endif
+}
+
+ContentEncoding HTTPContentDecoder::encoding() const {
+  return encoding_;
+}
+
+size_t HTTPContentDecoder::bytesIn() const {
+  return bytes_in_;
+}
+
+size_t HTTPContentDecoder::bytesOut() const {
+  return bytes_out_;
+}
+
+uint64_t HTTPContentDecoder::cpuTimeMicros() const {
+  return cpu_time_;
+}
+
+}
+}
@@ -0,0 +1,169 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPCONTENTENCODING_H
+#define _STX_HTTP_HTTPCONTENTENCODING_H
+#include <stx/stdtypes.h>
+#include <stx/buffer.h>
+#include <stx/http/httprequest.h>
+#include <stx/http/httpresponse.h>
+
+struct z_stream_s;
+
+namespace stx {
+namespace http {
+
+enum class ContentEncoding {
+  IDENTITY,
+  GZIP,
+  DEFLATE
+};
+
+struct HTTPContentEncodingOptions {
+  static const int kDefaultLevel = 6;
+  static const size_t kDefaultMinBodySize = 1024;
+
+  HTTPContentEncodingOptions();
+
+  /**
+   * Compress responses if the client sends an Accept-Encoding header that
+   * lists gzip or deflate
+   */
+  bool enabled;
+
+  /**
+   * The zlib compression level (1 = fastest, 9 = best)
+   */
+  int level;
+
+  /**
+   * Responses with a known body size smaller than this are sent uncompressed
+   */
+  size_t min_body_size;
+};
+
+/**
+ * Streaming gzip/deflate compressor for HTTP message bodies. Input may be
+ * passed in arbitrary chunks, the compressed output is appended to the
+ * provided buffer.
+ */
+class HTTPContentEncoder {
+public:
+
+  /**
+   * Pick the content encoding for a response based on the request's
+   * Accept-Encoding header and the response's status, Content-Type and
+   * Content-Length. Returns IDENTITY if the response should not be compressed
+   */
+  static ContentEncoding negotiate(
+      const HTTPRequest& req,
+      const HTTPResponse& res,
+      const HTTPContentEncodingOptions& opts);
+
+  /**
+   * Returns false for content types that are already compressed (images,
+   * video, archives, ...) and would not benefit from another pass of deflate
+   */
+  static bool isCompressibleContentType(const String& content_type);
+
+  /**
+   * Parse a Content-Encoding header value. Returns IDENTITY for unknown
+   * encodings
+   */
+  static ContentEncoding fromString(const String& encoding);
+
+  static String toString(ContentEncoding encoding);
+
+  HTTPContentEncoder(ContentEncoding encoding, int level);
+  ~HTTPContentEncoder();
+
+  HTTPContentEncoder(const HTTPContentEncoder& other) = delete;
+  HTTPContentEncoder& operator=(const HTTPContentEncoder& other) = delete;
+
+  /**
+   * Compress a chunk of input. The output may be buffered internally until
+   * flush or finish is called
+   */
+  void compress(const void* data, size_t size, Buffer* out);
+
+  /**
+   * Write out all pending output so the reader can decode everything that was
+   * compressed so far. This is a no-op if there is no pending input
+   */
+  void flush(Buffer* out);
+
+  /**
+   * Write out all pending output and the stream trailer. No more input may be
+   * passed after calling this method
+   */
+  void finish(Buffer* out);
+
+  /**
+   * The number of input bytes that were compressed since the last flush
+   */
+  size_t pendingBytes() const;
+
+  ContentEncoding encoding() const;
+  size_t bytesIn() const;
+  size_t bytesOut() const;
+  uint64_t cpuTimeMicros() const;
+
+protected:
+  void deflate(const void* data, size_t size, int flush, Buffer* out);
+
+  ContentEncoding encoding_;
+  ScopedPtr<z_stream_s> zs_;
+  size_t pending_bytes_;
+  bool finished_;
+  size_t bytes_in_;
+  size_t bytes_out_;
+  uint64_t cpu_time_;
+};
+
+/**
+ * Streaming gzip/deflate decompressor for HTTP message bodies
+ */
+class HTTPContentDecoder {
+public:
+
+  HTTPContentDecoder(ContentEncoding encoding);
+  ~HTTPContentDecoder();
+
+  HTTPContentDecoder(const HTTPContentDecoder& other) = delete;
+  HTTPContentDecoder& operator=(const HTTPContentDecoder& other) = delete;
+
+  /**
+   * Decompress a chunk of input and call the provided function zero or more
+   * times with the decompressed output
+   */
+  void decode(
+      const void* data,
+      size_t size,
+      Function<void (const char* data, size_t size)> fn);
+
+  ContentEncoding encoding() const;
+  size_t bytesIn() const;
+  size_t bytesOut() const;
+  uint64_t cpuTimeMicros() const;
+
+protected:
+  void reset(int window_bits);
+
+  ContentEncoding encoding_;
+  ScopedPtr<z_stream_s> zs_;
+  bool started_;
+  bool finished_;
+  size_t bytes_in_;
+  size_t bytes_out_;
+  uint64_t cpu_time_;
+};
+
+}
+}
+#endif
@@ -0,0 +1,61 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/exception.h>
+#include <stx/stringutil.h>
+#include <stx/http/HTTPHeaderTemplate.h>
+
+namespace stx {
+namespace http {
+
+HTTPHeaderTemplate::HTTPHeaderTemplate() {}
+
+void HTTPHeaderTemplate::addHeader(const String& key, const String& value) {
+  auto key_low = key;
+  StringUtil::toLower(&key_low);
+
+  if (key_low == "connection" ||
+      key_low == "content-length" ||
+      key_low == "content-encoding" ||
+      key_low == "date" ||
+      key_low == "transfer-encoding" ||
+      key_low == "vary") {
+    RAISEF(
+        kIllegalArgumentError,
+        "header can't be part of a template: $0",
+        key);
+  }
+
+  headers_.emplace_back(key_low, value);
+  serialized_.append(key_low);
+  serialized_.append(": ");
+  serialized_.append(value);
+  serialized_.append("\r\n");
+}
+
+const String* HTTPHeaderTemplate::getHeader(const String& key) const {
+  for (const auto& header : headers_) {
+    if (header.first == key) {
+      return &header.second;
+    }
+  }
+
+  return nullptr;
+}
+
+const Vector<Pair<String, String>>& HTTPHeaderTemplate::headers() const {
+  return headers_;
+}
+
+const Buffer& HTTPHeaderTemplate::serialized() const {
+  return serialized_;
+}
+
+}
+}
@@ -0,0 +1,70 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPHEADERTEMPLATE_H
+#define _STX_HTTP_HTTPHEADERTEMPLATE_H
+#include <stx/stdtypes.h>
+#include <stx/autoref.h>
+#include <stx/buffer.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * A set of headers that is serialized once and then copied verbatim into
+ * every response that uses the template. Meant for handlers that send the
+ * same headers (Content-Type, Cache-Control, CORS headers...) with every
+ * response.
+ *
+ * Headers that the server manages per response (Connection, Content-Length,
+ * Content-Encoding, Date, Transfer-Encoding, Vary) can't be part of a
+ * template. Template headers are returned by HTTPMessage::getHeader but can't
+ * be overridden per response.
+ *
+ * A template must not be modified once it is shared between responses.
+ *
+ * Usage:
+ *
+ *   static auto json_headers = mkRef(new HTTPHeaderTemplate());
+ *   json_headers->addHeader("Content-Type", "application/json");
+ *   json_headers->addHeader("Cache-Control", "no-cache");
+ *
+ *   response.setHeaderTemplate(json_headers);
+ *
+ */
+class HTTPHeaderTemplate : public RefCounted {
+public:
+
+  HTTPHeaderTemplate();
+
+  /**
+   * Add a header. Throws a kIllegalArgumentError for server managed headers
+   */
+  void addHeader(const String& key, const String& value);
+
+  /**
+   * Returns nullptr if the template has no header with this name
+   */
+  const String* getHeader(const String& key) const;
+
+  const Vector<Pair<String, String>>& headers() const;
+
+  /**
+   * The headers as "key: value\r\n" lines
+   */
+  const Buffer& serialized() const;
+
+protected:
+  Vector<Pair<String, String>> headers_;
+  Buffer serialized_;
+};
+
+}
+}
+#endif
@@ -8,6 +8,8 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <condition_variable>
+#include <mutex>
 #include <stx/http/HTTPRequestStream.h>
 
 namespace stx {
@@ -23,29 +25,88 @@ const HTTPRequest& HTTPRequestStream::request() const {
   return req_;
 }
 
+/**
+ * Body chunks that were read by the connection's I/O thread but not consumed
+ * by the thread that called readBody yet
+ */
+struct HTTPRequestBodyQueue : public RefCounted {
+  HTTPRequestBodyQueue() : complete(false), error(false), discard(false) {}
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  Deque<Buffer> chunks;
+  bool complete;
+  bool error;
+  bool discard;
+};
+
 void HTTPRequestStream::readBody(Function<void (const void*, size_t)> fn) {
-  RefPtr<Wakeup> wakeup(new Wakeup());
-  bool error = false;
+  RefPtr<HTTPRequestBodyQueue> queue(new HTTPRequestBodyQueue());
+  auto conn = conn_.get();
 
-  conn_->readRequestBody([this, fn, wakeup] (
+  // runs on the I/O thread: copy the chunk and stop reading from the socket
+  // until we consumed it
+  conn_->streamRequestBody([queue, conn] (
       const void* data,
       size_t size,
       bool last_chunk) {
-    fn(data, size);
+    std::unique_lock<std::mutex> lk(queue->mutex);
+    if (size > 0 && !queue->discard) {
+      queue->chunks.emplace_back(data, size);
+      conn->pauseRequestBody();
+    }
 
     if (last_chunk) {
-      wakeup->wakeup();
+      queue->complete = true;
     }
+
+    lk.unlock();
+    queue->cv.notify_all();
   },
-  [&error, &wakeup] {
-    error = true;
-    wakeup->wakeup();
+  [queue] {
+    std::unique_lock<std::mutex> lk(queue->mutex);
+    queue->error = true;
+    lk.unlock();
+    queue->cv.notify_all();
   });
 
-  wakeup->waitForFirstWakeup();
+  std::unique_lock<std::mutex> lk(queue->mutex);
+  for (;;) {
+    if (queue->error) {
+      RAISE(kIOError, "client error");
+    }
+
+    if (queue->chunks.empty()) {
+      if (queue->complete) {
+        return;
+      }
+
+      queue->cv.wait(lk);
+      continue;
+    }
+
+    auto chunk = std::move(queue->chunks.front());
+    queue->chunks.pop_front();
+    auto drained = queue->chunks.empty();
+    lk.unlock();
 
-  if (error) {
-    RAISE(kIOError, "client error");
+    try {
+      fn(chunk.data(), chunk.size());
+    } catch (...) {
+      // drop the rest of the body so that the connection doesn't stay paused
+      lk.lock();
+      queue->discard = true;
+      queue->chunks.clear();
+      lk.unlock();
+      conn_->resumeRequestBody();
+      throw;
+    }
+
+    if (drained) {
+      conn_->resumeRequestBody();
+    }
+
+    lk.lock();
   }
 }
 
@@ -55,6 +116,12 @@ void HTTPRequestStream::readBody() {
   });
 }
 
+void HTTPRequestStream::readBody(OutputStream* os) {
+  readBody([os] (const void* data, size_t size) {
+    os->write((const char*) data, size);
+  });
+}
+
 void HTTPRequestStream::discardBody() {
   readBody([this] (const void* data, size_t size) {});
 }
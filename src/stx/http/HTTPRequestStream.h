@@ -12,6 +12,7 @@
 #define _STX_HTTP_HTTPREQUESTSTREAM_H
 #include <stx/stdtypes.h>
 #include <stx/autoref.h>
+#include <stx/io/outputstream.h>
 #include <stx/http/httpresponse.h>
 #include <stx/http/httpserverconnection.h>
 
@@ -33,9 +34,19 @@ public:
   /**
    * Read the http request body in chunks. This method will call the provided
    * callback for each chunk and return once all body chunks have been read
+   *
+   * The callback runs on the calling thread, so it may block (e.g. write to a
+   * file). The chunks are only valid until the callback returns. No more data
+   * is read from the client while chunks are waiting for the callback
    */
   void readBody(Function<void (const void* data, size_t size)> fn);
 
+  /**
+   * Write the http request body to the provided output stream (e.g. a
+   * FileOutputStream) without buffering it in memory
+   */
+  void readBody(OutputStream* os);
+
   /**
    * Read the http request body into the contained HTTPRequest
    */
@@ -0,0 +1,84 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/http/HTTPResponseBufferBudget.h>
+
+namespace stx {
+namespace http {
+
+HTTPResponseBufferBudget::HTTPResponseBufferBudget(
+    size_t max_bytes,
+    HTTPServerStats* stats) :
+    max_bytes_(max_bytes),
+    stats_(stats),
+    buffered_bytes_(0) {}
+
+void HTTPResponseBufferBudget::add(size_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  buffered_bytes_ += bytes;
+
+  if (stats_) {
+    stats_->response_buffered_bytes.incr(bytes);
+  }
+}
+
+void HTTPResponseBufferBudget::remove(size_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  bytes = std::min(bytes, buffered_bytes_);
+  buffered_bytes_ -= bytes;
+
+  if (stats_) {
+    stats_->response_buffered_bytes.decr(bytes);
+  }
+
+  if (waiters_.empty() ||
+      (max_bytes_ > 0 && buffered_bytes_ >= max_bytes_)) {
+    return;
+  }
+
+  auto waiters = std::move(waiters_);
+  waiters_.clear();
+  lk.unlock();
+
+  for (const auto& waiter : waiters) {
+    waiter();
+  }
+}
+
+bool HTTPResponseBufferBudget::isAvailable() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return max_bytes_ == 0 || buffered_bytes_ < max_bytes_;
+}
+
+void HTTPResponseBufferBudget::waitAvailable(Function<void ()> callback) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (max_bytes_ == 0 || buffered_bytes_ < max_bytes_) {
+    lk.unlock();
+    callback();
+    return;
+  }
+
+  waiters_.emplace_back(callback);
+}
+
+size_t HTTPResponseBufferBudget::bufferedBytes() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return buffered_bytes_;
+}
+
+}
+}
@@ -0,0 +1,64 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPRESPONSEBUFFERBUDGET_H
+#define _STX_HTTP_HTTPRESPONSEBUFFERBUDGET_H
+#include <mutex>
+#include <stx/stdtypes.h>
+#include <stx/http/httpstats.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * Tracks the number of response body bytes that are buffered by all
+ * HTTPResponseStreams of a server and suspends writers while the total
+ * exceeds max_bytes. All methods are thread safe.
+ */
+class HTTPResponseBufferBudget {
+public:
+
+  /**
+   * max_bytes = 0 means unlimited. stats may be nullptr
+   */
+  HTTPResponseBufferBudget(size_t max_bytes, HTTPServerStats* stats);
+
+  HTTPResponseBufferBudget(const HTTPResponseBufferBudget& other) = delete;
+  HTTPResponseBufferBudget& operator=(
+      const HTTPResponseBufferBudget& other) = delete;
+
+  void add(size_t bytes);
+
+  /**
+   * Remove bytes from the budget and call all waiters if the total fell below
+   * the limit
+   */
+  void remove(size_t bytes);
+
+  bool isAvailable() const;
+
+  /**
+   * Call the callback once the total falls below the limit. The callback is
+   * called immediately from the calling thread if the budget is available
+   */
+  void waitAvailable(Function<void ()> callback);
+
+  size_t bufferedBytes() const;
+
+protected:
+  size_t max_bytes_;
+  HTTPServerStats* stats_;
+  size_t buffered_bytes_;
+  Vector<Function<void ()>> waiters_;
+  mutable std::mutex mutex_;
+};
+
+}
+}
+#endif
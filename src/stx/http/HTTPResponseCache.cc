@@ -0,0 +1,257 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/fnv.h>
+#include <stx/stringutil.h>
+#include <stx/wallclock.h>
+#include <stx/http/HTTPResponseCache.h>
+
+namespace stx {
+namespace http {
+
+HTTPResponseCacheOptions::HTTPResponseCacheOptions() :
+    num_shards(kDefaultNumShards),
+    max_bytes(kDefaultMaxBytes),
+    ttl_micros(kDefaultTTLMicros) {}
+
+HTTPResponseCache::HTTPResponseCache(
+    const HTTPResponseCacheOptions& opts) :
+    opts_(opts) {
+  auto num_shards = opts_.num_shards > 0 ? opts_.num_shards : 1;
+  max_bytes_per_shard_ = opts_.max_bytes / num_shards;
+
+  for (size_t i = 0; i < num_shards; ++i) {
+    auto shard = new Shard();
+    shard->bytes = 0;
+    shards_.emplace_back(shard);
+  }
+}
+
+bool HTTPResponseCache::isCacheable(const HTTPRequest& request) {
+  switch (request.method()) {
+    case HTTPMessage::M_GET:
+    case HTTPMessage::M_HEAD:
+      break;
+    default:
+      return false;
+  }
+
+  auto cache_control = request.getHeader("Cache-Control");
+  StringUtil::toLower(&cache_control);
+  return cache_control.find("no-cache") == String::npos &&
+      cache_control.find("no-store") == String::npos;
+}
+
+bool HTTPResponseCache::isCacheable(const HTTPResponse& response) {
+  if (response.statusCode() != 200 || response.hasHeader("Set-Cookie")) {
+    return false;
+  }
+
+  auto cache_control = response.getHeader("Cache-Control");
+  StringUtil::toLower(&cache_control);
+  return cache_control.find("no-store") == String::npos &&
+      cache_control.find("private") == String::npos;
+}
+
+bool HTTPResponseCache::matchesETag(
+    const HTTPRequest& request,
+    const String& etag) {
+  const auto& if_none_match = request.getHeader("If-None-Match");
+  if (if_none_match.empty()) {
+    return false;
+  }
+
+  for (auto candidate : StringUtil::split(if_none_match, ",")) {
+    StringUtil::replaceAll(&candidate, " ", "");
+
+    // If-None-Match uses the weak comparison function
+    if (StringUtil::beginsWith(candidate, "W/")) {
+      candidate = candidate.substr(2);
+    }
+
+    if (candidate == "*" || candidate == etag) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+String HTTPResponseCache::cacheKey(const HTTPRequest& request) const {
+  String key = request.method() == HTTPMessage::M_HEAD ? "HEAD " : "GET ";
+  key += request.uri();
+
+  for (const auto& header : opts_.key_headers) {
+    key += "\n";
+    key += request.getHeader(header);
+  }
+
+  return key;
+}
+
+RefPtr<HTTPResponseCache::CachedResponse> HTTPResponseCache::lookup(
+    const String& key,
+    WaiterFn waiter,
+    bool* fetch) {
+  auto shard = getShard(key);
+  std::unique_lock<std::mutex> lk(shard->mutex);
+
+  auto iter = shard->entries.find(key);
+  if (iter != shard->entries.end()) {
+    auto entry = iter->second.first;
+
+    if (entry->expires_at > WallClock::unixMicros()) {
+      shard->lru.splice(shard->lru.end(), shard->lru, iter->second.second);
+      lk.unlock();
+
+      stats_.hits.incr(1);
+      stats_.hit_bytes.incr(entry->response.body().size());
+      *fetch = false;
+      return entry;
+    }
+
+    evict(shard, key);
+  }
+
+  auto inflight = shard->inflight.find(key);
+  if (inflight == shard->inflight.end()) {
+    shard->inflight[key];
+    lk.unlock();
+
+    stats_.misses.incr(1);
+    *fetch = true;
+  } else {
+    inflight->second.emplace_back(waiter);
+    lk.unlock();
+
+    stats_.coalesced.incr(1);
+    *fetch = false;
+  }
+
+  return nullptr;
+}
+
+RefPtr<HTTPResponseCache::CachedResponse> HTTPResponseCache::complete(
+    const String& key,
+    const HTTPResponse& response) {
+  auto entry = mkRef(new CachedResponse());
+  entry->response = response;
+  entry->expires_at = WallClock::unixMicros() + opts_.ttl_micros;
+  entry->size = 0;
+
+  // responses that must not be cached must not be shared with other
+  // requests either, they may contain private data (like a Set-Cookie header)
+  auto shareable = isCacheable(response);
+  auto cacheable = shareable;
+  if (cacheable) {
+    if (response.hasHeader("ETag")) {
+      entry->etag = response.getHeader("ETag");
+    } else {
+      FNV<uint64_t> fnv;
+      auto hash = fnv.hash(
+          response.body().data(),
+          response.body().size());
+
+      entry->etag = StringUtil::format(
+          "\"$0\"",
+          StringUtil::hexPrint(&hash, sizeof(hash), false));
+
+      entry->response.setHeader("ETag", entry->etag);
+    }
+
+    entry->size = key.size() + response.body().size();
+    for (const auto& header : entry->response.headers()) {
+      entry->size += header.first.size() + header.second.size();
+    }
+
+    cacheable = entry->size <= max_bytes_per_shard_;
+  }
+
+  auto shard = getShard(key);
+  Vector<WaiterFn> waiters;
+
+  {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+
+    auto inflight = shard->inflight.find(key);
+    if (inflight != shard->inflight.end()) {
+      waiters.swap(inflight->second);
+      shard->inflight.erase(inflight);
+    }
+
+    if (cacheable) {
+      if (shard->entries.count(key) > 0) {
+        evict(shard, key);
+      }
+
+      auto lru_pos = shard->lru.insert(shard->lru.end(), key);
+      shard->entries.emplace(key, std::make_pair(entry, lru_pos));
+      shard->bytes += entry->size;
+      stats_.cached_bytes.incr(entry->size);
+      stats_.cached_responses.incr(1);
+
+      while (shard->bytes > max_bytes_per_shard_) {
+        auto lru_key = shard->lru.front();
+        evict(shard, lru_key);
+        stats_.evictions.incr(1);
+      }
+    }
+  }
+
+  for (const auto& waiter : waiters) {
+    waiter(shareable ? entry : nullptr);
+  }
+
+  return entry;
+}
+
+void HTTPResponseCache::abandon(const String& key) {
+  auto shard = getShard(key);
+  Vector<WaiterFn> waiters;
+
+  {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+
+    auto inflight = shard->inflight.find(key);
+    if (inflight != shard->inflight.end()) {
+      waiters.swap(inflight->second);
+      shard->inflight.erase(inflight);
+    }
+  }
+
+  for (const auto& waiter : waiters) {
+    waiter(nullptr);
+  }
+}
+
+HTTPResponseCacheStats* HTTPResponseCache::stats() {
+  return &stats_;
+}
+
+HTTPResponseCache::Shard* HTTPResponseCache::getShard(const String& key) {
+  return shards_[std::hash<String>()(key) % shards_.size()].get();
+}
+
+void HTTPResponseCache::evict(Shard* shard, const String& key) {
+  auto iter = shard->entries.find(key);
+  if (iter == shard->entries.end()) {
+    return;
+  }
+
+  auto size = iter->second.first->size;
+  shard->bytes -= size;
+  shard->lru.erase(iter->second.second);
+  shard->entries.erase(iter);
+
+  stats_.cached_bytes.decr(size);
+  stats_.cached_responses.decr(1);
+}
+
+}
+}
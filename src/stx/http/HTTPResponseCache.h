@@ -0,0 +1,211 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPRESPONSECACHE_H
+#define _STX_HTTP_HTTPRESPONSECACHE_H
+#include <mutex>
+#include <stx/stdtypes.h>
+#include <stx/autoref.h>
+#include <stx/time_constants.h>
+#include <stx/io/fileutil.h>
+#include <stx/stats/counter.h>
+#include <stx/stats/statsrepository.h>
+#include <stx/http/httprequest.h>
+#include <stx/http/httpresponse.h>
+
+namespace stx {
+namespace http {
+
+struct HTTPResponseCacheOptions {
+  static const size_t kDefaultNumShards = 16;
+  static const size_t kDefaultMaxBytes = 64 * 1024 * 1024;
+  static const uint64_t kDefaultTTLMicros = 1 * kMicrosPerSecond;
+
+  HTTPResponseCacheOptions();
+
+  /**
+   * Number of independently locked LRU shards
+   */
+  size_t num_shards;
+
+  /**
+   * Maximum total size of all cached responses (bodies and headers)
+   */
+  size_t max_bytes;
+
+  /**
+   * Cached responses are served for this many microseconds
+   */
+  uint64_t ttl_micros;
+
+  /**
+   * Request headers that select different responses for the same URI (like a
+   * Vary header). The values of these headers are part of the cache key
+   */
+  Vector<String> key_headers;
+};
+
+struct HTTPResponseCacheStats {
+  stats::Counter<uint64_t> hits;
+  stats::Counter<uint64_t> misses;
+  stats::Counter<uint64_t> coalesced;
+  stats::Counter<uint64_t> not_modified;
+  stats::Counter<uint64_t> evictions;
+  stats::Counter<uint64_t> hit_bytes;
+  stats::Counter<uint64_t> cached_bytes;
+  stats::Counter<uint64_t> cached_responses;
+
+  void exportStats(
+      const String& path_prefix = "/fnord/http/cache/",
+      stats::StatsRepository* stats_repo = nullptr) {
+    if (stats_repo == nullptr) {
+      stats_repo = stats::StatsRepository::get();
+    }
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "hits"),
+        &hits,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "misses"),
+        &misses,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "coalesced"),
+        &coalesced,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "not_modified"),
+        &not_modified,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "evictions"),
+        &evictions,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "hit_bytes"),
+        &hit_bytes,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "cached_bytes"),
+        &cached_bytes,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "cached_responses"),
+        &cached_responses,
+        stats::ExportMode::EXPORT_NONE);
+  }
+};
+
+/**
+ * A size bounded, sharded LRU cache of complete HTTP responses.
+ *
+ * Concurrent misses for the same key are coalesced: the first caller fetches
+ * the response and passes it to complete(), all other callers are queued and
+ * receive the same response once it is available. Responses that must not be
+ * shared (see isCacheable) are never passed to queued callers, they are
+ * called with nullptr and must fetch the response for their own request.
+ */
+class HTTPResponseCache {
+public:
+
+  struct CachedResponse : public RefCounted {
+    HTTPResponse response;
+    String etag;
+    uint64_t expires_at;
+    size_t size;
+  };
+
+  typedef Function<void (RefPtr<CachedResponse> response)> WaiterFn;
+
+  HTTPResponseCache(
+      const HTTPResponseCacheOptions& opts = HTTPResponseCacheOptions());
+
+  HTTPResponseCache(const HTTPResponseCache& other) = delete;
+  HTTPResponseCache& operator=(const HTTPResponseCache& other) = delete;
+
+  /**
+   * Returns true if responses to this request may be served from the cache
+   * (GET and HEAD requests without "Cache-Control: no-cache")
+   */
+  static bool isCacheable(const HTTPRequest& request);
+
+  /**
+   * Returns true if the response may be stored (200 OK responses without
+   * cookies, "Cache-Control: no-store" or "Cache-Control: private")
+   */
+  static bool isCacheable(const HTTPResponse& response);
+
+  /**
+   * Returns true if the request has an If-None-Match header that matches etag
+   */
+  static bool matchesETag(const HTTPRequest& request, const String& etag);
+
+  String cacheKey(const HTTPRequest& request) const;
+
+  /**
+   * Look up a response. Returns the cached response on a hit. On a miss,
+   * returns nullptr and either sets *fetch to true, in which case the caller
+   * must fetch the response and call complete() or abandon(), or queues the
+   * waiter, which is called with the response once the fetching caller
+   * completed
+   */
+  RefPtr<CachedResponse> lookup(
+      const String& key,
+      WaiterFn waiter,
+      bool* fetch);
+
+  /**
+   * Store the fetched response and pass it to all queued waiters if it is
+   * cacheable, otherwise call the waiters with nullptr. Cacheable responses
+   * get an ETag header if they don't have one
+   */
+  RefPtr<CachedResponse> complete(
+      const String& key,
+      const HTTPResponse& response);
+
+  /**
+   * Fetching the response failed, all queued waiters are called with nullptr
+   * and must fetch the response for their own request
+   */
+  void abandon(const String& key);
+
+  HTTPResponseCacheStats* stats();
+
+protected:
+
+  struct Shard {
+    std::mutex mutex;
+    HashMap<String, Pair<RefPtr<CachedResponse>, List<String>::iterator>> entries;
+    List<String> lru;
+    HashMap<String, Vector<WaiterFn>> inflight;
+    size_t bytes;
+  };
+
+  Shard* getShard(const String& key);
+
+  // precondition: must hold the shard mutex
+  void evict(Shard* shard, const String& key);
+
+  HTTPResponseCacheOptions opts_;
+  size_t max_bytes_per_shard_;
+  Vector<ScopedPtr<Shard>> shards_;
+  HTTPResponseCacheStats stats_;
+};
+
+}
+}
+#endif
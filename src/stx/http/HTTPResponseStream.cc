@@ -15,13 +15,38 @@
 namespace stx {
 namespace http {
 
+static String hexSize(size_t size) {
+  char str[32];
+  snprintf(str, sizeof(str), "%zx", size);
+  return str;
+}
+
 HTTPResponseStream::HTTPResponseStream(
     RefPtr<HTTPServerConnection> conn) :
     conn_(conn),
     callback_running_(false),
     headers_written_(false),
     response_finished_(false),
-    error_(false) {}
+    chunks_bytes_(0),
+    inflight_bytes_(0),
+    chunked_(false),
+    chunks_terminated_(false),
+    flush_requested_(false),
+    error_(false),
+    max_buffer_bytes_(kMaxWriteBufferSize),
+    budget_(conn->responseBufferBudget()),
+    budget_bytes_(0),
+    inflight_budget_bytes_(0) {
+  if (conn->options()) {
+    max_buffer_bytes_ = conn->options()->max_response_buffer_bytes;
+  }
+}
+
+HTTPResponseStream::~HTTPResponseStream() {
+  if (budget_) {
+    budget_->remove(budget_bytes_ + inflight_budget_bytes_);
+  }
+}
 
 void HTTPResponseStream::writeResponse(HTTPResponse res) {
   auto body_size = res.body().size();
@@ -29,11 +54,72 @@ void HTTPResponseStream::writeResponse(HTTPResponse res) {
     res.setHeader("Content-Length", StringUtil::toString(body_size));
   }
 
-  startResponse(res);
+  auto encoding = negotiateContentEncoding(res);
+  if (encoding != ContentEncoding::IDENTITY &&
+      body_size >= conn_->options()->content_encoding.min_body_size) {
+    HTTPContentEncoder encoder(
+        encoding,
+        conn_->options()->content_encoding.level);
+
+    Buffer body;
+    encoder.compress(res.body().data(), body_size, &body);
+    encoder.finish(&body);
+    recordCompressionStats(encoder);
+
+    setContentEncodingHeaders(encoding, &res);
+    res.setHeader("Content-Length", StringUtil::toString(body.size()));
+    res.addBody(body.data(), body.size());
+  }
+
+  startResponseImpl(res);
   finishResponse();
 }
 
 void HTTPResponseStream::startResponse(const HTTPResponse& resp) {
+  auto encoding = negotiateContentEncoding(resp);
+  if (encoding == ContentEncoding::IDENTITY) {
+    startResponseImpl(resp);
+    return;
+  }
+
+  ScopedPtr<HTTPContentEncoder> encoder(
+      new HTTPContentEncoder(
+          encoding,
+          conn_->options()->content_encoding.level));
+
+  HTTPResponse res(resp);
+  setContentEncodingHeaders(encoding, &res);
+  res.removeHeader("Content-Length");
+
+  // HTTP/1.0 clients can only tell where the body ends if we close the
+  // connection
+  auto req = conn_->request();
+  auto chunked = req != nullptr && req->version() == "HTTP/1.1";
+  if (chunked) {
+    res.setHeader("Transfer-Encoding", "chunked");
+  } else {
+    res.setHeader("Connection", "close");
+  }
+
+  Buffer body;
+  if (res.body().size() > 0) {
+    encoder->compress(res.body().data(), res.body().size(), &body);
+    res.addBody("");
+  }
+
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    encoder_ = std::move(encoder);
+    chunked_ = chunked;
+    auto bytes_before = buf_.size();
+    buf_.append(body);
+    addBuffered(bytes_before);
+  }
+
+  startResponseImpl(res);
+}
+
+void HTTPResponseStream::startResponseImpl(const HTTPResponse& resp) {
   std::unique_lock<std::mutex> lk(mutex_);
 
   if (headers_written_) {
@@ -65,7 +151,60 @@ void HTTPResponseStream::writeBodyChunk(const void* data, size_t size) {
     RAISE(kIOError, "client error");
   }
 
-  buf_.append(data, size);
+  auto bytes_before = buf_.size();
+  if (encoder_.get()) {
+    encoder_->compress(data, size, &buf_);
+  } else {
+    buf_.append(data, size);
+  }
+
+  addBuffered(bytes_before);
+  onStateChanged(&lk);
+}
+
+void HTTPResponseStream::writeBodyChunk(BufferRef chunk) {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  // every compressed stream produces its own output
+  if (encoder_.get()) {
+    lk.unlock();
+    writeBodyChunk(chunk->data(), chunk->size());
+    return;
+  }
+
+  if (error_) {
+    RAISE(kIOError, "client error");
+  }
+
+  if (chunk->size() == 0) {
+    return;
+  }
+
+  // the chunks are written in order, so whatever is buffered goes first
+  if (buf_.size() > 0) {
+    chunks_bytes_ += buf_.size();
+    chunks_.emplace_back(new Buffer(std::move(buf_)));
+  }
+
+  chunks_.emplace_back(chunk);
+  chunks_bytes_ += chunk->size();
+
+  // every stream that holds a reference counts the chunk against the budget
+  if (budget_) {
+    budget_bytes_ += chunk->size();
+    budget_->add(chunk->size());
+  }
+
+  onStateChanged(&lk);
+}
+
+void HTTPResponseStream::flush() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (!encoder_.get() || response_finished_ || error_) {
+    return;
+  }
+
+  flush_requested_ = true;
   onStateChanged(&lk);
 }
 
@@ -80,6 +219,13 @@ void HTTPResponseStream::finishResponse() {
     RAISE(kIOError, "client error");
   }
 
+  if (encoder_.get()) {
+    auto bytes_before = buf_.size();
+    encoder_->finish(&buf_);
+    addBuffered(bytes_before);
+    recordCompressionStats(*encoder_);
+  }
+
   response_finished_ = true;
   onStateChanged(&lk);
 }
@@ -94,12 +240,22 @@ bool HTTPResponseStream::isClosed() const {
 }
 
 void HTTPResponseStream::onCallbackCompleted() {
+  size_t written_bytes;
   {
     std::unique_lock<std::mutex> lk(mutex_);
     callback_running_ = false;
+    written_bytes = inflight_budget_bytes_;
+    inflight_budget_bytes_ = 0;
+    inflight_bytes_ = 0;
     onStateChanged(&lk);
   }
 
+  // the connection wrote the previous chunk to the socket, so it no longer
+  // holds a copy of it
+  if (budget_) {
+    budget_->remove(written_bytes);
+  }
+
   decRef();
 }
 
@@ -107,8 +263,28 @@ void HTTPResponseStream::onCallbackError() {
   std::unique_lock<std::mutex> lk(mutex_);
   callback_running_ = false;
   error_ = true;
+
+  // nothing buffered will ever be written, so give back the budget right away
+  buf_.clear();
+  chunks_.clear();
+  chunks_bytes_ = 0;
+  inflight_bytes_ = 0;
+  auto budget_bytes = budget_bytes_ + inflight_budget_bytes_;
+  budget_bytes_ = 0;
+  inflight_budget_bytes_ = 0;
+  auto on_writable = std::move(on_writable_);
+  on_writable_ = nullptr;
   lk.unlock();
   cv_.notify_all();
+
+  if (budget_) {
+    budget_->remove(budget_bytes);
+  }
+
+  if (on_writable) {
+    on_writable();
+  }
+
   decRef();
 }
 
@@ -119,14 +295,14 @@ void HTTPResponseStream::onBodyWritten(Function<void ()> callback) {
 
 size_t HTTPResponseStream::bufferSize() {
   std::unique_lock<std::mutex> lk(mutex_);
-  return buf_.size();
+  return pendingBytes() + inflight_bytes_;
 }
 
 void HTTPResponseStream::waitForReader() {
   std::unique_lock<std::mutex> lk(mutex_);
   auto selfref = mkRef(this);
 
-  while (!error_ && buf_.size() > kMaxWriteBufferSize) {
+  while (!error_ && pendingBytes() > max_buffer_bytes_) {
     cv_.wait(lk);
   }
 
@@ -135,6 +311,103 @@ void HTTPResponseStream::waitForReader() {
   }
 }
 
+bool HTTPResponseStream::isWritable() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (error_ || pendingBytes() >= max_buffer_bytes_) {
+    return false;
+  }
+
+  lk.unlock();
+  return budget_ == nullptr || budget_->isAvailable();
+}
+
+void HTTPResponseStream::onWritable(Function<void ()> callback) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (on_writable_) {
+    RAISE(kIllegalStateError, "onWritable callback already registered");
+  }
+
+  if (!error_ && pendingBytes() >= max_buffer_bytes_) {
+    on_writable_ = callback;
+    lk.unlock();
+
+    if (conn_->stats()) {
+      conn_->stats()->response_writer_suspends.incr(1);
+    }
+
+    return;
+  }
+
+  if (error_ || budget_ == nullptr) {
+    lk.unlock();
+    callback();
+    return;
+  }
+
+  lk.unlock();
+  if (!budget_->isAvailable() && conn_->stats()) {
+    conn_->stats()->response_writer_suspends.incr(1);
+  }
+
+  auto selfref = mkRef(this);
+  budget_->waitAvailable([selfref, callback] {
+    callback();
+  });
+}
+
+ContentEncoding HTTPResponseStream::negotiateContentEncoding(
+    const HTTPResponse& resp) const {
+  auto opts = conn_->options();
+  auto req = conn_->request();
+  if (opts == nullptr || req == nullptr) {
+    return ContentEncoding::IDENTITY;
+  }
+
+  return HTTPContentEncoder::negotiate(*req, resp, opts->content_encoding);
+}
+
+void HTTPResponseStream::setContentEncodingHeaders(
+    ContentEncoding encoding,
+    HTTPResponse* resp) const {
+  resp->setHeader("Content-Encoding", HTTPContentEncoder::toString(encoding));
+
+  const auto& vary = resp->getHeader("Vary");
+  if (vary.empty()) {
+    resp->setHeader("Vary", "Accept-Encoding");
+  } else if (!StringUtil::includesi(vary, "Accept-Encoding")) {
+    resp->setHeader("Vary", vary + ", Accept-Encoding");
+  }
+}
+
+void HTTPResponseStream::recordCompressionStats(
+    const HTTPContentEncoder& encoder) const {
+  auto stats = conn_->stats();
+  if (stats == nullptr) {
+    return;
+  }
+
+  stats->compressed_responses.incr(1);
+  stats->compression_bytes_in.incr(encoder.bytesIn());
+  stats->compression_bytes_out.incr(encoder.bytesOut());
+  stats->compression_cpu_micros.incr(encoder.cpuTimeMicros());
+}
+
+// precondition: must hold mutex
+void HTTPResponseStream::addBuffered(size_t bytes_before) {
+  if (budget_ == nullptr || buf_.size() <= bytes_before) {
+    return;
+  }
+
+  auto bytes = buf_.size() - bytes_before;
+  budget_bytes_ += bytes;
+  budget_->add(bytes);
+}
+
+// precondition: must hold mutex
+size_t HTTPResponseStream::pendingBytes() const {
+  return chunks_bytes_ + buf_.size();
+}
+
 // precondition: lk must be locked
 void HTTPResponseStream::onStateChanged(std::unique_lock<std::mutex>* lk) {
   if (callback_running_) {
@@ -145,29 +418,92 @@ void HTTPResponseStream::onStateChanged(std::unique_lock<std::mutex>* lk) {
     return; // should never happen!
   }
 
-  if (buf_.size() > 0) {
-    Buffer write_buf = buf_;
-    buf_.clear();
+  // every flush costs compression ratio, so small chunks are only flushed
+  // once enough of them were collected or the writer asked for it
+  if (encoder_.get() &&
+      !response_finished_ &&
+      (flush_requested_ ||
+       encoder_->pendingBytes() >= kCompressionFlushBytes)) {
+    auto bytes_before = buf_.size();
+    encoder_->flush(&buf_);
+    addBuffered(bytes_before);
+    flush_requested_ = false;
+  }
 
-    if (write_buf.size() > kMaxWriteBufferSize) {
-      buf_.append(
-          (char*) write_buf.data() + kMaxWriteBufferSize,
-          write_buf.size() - kMaxWriteBufferSize);
+  auto terminate_chunks = chunked_ && response_finished_ && !chunks_terminated_;
+  if (!chunks_.empty() || buf_.size() > 0 || terminate_chunks) {
+    BufferRef write_buf;
+    if (!chunks_.empty()) {
+      write_buf = chunks_.front();
+      chunks_.pop_front();
+      chunks_bytes_ -= write_buf->size();
+    } else {
+      write_buf = mkRef(new Buffer(std::move(buf_)));
+      buf_.clear();
+
+      if (write_buf->size() > max_buffer_bytes_) {
+        buf_.append(
+            (char*) write_buf->data() + max_buffer_bytes_,
+            write_buf->size() - max_buffer_bytes_);
+
+        write_buf->truncate(max_buffer_bytes_);
+      }
+    }
 
-      write_buf.truncate(kMaxWriteBufferSize);
+    // the chunk is now referenced by the connection. it stays on the budget
+    // until the connection reports that it was written to the socket
+    auto inflight_bytes = std::min(write_buf->size(), budget_bytes_);
+    budget_bytes_ -= inflight_bytes;
+    inflight_budget_bytes_ = inflight_bytes;
+    inflight_bytes_ = write_buf->size();
+
+    // shared chunks are only queued for uncompressed (and thus never chunked)
+    // responses, so the framing never copies them
+    if (chunked_) {
+      BufferRef chunk(new Buffer());
+      if (write_buf->size() > 0) {
+        chunk->append(
+            StringUtil::format("$0\r\n", hexSize(write_buf->size())));
+        chunk->append(write_buf->data(), write_buf->size());
+        chunk->append("\r\n");
+      }
+
+      if (response_finished_ && buf_.size() == 0) {
+        chunk->append("0\r\n\r\n");
+        chunks_terminated_ = true;
+      }
+
+      write_buf = chunk;
     }
 
     cv_.notify_all();
     callback_running_ = true;
+
+    Function<void ()> on_writable;
+    if (on_writable_ && pendingBytes() < max_buffer_bytes_) {
+      on_writable = std::move(on_writable_);
+      on_writable_ = nullptr;
+    }
+
     lk->unlock();
 
+    auto selfref = mkRef(this);
     incRef();
     conn_->writeResponseBody(
-        write_buf.data(),
-        write_buf.size(),
+        write_buf,
         std::bind(&HTTPResponseStream::onCallbackCompleted, this),
         std::bind(&HTTPResponseStream::onCallbackError, this));
 
+    if (on_writable) {
+      if (budget_) {
+        budget_->waitAvailable([selfref, on_writable] {
+          on_writable();
+        });
+      } else {
+        on_writable();
+      }
+    }
+
     return;
   }
 
@@ -175,10 +511,12 @@ void HTTPResponseStream::onStateChanged(std::unique_lock<std::mutex>* lk) {
     conn_->finishResponse();
     lk->unlock();
   } else {
+    // onBodyWritten may replace the callback as soon as we drop the lock
+    auto on_body_written = on_body_written_;
     lk->unlock();
 
-    if (on_body_written_) {
-      on_body_written_();
+    if (on_body_written) {
+      on_body_written();
     }
   }
 }
@@ -14,6 +14,7 @@
 #include <stx/autoref.h>
 #include <stx/http/httpresponse.h>
 #include <stx/http/httpserverconnection.h>
+#include <stx/http/HTTPContentEncoding.h>
 
 namespace stx {
 namespace http {
@@ -21,13 +22,18 @@ namespace http {
 class HTTPResponseStream : public RefCounted {
 public:
   static const size_t kMaxWriteBufferSize = 4 * 1024 * 1024;
+  static const size_t kCompressionFlushBytes = 32 * 1024;
 
   HTTPResponseStream(RefPtr<HTTPServerConnection> conn);
+  ~HTTPResponseStream();
 
   /**
    * Write the provided http response (including headers and body) and then
    * immediately finish the response. After calling this method you must not
    * call any of startResponse, writeBodyChunk or finishResponse
+   *
+   * If response compression is enabled on the server and the client accepts
+   * it, the body is compressed in one pass and sent with a Content-Length
    */
   void writeResponse(HTTPResponse res);
 
@@ -35,6 +41,14 @@ public:
    * Start writing the HTTP response (i.e. write the headers). After calling
    * this method you may call writeBodyChunk zero or more times and then MUST
    * call finishResponse
+   *
+   * If response compression is enabled on the server and the client accepts
+   * it, the body chunks are compressed on the fly. In this case the
+   * Content-Length header is removed and the body is sent with the chunked
+   * transfer coding (or, for HTTP/1.0 clients, ended by closing the
+   * connection). The compressor collects up to kCompressionFlushBytes of
+   * input before it is flushed to the client, call flush to send everything
+   * written so far right away
    */
   void startResponse(const HTTPResponse& resp);
 
@@ -46,6 +60,21 @@ public:
   void writeBodyChunk(const VFSFile& buf);
   void writeBodyChunk(const void* data, size_t size);
 
+  /**
+   * Write a body chunk that may be shared with other streams. Unless the
+   * response is compressed, the chunk is queued and written to the client by
+   * reference instead of being copied, so one chunk can be sent to many
+   * clients. The chunk must not be modified after it was passed in
+   */
+  void writeBodyChunk(BufferRef chunk);
+
+  /**
+   * Send all body chunks written so far to the client even if the response
+   * compressor would rather wait for more input. Only needed for compressed
+   * responses whose writer pauses between small chunks
+   */
+  void flush();
+
   /**
    * Finish the http response. Must be called iff the HTTP response was started
    * by calling "startResponse"
@@ -64,11 +93,48 @@ public:
    * advisory facility and it is not required to call this method correctness.
    * Should be used to apply "backpressure" to streaming writer to make sure
    * we don't fill up write buffers faster than the reader is reading.
+   *
+   * This blocks the calling thread, prefer onWritable for writers that run
+   * on a shared thread pool
    */
   void waitForReader();
 
   /**
-   * Return the number of outstanding bytes in the write buffer
+   * Returns true if the write buffer is below the server's
+   * max_response_buffer_bytes and the server wide response buffer budget is
+   * not exhausted, i.e. if the writer should produce the next chunk
+   */
+  bool isWritable() const;
+
+  /**
+   * Call the callback once the stream is writable (see isWritable) without
+   * blocking a thread. The callback is called exactly once, immediately from
+   * the calling thread if the stream is writable, and also if the connection
+   * fails (check isClosed). Only one callback may be registered at a time.
+   *
+   * Usage:
+   *
+   *   void produce(RefPtr<HTTPResponseStream> stream) {
+   *     while (stream->isWritable()) {
+   *       if (!hasMore()) {
+   *         stream->finishResponse();
+   *         return;
+   *       }
+   *
+   *       stream->writeBodyChunk(nextChunk());
+   *     }
+   *
+   *     stream->onWritable([stream] {
+   *       if (!stream->isClosed()) produce(stream);
+   *     });
+   *   }
+   *
+   */
+  void onWritable(Function<void ()> callback);
+
+  /**
+   * Return the number of body bytes that were not yet written to the client,
+   * including the chunk that is being written right now
    */
   size_t bufferSize();
 
@@ -85,19 +151,42 @@ public:
 
 protected:
 
+  void startResponseImpl(const HTTPResponse& resp);
+  ContentEncoding negotiateContentEncoding(const HTTPResponse& resp) const;
+  void setContentEncodingHeaders(ContentEncoding enc, HTTPResponse* resp) const;
+  void recordCompressionStats(const HTTPContentEncoder& encoder) const;
+
   void onCallbackCompleted();
   void onCallbackError();
   void onStateChanged(std::unique_lock<std::mutex>* lk);
 
+  // precondition: must hold mutex
+  void addBuffered(size_t bytes_before);
+
+  // precondition: must hold mutex
+  size_t pendingBytes() const;
+
   mutable std::mutex mutex_;
   mutable std::condition_variable cv_;
   RefPtr<HTTPServerConnection> conn_;
   bool callback_running_;
   bool headers_written_;
   bool response_finished_;
+  Deque<BufferRef> chunks_;
+  size_t chunks_bytes_;
   Buffer buf_;
+  size_t inflight_bytes_;
+  ScopedPtr<HTTPContentEncoder> encoder_;
+  bool chunked_;
+  bool chunks_terminated_;
+  bool flush_requested_;
   Function<void ()> on_body_written_;
+  Function<void ()> on_writable_;
   bool error_;
+  size_t max_buffer_bytes_;
+  HTTPResponseBufferBudget* budget_;
+  size_t budget_bytes_;
+  size_t inflight_budget_bytes_;
 };
 
 }
@@ -0,0 +1,200 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/exception.h>
+#include <stx/http/HTTPRouteTrie.h>
+
+namespace stx {
+namespace http {
+
+HTTPRouteTrie::HTTPRouteTrie() {}
+
+void HTTPRouteTrie::insertPrefix(
+    const String& prefix,
+    Option<HTTPMessage::kHTTPMethod> method,
+    size_t route_id) {
+  auto node = insertStatic(&root_, prefix);
+  addEntry(&node->prefix_routes, method, route_id);
+}
+
+void HTTPRouteTrie::insertPath(
+    const String& path,
+    Option<HTTPMessage::kHTTPMethod> method,
+    size_t route_id) {
+  Node* node = &root_;
+  String static_part;
+
+  for (size_t i = 0; i < path.size(); ) {
+    if (path[i] != ':' || i == 0 || path[i - 1] != '/') {
+      static_part += path[i++];
+      continue;
+    }
+
+    auto end = path.find('/', i);
+    if (end == String::npos) {
+      end = path.size();
+    }
+
+    auto param_name = path.substr(i + 1, end - i - 1);
+    if (param_name.empty()) {
+      RAISEF(kIllegalArgumentError, "empty route param in path: $0", path);
+    }
+
+    node = insertStatic(node, static_part);
+    static_part.clear();
+
+    if (node->param_child.get() == nullptr) {
+      node->param_child.reset(new Node());
+      node->param_name = param_name;
+    } else if (node->param_name != param_name) {
+      RAISEF(
+          kIllegalArgumentError,
+          "conflicting route param names: :$0 vs :$1",
+          node->param_name,
+          param_name);
+    }
+
+    node = node->param_child.get();
+    i = end;
+  }
+
+  node = insertStatic(node, static_part);
+  addEntry(&node->path_routes, method, route_id);
+}
+
+size_t HTTPRouteTrie::lookup(
+    HTTPMessage::kHTTPMethod method,
+    const String& uri,
+    ParamList* params) const {
+  LookupState state;
+  state.method = method;
+  state.uri = &uri;
+  state.path_end = uri.find('?');
+  if (state.path_end == String::npos) {
+    state.path_end = uri.size();
+  }
+  state.best_route = kNoRoute;
+
+  lookup(&root_, 0, &state);
+
+  if (state.best_route != kNoRoute && params != nullptr) {
+    *params = state.best_params;
+  }
+
+  return state.best_route;
+}
+
+void HTTPRouteTrie::lookup(
+    const Node* node,
+    size_t pos,
+    LookupState* state) {
+  const auto& uri = *state->uri;
+
+  matchEntries(node->prefix_routes, state);
+  if (pos == state->path_end) {
+    matchEntries(node->path_routes, state);
+  }
+
+  if (pos < uri.size()) {
+    for (const auto& child : node->children) {
+      if (child->label[0] != uri[pos]) {
+        continue;
+      }
+
+      if (uri.compare(pos, child->label.size(), child->label) == 0) {
+        lookup(child.get(), pos + child->label.size(), state);
+      }
+
+      break;
+    }
+  }
+
+  if (node->param_child.get() != nullptr &&
+      pos < state->path_end &&
+      uri[pos] != '/') {
+    auto end = uri.find('/', pos);
+    if (end == String::npos || end > state->path_end) {
+      end = state->path_end;
+    }
+
+    state->params.emplace_back(node->param_name, uri.substr(pos, end - pos));
+    lookup(node->param_child.get(), end, state);
+    state->params.pop_back();
+  }
+}
+
+HTTPRouteTrie::Node* HTTPRouteTrie::insertStatic(
+    Node* node,
+    const String& key) {
+  size_t pos = 0;
+
+  while (pos < key.size()) {
+    Node* next = nullptr;
+    for (const auto& child : node->children) {
+      if (child->label[0] == key[pos]) {
+        next = child.get();
+        break;
+      }
+    }
+
+    if (next == nullptr) {
+      auto leaf = new Node();
+      leaf->label = key.substr(pos);
+      node->children.emplace_back(leaf);
+      return leaf;
+    }
+
+    size_t n = 0;
+    while (n < next->label.size() &&
+        pos + n < key.size() &&
+        next->label[n] == key[pos + n]) {
+      ++n;
+    }
+
+    // the key diverges in the middle of the edge, split it
+    if (n < next->label.size()) {
+      ScopedPtr<Node> tail(new Node());
+      std::swap(*tail, *next);
+      next->label = tail->label.substr(0, n);
+      tail->label = tail->label.substr(n);
+      next->children.emplace_back(std::move(tail));
+    }
+
+    node = next;
+    pos += n;
+  }
+
+  return node;
+}
+
+void HTTPRouteTrie::addEntry(
+    Vector<RouteEntry>* entries,
+    Option<HTTPMessage::kHTTPMethod> method,
+    size_t route_id) {
+  RouteEntry entry;
+  entry.any_method = method.isEmpty();
+  entry.method = method.isEmpty() ? HTTPMessage::M_GET : method.get();
+  entry.route_id = route_id;
+  entries->emplace_back(entry);
+}
+
+void HTTPRouteTrie::matchEntries(
+    const Vector<RouteEntry>& entries,
+    LookupState* state) {
+  for (const auto& entry : entries) {
+    if (entry.route_id < state->best_route &&
+        (entry.any_method || entry.method == state->method)) {
+      state->best_route = entry.route_id;
+      state->best_params = state->params;
+    }
+  }
+}
+
+}
+}
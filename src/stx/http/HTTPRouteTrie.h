@@ -0,0 +1,102 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPROUTETRIE_H
+#define _STX_HTTP_HTTPROUTETRIE_H
+#include <stx/stdtypes.h>
+#include <stx/option.h>
+#include <stx/http/httpmessage.h>
+
+namespace stx {
+namespace http {
+
+/**
+ * A radix trie that maps request URIs to route ids. Routes are either
+ *
+ *   - prefix routes, which match every URI that starts with the prefix
+ *   - path routes, which match the path part (without the query string) of
+ *     the URI exactly. Path segments of the form ":name" match any single
+ *     non-empty segment and are returned as route params
+ *
+ * Every route can be restricted to a single HTTP method. If more than one
+ * route matches a request, the one with the lowest route id wins so that
+ * routes keep their registration order.
+ */
+class HTTPRouteTrie {
+public:
+  typedef Vector<Pair<String, String>> ParamList;
+
+  static const size_t kNoRoute = (size_t) -1;
+
+  HTTPRouteTrie();
+
+  void insertPrefix(
+      const String& prefix,
+      Option<HTTPMessage::kHTTPMethod> method,
+      size_t route_id);
+
+  void insertPath(
+      const String& path,
+      Option<HTTPMessage::kHTTPMethod> method,
+      size_t route_id);
+
+  /**
+   * Returns the id of the matching route with the lowest id or kNoRoute. The
+   * params of the returned route are stored in params
+   */
+  size_t lookup(
+      HTTPMessage::kHTTPMethod method,
+      const String& uri,
+      ParamList* params) const;
+
+protected:
+
+  struct RouteEntry {
+    bool any_method;
+    HTTPMessage::kHTTPMethod method;
+    size_t route_id;
+  };
+
+  struct Node {
+    String label;
+    Vector<ScopedPtr<Node>> children;
+    ScopedPtr<Node> param_child;
+    String param_name;
+    Vector<RouteEntry> prefix_routes;
+    Vector<RouteEntry> path_routes;
+  };
+
+  struct LookupState {
+    HTTPMessage::kHTTPMethod method;
+    const String* uri;
+    size_t path_end;
+    size_t best_route;
+    ParamList params;
+    ParamList best_params;
+  };
+
+  static Node* insertStatic(Node* node, const String& key);
+
+  static void addEntry(
+      Vector<RouteEntry>* entries,
+      Option<HTTPMessage::kHTTPMethod> method,
+      size_t route_id);
+
+  static void matchEntries(
+      const Vector<RouteEntry>& entries,
+      LookupState* state);
+
+  static void lookup(const Node* node, size_t pos, LookupState* state);
+
+  Node root_;
+};
+
+}
+}
+#endif
@@ -0,0 +1,170 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stx/logging.h>
+#include <stx/http/HTTPSSEBroadcaster.h>
+
+namespace stx {
+namespace http {
+
+HTTPSSEBroadcasterOptions::HTTPSSEBroadcasterOptions() :
+    max_lag_bytes(kDefaultMaxLagBytes),
+    coalesce(kDefaultCoalesce) {}
+
+HTTPSSEBroadcaster::Handle::Handle(
+    HTTPSSEBroadcaster* _broadcaster) :
+    broadcaster(_broadcaster) {}
+
+HTTPSSEBroadcaster::HTTPSSEBroadcaster(
+    const HTTPSSEBroadcasterOptions& opts) :
+    opts_(opts),
+    handle_(new Handle(this)) {}
+
+HTTPSSEBroadcaster::~HTTPSSEBroadcaster() {
+  // waits for callbacks that are running right now
+  {
+    std::unique_lock<std::recursive_mutex> lk(handle_->mutex);
+    handle_->broadcaster = nullptr;
+  }
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  for (auto& sub : subscribers_) {
+    sub.second.stream->onBodyWritten(nullptr);
+  }
+
+  stats_.subscribers.decr(subscribers_.size());
+}
+
+void HTTPSSEBroadcaster::subscribe(RefPtr<HTTPSSEStream> stream) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto& sub = subscribers_[stream.get()];
+  if (sub.stream.get() != nullptr) {
+    return;
+  }
+
+  sub.stream = stream;
+  stats_.subscribers.incr(1);
+  lk.unlock();
+
+  auto handle = handle_;
+  auto stream_ptr = stream.get();
+  stream->onBodyWritten([handle, stream_ptr] {
+    onSubscriberDrained(handle, stream_ptr);
+  });
+}
+
+void HTTPSSEBroadcaster::unsubscribe(RefPtr<HTTPSSEStream> stream) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (subscribers_.erase(stream.get()) == 0) {
+    return;
+  }
+
+  stats_.subscribers.decr(1);
+  lk.unlock();
+
+  stream->onBodyWritten(nullptr);
+}
+
+void HTTPSSEBroadcaster::publish(
+    const String& data,
+    const Option<String>& event_type) {
+  publish(data.data(), data.size(), event_type);
+}
+
+void HTTPSSEBroadcaster::publish(
+    const void* event_data,
+    size_t event_size,
+    const Option<String>& event_type) {
+  BufferRef frame(new Buffer());
+  HTTPSSEStream::encodeEvent(event_data, event_size, event_type, frame.get());
+  stats_.published_events.incr(1);
+
+  Vector<RefPtr<HTTPSSEStream>> targets;
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    targets.reserve(subscribers_.size());
+
+    for (auto iter = subscribers_.begin(); iter != subscribers_.end(); ) {
+      auto& sub = iter->second;
+      if (sub.stream->isClosed()) {
+        stats_.subscribers.decr(1);
+        iter = subscribers_.erase(iter);
+        continue;
+      }
+
+      // a newer event replaces the pending one in any case
+      if (sub.pending.get() != nullptr) {
+        stats_.coalesced_events.incr(1);
+        sub.pending = nullptr;
+      }
+
+      if (sub.stream->bufferSize() <= opts_.max_lag_bytes) {
+        targets.emplace_back(sub.stream);
+      } else if (opts_.coalesce) {
+        sub.pending = frame;
+      } else {
+        stats_.dropped_events.incr(1);
+      }
+
+      ++iter;
+    }
+  }
+
+  for (auto& target : targets) {
+    sendFrame(target, frame);
+  }
+}
+
+void HTTPSSEBroadcaster::onSubscriberDrained(
+    RefPtr<Handle> handle,
+    HTTPSSEStream* stream) {
+  std::unique_lock<std::recursive_mutex> lk(handle->mutex);
+  if (handle->broadcaster != nullptr) {
+    handle->broadcaster->onSubscriberDrained(stream);
+  }
+}
+
+void HTTPSSEBroadcaster::onSubscriberDrained(HTTPSSEStream* stream) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto iter = subscribers_.find(stream);
+  if (iter == subscribers_.end() || iter->second.pending.get() == nullptr) {
+    return;
+  }
+
+  auto target = iter->second.stream;
+  auto frame = iter->second.pending;
+  iter->second.pending = nullptr;
+  lk.unlock();
+
+  sendFrame(target, frame);
+}
+
+void HTTPSSEBroadcaster::sendFrame(
+    RefPtr<HTTPSSEStream> stream,
+    BufferRef frame) {
+  try {
+    stream->sendFrame(frame);
+    stats_.delivered_events.incr(1);
+  } catch (const std::exception& e) {
+    // the stream is removed on the next publish
+    logDebug("http.server", e, "error while sending SSE event");
+  }
+}
+
+size_t HTTPSSEBroadcaster::numSubscribers() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return subscribers_.size();
+}
+
+HTTPSSEBroadcasterStats* HTTPSSEBroadcaster::stats() {
+  return &stats_;
+}
+
+}
+}
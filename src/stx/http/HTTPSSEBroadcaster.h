@@ -0,0 +1,173 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPSSEBROADCASTER_H
+#define _STX_HTTP_HTTPSSEBROADCASTER_H
+#include <mutex>
+#include <stx/stdtypes.h>
+#include <stx/buffer.h>
+#include <stx/option.h>
+#include <stx/io/fileutil.h>
+#include <stx/stats/counter.h>
+#include <stx/stats/statsrepository.h>
+#include <stx/http/HTTPSSEStream.h>
+
+namespace stx {
+namespace http {
+
+struct HTTPSSEBroadcasterOptions {
+  static const size_t kDefaultMaxLagBytes = 256 * 1024;
+  static const bool kDefaultCoalesce = false;
+
+  HTTPSSEBroadcasterOptions();
+
+  /**
+   * A subscriber is considered slow while more than this many bytes of
+   * previous events are still waiting to be written to it (including the
+   * bytes that are being written right now)
+   */
+  size_t max_lag_bytes;
+
+  /**
+   * If false, events are dropped for slow subscribers. If true, only the most
+   * recent event is kept for each slow subscriber and sent once it caught up
+   */
+  bool coalesce;
+};
+
+struct HTTPSSEBroadcasterStats {
+  stats::Counter<uint64_t> subscribers;
+  stats::Counter<uint64_t> published_events;
+  stats::Counter<uint64_t> delivered_events;
+  stats::Counter<uint64_t> dropped_events;
+  stats::Counter<uint64_t> coalesced_events;
+
+  void exportStats(
+      const String& path_prefix = "/fnord/http/sse/",
+      stats::StatsRepository* stats_repo = nullptr) {
+    if (stats_repo == nullptr) {
+      stats_repo = stats::StatsRepository::get();
+    }
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "subscribers"),
+        &subscribers,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "published_events"),
+        &published_events,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "delivered_events"),
+        &delivered_events,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "dropped_events"),
+        &dropped_events,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "coalesced_events"),
+        &coalesced_events,
+        stats::ExportMode::EXPORT_DELTA);
+  }
+};
+
+/**
+ * Publishes server-sent events to a set of subscribed HTTPSSEStreams. Each
+ * event is encoded once into a refcounted frame and every subscriber queues
+ * a reference to that frame, so the event is not copied per subscriber
+ * (unless the subscriber's response is compressed).
+ * Subscribers that fall behind by more than max_lag_bytes miss events (or
+ * only receive the latest one with coalescing) instead of buffering an
+ * unbounded backlog. Closed streams are unsubscribed on the next publish.
+ *
+ * Streams may outlive the broadcaster. All methods are thread safe.
+ *
+ * Usage:
+ *
+ *   HTTPSSEBroadcaster ticker;
+ *
+ *   // in the service handler
+ *   auto sse_stream = mkRef(new HTTPSSEStream(req_stream, res_stream));
+ *   sse_stream->start();
+ *   ticker.subscribe(sse_stream);
+ *
+ *   // from any thread
+ *   ticker.publish("{ \"price\": 42 }", Some(String("tick")));
+ *
+ */
+class HTTPSSEBroadcaster {
+public:
+
+  HTTPSSEBroadcaster(
+      const HTTPSSEBroadcasterOptions& opts = HTTPSSEBroadcasterOptions());
+
+  ~HTTPSSEBroadcaster();
+
+  HTTPSSEBroadcaster(const HTTPSSEBroadcaster& other) = delete;
+  HTTPSSEBroadcaster& operator=(const HTTPSSEBroadcaster& other) = delete;
+
+  /**
+   * Subscribe a stream. The stream must already be started. The broadcaster
+   * takes over the stream's onBodyWritten callback
+   */
+  void subscribe(RefPtr<HTTPSSEStream> stream);
+  void unsubscribe(RefPtr<HTTPSSEStream> stream);
+
+  void publish(
+      const String& data,
+      const Option<String>& event_type);
+
+  void publish(
+      const void* event_data,
+      size_t event_size,
+      const Option<String>& event_type);
+
+  size_t numSubscribers() const;
+
+  HTTPSSEBroadcasterStats* stats();
+
+protected:
+
+  struct Subscriber {
+    RefPtr<HTTPSSEStream> stream;
+    BufferRef pending;
+  };
+
+  /**
+   * The streams' onBodyWritten callbacks go through the handle, so that they
+   * are ignored once the broadcaster is destroyed
+   */
+  struct Handle : public RefCounted {
+    Handle(HTTPSSEBroadcaster* broadcaster);
+    std::recursive_mutex mutex;
+    HTTPSSEBroadcaster* broadcaster;
+  };
+
+  static void onSubscriberDrained(
+      RefPtr<Handle> handle,
+      HTTPSSEStream* stream);
+
+  void onSubscriberDrained(HTTPSSEStream* stream);
+  void sendFrame(RefPtr<HTTPSSEStream> stream, BufferRef frame);
+
+  HTTPSSEBroadcasterOptions opts_;
+  HTTPSSEBroadcasterStats stats_;
+  HashMap<HTTPSSEStream*, Subscriber> subscribers_;
+  mutable std::mutex mutex_;
+  RefPtr<Handle> handle_;
+};
+
+}
+}
+#endif
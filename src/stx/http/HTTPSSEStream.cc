@@ -61,19 +61,42 @@ void HTTPSSEStream::sendEvent(
     size_t event_size,
     const Option<String>& event_type) {
   Buffer buf;
-  buf.reserve(event_size + 1024);
+  encodeEvent(event_data, event_size, event_type, &buf);
+  res_stream_->writeBodyChunk(buf);
+}
+
+void HTTPSSEStream::encodeEvent(
+    const void* event_data,
+    size_t event_size,
+    const Option<String>& event_type,
+    Buffer* out) {
+  out->reserve(event_size + 1024);
 
   if (!event_type.isEmpty()) {
-    buf.append("event: ");
-    buf.append(event_type.get());
-    buf.append("\n");
+    out->append("event: ");
+    out->append(event_type.get());
+    out->append("\n");
   }
 
-  buf.append("data: ");
-  buf.append(event_data, event_size);
-  buf.append("\n\n");
+  out->append("data: ");
+  out->append(event_data, event_size);
+  out->append("\n\n");
+}
 
-  res_stream_->writeBodyChunk(buf);
+void HTTPSSEStream::sendFrame(const Buffer& frame) {
+  res_stream_->writeBodyChunk(frame.data(), frame.size());
+}
+
+void HTTPSSEStream::sendFrame(BufferRef frame) {
+  res_stream_->writeBodyChunk(frame);
+}
+
+size_t HTTPSSEStream::bufferSize() {
+  return res_stream_->bufferSize();
+}
+
+void HTTPSSEStream::onBodyWritten(Function<void ()> callback) {
+  res_stream_->onBodyWritten(callback);
 }
 
 void HTTPSSEStream::finish() {
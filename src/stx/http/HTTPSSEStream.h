@@ -21,6 +21,15 @@ namespace http {
 class HTTPSSEStream : public RefCounted {
 public:
 
+  /**
+   * Append the wire encoding of an event to out
+   */
+  static void encodeEvent(
+      const void* event_data,
+      size_t event_size,
+      const Option<String>& event_type,
+      Buffer* out);
+
   /**
    * Initialize the response from the provided request stream, write to the
    * provided response stream
@@ -60,6 +69,26 @@ public:
     size_t event_size,
     const Option<String>& event_type);
 
+  /**
+   * Write an event that was previously encoded with encodeEvent. The
+   * refcounted variant writes the frame by reference, so the same frame can
+   * be sent to many streams without copying it
+   */
+  void sendFrame(const Buffer& frame);
+  void sendFrame(BufferRef frame);
+
+  /**
+   * Return the number of bytes that were sent but not yet written to the
+   * client, including the bytes that are being written right now
+   */
+  size_t bufferSize();
+
+  /**
+   * Register a callback that will be called whenever all pending events have
+   * been written to the client
+   */
+  void onBodyWritten(Function<void ()> callback);
+
   const HTTPResponse response() const;
   void finish();
 
@@ -0,0 +1,104 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_HTTP_HTTPSERVEROPTIONS_H
+#define _STX_HTTP_HTTPSERVEROPTIONS_H
+#include <stx/stdtypes.h>
+#include <stx/http/HTTPContentEncoding.h>
+
+namespace stx {
+namespace http {
+
+struct HTTPServerOptions {
+  static const size_t kDefaultMaxConnections = 0;
+  static const size_t kDefaultBufferPoolSize = 1024;
+  static const size_t kDefaultMaxResponseBufferBytes = 4 * 1024 * 1024;
+  static const size_t kDefaultMaxTotalResponseBufferBytes = 0;
+  static const uint64_t kDefaultHeaderReadTimeoutMicros = 0;
+  static const uint64_t kDefaultBodyReadTimeoutMicros = 0;
+  static const uint64_t kDefaultIdleTimeoutMicros = 0;
+  static const uint64_t kDefaultWriteTimeoutMicros = 0;
+  static const uint32_t kDefaultHTTP2MaxConcurrentStreams = 100;
+
+  HTTPServerOptions();
+
+  /**
+   * Response compression settings. Compression is disabled by default
+   */
+  HTTPContentEncodingOptions content_encoding;
+
+  /**
+   * Stop accepting new connections while this many connections are open.
+   * 0 means unlimited
+   */
+  size_t max_connections;
+
+  /**
+   * Maximum number of connection buffers that are kept for reuse. Connections
+   * only borrow buffers from the pool while data is in flight, so idle
+   * keep-alive connections hold (almost) no memory. 0 disables pooling and
+   * connections keep their buffers for their whole lifetime
+   */
+  size_t buffer_pool_size;
+
+  /**
+   * Maximum number of response body bytes a HTTPResponseStream buffers before
+   * its writer is suspended (see HTTPResponseStream::onWritable)
+   */
+  size_t max_response_buffer_bytes;
+
+  /**
+   * Maximum number of response body bytes buffered by all response streams
+   * of the server combined, including chunks that were handed to a connection
+   * but not written to the socket yet. Writers are suspended while the total
+   * exceeds the limit. 0 means unlimited
+   */
+  size_t max_total_response_buffer_bytes;
+
+  /**
+   * Close the connection if the request line and headers were not received
+   * within this time after the first byte of the request. 0 means no timeout
+   */
+  uint64_t header_read_timeout_micros;
+
+  /**
+   * Close the connection if no request body data was received for this long
+   * while the server is waiting for it. 0 means no timeout
+   */
+  uint64_t body_read_timeout_micros;
+
+  /**
+   * Close (keep-alive) connections on which no new request was started for
+   * this long. 0 means no timeout
+   */
+  uint64_t idle_timeout_micros;
+
+  /**
+   * Close the connection if the client didn't accept any response data for
+   * this long. 0 means no timeout
+   */
+  uint64_t write_timeout_micros;
+
+  /**
+   * Accept HTTP/2 over cleartext, either with prior knowledge or with an
+   * "Upgrade: h2c" request. Enabled by default
+   */
+  bool enable_h2c;
+
+  /**
+   * Maximum number of concurrent HTTP/2 streams per connection. Streams
+   * beyond the limit are refused
+   */
+  uint32_t http2_max_concurrent_streams;
+
+};
+
+}
+}
+#endif
@@ -11,18 +11,46 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
 #include <stx/exception.h>
 #include <stx/http/httpclient.h>
 #include <stx/http/httpconnectionpool.h>
+#include <stx/http/httpgenerator.h>
 #include <stx/http/httpparser.h>
 #include <stx/http/httprequest.h>
 #include <stx/http/httpresponse.h>
 #include <stx/http/httpresponsehandler.h>
+#include <stx/http/httprouter.h>
+#include <stx/http/httpserver.h>
+#include <stx/http/httpservice.h>
+#include <stx/http/httpstats.h>
 #include <stx/http/httpclientconnection.h>
+#include <stx/http/CachingHTTPService.h>
+#include <stx/http/HPACK.h>
+#include <stx/http/HTTP2Frame.h>
+#include <stx/http/HTTPAdmissionController.h>
+#include <stx/http/HTTPContentEncoding.h>
+#include <stx/http/HTTPResponseBufferBudget.h>
+#include <stx/http/HTTPResponseCache.h>
+#include <stx/http/HTTPResponseStream.h>
+#include <stx/http/HTTPRouteTrie.h>
+#include <stx/http/HTTPSSEBroadcaster.h>
 #include <stx/io/inputstream.h>
+#include <stx/net/dnscache.h>
+#include <stx/net/tcpconnection.h>
 #include <stx/test/unittest.h>
+#include <stx/wallclock.h>
 #include <stx/thread/eventloop.h>
 #include <stx/thread/threadpool.h>
+#include <stx/thread/FixedSizeThreadPool.h>
 
 using namespace stx;
 using namespace stx::http;
@@ -31,6 +59,98 @@ using stx::StringOutputStream;
 
 UNIT_TEST(HTTPTest);
 
+/**
+ * The end to end tests run their servers and clients on a shared event loop
+ * and handler pool that live until the test binary exits
+ */
+static thread::EventLoop* testEventLoop() {
+  static thread::EventLoop* ev = nullptr;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    ev = new thread::EventLoop();
+    std::thread([] { ev->run(); }).detach();
+  });
+
+  return ev;
+}
+
+static thread::FixedSizeThreadPool* testHandlerPool() {
+  static thread::FixedSizeThreadPool* tp = nullptr;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    tp = new thread::FixedSizeThreadPool(thread::ThreadPoolOptions{}, 8);
+    tp->start();
+  });
+
+  return tp;
+}
+
+/**
+ * Servers are never shut down, so every test listens on its own port
+ */
+static HTTPServer* startTestServer(
+    int port,
+    HTTPRouter* router,
+    const HTTPServerOptions& opts = HTTPServerOptions()) {
+  auto server = new HTTPServer(router, testEventLoop(), opts);
+  server->listen(port);
+  return server;
+}
+
+/**
+ * Open a plain TCP connection to a test server and send the raw request
+ */
+static std::unique_ptr<net::TCPConnection> sendTestRequest(
+    int port,
+    const String& raw_request) {
+  auto conn = net::TCPConnection::connect(
+      InetAddr::resolve(StringUtil::format("127.0.0.1:$0", port)));
+
+  if (!raw_request.empty()) {
+    conn->write(raw_request.data(), raw_request.size());
+  }
+
+  return conn;
+}
+
+/**
+ * Read from the connection until the server closes it and return the body of
+ * the (single) response
+ */
+static String readTestResponseBody(net::TCPConnection* conn) {
+  String response;
+  char buf[4096];
+  for (;;) {
+    auto len = conn->read(buf, sizeof(buf));
+    if (len == 0) {
+      break;
+    }
+
+    response.append(buf, len);
+  }
+
+  auto body_start = response.find("\r\n\r\n");
+  if (body_start == String::npos) {
+    return "";
+  }
+
+  return response.substr(body_start + 4);
+}
+
+class TestHTTPService : public HTTPService {
+public:
+  TestHTTPService(
+      Function<void (HTTPRequest* req, HTTPResponse* res)> fn) :
+      fn_(fn) {}
+
+  void handleHTTPRequest(HTTPRequest* req, HTTPResponse* res) override {
+    fn_(req, res);
+  }
+
+protected:
+  Function<void (HTTPRequest* req, HTTPResponse* res)> fn_;
+};
+
 TEST_CASE(HTTPTest, ParseHTTP1dot0Request, [] () {
   auto request = HTTPRequest::parse(
       "GET / HTTP/1.0\r\n" \
@@ -117,6 +237,112 @@ TEST_CASE(HTTPTest, ParseHTTP1dot0ResponseWithBodyWithoutContentLength, [] () {
   EXPECT_EQ(response.body().toString(), "blah");
 });
 
+TEST_CASE(HTTPTest, ParsePipelinedHTTPResponses, [] () {
+  String responses =
+      "HTTP/1.1 200 OK\r\n" \
+      "Content-Length: 5\r\n" \
+      "\r\n" \
+      "blah1" \
+      "HTTP/1.1 204 No Content\r\n" \
+      "\r\n" \
+      "HTTP/1.1 200 OK\r\n" \
+      "Content-Length: 3\r\n" \
+      "\r\n" \
+      "foo";
+
+  Vector<int> codes;
+  String body;
+  HTTPParser parser(HTTPParser::PARSE_HTTP_RESPONSE);
+  parser.onStatusCode([&codes] (int code) {
+    codes.emplace_back(code);
+  });
+  parser.onBodyChunk([&body] (const char* data, size_t size) {
+    body.append(data, size);
+  });
+
+  size_t pos = 0;
+  while (pos < responses.size()) {
+    pos += parser.parse(responses.data() + pos, responses.size() - pos);
+    EXPECT_TRUE(parser.state() == HTTPParser::S_DONE);
+    parser.reset();
+  }
+
+  EXPECT_EQ(codes.size(), 3);
+  EXPECT_EQ(codes[0], 200);
+  EXPECT_EQ(codes[1], 204);
+  EXPECT_EQ(codes[2], 200);
+  EXPECT_EQ(body, "blah1foo");
+});
+
+TEST_CASE(HTTPTest, ParseChunkedHTTPMessages, [] () {
+  String responses =
+      "HTTP/1.1 200 OK\r\n" \
+      "Transfer-Encoding: chunked\r\n" \
+      "\r\n" \
+      "5\r\nblah1\r\n" \
+      "A;ext=fnord\r\n0123456789\r\n" \
+      "0\r\n" \
+      "X-Trailer: 1\r\n" \
+      "\r\n" \
+      "HTTP/1.1 200 OK\r\n" \
+      "Content-Length: 3\r\n" \
+      "\r\n" \
+      "foo";
+
+  // feed the input byte by byte to hit every partial state
+  String body;
+  HTTPParser parser(HTTPParser::PARSE_HTTP_RESPONSE);
+  parser.onBodyChunk([&body] (const char* data, size_t size) {
+    body.append(data, size);
+  });
+
+  size_t pos = 0;
+  while (parser.state() != HTTPParser::S_DONE) {
+    pos += parser.parse(responses.data() + pos, 1);
+  }
+
+  EXPECT_EQ(body, "blah10123456789");
+
+  parser.reset();
+  pos += parser.parse(responses.data() + pos, responses.size() - pos);
+  EXPECT_EQ(pos, responses.size());
+  EXPECT_TRUE(parser.state() == HTTPParser::S_DONE);
+  EXPECT_EQ(body, "blah10123456789foo");
+
+  String request =
+      "POST /upload HTTP/1.1\r\n" \
+      "Transfer-Encoding: chunked\r\n" \
+      "\r\n" \
+      "3\r\nabc\r\n" \
+      "0\r\n\r\n" \
+      "GET / HTTP/1.1\r\n\r\n";
+
+  String request_body;
+  HTTPParser request_parser(HTTPParser::PARSE_HTTP_REQUEST);
+  request_parser.onBodyChunk([&request_body] (const char* data, size_t size) {
+    request_body.append(data, size);
+  });
+
+  auto consumed = request_parser.parse(request.data(), request.size());
+  EXPECT_TRUE(request_parser.state() == HTTPParser::S_DONE);
+  EXPECT_EQ(request_body, "abc");
+  EXPECT_EQ(request.substr(consumed), "GET / HTTP/1.1\r\n\r\n");
+
+  String invalid =
+      "HTTP/1.1 200 OK\r\n" \
+      "Transfer-Encoding: chunked\r\n" \
+      "\r\n" \
+      "xyz\r\n";
+
+  HTTPParser invalid_parser(HTTPParser::PARSE_HTTP_RESPONSE);
+  try {
+    invalid_parser.parse(invalid.data(), invalid.size());
+    EXPECT_TRUE(false);
+  } catch (Exception& e) {
+    EXPECT_EQ(String(e.getMessage()), "invalid HTTP chunk size: xyz");
+  }
+});
+
 TEST_CASE(HTTPTest, PopulateHTTPResponseFromHTTP1dot0Request, [] () {
   auto request = HTTPRequest::parse(
       "GET / HTTP/1.0\r\n" \
@@ -243,6 +469,1925 @@ TEST_CASE(HTTPTest, TestInvalidCookies, [] () {
   EXPECT_EQ(cookies[0].second, "fnord");
 });
 
+TEST_CASE(HTTPTest, TestRouteTrie, [] () {
+  HTTPRouteTrie trie;
+  trie.insertPath("/", None<HTTPMessage::kHTTPMethod>(), 0);
+  trie.insertPrefix("/static/", None<HTTPMessage::kHTTPMethod>(), 1);
+  trie.insertPath("/users/:id", Some(HTTPMessage::M_GET), 2);
+  trie.insertPath("/users/:id", Some(HTTPMessage::M_POST), 3);
+  trie.insertPath("/users/:id/posts/:post", None<HTTPMessage::kHTTPMethod>(), 4);
+  trie.insertPath("/users/me", None<HTTPMessage::kHTTPMethod>(), 5);
+  trie.insertPath("/user", None<HTTPMessage::kHTTPMethod>(), 6);
+
+  HTTPRouteTrie::ParamList params;
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/", &params), 0);
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/?x=1", &params), 0);
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/static/a/b.js", &params), 1);
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/user", &params), 6);
+  EXPECT_EQ(
+      trie.lookup(HTTPMessage::M_GET, "/nope", &params),
+      HTTPRouteTrie::kNoRoute);
+  EXPECT_EQ(
+      trie.lookup(HTTPMessage::M_GET, "/users/", &params),
+      HTTPRouteTrie::kNoRoute);
+
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/users/123?a=b", &params), 2);
+  EXPECT_EQ(params.size(), 1);
+  EXPECT_EQ(params[0].first, "id");
+  EXPECT_EQ(params[0].second, "123");
+
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_POST, "/users/123", &params), 3);
+  EXPECT_EQ(
+      trie.lookup(HTTPMessage::M_PUT, "/users/123", &params),
+      HTTPRouteTrie::kNoRoute);
+
+  // the parametrized route was registered first, so it wins
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/users/me", &params), 2);
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_PUT, "/users/me", &params), 5);
+  EXPECT_EQ(params.size(), 0);
+
+  EXPECT_EQ(trie.lookup(HTTPMessage::M_GET, "/users/1/posts/2", &params), 4);
+  EXPECT_EQ(params.size(), 2);
+  EXPECT_EQ(params[0].second, "1");
+  EXPECT_EQ(params[1].first, "post");
+  EXPECT_EQ(params[1].second, "2");
+});
+
+TEST_CASE(HTTPTest, TestResponseCache, [] () {
+  HTTPResponseCacheOptions opts;
+  opts.num_shards = 1;
+  opts.max_bytes = 200;
+  HTTPResponseCache cache(opts);
+
+  auto req = HTTPRequest::mkGet("http://localhost/foo");
+  auto key = cache.cacheKey(req);
+
+  bool fetch = false;
+  RefPtr<HTTPResponseCache::CachedResponse> coalesced;
+  auto waiter = [&coalesced] (RefPtr<HTTPResponseCache::CachedResponse> r) {
+    coalesced = r;
+  };
+
+  EXPECT_TRUE(cache.lookup(key, waiter, &fetch).get() == nullptr);
+  EXPECT_TRUE(fetch);
+  EXPECT_TRUE(cache.lookup(key, waiter, &fetch).get() == nullptr);
+  EXPECT_FALSE(fetch);
+
+  HTTPResponse res;
+  res.setStatus(kStatusOK);
+  res.addBody("hello world");
+  auto cached = cache.complete(key, res);
+  EXPECT_FALSE(cached->etag.empty());
+  EXPECT_EQ(cached->response.getHeader("ETag"), cached->etag);
+  EXPECT_TRUE(coalesced.get() == cached.get());
+
+  auto hit = cache.lookup(key, waiter, &fetch);
+  EXPECT_TRUE(hit.get() == cached.get());
+  EXPECT_FALSE(fetch);
+  EXPECT_EQ(cache.stats()->hits.get(), 1);
+  EXPECT_EQ(cache.stats()->misses.get(), 1);
+  EXPECT_EQ(cache.stats()->coalesced.get(), 1);
+
+  req.addHeader("If-None-Match", "\"xxx\", W/" + cached->etag);
+  EXPECT_TRUE(HTTPResponseCache::matchesETag(req, cached->etag));
+
+  // uncacheable responses are neither stored nor passed to waiters
+  auto req2 = HTTPRequest::mkGet("http://localhost/bar");
+  auto key2 = cache.cacheKey(req2);
+  HTTPResponse res2;
+  res2.setStatus(kStatusNotFound);
+  EXPECT_TRUE(cache.lookup(key2, waiter, &fetch).get() == nullptr);
+  EXPECT_TRUE(cache.lookup(key2, waiter, &fetch).get() == nullptr);
+  EXPECT_FALSE(fetch);
+  EXPECT_TRUE(cache.complete(key2, res2)->etag.empty());
+  EXPECT_TRUE(coalesced.get() == nullptr);
+  EXPECT_TRUE(cache.lookup(key2, waiter, &fetch).get() == nullptr);
+  EXPECT_TRUE(fetch);
+  cache.abandon(key2);
+
+  // exceeding max_bytes evicts the least recently used response
+  auto req3 = HTTPRequest::mkGet("http://localhost/baz");
+  auto key3 = cache.cacheKey(req3);
+  HTTPResponse res3;
+  res3.setStatus(kStatusOK);
+  res3.addBody(String(170, 'x'));
+  cache.lookup(key3, waiter, &fetch);
+  cache.complete(key3, res3);
+  EXPECT_EQ(cache.stats()->evictions.get(), 1);
+  EXPECT_TRUE(cache.lookup(key, waiter, &fetch).get() == nullptr);
+  EXPECT_TRUE(cache.lookup(key3, waiter, &fetch).get() != nullptr);
+});
+
+static const int kResponseCacheTestPort = 18502;
+
+TEST_CASE(HTTPTest, TestResponseCacheDoesNotSharePrivateResponses, [] () {
+  static std::atomic<int> num_calls(0);
+  static TestHTTPService service([] (HTTPRequest* req, HTTPResponse* res) {
+    ++num_calls;
+    usleep(100 * kMicrosPerMilli);
+    auto user = req->getHeader("X-User");
+    res->setStatus(kStatusOK);
+    res->addHeader("Set-Cookie", "user=" + user);
+    res->addBody("hello " + user);
+  });
+
+  static HTTPResponseCache cache;
+  static CachingHTTPService cached_service(&service, &cache);
+  static HTTPRouter router;
+  router.addRouteByPrefixMatch("/", &cached_service, testHandlerPool());
+  startTestServer(kResponseCacheTestPort, &router);
+
+  auto addr = InetAddr::resolve(
+      StringUtil::format("127.0.0.1:$0", kResponseCacheTestPort));
+
+  HTTPConnectionPool pool(testEventLoop(), nullptr);
+  auto req_a = HTTPRequest::mkGet("/private");
+  req_a.addHeader("X-User", "a");
+  auto req_b = HTTPRequest::mkGet("/private");
+  req_b.addHeader("X-User", "b");
+
+  // both requests have the same cache key and are coalesced
+  auto res_a = pool.executeRequest(req_a, addr);
+  usleep(20 * kMicrosPerMilli);
+  auto res_b = pool.executeRequest(req_b, addr);
+
+  EXPECT_EQ(res_a.waitAndGet().getHeader("Set-Cookie"), "user=a");
+  EXPECT_EQ(res_a.waitAndGet().body().toString(), "hello a");
+  EXPECT_EQ(res_b.waitAndGet().getHeader("Set-Cookie"), "user=b");
+  EXPECT_EQ(res_b.waitAndGet().body().toString(), "hello b");
+  EXPECT_EQ(num_calls.load(), 2);
+  EXPECT_EQ(cache.stats()->coalesced.get(), 1);
+});
+
+TEST_CASE(HTTPTest, TestGenerateResponseWithHeaderTemplate, [] () {
+  auto tpl = mkRef(new HTTPHeaderTemplate());
+  tpl->addHeader("Content-Type", "application/json");
+
+  HTTPResponse res;
+  res.setVersion("HTTP/1.1");
+  res.setStatus(kStatusOK);
+  res.setHeaderTemplate(tpl);
+  res.addHeader("Content-Length", "2");
+  res.addBody("{}");
+  EXPECT_EQ(res.getHeader("Content-Type"), "application/json");
+
+  Buffer buf;
+  HTTPGenerator::generate(res, &buf);
+  EXPECT_EQ(
+      buf.toString(),
+      "HTTP/1.1 200 OK\r\n"
+      "content-length: 2\r\n"
+      "content-type: application/json\r\n"
+      "\r\n"
+      "{}");
+
+  buf.clear();
+  HTTPGenerator::generate(res, &buf, true);
+  auto parsed = HTTPResponse::parse(buf.toString());
+  EXPECT_EQ(parsed.getHeader("Date").size(), 29);
+  EXPECT_EQ(parsed.getHeader("Content-Type"), "application/json");
+
+  bool raised = false;
+  try {
+    tpl->addHeader("Content-Length", "2");
+  } catch (const std::exception& e) {
+    raised = true;
+  }
+
+  EXPECT_TRUE(raised);
+});
+
+TEST_CASE(HTTPTest, TestHPACKRequestExamples, [] () {
+  // RFC 7541 C.3.1 and C.3.2
+  HPACKEncoder encoder;
+  HPACKDecoder decoder;
+
+  HTTPMessage::HeaderList req1;
+  req1.emplace_back(":method", "GET");
+  req1.emplace_back(":scheme", "http");
+  req1.emplace_back(":path", "/");
+  req1.emplace_back(":authority", "www.example.com");
+
+  Buffer block1;
+  encoder.encode(req1, &block1);
+  EXPECT_EQ(
+      StringUtil::hexPrint(block1.data(), block1.size(), false),
+      "828684410f7777772e6578616d706c652e636f6d");
+
+  HTTPMessage::HeaderList decoded1;
+  decoder.decode(block1.data(), block1.size(), &decoded1);
+  EXPECT_TRUE(decoded1 == req1);
+
+  auto req2 = req1;
+  req2.emplace_back("Cache-Control", "no-cache");
+
+  Buffer block2;
+  encoder.encode(req2, &block2);
+  EXPECT_EQ(
+      StringUtil::hexPrint(block2.data(), block2.size(), false),
+      "828684be58086e6f2d6361636865");
+
+  HTTPMessage::HeaderList decoded2;
+  decoder.decode(block2.data(), block2.size(), &decoded2);
+  EXPECT_EQ(decoded2.size(), 5);
+  EXPECT_EQ(decoded2[3].second, "www.example.com");
+  EXPECT_EQ(decoded2[4].first, "cache-control");
+  EXPECT_EQ(decoded2[4].second, "no-cache");
+});
+
+static String hpackHexBlock(const String& hex) {
+  String block;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    block += (char) std::stoi(hex.substr(i, 2), nullptr, 16);
+  }
+
+  return block;
+}
+
+TEST_CASE(HTTPTest, TestHPACKHuffmanExamples, [] () {
+  // RFC 7541 C.4.1 - C.4.3
+  HPACKDecoder decoder;
+
+  auto block1 = hpackHexBlock("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+  HTTPMessage::HeaderList decoded1;
+  decoder.decode(block1.data(), block1.size(), &decoded1);
+  EXPECT_EQ(decoded1.size(), 4);
+  EXPECT_EQ(decoded1[3].first, ":authority");
+  EXPECT_EQ(decoded1[3].second, "www.example.com");
+
+  auto block2 = hpackHexBlock("828684be5886a8eb10649cbf");
+  HTTPMessage::HeaderList decoded2;
+  decoder.decode(block2.data(), block2.size(), &decoded2);
+  EXPECT_EQ(decoded2.size(), 5);
+  EXPECT_EQ(decoded2[4].first, "cache-control");
+  EXPECT_EQ(decoded2[4].second, "no-cache");
+
+  auto block3 = hpackHexBlock(
+      "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+  HTTPMessage::HeaderList decoded3;
+  decoder.decode(block3.data(), block3.size(), &decoded3);
+  EXPECT_EQ(decoded3.size(), 5);
+  EXPECT_EQ(decoded3[1].second, "https");
+  EXPECT_EQ(decoded3[2].second, "/index.html");
+  EXPECT_EQ(decoded3[3].second, "www.example.com");
+  EXPECT_EQ(decoded3[4].first, "custom-key");
+  EXPECT_EQ(decoded3[4].second, "custom-value");
+
+  // RFC 7541 C.6.1
+  HPACKDecoder res_decoder(256);
+  auto block4 = hpackHexBlock(
+      "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff"
+      "6e919d29ad171863c78f0b97c8e9ae82ae43d3");
+  HTTPMessage::HeaderList decoded4;
+  res_decoder.decode(block4.data(), block4.size(), &decoded4);
+  EXPECT_EQ(decoded4.size(), 4);
+  EXPECT_EQ(decoded4[0].second, "302");
+  EXPECT_EQ(decoded4[1].second, "private");
+  EXPECT_EQ(decoded4[2].second, "Mon, 21 Oct 2013 20:13:21 GMT");
+  EXPECT_EQ(decoded4[3].second, "https://www.example.com");
+});
+
+TEST_CASE(HTTPTest, TestHPACKHuffmanRejectsInvalidPadding, [] () {
+  // "a" is 00011, so the padding must be 111
+  EXPECT_EQ(HPACKDecoder::decodeHuffman("\x1f", 1), "a");
+
+  bool raised = false;
+  try {
+    HPACKDecoder::decodeHuffman("\x1e", 1);
+  } catch (Exception& e) {
+    raised = true;
+  }
+
+  EXPECT_TRUE(raised);
+
+  // a full byte of padding is longer than any EOS prefix we may send
+  raised = false;
+  try {
+    HPACKDecoder::decodeHuffman("\x1f\xff", 2);
+  } catch (Exception& e) {
+    raised = true;
+  }
+
+  EXPECT_TRUE(raised);
+
+  // EOS itself must not appear in a string
+  raised = false;
+  try {
+    HPACKDecoder::decodeHuffman("\xff\xff\xff\xff", 4);
+  } catch (Exception& e) {
+    raised = true;
+  }
+
+  EXPECT_TRUE(raised);
+});
+
+TEST_CASE(HTTPTest, TestHTTP2FrameParser, [] () {
+  Buffer wire;
+  HTTP2Frame data(HTTP2FrameType::DATA, HTTP2Frame::kFlagEndStream, 3);
+  data.payload.append("hello");
+  data.writeTo(&wire);
+  HTTP2Frame::mkWindowUpdate(0, 1234567).writeTo(&wire);
+
+  Vector<HTTP2Frame> frames;
+  HTTP2FrameParser parser;
+  parser.onFrame([&frames] (const HTTP2Frame& frame) {
+    frames.emplace_back(frame);
+  });
+
+  // feed byte by byte to exercise partial frames
+  for (size_t i = 0; i < wire.size(); ++i) {
+    parser.parse((const char*) wire.data() + i, 1);
+  }
+
+  EXPECT_EQ(frames.size(), 2);
+  EXPECT_TRUE(frames[0].type == HTTP2FrameType::DATA);
+  EXPECT_TRUE(frames[0].hasFlag(HTTP2Frame::kFlagEndStream));
+  EXPECT_EQ(frames[0].stream_id, 3);
+  EXPECT_EQ(frames[0].payload.toString(), "hello");
+  EXPECT_TRUE(frames[1].type == HTTP2FrameType::WINDOW_UPDATE);
+  EXPECT_EQ(frames[1].windowIncrement(), 1234567);
+});
+
+TEST_CASE(HTTPTest, TestAdmissionController, [] () {
+  HTTPAdmissionControlOptions opts;
+  opts.max_inflight_requests = 2;
+  opts.target_queue_delay_micros = 5000;
+  opts.interval_micros = 100000;
+  HTTPAdmissionController admission(opts);
+
+  uint64_t now = 1000000;
+  EXPECT_TRUE(admission.admit(now));
+  EXPECT_TRUE(admission.admit(now));
+  EXPECT_FALSE(admission.admit(now));
+  EXPECT_EQ(admission.stats()->shed_inflight_limit.get(), 1);
+  admission.release();
+  admission.release();
+
+  // a single slow request doesn't make the route overloaded
+  EXPECT_TRUE(admission.dequeue(20000, now));
+  EXPECT_TRUE(admission.dequeue(1000, now));
+  now += 100000;
+  EXPECT_TRUE(admission.admit(now));
+  EXPECT_FALSE(admission.isOverloaded());
+
+  // the queue didn't drain for a whole interval
+  EXPECT_TRUE(admission.dequeue(8000, now));
+  EXPECT_TRUE(admission.dequeue(20000, now));
+  admission.release();
+  now += 100000;
+  EXPECT_FALSE(admission.admit(now));
+  EXPECT_TRUE(admission.isOverloaded());
+  EXPECT_TRUE(admission.dequeue(6000, now));
+  EXPECT_FALSE(admission.dequeue(20000, now));
+  EXPECT_EQ(admission.stats()->shed_queue_delay.get(), 2);
+
+  // nothing was dequeued during the last interval
+  now += 200000;
+  EXPECT_TRUE(admission.admit(now));
+  EXPECT_FALSE(admission.isOverloaded());
+});
+
+TEST_CASE(HTTPTest, TestResponseBufferBudget, [] () {
+  HTTPServerStats stats;
+  HTTPResponseBufferBudget budget(100, &stats);
+
+  int calls = 0;
+  budget.add(60);
+  budget.waitAvailable([&calls] { ++calls; });
+  EXPECT_EQ(calls, 1);
+
+  budget.add(60);
+  EXPECT_FALSE(budget.isAvailable());
+  budget.waitAvailable([&calls] { ++calls; });
+  budget.waitAvailable([&calls] { ++calls; });
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(stats.response_buffered_bytes.get(), 120);
+
+  budget.remove(10);
+  EXPECT_EQ(calls, 1);
+  budget.remove(60);
+  EXPECT_EQ(calls, 3);
+  EXPECT_TRUE(budget.isAvailable());
+  EXPECT_EQ(budget.bufferedBytes(), 50);
+  EXPECT_EQ(stats.response_buffered_bytes.get(), 50);
+});
+
+TEST_CASE(HTTPTest, TestRouteStats, [] () {
+  class NullHandlerFactory : public HTTPHandlerFactory {
+  public:
+    std::unique_ptr<HTTPHandler> getHandler(
+        HTTPServerConnection* conn,
+        HTTPRequest* req) override {
+      return std::unique_ptr<HTTPHandler>(nullptr);
+    }
+  };
+
+  NullHandlerFactory factory;
+  HTTPRouter router;
+  router.addRouteByPath("/users/:id", &factory);
+  router.addRoute([] (HTTPRequest* req) { return true; }, &factory);
+
+  auto req = HTTPRequest::mkGet("http://localhost/users/123");
+  router.getHandler(nullptr, &req);
+  EXPECT_EQ(req.routeLabel(), "/users/:id");
+
+  auto req2 = HTTPRequest::mkGet("http://localhost/other");
+  router.getHandler(nullptr, &req2);
+  EXPECT_EQ(req2.routeLabel(), "route1");
+
+  HTTPServerStats stats;
+  auto route_stats = stats.routeStats(req.routeLabel());
+  EXPECT_TRUE(stats.routeStats(req.routeLabel()) == route_stats);
+  EXPECT_TRUE(stats.routeStats(req2.routeLabel()) != route_stats);
+  route_stats->total_micros->record(100);
+  route_stats->total_micros->record(300);
+
+  stats::BufferStatsSinkStatsSink sink;
+  stats.route_total_micros.getStat()->exportAll("/http/total_micros", &sink);
+
+  auto value = [&sink] (const String& path) -> double {
+    for (const auto& v : sink.values()) {
+      if (v.first == path) {
+        return v.second;
+      }
+    }
+
+    return -1;
+  };
+
+  EXPECT_EQ(value("/http/total_micros/users.:id/count"), 2);
+  EXPECT_EQ(value("/http/total_micros/users.:id/max"), 300);
+  EXPECT_TRUE(value("/http/total_micros/users.:id/p50") >= 100);
+});
+
+TEST_CASE(HTTPTest, TestRouteStatsExpire, [] () {
+  static const uint64_t kIntervalMicros = 50 * kMicrosPerMilli;
+  stats::MultiHistogram histogram(kIntervalMicros);
+  histogram.record("/fnord", 100);
+
+  auto exportCount = [&histogram] () -> double {
+    stats::BufferStatsSinkStatsSink sink;
+    histogram.getStat()->exportAll("/http", &sink);
+    for (const auto& v : sink.values()) {
+      if (v.first == "/http/fnord/count") {
+        return v.second;
+      }
+    }
+
+    return -1;
+  };
+
+  EXPECT_EQ(exportCount(), 1);
+  EXPECT_EQ(exportCount(), 1);
+
+  // the value is dropped once its interval and the next one are over
+  usleep(2 * kIntervalMicros + 10 * kMicrosPerMilli);
+  EXPECT_EQ(exportCount(), 0);
+
+  histogram.record("/fnord", 200);
+  EXPECT_EQ(exportCount(), 1);
+});
+
+TEST_CASE(HTTPTest, TestContentEncodingNegotiation, [] () {
+  HTTPContentEncodingOptions opts;
+  opts.enabled = true;
+
+  auto req = HTTPRequest::parse(
+      "GET / HTTP/1.1\r\n" \
+      "Accept-Encoding: deflate;q=0.5, gzip\r\n" \
+      "\r\n");
+
+  HTTPResponse res;
+  res.populateFromRequest(req);
+  res.setStatus(kStatusOK);
+  res.addHeader("Content-Type", "text/html");
+
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req, res, opts) == ContentEncoding::GZIP);
+
+  res.setHeader("Content-Length", "100");
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req, res, opts) ==
+      ContentEncoding::IDENTITY);
+
+  res.setHeader("Content-Length", "100000");
+  res.setHeader("Content-Type", "image/png");
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req, res, opts) ==
+      ContentEncoding::IDENTITY);
+
+  auto req2 = HTTPRequest::parse(
+      "GET / HTTP/1.1\r\n" \
+      "Accept-Encoding: gzip;q=0, deflate\r\n" \
+      "\r\n");
+
+  res.setHeader("Content-Type", "application/json");
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req2, res, opts) ==
+      ContentEncoding::DEFLATE);
+
+  // the wildcard doesn't override an explicit q=0
+  auto req3 = HTTPRequest::parse(
+      "GET / HTTP/1.1\r\n" \
+      "Accept-Encoding: gzip;q=0, deflate;q=0, *\r\n" \
+      "\r\n");
+
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req3, res, opts) ==
+      ContentEncoding::IDENTITY);
+
+  auto req4 = HTTPRequest::parse(
+      "GET / HTTP/1.1\r\n" \
+      "Accept-Encoding: gzip;q=0, *;q=0.5\r\n" \
+      "\r\n");
+
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req4, res, opts) ==
+      ContentEncoding::DEFLATE);
+
+  auto req5 = HTTPRequest::parse(
+      "GET / HTTP/1.1\r\n" \
+      "Accept-Encoding: *\r\n" \
+      "\r\n");
+
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req5, res, opts) ==
+      ContentEncoding::GZIP);
+
+  opts.enabled = false;
+  EXPECT_TRUE(
+      HTTPContentEncoder::negotiate(req2, res, opts) ==
+      ContentEncoding::IDENTITY);
+});
+
+TEST_CASE(HTTPTest, TestContentEncodingRoundtrip, [] () {
+  String input;
+  for (int i = 0; i < 10000; ++i) {
+    input += StringUtil::format("fnord $0 bar ", i);
+  }
+
+  for (auto enc : { ContentEncoding::GZIP, ContentEncoding::DEFLATE }) {
+    HTTPContentEncoder encoder(enc, 6);
+    Buffer compressed;
+    for (size_t pos = 0; pos < input.size(); pos += 1000) {
+      encoder.compress(
+          input.data() + pos,
+          std::min(input.size() - pos, size_t(1000)),
+          &compressed);
+
+      encoder.flush(&compressed);
+    }
+
+    encoder.finish(&compressed);
+    EXPECT_EQ(encoder.bytesIn(), input.size());
+    EXPECT_EQ(encoder.bytesOut(), compressed.size());
+    EXPECT_TRUE(compressed.size() < input.size());
+
+    String output;
+    HTTPContentDecoder decoder(enc);
+    for (size_t pos = 0; pos < compressed.size(); pos += 7) {
+      decoder.decode(
+          (char*) compressed.data() + pos,
+          std::min(compressed.size() - pos, size_t(7)),
+          [&output] (const char* data, size_t size) {
+        output.append(data, size);
+      });
+    }
+
+    EXPECT_EQ(output, input);
+  }
+});
+
+TEST_CASE(HTTPTest, TestTCPConnectionTryReadWrite, [] () {
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  net::TCPConnection a(fds[0]);
+  net::TCPConnection b(fds[1]);
+  b.setNonblocking();
+
+  char buf[16];
+  auto res = b.tryRead(buf, sizeof(buf));
+  EXPECT_TRUE(res.wouldBlock());
+
+  String hello = "hello ";
+  String world = "world";
+  struct iovec iov[2];
+  iov[0].iov_base = (void*) hello.data();
+  iov[0].iov_len = hello.size();
+  iov[1].iov_base = (void*) world.data();
+  iov[1].iov_len = world.size();
+  res = a.tryWritev(iov, 2);
+  EXPECT_TRUE(res.ok());
+  EXPECT_EQ(res.bytes, 11);
+
+  char part1[4];
+  char part2[16];
+  iov[0].iov_base = part1;
+  iov[0].iov_len = sizeof(part1);
+  iov[1].iov_base = part2;
+  iov[1].iov_len = sizeof(part2);
+  res = b.tryReadv(iov, 2);
+  EXPECT_TRUE(res.ok());
+  EXPECT_EQ(res.bytes, 11);
+  EXPECT_EQ(String(part1, 4) + String(part2, 7), "hello world");
+
+  a.close();
+  res = b.tryRead(buf, sizeof(buf));
+  EXPECT_TRUE(res.eof());
+
+  res = b.tryWrite("x", 1);
+  EXPECT_TRUE(res.failed());
+  EXPECT_EQ(res.error, EPIPE);
+});
+
+static std::atomic<size_t> stub_resolver_calls;
+static std::atomic<bool> stub_resolver_blocked;
+
+static Vector<String> stubResolver(const String& hostname) {
+  ++stub_resolver_calls;
+  while (stub_resolver_blocked.load()) {
+    usleep(1000);
+  }
+
+  if (hostname == "multi.example.com") {
+    Vector<String> ips;
+    ips.emplace_back("10.0.0.1");
+    ips.emplace_back("10.0.0.2");
+    return ips;
+  }
+
+  RAISEF(kResolveError, "unknown host: $0", hostname);
+}
+
+TEST_CASE(HTTPTest, TestDNSCache, [] () {
+  net::DNSCacheOptions opts;
+  opts.resolver = &stubResolver;
+  net::DNSCache cache(opts);
+
+  /* concurrent lookups for the same hostname share one resolver call */
+  stub_resolver_calls = 0;
+  stub_resolver_blocked = true;
+  Vector<Future<InetAddr>> futures;
+  for (size_t i = 0; i < 8; ++i) {
+    futures.emplace_back(cache.resolveAsync("multi.example.com:8080"));
+  }
+
+  EXPECT_TRUE(cache.lookup("multi.example.com").isEmpty());
+  stub_resolver_blocked = false;
+
+  size_t num_first = 0;
+  for (auto& f : futures) {
+    const auto& addr = f.waitAndGet();
+    EXPECT_EQ(addr.port(), 8080);
+    if (addr.ip() == "10.0.0.1") {
+      ++num_first;
+    }
+  }
+
+  EXPECT_EQ(stub_resolver_calls.load(), 1);
+  EXPECT_EQ(num_first, 4);
+
+  /* cached: round robin over all addresses without calling the resolver */
+  auto a = cache.resolve("multi.example.com:80");
+  auto b = cache.lookup("multi.example.com:80").get();
+  EXPECT_TRUE(a.ip() != b.ip());
+  EXPECT_EQ(cache.resolveAll("multi.example.com").waitAndGet().size(), 2);
+  EXPECT_EQ(stub_resolver_calls.load(), 1);
+
+  /* failures are cached too */
+  for (size_t i = 0; i < 2; ++i) {
+    try {
+      cache.resolve("unknown.example.com");
+      EXPECT_TRUE(false);
+    } catch (Exception& e) {
+      EXPECT_TRUE(e.ofType(kResolveError));
+    }
+  }
+
+  EXPECT_EQ(stub_resolver_calls.load(), 2);
+});
+
+static const int kConnectionPoolTestPort = 18501;
+
+TEST_CASE(HTTPTest, TestHTTPConnectionPoolWaitTimeoutAndShutdown, [] () {
+  static HTTPRouter router;
+  static TestHTTPService slow([] (HTTPRequest* req, HTTPResponse* res) {
+    usleep(200 * kMicrosPerMilli);
+    res->setStatus(kStatusOK);
+    res->addBody("slow");
+  });
+
+  router.addRouteByPrefixMatch("/", &slow, testHandlerPool());
+  startTestServer(kConnectionPoolTestPort, &router);
+
+  auto addr = InetAddr::resolve(
+      StringUtil::format("127.0.0.1:$0", kConnectionPoolTestPort));
+  auto req = HTTPRequest::mkGet("/slow");
+
+  HTTPClientStats stats;
+  HTTPConnectionPoolOptions opts;
+  opts.max_connections_per_host = 1;
+  opts.wait_timeout_micros = 50 * kMicrosPerMilli;
+
+  // the second request can't get a connection in time
+  {
+    HTTPConnectionPool pool(testEventLoop(), &stats, opts);
+    auto first = pool.executeRequest(req, addr);
+    auto second = pool.executeRequest(req, addr);
+
+    try {
+      second.waitAndGet();
+      EXPECT_TRUE(false);
+    } catch (const std::exception& e) {
+      EXPECT_EQ(stats.pool_wait_timeouts.get(), 1);
+    }
+
+    EXPECT_EQ(first.waitAndGet().statusCode(), 200);
+  }
+
+  // destroying the pool fails queued requests, requests in flight complete
+  opts.wait_timeout_micros = 0;
+  Vector<Future<HTTPResponse>> responses;
+  {
+    HTTPConnectionPool pool(testEventLoop(), &stats, opts);
+    responses.emplace_back(pool.executeRequest(req, addr));
+    usleep(50 * kMicrosPerMilli);
+    responses.emplace_back(pool.executeRequest(req, addr));
+  }
+
+  try {
+    responses[1].waitAndGet();
+    EXPECT_TRUE(false);
+  } catch (Exception& e) {
+    EXPECT_EQ(String(e.getMessage()), "HTTPConnectionPool was destroyed");
+  }
+
+  EXPECT_EQ(responses[0].waitAndGet().statusCode(), 200);
+  EXPECT_EQ(responses[0].waitAndGet().body().toString(), "slow");
+});
+
+static const int kStalledServerTestPort = 18510;
+
+TEST_CASE(HTTPTest, TestHTTPConnectionPoolDestroyedFromCallback, [] () {
+  // the pool aborts the process, so destroy it in a child
+  auto pid = fork();
+  if (pid == 0) {
+    alarm(10);
+
+    // accepts connections but never answers, so the only connection stays busy
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(kStalledServerTestPort);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listen_fd, (struct sockaddr*) &saddr, sizeof(saddr)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+      _exit(1);
+    }
+
+    thread::EventLoop ev;
+    HTTPConnectionPoolOptions opts;
+    opts.max_connections_per_host = 1;
+    opts.wait_timeout_micros = 50 * kMicrosPerMilli;
+    auto pool = new HTTPConnectionPool(&ev, nullptr, opts);
+    auto addr = InetAddr::resolve(
+        StringUtil::format("127.0.0.1:$0", kStalledServerTestPort));
+
+    // the wait timeout fails the second request from one of the pool's
+    // callbacks
+    ev.runAsync([pool, addr] {
+      pool->executeRequest(HTTPRequest::mkGet("/first"), addr);
+      auto second = pool->executeRequest(HTTPRequest::mkGet("/second"), addr);
+      second.onFailure([pool] (const Status& status) {
+        delete pool;
+      });
+    });
+
+    ev.run();
+    _exit(0);
+  }
+
+  int status;
+  EXPECT_EQ(waitpid(pid, &status, 0), pid);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  EXPECT_EQ(WTERMSIG(status), SIGABRT);
+});
+
+static const int kPipeliningTestPort = 18508;
+
+TEST_CASE(HTTPTest, TestHTTPConnectionPoolPipeliningPerHost, [] () {
+  static const size_t kNumRequests = 8;
+
+  // earlier requests take longer, so out of order responses would show
+  static HTTPRouter router;
+  static TestHTTPService echo([] (HTTPRequest* req, HTTPResponse* res) {
+    auto idx = std::stoul(req->uri().substr(req->uri().rfind('/') + 1));
+    usleep((kNumRequests - idx) * 5 * kMicrosPerMilli);
+    res->setStatus(kStatusOK);
+    res->addBody(req->uri());
+  });
+
+  router.addRouteByPrefixMatch("/", &echo, testHandlerPool());
+  auto server = startTestServer(kPipeliningTestPort, &router);
+
+  auto addr = InetAddr::resolve(
+      StringUtil::format("127.0.0.1:$0", kPipeliningTestPort));
+
+  HTTPClientStats stats;
+  HTTPConnectionPoolOptions opts;
+  opts.max_connections_per_host = 1;
+  opts.host_pipelining_depth[addr.ipAndPort()] = kNumRequests;
+  HTTPConnectionPool pool(testEventLoop(), &stats, opts);
+
+  // open the connection and wait until it is back in the pool
+  auto first = pool.executeRequest(HTTPRequest::mkGet("/pipelined/0"), addr);
+  EXPECT_EQ(first.waitAndGet().body().toString(), "/pipelined/0");
+  for (int i = 0; i < 100 && stats.pool_idle_connections.get() == 0; ++i) {
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  Vector<Future<HTTPResponse>> responses;
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    responses.emplace_back(
+        pool.executeRequest(
+            HTTPRequest::mkGet(StringUtil::format("/pipelined/$0", i)),
+            addr));
+  }
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    EXPECT_EQ(
+        responses[i].waitAndGet().body().toString(),
+        StringUtil::format("/pipelined/$0", i));
+  }
+
+  // all requests went over the one connection, all but the first pipelined
+  EXPECT_EQ(server->stats()->total_connections.get(), 1);
+  EXPECT_EQ(stats.pool_pipelined.get(), kNumRequests - 1);
+});
+
+static const int kPipelinedBatchTestPort = 18509;
+
+TEST_CASE(HTTPTest, TestHTTPConnectionPoolPipeliningLargeBatch, [] () {
+  static const size_t kNumRequests = 64;
+  static const size_t kBodySize = 1024 * 1024;
+
+  // the server only reads the next request once it wrote the previous
+  // response, so the client must read responses while it's still writing
+  // the batch
+  static HTTPRouter router;
+  static TestHTTPService echo([] (HTTPRequest* req, HTTPResponse* res) {
+    res->setStatus(kStatusOK);
+    res->addBody(req->uri() + " " + req->body().toString());
+  });
+
+  router.addRouteByPrefixMatch("/", &echo, testHandlerPool());
+  startTestServer(kPipelinedBatchTestPort, &router);
+
+  auto addr = InetAddr::resolve(
+      StringUtil::format("127.0.0.1:$0", kPipelinedBatchTestPort));
+
+  HTTPClientStats stats;
+  HTTPConnectionPoolOptions opts;
+  opts.max_connections_per_host = 1;
+  opts.host_pipelining_depth[addr.ipAndPort()] = kNumRequests;
+  HTTPConnectionPool pool(testEventLoop(), &stats, opts);
+
+  auto first = pool.executeRequest(HTTPRequest::mkGet("/batch/first"), addr);
+  EXPECT_EQ(first.waitAndGet().body().toString(), "/batch/first ");
+  for (int i = 0; i < 100 && stats.pool_idle_connections.get() == 0; ++i) {
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  String body(kBodySize, 'x');
+  Vector<Future<HTTPResponse>> responses;
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    HTTPRequest req(
+        HTTPMessage::M_POST,
+        StringUtil::format("/batch/$0", i));
+    req.addBody(body);
+    responses.emplace_back(pool.executeRequest(req, addr));
+  }
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    EXPECT_TRUE(responses[i].waitFor(Duration(10 * kMicrosPerSecond)));
+    EXPECT_EQ(
+        responses[i].get().body().toString(),
+        StringUtil::format("/batch/$0 $1", i, body));
+  }
+
+  EXPECT_EQ(stats.pool_pipelined.get(), kNumRequests - 1);
+});
+
+static const int kResponseBudgetTestPort = 18503;
+
+/**
+ * Streams kTotalBytes per request in kChunkSize chunks as fast as the
+ * response stream lets it
+ */
+class TestProducerService : public StreamingHTTPService {
+public:
+  static const size_t kChunkSize = 16 * 1024;
+  static const size_t kTotalBytes = 64 * 1024 * 1024;
+
+  TestProducerService() : produced_bytes(0), chunk_(kChunkSize, 'x') {}
+
+  void handleHTTPRequest(
+      RefPtr<HTTPRequestStream> req,
+      RefPtr<HTTPResponseStream> res) override {
+    HTTPResponse resp;
+    resp.populateFromRequest(req->request());
+    resp.setStatus(kStatusOK);
+    resp.setHeader("Content-Length", StringUtil::toString(kTotalBytes));
+    res->startResponse(resp);
+    produce(res, 0);
+  }
+
+  std::atomic<size_t> produced_bytes;
+
+protected:
+
+  void produce(RefPtr<HTTPResponseStream> res, size_t offset) {
+    while (res->isWritable()) {
+      if (offset == kTotalBytes) {
+        res->finishResponse();
+        return;
+      }
+
+      res->writeBodyChunk(chunk_.data(), chunk_.size());
+      offset += chunk_.size();
+      produced_bytes += chunk_.size();
+    }
+
+    res->onWritable([this, res, offset] {
+      if (!res->isClosed()) {
+        produce(res, offset);
+      }
+    });
+  }
+
+  String chunk_;
+};
+
+TEST_CASE(HTTPTest, TestResponseBufferBudgetWithStalledReaders, [] () {
+  static const size_t kNumReaders = 8;
+  static const size_t kMaxTotalBytes = 128 * 1024;
+
+  // the producers get their own threads, so handlers that earlier tests left
+  // running on the shared pool can't delay them
+  auto handler_pool = new thread::FixedSizeThreadPool(
+      thread::ThreadPoolOptions{},
+      kNumReaders);
+  handler_pool->start();
+
+  static HTTPRouter router;
+  static TestProducerService producer;
+  router.addRouteByPrefixMatch("/", &producer, handler_pool);
+
+  HTTPServerOptions opts;
+  opts.max_response_buffer_bytes = 64 * 1024;
+  opts.max_total_response_buffer_bytes = kMaxTotalBytes;
+  auto server = startTestServer(kResponseBudgetTestPort, &router, opts);
+
+  // the readers send a request and then never read the response
+  Vector<std::unique_ptr<net::TCPConnection>> readers;
+  for (size_t i = 0; i < kNumReaders; ++i) {
+    readers.emplace_back(
+        sendTestRequest(
+            kResponseBudgetTestPort,
+            "GET /stream HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+  }
+
+  // wait until the socket buffers are full and the producers stalled
+  size_t produced = 0;
+  for (int i = 0; i < 100; ++i) {
+    usleep(100 * kMicrosPerMilli);
+    auto now_produced = producer.produced_bytes.load();
+    if (now_produced > 0 && now_produced == produced) {
+      break;
+    }
+
+    produced = now_produced;
+  }
+
+  // everything that was produced but not written to a socket yet must be
+  // on the budget, and each writer may overshoot the limit by one chunk
+  auto stats = server->stats();
+  auto max_buffered =
+      kMaxTotalBytes + kNumReaders * TestProducerService::kChunkSize;
+  EXPECT_TRUE(producer.produced_bytes.load() < kNumReaders *
+      TestProducerService::kTotalBytes);
+  EXPECT_TRUE(
+      producer.produced_bytes.load() <=
+      stats->sent_bytes.get() + stats->response_buffered_bytes.get());
+  EXPECT_TRUE(stats->response_buffered_bytes.get() <= max_buffered);
+  EXPECT_TRUE(stats->response_writer_suspends.get() > 0);
+
+  // the budget is returned once the readers are gone
+  readers.clear();
+  for (int i = 0; i < 100 && stats->response_buffered_bytes.get() > 0; ++i) {
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  EXPECT_EQ(stats->response_buffered_bytes.get(), 0);
+});
+
+static const int kRequestBodyTestPort = 18504;
+
+/**
+ * Reads the request body with HTTPRequestStream::readBody and responds with
+ * "<body bytes> <chunks> <all chunks on the handler thread>" or the body
+ * itself for /echo. On /gated, the first chunk blocks until the gate opens
+ */
+class TestUploadService : public StreamingHTTPService {
+public:
+
+  TestUploadService() : gate_open_(true) {}
+
+  void handleHTTPRequest(
+      RefPtr<HTTPRequestStream> req,
+      RefPtr<HTTPResponseStream> res) override {
+    auto gated = req->request().uri() == "/gated";
+    auto handler_thread = std::this_thread::get_id();
+    size_t bytes = 0;
+    size_t chunks = 0;
+    bool same_thread = true;
+    String body;
+
+    req->readBody([&] (const void* data, size_t size) {
+      if (gated && chunks == 0) {
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (!gate_open_) {
+          cv_.wait(lk);
+        }
+      }
+
+      same_thread = same_thread && std::this_thread::get_id() == handler_thread;
+      bytes += size;
+      ++chunks;
+      if (body.size() < 4096) {
+        body.append((const char*) data, size);
+      }
+    });
+
+    HTTPResponse resp;
+    resp.populateFromRequest(req->request());
+    resp.setStatus(kStatusOK);
+    if (req->request().uri() == "/echo") {
+      resp.addBody(body);
+    } else {
+      resp.addBody(StringUtil::format("$0 $1 $2", bytes, chunks, same_thread));
+    }
+
+    res->writeResponse(resp);
+  }
+
+  void setGate(bool open) {
+    std::unique_lock<std::mutex> lk(mutex_);
+    gate_open_ = open;
+    cv_.notify_all();
+  }
+
+protected:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool gate_open_;
+};
+
+static TestUploadService upload_test_service;
+
+static HTTPServer* uploadTestServer() {
+  static HTTPServer* server = nullptr;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    static HTTPRouter router;
+    router.addRouteByPrefixMatch("/", &upload_test_service, testHandlerPool());
+    server = startTestServer(kRequestBodyTestPort, &router);
+  });
+
+  return server;
+}
+
+TEST_CASE(HTTPTest, TestRequestBodyChunksOnHandlerThread, [] () {
+  uploadTestServer();
+
+  auto conn = sendTestRequest(
+      kRequestBodyTestPort,
+      "POST /echo HTTP/1.1\r\n" \
+      "Connection: close\r\n" \
+      "Content-Length: 11\r\n" \
+      "\r\n");
+
+  for (const auto& chunk : { "hello", " ", "world" }) {
+    usleep(20 * kMicrosPerMilli);
+    conn->write(chunk, strlen(chunk));
+  }
+
+  EXPECT_EQ(readTestResponseBody(conn.get()), "hello world");
+
+  auto conn2 = sendTestRequest(
+      kRequestBodyTestPort,
+      "POST /count HTTP/1.1\r\n" \
+      "Connection: close\r\n" \
+      "Content-Length: 10\r\n" \
+      "\r\n" \
+      "01234");
+
+  usleep(20 * kMicrosPerMilli);
+  conn2->write("56789", 5);
+  EXPECT_EQ(readTestResponseBody(conn2.get()), "10 2 true");
+});
+
+TEST_CASE(HTTPTest, TestRequestBodyBufferedWithHeaders, [] () {
+  uploadTestServer();
+
+  // the whole body arrives with the headers, so the request is complete
+  // before the handler starts reading the body
+  auto conn = sendTestRequest(
+      kRequestBodyTestPort,
+      "POST /echo HTTP/1.1\r\n" \
+      "Connection: close\r\n" \
+      "Content-Length: 5\r\n" \
+      "\r\n" \
+      "hello");
+
+  EXPECT_EQ(readTestResponseBody(conn.get()), "hello");
+});
+
+TEST_CASE(HTTPTest, TestRequestBodyPausesReading, [] () {
+  static const size_t kBodySize = 16 * 1024 * 1024;
+  auto stats = uploadTestServer()->stats();
+  auto received_before = stats->received_bytes.get();
+  upload_test_service.setGate(false);
+
+  auto conn = sendTestRequest(
+      kRequestBodyTestPort,
+      StringUtil::format(
+          "POST /gated HTTP/1.1\r\n" \
+          "Connection: close\r\n" \
+          "Content-Length: $0\r\n" \
+          "\r\n",
+          kBodySize));
+
+  // the writes block once the socket buffers are full
+  std::thread writer([&conn] {
+    String chunk(64 * 1024, 'x');
+    for (size_t n = 0; n < kBodySize; n += chunk.size()) {
+      conn->write(chunk.data(), chunk.size());
+    }
+  });
+
+  // the handler is stuck on the first chunk, so the server must stop reading
+  // the body after the first read
+  uint64_t received = 0;
+  for (int i = 0; i < 50; ++i) {
+    usleep(100 * kMicrosPerMilli);
+    auto now_received = stats->received_bytes.get() - received_before;
+    if (now_received > 0 && now_received == received) {
+      break;
+    }
+
+    received = now_received;
+  }
+
+  EXPECT_TRUE(received > 0);
+  EXPECT_TRUE(received < 1024 * 1024);
+
+  upload_test_service.setGate(true);
+  writer.join();
+
+  auto res = readTestResponseBody(conn.get());
+  EXPECT_TRUE(StringUtil::beginsWith(res, StringUtil::format("$0 ", kBodySize)));
+  EXPECT_TRUE(StringUtil::endsWith(res, " true"));
+});
+
+static const int kSSETestPort = 18505;
+
+/**
+ * Subscribes every request to the current test broadcaster
+ */
+class TestSSEService : public StreamingHTTPService {
+public:
+
+  TestSSEService() : broadcaster(nullptr) {}
+
+  void handleHTTPRequest(
+      RefPtr<HTTPRequestStream> req,
+      RefPtr<HTTPResponseStream> res) override {
+    auto sse = mkRef(new HTTPSSEStream(req, res));
+    sse->start();
+    broadcaster.load()->subscribe(sse);
+  }
+
+  std::atomic<HTTPSSEBroadcaster*> broadcaster;
+};
+
+static TestSSEService sse_test_service;
+
+static void startSSETestServer() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    static HTTPRouter router;
+    router.addRouteByPrefixMatch("/", &sse_test_service, testHandlerPool());
+    startTestServer(kSSETestPort, &router);
+  });
+}
+
+/**
+ * The handlers subscribe from the (shared, possibly busy) handler pool, so
+ * wait until they did before publishing anything
+ */
+static void waitForSubscribers(HTTPSSEBroadcaster* broadcaster, size_t n) {
+  for (int i = 0; i < 2000 && broadcaster->numSubscribers() < n; ++i) {
+    usleep(5 * kMicrosPerMilli);
+  }
+
+  EXPECT_EQ(broadcaster->numSubscribers(), n);
+}
+
+static void publishTestEvents(
+    HTTPSSEBroadcaster* broadcaster,
+    size_t first,
+    size_t n,
+    size_t padding,
+    uint64_t interval_micros) {
+  String pad(padding, 'x');
+  for (size_t i = first; i < first + n; ++i) {
+    broadcaster->publish(
+        StringUtil::format("event $0 $1", i, pad),
+        None<String>());
+
+    if (interval_micros > 0) {
+      usleep(interval_micros);
+    }
+  }
+}
+
+/**
+ * Read events until the data contains the marker or nothing arrived for
+ * idle_timeout_ms. Returns the number of events
+ */
+static size_t readTestEvents(
+    net::TCPConnection* conn,
+    const String& marker,
+    int idle_timeout_ms,
+    String* last_event = nullptr) {
+  String data;
+  char buf[65536];
+  for (;;) {
+    struct pollfd p;
+    p.fd = conn->fd();
+    p.events = POLLIN;
+    if (poll(&p, 1, idle_timeout_ms) <= 0) {
+      break;
+    }
+
+    auto len = conn->read(buf, sizeof(buf));
+    if (len == 0) {
+      break;
+    }
+
+    // only the new data (and what a marker split by the read may start with)
+    // needs to be searched
+    auto search_from = data.size() >= marker.size() ?
+        data.size() - marker.size() : 0;
+    data.append(buf, len);
+    if (!marker.empty() && data.find(marker, search_from) != String::npos) {
+      break;
+    }
+  }
+
+  size_t events = 0;
+  size_t last_pos = String::npos;
+  for (auto pos = data.find("data: event "); pos != String::npos;
+      pos = data.find("data: event ", pos + 1)) {
+    last_pos = pos;
+    ++events;
+  }
+
+  if (last_event && last_pos != String::npos) {
+    *last_event = data.substr(last_pos + 6, data.find(' ', last_pos + 12) -
+        last_pos - 6);
+  }
+
+  return events;
+}
+
+TEST_CASE(HTTPTest, TestSSEBroadcasterFanOut, [] () {
+  startSSETestServer();
+  HTTPSSEBroadcaster broadcaster;
+  sse_test_service.broadcaster = &broadcaster;
+
+  Vector<std::unique_ptr<net::TCPConnection>> readers;
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back(
+        sendTestRequest(kSSETestPort, "GET /sse HTTP/1.1\r\n\r\n"));
+  }
+
+  waitForSubscribers(&broadcaster, 3);
+  publishTestEvents(&broadcaster, 0, 100, 0, 0);
+
+  for (auto& reader : readers) {
+    EXPECT_EQ(readTestEvents(reader.get(), "event 99 ", 10000), 100);
+  }
+
+  EXPECT_EQ(broadcaster.stats()->published_events.get(), 100);
+  EXPECT_EQ(broadcaster.stats()->delivered_events.get(), 300);
+  EXPECT_EQ(broadcaster.stats()->dropped_events.get(), 0);
+
+  readers.clear();
+  publishTestEvents(&broadcaster, 100, 1, 0, 0);
+  for (int i = 0; i < 200 && broadcaster.numSubscribers() > 0; ++i) {
+    usleep(5 * kMicrosPerMilli);
+    publishTestEvents(&broadcaster, 101, 1, 0, 0);
+  }
+
+  EXPECT_EQ(broadcaster.numSubscribers(), 0);
+});
+
+TEST_CASE(HTTPTest, TestSSEBroadcasterDropsEventsForSlowSubscribers, [] () {
+  static const size_t kNumEvents = 2000;
+  startSSETestServer();
+
+  HTTPSSEBroadcasterOptions opts;
+  opts.max_lag_bytes = 1024 * 1024;
+  HTTPSSEBroadcaster broadcaster(opts);
+  sse_test_service.broadcaster = &broadcaster;
+
+  auto fast = sendTestRequest(kSSETestPort, "GET /sse HTTP/1.1\r\n\r\n");
+  auto slow = sendTestRequest(kSSETestPort, "GET /sse HTTP/1.1\r\n\r\n");
+  waitForSubscribers(&broadcaster, 2);
+
+  // both readers stop at the "done" event, which is published until both of
+  // them caught up far enough to receive it
+  std::atomic<size_t> readers_done(0);
+  size_t fast_events = 0;
+  std::thread fast_reader([&fast, &fast_events, &readers_done] {
+    fast_events = readTestEvents(fast.get(), "data: done", 10000);
+    ++readers_done;
+  });
+
+  // the slow subscriber doesn't read until everything was published
+  publishTestEvents(&broadcaster, 0, kNumEvents, 16 * 1024, 200);
+  auto delivered = broadcaster.stats()->delivered_events.get();
+  auto dropped = broadcaster.stats()->dropped_events.get();
+
+  size_t slow_events = 0;
+  std::thread slow_reader([&slow, &slow_events, &readers_done] {
+    slow_events = readTestEvents(slow.get(), "data: done", 10000);
+    ++readers_done;
+  });
+
+  for (int i = 0; i < 1000 && readers_done.load() < 2; ++i) {
+    broadcaster.publish("done", None<String>());
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  fast_reader.join();
+  slow_reader.join();
+
+  EXPECT_TRUE(slow_events < kNumEvents);
+  EXPECT_TRUE(fast_events > slow_events);
+  EXPECT_TRUE(dropped > 0);
+  EXPECT_EQ(broadcaster.stats()->coalesced_events.get(), 0);
+  EXPECT_EQ(delivered + dropped, kNumEvents * 2);
+});
+
+TEST_CASE(HTTPTest, TestSSEBroadcasterCoalescesEventsForSlowSubscribers, [] () {
+  static const size_t kNumEvents = 2000;
+  startSSETestServer();
+
+  HTTPSSEBroadcasterOptions opts;
+  opts.max_lag_bytes = 1024 * 1024;
+  opts.coalesce = true;
+  auto broadcaster = new HTTPSSEBroadcaster(opts);
+  sse_test_service.broadcaster = broadcaster;
+
+  auto slow = sendTestRequest(kSSETestPort, "GET /sse HTTP/1.1\r\n\r\n");
+  waitForSubscribers(broadcaster, 1);
+  publishTestEvents(broadcaster, 0, kNumEvents, 16 * 1024, 0);
+
+  // the latest event is sent once the subscriber caught up
+  String last_event;
+  auto events = readTestEvents(
+      slow.get(),
+      StringUtil::format("event $0 ", kNumEvents - 1),
+      10000,
+      &last_event);
+
+  EXPECT_TRUE(events < kNumEvents);
+  EXPECT_EQ(last_event, StringUtil::format("event $0", kNumEvents - 1));
+  EXPECT_TRUE(broadcaster->stats()->coalesced_events.get() > 0);
+  EXPECT_EQ(broadcaster->stats()->dropped_events.get(), 0);
+
+  // the subscriber still drains (and calls back into the broadcaster) after
+  // the broadcaster is gone
+  publishTestEvents(broadcaster, kNumEvents, kNumEvents, 16 * 1024, 0);
+  delete broadcaster;
+  sse_test_service.broadcaster = nullptr;
+  readTestEvents(slow.get(), "", 300);
+});
+
+static const int kDeadlineTestPort = 18506;
+static const uint64_t kDeadlineTestTimeoutMicros = 200 * kMicrosPerMilli;
+
+static HTTPServer* deadlineTestServer() {
+  static HTTPServer* server = nullptr;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    static HTTPRouter router;
+    static TestProducerService producer;
+    static TestHTTPService ok([] (HTTPRequest* req, HTTPResponse* res) {
+      res->setStatus(kStatusOK);
+      res->addBody("ok");
+    });
+
+    router.addRouteByPrefixMatch("/stream", &producer, testHandlerPool());
+    router.addRouteByPrefixMatch("/", &ok, testHandlerPool());
+
+    HTTPServerOptions opts;
+    opts.header_read_timeout_micros = kDeadlineTestTimeoutMicros;
+    opts.body_read_timeout_micros = kDeadlineTestTimeoutMicros;
+    opts.idle_timeout_micros = kDeadlineTestTimeoutMicros;
+    opts.write_timeout_micros = kDeadlineTestTimeoutMicros;
+    server = startTestServer(kDeadlineTestPort, &router, opts);
+  });
+
+  return server;
+}
+
+/**
+ * Returns true if the server closed the connection within timeout_ms. Any
+ * data that arrives in the meantime is discarded
+ */
+static bool waitForTestConnectionClose(
+    net::TCPConnection* conn,
+    int timeout_ms) {
+  char buf[65536];
+  auto deadline = WallClock::unixMicros() + timeout_ms * kMicrosPerMilli;
+  for (;;) {
+    auto now = WallClock::unixMicros();
+    if (now >= deadline) {
+      return false;
+    }
+
+    struct pollfd p;
+    p.fd = conn->fd();
+    p.events = POLLIN;
+    if (poll(&p, 1, (deadline - now) / kMicrosPerMilli + 1) <= 0) {
+      continue;
+    }
+
+    try {
+      if (conn->read(buf, sizeof(buf)) == 0) {
+        return true;
+      }
+    } catch (const std::exception& e) {
+      return true; // reset
+    }
+  }
+}
+
+TEST_CASE(HTTPTest, TestServerHeaderReadDeadline, [] () {
+  auto stats = deadlineTestServer()->stats();
+  auto timeouts_before = stats->header_read_timeouts.get();
+
+  // a slowloris client that keeps sending header bytes must still be cut off
+  auto conn = sendTestRequest(kDeadlineTestPort, "GET / HTTP/1.1\r\n");
+  auto started = WallClock::unixMicros();
+  bool closed = false;
+  for (int i = 0; i < 40 && !closed; ++i) {
+    try {
+      conn->write("X", 1);
+    } catch (const std::exception& e) {
+      closed = true;
+      break;
+    }
+
+    closed = waitForTestConnectionClose(conn.get(), 50);
+  }
+
+  EXPECT_TRUE(closed);
+  EXPECT_TRUE(
+      WallClock::unixMicros() - started < 10 * kDeadlineTestTimeoutMicros);
+  EXPECT_EQ(stats->header_read_timeouts.get(), timeouts_before + 1);
+});
+
+TEST_CASE(HTTPTest, TestServerBodyReadDeadline, [] () {
+  auto stats = deadlineTestServer()->stats();
+  auto timeouts_before = stats->body_read_timeouts.get();
+
+  auto conn = sendTestRequest(
+      kDeadlineTestPort,
+      "POST / HTTP/1.1\r\n" \
+      "Content-Length: 100\r\n" \
+      "\r\n" \
+      "abc");
+
+  EXPECT_TRUE(waitForTestConnectionClose(conn.get(), 2000));
+  EXPECT_EQ(stats->body_read_timeouts.get(), timeouts_before + 1);
+});
+
+TEST_CASE(HTTPTest, TestServerIdleDeadline, [] () {
+  auto stats = deadlineTestServer()->stats();
+  auto timeouts_before = stats->idle_timeouts.get();
+
+  // the first request is answered and the connection is kept alive ...
+  auto conn = sendTestRequest(kDeadlineTestPort, "GET / HTTP/1.1\r\n\r\n");
+  String response;
+  char buf[4096];
+  while (!StringUtil::endsWith(response, "\r\n\r\nok")) {
+    auto len = conn->read(buf, sizeof(buf));
+    if (len == 0) {
+      break;
+    }
+
+    response.append(buf, len);
+  }
+
+  EXPECT_TRUE(StringUtil::beginsWith(response, "HTTP/1.1 200"));
+
+  // ... until it was idle for too long
+  EXPECT_FALSE(
+      waitForTestConnectionClose(
+          conn.get(),
+          kDeadlineTestTimeoutMicros / kMicrosPerMilli / 2));
+  EXPECT_TRUE(waitForTestConnectionClose(conn.get(), 2000));
+  EXPECT_EQ(stats->idle_timeouts.get(), timeouts_before + 1);
+});
+
+TEST_CASE(HTTPTest, TestServerWriteDeadline, [] () {
+  auto stats = deadlineTestServer()->stats();
+  auto timeouts_before = stats->write_timeouts.get();
+
+  // the client never reads the response
+  auto conn = sendTestRequest(
+      kDeadlineTestPort,
+      "GET /stream HTTP/1.1\r\n\r\n");
+
+  for (int i = 0; i < 200; ++i) {
+    if (stats->write_timeouts.get() > timeouts_before) {
+      break;
+    }
+
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  EXPECT_EQ(stats->write_timeouts.get(), timeouts_before + 1);
+  EXPECT_TRUE(waitForTestConnectionClose(conn.get(), 2000));
+});
+
+static const int kCompressionTestPort = 18507;
+
+/**
+ * Streams kNumLines small text chunks, one body chunk per line, and pauses
+ * every few lines like a producer that waits for its data
+ */
+class TestLineService : public StreamingHTTPService {
+public:
+  static const size_t kNumLines = 4000;
+
+  static String line(size_t i) {
+    return StringUtil::format("line $0: fnord bar baz\n", i);
+  }
+
+  void handleHTTPRequest(
+      RefPtr<HTTPRequestStream> req,
+      RefPtr<HTTPResponseStream> res) override {
+    HTTPResponse resp;
+    resp.populateFromRequest(req->request());
+    resp.setStatus(kStatusOK);
+    resp.addHeader("Content-Type", "text/plain");
+    res->startResponse(resp);
+
+    for (size_t i = 0; i < kNumLines; ++i) {
+      auto l = line(i);
+      res->writeBodyChunk(l.data(), l.size());
+      if (i % 10 == 0) {
+        usleep(100);
+      }
+    }
+
+    res->finishResponse();
+  }
+};
+
+TEST_CASE(HTTPTest, TestCompressedResponseRoundtrip, [] () {
+  static HTTPRouter router;
+  static TestLineService lines;
+  router.addRouteByPrefixMatch("/", &lines, testHandlerPool());
+
+  HTTPServerOptions server_opts;
+  server_opts.content_encoding.enabled = true;
+  auto server = startTestServer(kCompressionTestPort, &router, server_opts);
+
+  String expected;
+  for (size_t i = 0; i < TestLineService::kNumLines; ++i) {
+    expected += TestLineService::line(i);
+  }
+
+  auto addr = InetAddr::resolve(
+      StringUtil::format("127.0.0.1:$0", kCompressionTestPort));
+  auto req = HTTPRequest::mkGet("/lines");
+  req.addHeader("Host", "localhost");
+  req.addHeader("Accept-Encoding", "gzip");
+
+  HTTPClientStats client_stats;
+  HTTPConnectionPoolOptions pool_opts;
+  pool_opts.max_connections_per_host = 1;
+  HTTPConnectionPool pool(testEventLoop(), &client_stats, pool_opts);
+
+  // the chunked framing keeps the connection open for the second request
+  for (int i = 0; i < 2; ++i) {
+    auto res = pool.executeRequest(req, addr).waitAndGet();
+    EXPECT_EQ(res.statusCode(), 200);
+    EXPECT_EQ(res.body().toString(), expected);
+    EXPECT_FALSE(res.hasHeader("Content-Encoding"));
+    EXPECT_FALSE(res.hasHeader("Content-Length"));
+  }
+
+  auto stats = server->stats();
+  EXPECT_EQ(stats->total_connections.get(), 1);
+  EXPECT_EQ(stats->compressed_responses.get(), 2);
+  EXPECT_EQ(stats->compression_bytes_in.get(), expected.size() * 2);
+  EXPECT_EQ(client_stats.decompressed_responses.get(), 2);
+
+  // the small chunks must be compressed together, not flushed one by one
+  EXPECT_TRUE(
+      stats->compression_bytes_out.get() * 8 <
+      stats->compression_bytes_in.get());
+});
+
+static const int kHTTP2TestPort = 18511;
+
+/**
+ * Answers /echo/<n> with the path and the request body, earlier requests
+ * take longer so that out of order responses would show. /slow waits for
+ * 100ms
+ */
+static HTTPServer* http2TestServer() {
+  static HTTPServer* server = nullptr;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    static HTTPRouter router;
+    static TestHTTPService echo([] (HTTPRequest* req, HTTPResponse* res) {
+      if (req->uri() == "/slow") {
+        usleep(100 * kMicrosPerMilli);
+      } else if (StringUtil::beginsWith(req->uri(), "/echo/")) {
+        auto idx = std::stoul(req->uri().substr(6));
+        usleep((64 - idx % 64) * kMicrosPerMilli);
+      }
+
+      res->setStatus(kStatusOK);
+      res->addHeader("X-Method", StringUtil::toString(req->method()));
+      res->addBody(req->uri() + " " + req->body().toString());
+    });
+
+    router.addRouteByPrefixMatch("/", &echo, testHandlerPool());
+    server = startTestServer(kHTTP2TestPort, &router);
+  });
+
+  return server;
+}
+
+static ScopedPtr<HTTPClientConnection> connectHTTP2(
+    HTTPClientConnection::Protocol protocol,
+    HTTPClientStats* stats) {
+  return ScopedPtr<HTTPClientConnection>(
+      new HTTPClientConnection(
+          net::TCPConnection::connect(
+              InetAddr::resolve(
+                  StringUtil::format("127.0.0.1:$0", kHTTP2TestPort))),
+          testEventLoop(),
+          stats,
+          protocol));
+}
+
+static Future<HTTPResponse> executeHTTP2Request(
+    HTTPClientConnection* conn,
+    const HTTPRequest& req) {
+  Promise<HTTPResponse> promise;
+  conn->executeRequest(req, new HTTPResponseFuture(promise));
+  return promise.future();
+}
+
+TEST_CASE(HTTPTest, TestHTTP2PriorKnowledge, [] () {
+  http2TestServer();
+
+  // a raw client, so that the server is not only tested against our client
+  auto conn = sendTestRequest(kHTTP2TestPort, "");
+  Buffer wire;
+  wire.append(
+      HTTP2Frame::kConnectionPreface,
+      HTTP2Frame::kConnectionPrefaceSize);
+  HTTP2Frame::mkSettings({}).writeTo(&wire);
+
+  HTTPMessage::HeaderList headers;
+  headers.emplace_back(":method", "GET");
+  headers.emplace_back(":scheme", "http");
+  headers.emplace_back(":authority", "localhost");
+  headers.emplace_back(":path", "/raw");
+  HTTP2Frame req(
+      HTTP2FrameType::HEADERS,
+      HTTP2Frame::kFlagEndHeaders | HTTP2Frame::kFlagEndStream,
+      1);
+  HPACKEncoder encoder;
+  encoder.encode(headers, &req.payload);
+  req.writeTo(&wire);
+  conn->write(wire.data(), wire.size());
+
+  Vector<HTTP2Frame> frames;
+  HTTP2FrameParser parser;
+  parser.onFrame([&frames] (const HTTP2Frame& frame) {
+    frames.emplace_back(frame);
+  });
+
+  HPACKDecoder decoder;
+  HTTPMessage::HeaderList res_headers;
+  String body;
+  bool done = false;
+  while (!done) {
+    char buf[4096];
+    auto len = conn->read(buf, sizeof(buf));
+    EXPECT_TRUE(len > 0);
+    parser.parse(buf, len);
+
+    // the server starts with its SETTINGS
+    if (body.empty() && res_headers.empty() && !frames.empty()) {
+      EXPECT_TRUE(frames[0].type == HTTP2FrameType::SETTINGS);
+    }
+
+    for (const auto& frame : frames) {
+      const char* data;
+      size_t size;
+      frame.data(&data, &size);
+
+      if (frame.stream_id == 1 && frame.type == HTTP2FrameType::HEADERS) {
+        decoder.decode(data, size, &res_headers);
+      }
+
+      if (frame.stream_id == 1 && frame.type == HTTP2FrameType::DATA) {
+        body.append(data, size);
+      }
+
+      done = done || (
+          frame.stream_id == 1 &&
+          frame.hasFlag(HTTP2Frame::kFlagEndStream));
+    }
+
+    frames.clear();
+  }
+
+  EXPECT_EQ(res_headers[0].first, ":status");
+  EXPECT_EQ(res_headers[0].second, "200");
+  EXPECT_EQ(body, "/raw ");
+});
+
+TEST_CASE(HTTPTest, TestHTTP2Multiplexing, [] () {
+  static const size_t kNumRequests = 64;
+  auto server = http2TestServer();
+  auto connections = server->stats()->total_connections.get();
+
+  auto addr = InetAddr::resolve(
+      StringUtil::format("127.0.0.1:$0", kHTTP2TestPort));
+
+  HTTPClientStats stats;
+  HTTPConnectionPoolOptions opts;
+  opts.max_connections_per_host = 1;
+  opts.host_pipelining_depth[addr.ipAndPort()] = kNumRequests;
+  opts.host_protocol[addr.ipAndPort()] = HTTPClientConnection::Protocol::H2C;
+  HTTPConnectionPool pool(testEventLoop(), &stats, opts);
+
+  // open the connection and wait until it is back in the pool
+  auto first = pool.executeRequest(HTTPRequest::mkGet("/first"), addr);
+  EXPECT_EQ(first.waitAndGet().body().toString(), "/first ");
+  EXPECT_EQ(first.get().version(), "HTTP/2.0");
+  for (int i = 0; i < 100 && stats.pool_idle_connections.get() == 0; ++i) {
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  Vector<Future<HTTPResponse>> responses;
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    HTTPRequest req(HTTPMessage::M_POST, StringUtil::format("/echo/$0", i));
+    req.addBody(StringUtil::toString(i * i));
+    responses.emplace_back(pool.executeRequest(req, addr));
+  }
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    EXPECT_TRUE(responses[i].waitFor(Duration(10 * kMicrosPerSecond)));
+    const auto& res = responses[i].get();
+    EXPECT_EQ(res.statusCode(), 200);
+    EXPECT_EQ(res.getHeader("X-Method"), "POST");
+    EXPECT_EQ(
+        res.body().toString(),
+        StringUtil::format("/echo/$0 $1", i, i * i));
+  }
+
+  // all requests were multiplexed onto a single connection
+  EXPECT_EQ(server->stats()->total_connections.get(), connections + 1);
+  EXPECT_EQ(stats.http2_connections.get(), 1);
+  EXPECT_EQ(stats.pool_pipelined.get(), kNumRequests - 1);
+});
+
+TEST_CASE(HTTPTest, TestHTTP2FlowControl, [] () {
+  static const size_t kNumRequests = 4;
+  static const size_t kBodySize = 4 * 1024 * 1024;
+  http2TestServer();
+
+  // the bodies exceed the connection and stream windows in both directions
+  HTTPClientStats stats;
+  auto conn = connectHTTP2(HTTPClientConnection::Protocol::H2C, &stats);
+
+  Vector<String> bodies;
+  Vector<Future<HTTPResponse>> responses;
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    bodies.emplace_back(kBodySize, 'a' + i);
+    HTTPRequest req(HTTPMessage::M_PUT, StringUtil::format("/large/$0", i));
+    req.addBody(bodies.back());
+    responses.emplace_back(executeHTTP2Request(conn.get(), req));
+  }
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    EXPECT_TRUE(responses[i].waitFor(Duration(10 * kMicrosPerSecond)));
+    EXPECT_TRUE(
+        responses[i].get().body().toString() ==
+        StringUtil::format("/large/$0 $1", i, bodies[i]));
+  }
+
+  EXPECT_TRUE(stats.sent_bytes.get() > kNumRequests * kBodySize);
+  EXPECT_TRUE(stats.received_bytes.get() > kNumRequests * kBodySize);
+});
+
+TEST_CASE(HTTPTest, TestHTTP2Upgrade, [] () {
+  auto server = http2TestServer();
+  auto upgrades = server->stats()->http2_connections.get();
+
+  // the first request is sent as the HTTP/1.1 upgrade request
+  HTTPClientStats stats;
+  auto conn = connectHTTP2(
+      HTTPClientConnection::Protocol::H2C_UPGRADE,
+      &stats);
+
+  auto req = HTTPRequest::mkGet("/upgrade");
+  req.addHeader("Host", "localhost");
+  auto first = executeHTTP2Request(conn.get(), req);
+  auto second = executeHTTP2Request(conn.get(), HTTPRequest::mkGet("/next"));
+
+  EXPECT_EQ(first.waitAndGet().version(), "HTTP/2.0");
+  EXPECT_EQ(first.get().body().toString(), "/upgrade ");
+  EXPECT_EQ(second.waitAndGet().body().toString(), "/next ");
+
+  // a request with a body waits for an OPTIONS upgrade request
+  auto conn2 = connectHTTP2(
+      HTTPClientConnection::Protocol::H2C_UPGRADE,
+      &stats);
+
+  HTTPRequest post(HTTPMessage::M_POST, "/upgrade/post");
+  post.addBody("payload");
+  auto third = executeHTTP2Request(conn2.get(), post);
+  EXPECT_EQ(third.waitAndGet().body().toString(), "/upgrade/post payload");
+  EXPECT_EQ(third.get().getHeader("X-Method"), "POST");
+
+  EXPECT_EQ(server->stats()->http2_connections.get(), upgrades + 2);
+  EXPECT_EQ(stats.http2_connections.get(), 2);
+});
+
+TEST_CASE(HTTPTest, TestHTTP2PingAndGoAway, [] () {
+  http2TestServer();
+
+  auto conn = connectHTTP2(HTTPClientConnection::Protocol::H2C, nullptr);
+  auto http2 = conn->http2();
+  auto rtt = http2->ping();
+  EXPECT_TRUE(rtt.waitFor(Duration(kMicrosPerSecond)));
+  EXPECT_TRUE(rtt.get() < Duration(kMicrosPerSecond));
+
+  // the open stream completes after the GOAWAY, new requests are refused
+  auto slow = executeHTTP2Request(conn.get(), HTTPRequest::mkGet("/slow"));
+  usleep(10 * kMicrosPerMilli);
+  http2->shutdown();
+  EXPECT_FALSE(conn->canPipeline());
+
+  auto refused = false;
+  try {
+    executeHTTP2Request(conn.get(), HTTPRequest::mkGet("/refused"));
+  } catch (Exception& e) {
+    refused = true;
+  }
+
+  EXPECT_TRUE(refused);
+  EXPECT_EQ(slow.waitAndGet().body().toString(), "/slow ");
+
+  // the connection is closed once the last stream is done
+  for (int i = 0; i < 100 && !http2->isClosed(); ++i) {
+    usleep(10 * kMicrosPerMilli);
+  }
+
+  EXPECT_TRUE(http2->isClosed());
+});
+
 //TEST_CASE(HTTPTest, TestHTTPConnectionPoolEnd2End, [] () {
 //  stx::thread::ThreadPool tp;
 //  HTTPConnectionPool http_pool(&tp);
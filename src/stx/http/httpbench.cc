@@ -0,0 +1,335 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "stx/application.h"
+#include "stx/exception.h"
+#include "stx/stdtypes.h"
+#include "stx/uri.h"
+#include "stx/wallclock.h"
+#include "stx/cli/flagparser.h"
+#include "stx/http/httpconnectionpool.h"
+#include "stx/thread/eventloop.h"
+#include "stx/util/LatencyHistogram.h"
+
+using namespace stx;
+
+/**
+ * stx-httpbench drives a HTTP server with GET requests and reports throughput
+ * and latency percentiles.
+ *
+ * Without --rate, it runs closed loop: every connection keeps --pipeline
+ * requests in flight and sends the next request as soon as a response
+ * arrives. This measures peak throughput.
+ *
+ * With --rate, requests are sent open loop on a fixed schedule, regardless of
+ * whether earlier requests completed. Latencies are measured from the time a
+ * request was scheduled to be sent rather than from the time it was actually
+ * sent, so that a stalled server can't hide its latency by slowing down the
+ * load generator (coordinated omission).
+ *
+ * Example:
+ *
+ *   $ stx-httpbench --url http://localhost:8080/ping --connections 32 \
+ *         --rate 20000 --duration 30 --max-p99 5
+ *
+ */
+struct BenchmarkState {
+  BenchmarkState(const InetAddr& _addr) : addr(_addr) {}
+
+  thread::EventLoop* ev;
+  http::HTTPConnectionPool* pool;
+  InetAddr addr;
+  http::HTTPRequest request;
+  bool closed_loop;
+  uint64_t rate;
+  uint64_t start;
+  uint64_t end;
+  uint64_t num_scheduled;
+  util::LatencyHistogram latencies;
+  std::atomic<uint64_t> num_inflight;
+  std::atomic<uint64_t> num_ok;
+  std::atomic<uint64_t> num_bad_status;
+  std::atomic<uint64_t> num_errors;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+static void requestFinished(BenchmarkState* state) {
+  if (state->num_inflight.fetch_sub(1) == 1) {
+    std::unique_lock<std::mutex> lk(state->mutex);
+    state->cv.notify_all();
+  }
+}
+
+static void sendRequest(BenchmarkState* state, uint64_t scheduled_at) {
+  state->num_inflight.fetch_add(1);
+
+  auto future = state->pool->executeRequest(state->request, state->addr);
+
+  future.onSuccess([state, scheduled_at] (const http::HTTPResponse& res) {
+    auto now = WallClock::unixMicros();
+    state->latencies.record(now - scheduled_at);
+
+    if (res.statusCode() >= 200 && res.statusCode() < 300) {
+      state->num_ok.fetch_add(1);
+    } else {
+      state->num_bad_status.fetch_add(1);
+    }
+
+    if (state->closed_loop && now < state->end) {
+      sendRequest(state, now);
+    }
+
+    requestFinished(state);
+  });
+
+  future.onFailure([state] (const Status& status) {
+    state->num_errors.fetch_add(1);
+
+    auto now = WallClock::unixMicros();
+    if (state->closed_loop && now < state->end) {
+      sendRequest(state, now);
+    }
+
+    requestFinished(state);
+  });
+}
+
+static void sendScheduledRequests(BenchmarkState* state) {
+  auto now = WallClock::unixMicros();
+  auto due = ((std::min(now, state->end) - state->start) * state->rate) /
+      kMicrosPerSecond + 1;
+
+  for (; state->num_scheduled < due; ++state->num_scheduled) {
+    sendRequest(
+        state,
+        state->start + state->num_scheduled * kMicrosPerSecond / state->rate);
+  }
+
+  if (now < state->end) {
+    state->ev->runAfter(std::bind(&sendScheduledRequests, state), 1000);
+  }
+}
+
+int main(int argc, const char** argv) {
+  Application::init();
+  Application::logToStderr(LogLevel::kWarning);
+
+  cli::FlagParser flags;
+
+  flags.defineFlag(
+      "url",
+      cli::FlagParser::T_STRING,
+      false,
+      "u",
+      NULL,
+      "target url",
+      "<url>");
+
+  flags.defineFlag(
+      "connections",
+      cli::FlagParser::T_INTEGER,
+      false,
+      "c",
+      "16",
+      "number of connections",
+      "<num>");
+
+  flags.defineFlag(
+      "pipeline",
+      cli::FlagParser::T_INTEGER,
+      false,
+      "p",
+      "1",
+      "max number of pipelined requests per connection",
+      "<num>");
+
+  flags.defineFlag(
+      "rate",
+      cli::FlagParser::T_INTEGER,
+      false,
+      "r",
+      "0",
+      "requests per second (open loop), 0 means as fast as possible",
+      "<rps>");
+
+  flags.defineFlag(
+      "duration",
+      cli::FlagParser::T_INTEGER,
+      false,
+      "d",
+      "10",
+      "benchmark duration in seconds",
+      "<secs>");
+
+  flags.defineFlag(
+      "max-p99",
+      cli::FlagParser::T_INTEGER,
+      false,
+      NULL,
+      NULL,
+      "exit with an error if the p99 latency exceeds this many milliseconds",
+      "<ms>");
+
+  flags.defineFlag(
+      "help",
+      cli::FlagParser::T_SWITCH,
+      false,
+      "?",
+      NULL,
+      "help",
+      "<help>");
+
+  try {
+    flags.parseArgv(argc, argv);
+  } catch (const std::exception& e) {
+    fprintf(stderr, "error: %s\n\n", e.what());
+    flags.printUsage(OutputStream::getStderr().get());
+    return 1;
+  }
+
+  if (flags.isSet("help") || !flags.isSet("url")) {
+    flags.printUsage(OutputStream::getStdout().get());
+    return flags.isSet("help") ? 0 : 1;
+  }
+
+  URI uri(flags.getString("url"));
+  auto num_connections = flags.getInt("connections");
+  auto pipeline_depth = flags.getInt("pipeline");
+  auto duration = flags.getInt("duration") * kMicrosPerSecond;
+
+  if (num_connections < 1 || pipeline_depth < 1) {
+    RAISE(kIllegalArgumentError, "--connections and --pipeline must be >= 1");
+  }
+
+  auto addr = InetAddr::resolve(uri.hostAndPort());
+  if (!addr.hasPort()) {
+    addr.setPort(80);
+  }
+
+  thread::EventLoop ev;
+  auto ev_thread = std::thread([&ev] { ev.run(); });
+
+  // the state must outlive the pool, destroying the pool fails the requests
+  // that are still waiting for a connection
+  BenchmarkState state(addr);
+
+  http::HTTPConnectionPoolOptions pool_opts;
+  pool_opts.max_connections_per_host = num_connections;
+  pool_opts.max_idle_connections_per_host = num_connections;
+  pool_opts.pipelining_depth = pipeline_depth;
+  http::HTTPConnectionPool pool(&ev, nullptr, pool_opts);
+
+  auto num_prewarmed = pool.prewarm(addr, num_connections).waitAndGet();
+  if (num_prewarmed < (size_t) num_connections) {
+    fprintf(
+        stderr,
+        "warning: only %llu of %lli connections could be opened\n",
+        (unsigned long long) num_prewarmed,
+        (long long) num_connections);
+  }
+
+  state.ev = &ev;
+  state.pool = &pool;
+  state.request = http::HTTPRequest::mkGet(uri);
+  state.rate = flags.getInt("rate");
+  state.closed_loop = state.rate == 0;
+  state.num_scheduled = 0;
+  state.num_inflight = 0;
+  state.num_ok = 0;
+  state.num_bad_status = 0;
+  state.num_errors = 0;
+
+  state.start = WallClock::unixMicros();
+  state.end = state.start + duration;
+
+  if (state.closed_loop) {
+    ev.runAsync([&state, num_connections, pipeline_depth] {
+      for (int64_t i = 0; i < num_connections * pipeline_depth; ++i) {
+        sendRequest(&state, state.start);
+      }
+    });
+  } else {
+    ev.runAsync(std::bind(&sendScheduledRequests, &state));
+  }
+
+  // wait for all requests to complete, but don't wait forever for a stalled
+  // server
+  {
+    auto deadline = state.end + 10 * kMicrosPerSecond;
+    std::unique_lock<std::mutex> lk(state.mutex);
+    for (;;) {
+      auto now = WallClock::unixMicros();
+      if (now >= deadline ||
+          (now >= state.end && state.num_inflight.load() == 0)) {
+        break;
+      }
+
+      auto wakeup = now < state.end ? state.end : deadline;
+      state.cv.wait_for(lk, std::chrono::microseconds(wakeup - now));
+    }
+  }
+
+  auto elapsed = WallClock::unixMicros() - state.start;
+  auto num_timeouts = state.num_inflight.load();
+  auto num_completed = state.num_ok.load() + state.num_bad_status.load();
+  const auto& lat = state.latencies;
+
+  printf("target:      %s\n", uri.toString().c_str());
+  printf(
+      "load:        %lli connections, pipeline depth %lli, %s\n",
+      (long long) num_connections,
+      (long long) pipeline_depth,
+      state.closed_loop ?
+          "closed loop" :
+          StringUtil::format("open loop @ $0 req/s", state.rate).c_str());
+  printf("duration:    %.2fs\n", elapsed / (double) kMicrosPerSecond);
+  printf(
+      "requests:    %llu ok, %llu non-2xx, %llu errors, %llu timeouts\n",
+      (unsigned long long) state.num_ok.load(),
+      (unsigned long long) state.num_bad_status.load(),
+      (unsigned long long) state.num_errors.load(),
+      (unsigned long long) num_timeouts);
+  printf(
+      "throughput:  %.1f req/s\n",
+      num_completed / (elapsed / (double) kMicrosPerSecond));
+  printf(
+      "latency:     mean=%.3fms p50=%.3fms p90=%.3fms p99=%.3fms "
+      "p99.9=%.3fms max=%.3fms\n",
+      lat.mean() / 1000.0,
+      lat.percentile(50) / 1000.0,
+      lat.percentile(90) / 1000.0,
+      lat.percentile(99) / 1000.0,
+      lat.percentile(99.9) / 1000.0,
+      lat.max() / 1000.0);
+  fflush(stdout);
+
+  int rc = 0;
+  if (state.num_errors.load() > 0 || num_timeouts > 0) {
+    rc = 1;
+  }
+
+  if (flags.isSet("max-p99") &&
+      lat.percentile(99) > flags.getInt("max-p99") * 1000) {
+    fprintf(stderr, "p99 latency exceeds --max-p99\n");
+    rc = 1;
+  }
+
+  // stop the event loop first so that requests that timed out can't call
+  // back into the state any more, then the pool is destroyed
+  ev.shutdown();
+  ev_thread.join();
+  return rc;
+}
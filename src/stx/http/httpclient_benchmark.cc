@@ -0,0 +1,113 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <signal.h>
+#include <thread>
+#include "stx/stdtypes.h"
+#include "stx/exception.h"
+#include "stx/wallclock.h"
+#include "stx/http/httpconnectionpool.h"
+#include "stx/http/httprouter.h"
+#include "stx/http/httpserver.h"
+#include "stx/http/httpservice.h"
+#include "stx/test/benchmark.h"
+#include "stx/thread/eventloop.h"
+
+using namespace stx;
+
+/**
+ * Measures HTTPConnectionPool throughput against a local HTTPServer with
+ * different pipelining depths. Each round issues batches of concurrent
+ * requests (like a scatter-gather query would) and waits for all responses
+ * before starting the next batch.
+ */
+
+static const int kPort = 18420;
+static const size_t kNumBatches = 500;
+static const size_t kBatchSize = 64;
+static const size_t kMaxConnections = 4;
+
+class PingService : public http::HTTPService {
+public:
+  void handleHTTPRequest(
+      http::HTTPRequest* req,
+      http::HTTPResponse* res) override {
+    res->setStatus(http::kStatusOK);
+    res->addHeader("Content-Type", "text/plain");
+    res->addBody("pong");
+  }
+};
+
+static Benchmark::BenchmarkResult benchmarkPipelining(
+    thread::EventLoop* ev,
+    size_t depth) {
+  http::HTTPClientStats stats;
+  http::HTTPConnectionPoolOptions opts;
+  opts.max_connections_per_host = kMaxConnections;
+  opts.pipelining_depth = depth;
+  opts.idle_timeout_micros = 0; // the pool doesn't outlive this function
+  http::HTTPConnectionPool pool(ev, &stats, opts);
+
+  auto addr = InetAddr::resolve(StringUtil::format("127.0.0.1:$0", kPort));
+  auto req = http::HTTPRequest::mkGet(
+      StringUtil::format("http://127.0.0.1:$0/ping", kPort));
+
+  auto t0 = WallClock::unixMicros();
+
+  for (size_t i = 0; i < kNumBatches; ++i) {
+    Vector<Future<http::HTTPResponse>> responses;
+    for (size_t j = 0; j < kBatchSize; ++j) {
+      responses.emplace_back(pool.executeRequest(req, addr));
+    }
+
+    for (auto& r : responses) {
+      if (r.waitAndGet().statusCode() != 200) {
+        RAISE(kRuntimeError, "request failed");
+      }
+    }
+  }
+
+  auto t1 = WallClock::unixMicros();
+
+  return Benchmark::BenchmarkResult(
+      (t1 - t0) * 1000,
+      kNumBatches * kBatchSize);
+}
+
+int main(int argc, const char** argv) {
+  signal(SIGPIPE, SIG_IGN);
+
+  thread::EventLoop server_ev;
+  PingService ping_service;
+  http::HTTPRouter router;
+  router.addRouteByPrefixMatch("/ping", &ping_service, &server_ev);
+  http::HTTPServer server(&router, &server_ev);
+  server.listen(kPort);
+  std::thread server_thread([&server_ev] { server_ev.run(); });
+
+  thread::EventLoop client_ev;
+  std::thread client_thread([&client_ev] { client_ev.run(); });
+
+  bool append = false;
+  for (auto depth : Vector<size_t>{ 1, 2, 4, 8, 16 }) {
+    Benchmark::printResultTable(
+        StringUtil::format("http pipelining depth=$0", depth),
+        benchmarkPipelining(&client_ev, depth),
+        append);
+
+    append = true;
+  }
+
+  client_ev.shutdown();
+  server_ev.shutdown();
+  client_thread.join();
+  server_thread.join();
+  return 0;
+}
@@ -7,6 +7,8 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <errno.h>
+#include <sys/socket.h>
 #include <stx/exception.h>
 #include <stx/inspect.h>
 #include <stx/http/httpgenerator.h>
@@ -19,20 +21,111 @@ namespace http {
 HTTPClientConnection::HTTPClientConnection(
     std::unique_ptr<net::TCPConnection> conn,
     TaskScheduler* scheduler,
-    HTTPClientStats* stats) :
+    HTTPClientStats* stats,
+    Protocol protocol /* = Protocol::HTTP1 */) :
     conn_(std::move(conn)),
     scheduler_(scheduler),
     state_(S_CONN_IDLE),
     parser_(HTTPParser::PARSE_HTTP_RESPONSE),
+    reading_(false),
+    writing_(false),
+    content_encoding_(ContentEncoding::IDENTITY),
     keepalive_(false),
+    closing_(false),
     stats_(stats) {
-  buf_.reserve(kMinBufferSize);
+  read_buf_.reserve(kMinBufferSize);
   conn_->checkErrors();
+  conn_->setNoDelay(true);
 
   if (stats_ != nullptr) {
     stats_->current_connections.incr(1);
     stats_->total_connections.incr(1);
   }
+
+  if (protocol != Protocol::HTTP1) {
+    http2_ = HTTP2ClientConnection::start(
+        std::move(conn_),
+        scheduler_,
+        stats_,
+        protocol == Protocol::H2C_UPGRADE);
+
+    return;
+  }
+
+  parser_.onVersion([this] (const char* data, size_t size) {
+    std::string version(data, size);
+    keepalive_ = pending_.front().keepalive && version == "HTTP/1.1";
+    pending_.front().handler->onVersion(version);
+  });
+
+  parser_.onStatusName([this] (const char* data, size_t size) {
+    pending_.front().handler->onStatusName(std::string(data, size));
+  });
+
+  parser_.onStatusCode([this] (int code) {
+    pending_.front().handler->onStatusCode(code);
+  });
+
+  parser_.onHeader([this] (
+      const char* key,
+      size_t key_size,
+      const char* val,
+      size_t val_size) {
+    std::string key_str(key, key_size);
+    std::string val_str(val, val_size);
+
+    auto key_low = key_str;
+    StringUtil::toLower(&key_low);
+    if (key_low == "connection") {
+      auto val_low = val_str;
+      StringUtil::toLower(&val_low);
+      if (val_low == "close") {
+        keepalive_ = false;
+      }
+    }
+
+    if (key_low == "content-encoding") {
+      content_encoding_ = HTTPContentEncoder::fromString(val_str);
+      if (content_encoding_ != ContentEncoding::IDENTITY) {
+        return;
+      }
+    }
+
+    // the Content-Encoding may come after the Content-Length, so we only
+    // know whether to forward it once all headers were read
+    if (key_low == "content-length") {
+      content_length_headers_.emplace_back(key_str, val_str);
+      return;
+    }
+
+    pending_.front().handler->onHeader(key_str, val_str);
+  });
+
+  parser_.onHeadersComplete([this] () {
+    auto handler = pending_.front().handler;
+    if (content_encoding_ != ContentEncoding::IDENTITY) {
+      decoder_.reset(new HTTPContentDecoder(content_encoding_));
+    } else {
+      for (const auto& header : content_length_headers_) {
+        handler->onHeader(header.first, header.second);
+      }
+    }
+
+    content_length_headers_.clear();
+    handler->onHeadersComplete();
+  });
+
+  parser_.onBodyChunk([this] (const char* data, size_t size) {
+    auto handler = pending_.front().handler;
+
+    if (decoder_.get()) {
+      decoder_->decode(data, size, [handler] (const char* data, size_t size) {
+        handler->onBodyChunk(data, size);
+      });
+    } else {
+      handler->onBodyChunk(data, size);
+    }
+  });
 }
 
 HTTPClientConnection::~HTTPClientConnection() {
@@ -40,86 +133,197 @@ HTTPClientConnection::~HTTPClientConnection() {
     stats_->current_connections.decr(1);
   }
 
+  if (http2_.get()) {
+    http2_->close();
+    return;
+  }
+
   if (state_ != S_CONN_CLOSED) {
     close();
   }
 }
 
 Wakeup* HTTPClientConnection::onReady() {
+  if (http2_.get()) {
+    return http2_->onReady();
+  }
+
   return &on_ready_;
 }
 
 bool HTTPClientConnection::isIdle() const {
+  if (http2_.get()) {
+    return http2_->numPendingRequests() == 0;
+  }
+
   return state_ == S_CONN_IDLE;
 }
 
+bool HTTPClientConnection::isReusable() const {
+  if (http2_.get()) {
+    return http2_->numPendingRequests() == 0 && http2_->canExecute();
+  }
+
+  if (state_ != S_CONN_IDLE) {
+    return false;
+  }
+
+  // an idle connection must not be readable. if it is, the peer either
+  // closed it or sent unsolicited data, neither of which we can recover from
+  char c;
+  auto res = ::recv(conn_->fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+bool HTTPClientConnection::canPipeline() const {
+  if (http2_.get()) {
+    return http2_->canExecute();
+  }
+
+  std::unique_lock<std::mutex> l(mutex_);
+  return state_ != S_CONN_CLOSED && !closing_;
+}
+
+size_t HTTPClientConnection::numPendingRequests() const {
+  if (http2_.get()) {
+    return http2_->numPendingRequests();
+  }
+
+  std::unique_lock<std::mutex> l(mutex_);
+  return pending_.size();
+}
+
 void HTTPClientConnection::executeRequest(
     const HTTPRequest& request,
     HTTPResponseHandler* response_handler) {
+  if (http2_.get()) {
+    http2_->executeRequest(request, response_handler);
+    return;
+  }
+
   std::unique_lock<std::mutex> l(mutex_);
 
-  if (state_ != S_CONN_IDLE) {
-    RAISE(
-        kIllegalStateError,
-        "executeRequest called on non-idle HTTP connection");
+  switch (state_) {
+    case S_CONN_IDLE:
+      break;
+    case S_CONN_BUSY:
+      if (closing_) {
+        RAISE(
+            kIllegalStateError,
+            "can't pipeline request on closing HTTP connection");
+      }
+      break;
+    case S_CONN_CLOSED:
+      RAISE(
+          kIllegalStateError,
+          "executeRequest called on closed HTTP connection");
   }
 
-  parser_.onVersion([this] (const char* data, size_t size) {
-    cur_handler_->onVersion(std::string(data, size));
-  });
-
-  parser_.onStatusName([this] (const char* data, size_t size) {
-    cur_handler_->onStatusName(std::string(data, size));
-  });
+  executeRequestImpl(request, response_handler);
+}
 
-  parser_.onStatusCode([this] (int code) {
-    cur_handler_->onStatusCode(code);
-  });
+bool HTTPClientConnection::tryPipelineRequest(
+    const HTTPRequest& request,
+    Function<HTTPResponseHandler* ()> handler_factory) {
+  if (http2_.get()) {
+    // N.B. an idle connection is about to be parked by its owner
+    if (http2_->numPendingRequests() == 0 || !http2_->canExecute()) {
+      return false;
+    }
 
-  parser_.onHeader([this] (
-      const char* key,
-      size_t key_size,
-      const char* val,
-      size_t val_size) {
-    cur_handler_->onHeader(
-        std::string(key, key_size),
-        std::string(val, val_size));
-  });
+    http2_->executeRequest(request, handler_factory());
+    return true;
+  }
 
+  std::unique_lock<std::mutex> l(mutex_);
 
-  parser_.onHeadersComplete([this] () {
-    cur_handler_->onHeadersComplete();
-  });
+  if (state_ != S_CONN_BUSY || closing_) {
+    return false;
+  }
 
-  parser_.onBodyChunk([this] (const char* data, size_t size) {
-    cur_handler_->onBodyChunk(data, size);
-  });
+  executeRequestImpl(request, handler_factory());
+  return true;
+}
 
-  if (request.method() == HTTPRequest::M_HEAD) {
-    parser_.ignoreBody();
+// precondition: must hold mutex
+void HTTPClientConnection::executeRequestImpl(
+    const HTTPRequest& request,
+    HTTPResponseHandler* response_handler) {
+  PendingRequest pending;
+  pending.handler = response_handler;
+  pending.head = request.method() == HTTPRequest::M_HEAD;
+  pending.keepalive =
+      request.version() == "HTTP/1.1" &&
+      request.getHeader("Connection") != "close";
+
+  if (!pending.keepalive) {
+    closing_ = true;
   }
 
-  buf_.clear();
-  BufferOutputStream os(&buf_);
+  pending_.emplace_back(pending);
+
+  BufferOutputStream os(&write_buf_);
   HTTPGenerator::generate(request, &os);
-  state_ = S_CONN_BUSY;
-  cur_handler_ = response_handler;
 
   if (stats_ != nullptr) {
     stats_->current_requests.incr(1);
     stats_->total_requests.incr(1);
   }
 
-  awaitWrite();
+  if (state_ == S_CONN_IDLE) {
+    state_ = S_CONN_BUSY;
+    startResponse();
+    awaitWrite();
+    return;
+  }
+
+  if (writing_) {
+    return; // the running write will pick up the new request
+  }
+
+  // we are waiting for a response, try to send the pipelined request right
+  // away. whatever doesn't fit into the socket buffer is written while we
+  // keep reading responses
+  auto res = conn_->tryWrite(
+      (char*) write_buf_.data() + write_buf_.mark(),
+      write_buf_.size() - write_buf_.mark());
+
+  // ignore errors, they will be reported by the next read
+  if (res.ok()) {
+    write_buf_.setMark(write_buf_.mark() + res.bytes);
+    if (stats_ != nullptr) {
+      stats_->sent_bytes.incr(res.bytes);
+    }
+  }
+
+  if (write_buf_.mark() < write_buf_.size()) {
+    awaitWrite();
+  }
+}
+
+HTTP2ClientConnection* HTTPClientConnection::http2() const {
+  return http2_.get();
 }
 
+// precondition: must hold mutex
 void HTTPClientConnection::awaitRead() {
+  if (reading_) {
+    return;
+  }
+
+  reading_ = true;
   scheduler_->runOnReadable(
       std::bind(&HTTPClientConnection::read, this),
       *conn_);
 }
 
+// precondition: must hold mutex
 void HTTPClientConnection::awaitWrite() {
+  if (writing_) {
+    return;
+  }
+
+  writing_ = true;
   scheduler_->runOnWritable(
       std::bind(&HTTPClientConnection::write, this),
       *conn_);
@@ -135,116 +339,225 @@ void HTTPClientConnection::close() {
   conn_->close();
 }
 
-void HTTPClientConnection::keepalive() {
-  state_ = S_CONN_IDLE;
+// precondition: must hold mutex
+void HTTPClientConnection::startResponse() {
   parser_.reset();
-  buf_.clear();
+  content_encoding_ = ContentEncoding::IDENTITY;
+  content_length_headers_.clear();
+  decoder_.reset(nullptr);
   keepalive_ = false;
+
+  if (pending_.front().head) {
+    parser_.ignoreBody();
+  }
+}
+
+// precondition: must hold mutex
+HTTPResponseHandler* HTTPClientConnection::completeResponse() {
+  auto handler = pending_.front().handler;
+  pending_.pop_front();
+
+  if (stats_ != nullptr) {
+    stats_->current_requests.decr(1);
+  }
+
+  recordDecompressionStats();
+  return handler;
 }
 
 void HTTPClientConnection::read() {
-  mutex_.lock();
+  std::unique_lock<std::mutex> lk(mutex_);
+  reading_ = false;
 
-  size_t len;
-  try {
-    len = conn_->read(buf_.data(), buf_.allocSize());
-    if (stats_ != nullptr) {
-      stats_->received_bytes.incr(len);
-    }
-  } catch (Exception& e) {
-    if (e.ofType(kWouldBlockError)) {
-      std::lock_guard<std::mutex> l(mutex_, std::adopt_lock_t {});
-      return awaitRead();
-    } else {
-      close();
-      mutex_.unlock();
-      error(e);
-    }
+  auto res = conn_->tryRead(read_buf_.data(), read_buf_.allocSize());
+  if (res.wouldBlock()) {
+    return awaitRead();
+  }
+
+  if (res.failed()) {
+    close();
+    lk.unlock();
+    error(res.toException("read() failed"));
     return;
   }
 
+  size_t len = res.bytes;
+  if (stats_ != nullptr) {
+    stats_->received_bytes.incr(len);
+  }
+
+  Vector<HTTPResponseHandler*> completed;
+  bool close_conn = len == 0;
   try {
     if (len == 0) {
-      parser_.eof();
+      // responses without a Content-Length end with the connection. if the
+      // response didn't even start, the request fails below
+      if (parser_.state() != HTTPParser::S_RES_VERSION) {
+        parser_.eof();
+        completed.emplace_back(completeResponse());
+      }
     } else {
-      parser_.parse((char *) buf_.data(), len);
+      auto data = (const char*) read_buf_.data();
+      size_t pos = 0;
+
+      // a single read may contain any number of pipelined responses
+      while (pos < len) {
+        pos += parser_.parse(data + pos, len - pos);
+        if (parser_.state() != HTTPParser::S_DONE) {
+          break;
+        }
+
+        completed.emplace_back(completeResponse());
+        if (!keepalive_) {
+          close_conn = true;
+          break;
+        }
+
+        if (pending_.empty()) {
+          break;
+        }
+
+        startResponse();
+      }
     }
   } catch (Exception& e) {
     close();
-    mutex_.unlock();
+    lk.unlock();
+
+    for (auto handler : completed) {
+      handler->onResponseComplete();
+    }
+
     error(e);
     return;
   }
 
-  if (parser_.state() == HTTPParser::S_DONE) {
-    if (stats_ != nullptr) {
-      stats_->current_requests.decr(1);
+  bool ready = false;
+  if (close_conn) {
+    close();
+    ready = true;
+  } else if (pending_.empty()) {
+    state_ = S_CONN_IDLE;
+    parser_.reset();
+    ready = true;
+  } else {
+    // the server may not read the remaining pipelined requests before we
+    // read its responses, so keep reading while they are written
+    if (write_buf_.mark() < write_buf_.size()) {
+      awaitWrite();
     }
 
-    if (keepalive_) {
-      keepalive();
-    } else {
-      close();
+    awaitRead();
+  }
+
+  // requests that were pipelined behind a response that closed the
+  // connection will never receive a response
+  Deque<PendingRequest> failed;
+  if (state_ == S_CONN_CLOSED) {
+    failed.swap(pending_);
+
+    if (stats_ != nullptr) {
+      stats_->current_requests.decr(failed.size());
     }
+  }
 
-    mutex_.unlock();
+  lk.unlock();
 
-    scheduler_->runOnNextWakeup(
-        std::bind(&HTTPResponseHandler::onResponseComplete, cur_handler_),
-        &on_ready_);
+  for (size_t i = 0; i + 1 < completed.size(); ++i) {
+    completed[i]->onResponseComplete();
+  }
+
+  // N.B. the connection may be deleted by its owner once on_ready_ was woken
+  // up, so we must not access any members after this point
+  if (ready) {
+    if (!completed.empty()) {
+      scheduler_->runOnNextWakeup(
+          std::bind(
+              &HTTPResponseHandler::onResponseComplete,
+              completed.back()),
+          &on_ready_);
+    }
 
     on_ready_.wakeup();
-  } else {
-    std::lock_guard<std::mutex> l(mutex_, std::adopt_lock_t {});
-    awaitRead();
+  } else if (!completed.empty()) {
+    completed.back()->onResponseComplete();
+  }
+
+  if (!failed.empty()) {
+    Exception e("connection closed before response was received");
+    e.setTypeName(kIOError);
+
+    for (const auto& pending : failed) {
+      pending.handler->onError(e);
+    }
   }
 }
 
 void HTTPClientConnection::write() {
-  mutex_.lock();
+  std::unique_lock<std::mutex> lk(mutex_);
+  writing_ = false;
 
-  auto data = ((char *) buf_.data()) + buf_.mark();
-  auto size = buf_.size() - buf_.mark();
+  auto data = ((char *) write_buf_.data()) + write_buf_.mark();
+  auto size = write_buf_.size() - write_buf_.mark();
 
-  size_t len;
-  try {
-    len = conn_->write(data, size);
-    buf_.setMark(buf_.mark() + len);
-    if (stats_ != nullptr) {
-      stats_->sent_bytes.incr(len);
-    }
-  } catch (Exception& e) {
-    if (e.ofType(kWouldBlockError)) {
-      std::lock_guard<std::mutex> l(mutex_, std::adopt_lock_t {});
-      return awaitWrite();
-    } else {
-      close();
-      mutex_.unlock();
-      error(e);
-      return;
-    }
+  auto res = conn_->tryWrite(data, size);
+  if (res.wouldBlock()) {
+    return awaitWrite();
+  }
+
+  if (res.failed()) {
+    close();
+    lk.unlock();
+    error(res.toException("write() failed"));
+    return;
   }
 
-  std::lock_guard<std::mutex> l(mutex_, std::adopt_lock_t {});
+  write_buf_.setMark(write_buf_.mark() + res.bytes);
+  if (stats_ != nullptr) {
+    stats_->sent_bytes.incr(res.bytes);
+  }
 
-  if (buf_.mark() < buf_.size()) {
+  if (write_buf_.mark() < write_buf_.size()) {
     awaitWrite();
   } else {
-    buf_.clear();
+    write_buf_.clear();
+  }
+
+  if (state_ == S_CONN_BUSY) {
     awaitRead();
   }
 }
 
+void HTTPClientConnection::recordDecompressionStats() {
+  if (stats_ == nullptr || decoder_.get() == nullptr) {
+    return;
+  }
+
+  stats_->decompressed_responses.incr(1);
+  stats_->decompression_bytes_in.incr(decoder_->bytesIn());
+  stats_->decompression_bytes_out.incr(decoder_->bytesOut());
+  stats_->decompression_cpu_micros.incr(decoder_->cpuTimeMicros());
+}
 
+// precondition: must not hold mutex
 void HTTPClientConnection::error(const std::exception& e) {
-  if (cur_handler_) {
-    if (stats_ != nullptr) {
-      stats_->current_requests.decr(1);
-    }
+  Deque<PendingRequest> failed;
+
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    failed.swap(pending_);
   }
 
+  if (stats_ != nullptr) {
+    stats_->current_requests.decr(failed.size());
+  }
+
+  // N.B. the connection may be deleted once on_ready_ was woken up
   on_ready_.wakeup();
-  cur_handler_->onError(e);
+
+  for (const auto& pending : failed) {
+    pending.handler->onError(e);
+  }
 }
 
 }
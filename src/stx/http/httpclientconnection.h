@@ -16,6 +16,8 @@
 #include <stx/http/httprequest.h>
 #include <stx/http/httpresponse.h>
 #include <stx/http/httpstats.h>
+#include <stx/http/HTTP2ClientConnection.h>
+#include <stx/http/HTTPContentEncoding.h>
 #include <stx/net/inetaddr.h>
 #include <stx/net/tcpconnection.h>
 #include <stx/thread/taskscheduler.h>
@@ -28,24 +30,92 @@ class HTTPClientConnection {
 public:
   static const size_t kMinBufferSize = 4096;
 
+  /**
+   * The protocol that is spoken on the connection. H2C speaks HTTP/2 with
+   * prior knowledge, H2C_UPGRADE upgrades from HTTP/1.1 with the first
+   * request. See HTTP2ClientConnection
+   */
+  enum class Protocol {
+    HTTP1,
+    H2C,
+    H2C_UPGRADE
+  };
+
+  /**
+   * On a HTTP/2 connection, all requests are multiplexed onto the connection
+   * and complete in any order. The connection is busy while a request is
+   * outstanding, so more requests are executed with tryPipelineRequest,
+   * which doesn't wait for the previous responses
+   */
   HTTPClientConnection(
       std::unique_ptr<net::TCPConnection> conn,
       TaskScheduler* scheduler,
-      HTTPClientStats* stats);
+      HTTPClientStats* stats,
+      Protocol protocol = Protocol::HTTP1);
 
   ~HTTPClientConnection();
 
   HTTPClientConnection(const HTTPClientConnection& other) = delete;
   HTTPClientConnection& operator=(const HTTPClientConnection& other) = delete;
 
+  /**
+   * Execute a request on this connection. Responses with a gzip or deflate
+   * Content-Encoding are decompressed transparently before the body is passed
+   * to the response handler; the Content-Encoding and Content-Length headers
+   * of such responses are not forwarded. Note that the connection does not
+   * add an Accept-Encoding header, it is up to the caller to request a
+   * compressed response
+   *
+   * If the connection is busy the request is pipelined, i.e. it is written
+   * right behind the outstanding requests and the responses are passed to
+   * the handlers in request order. This is only legal if canPipeline returns
+   * true. Requests that are pipelined behind a response that closes the
+   * connection fail with an IOError
+   */
   void executeRequest(
       const HTTPRequest& request,
       HTTPResponseHandler* response_handler);
 
+  /**
+   * Pipeline the request onto this connection if it is busy and canPipeline
+   * is true. Returns false without calling the handler factory otherwise
+   */
+  bool tryPipelineRequest(
+      const HTTPRequest& request,
+      Function<HTTPResponseHandler* ()> handler_factory);
+
+  /**
+   * Woken up once all outstanding requests are completed (or failed)
+   */
   Wakeup* onReady();
 
   bool isIdle() const;
 
+  /**
+   * Returns true if another request may be pipelined onto this connection,
+   * i.e. if the connection is open and none of the outstanding requests asked
+   * for it to be closed
+   */
+  bool canPipeline() const;
+
+  /**
+   * Returns the number of requests that were sent (or queued for sending)
+   * but did not receive a response yet
+   */
+  size_t numPendingRequests() const;
+
+  /**
+   * Returns true if the connection is idle and was not closed by the peer in
+   * the meantime, i.e. if it is safe to execute another request on it
+   */
+  bool isReusable() const;
+
+  /**
+   * Returns the HTTP/2 connection or nullptr if the connection speaks
+   * HTTP/1.1
+   */
+  HTTP2ClientConnection* http2() const;
+
 protected:
 
   enum kHTTPClientConnectionState {
@@ -54,25 +124,44 @@ protected:
     S_CONN_CLOSED
   };
 
+  struct PendingRequest {
+    HTTPResponseHandler* handler;
+    bool head;
+    bool keepalive;
+  };
+
   void read();
   void write();
   void awaitRead();
   void awaitWrite();
   void close();
-  void keepalive();
+  void executeRequestImpl(
+      const HTTPRequest& request,
+      HTTPResponseHandler* response_handler);
+  void startResponse();
+  HTTPResponseHandler* completeResponse();
 
   void error(const std::exception& e);
+  void recordDecompressionStats();
 
   std::unique_ptr<net::TCPConnection> conn_;
   TaskScheduler* scheduler_;
   kHTTPClientConnectionState state_;
   HTTPParser parser_;
-  Buffer buf_;
-  std::mutex mutex_;
-  HTTPResponseHandler* cur_handler_;
+  Buffer read_buf_;
+  Buffer write_buf_;
+  bool reading_;
+  bool writing_;
+  mutable std::mutex mutex_;
+  Deque<PendingRequest> pending_;
+  ContentEncoding content_encoding_;
+  Vector<Pair<String, String>> content_length_headers_;
+  ScopedPtr<HTTPContentDecoder> decoder_;
   Wakeup on_ready_;
   bool keepalive_;
+  bool closing_;
   HTTPClientStats* stats_;
+  RefPtr<HTTP2ClientConnection> http2_;
 };
 
 }
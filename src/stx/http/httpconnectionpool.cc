@@ -7,17 +7,143 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <stdlib.h>
+#include <time.h>
+#include <thread>
 #include "stx/exception.h"
+#include "stx/logging.h"
 #include "stx/http/httpconnectionpool.h"
 
 namespace stx {
 namespace http {
 
+// idle connections must not expire early (or never) if the wall clock jumps
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    RAISE_ERRNO(kRuntimeError, "clock_gettime() failed");
+  }
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+HTTPConnectionPoolOptions::HTTPConnectionPoolOptions() :
+    num_shards(kDefaultNumShards),
+    max_connections_per_host(kDefaultMaxConnectionsPerHost),
+    max_idle_connections_per_host(kDefaultMaxIdleConnectionsPerHost),
+    idle_timeout_micros(kDefaultIdleTimeoutMicros),
+    pipelining_depth(kDefaultPipeliningDepth),
+    wait_timeout_micros(kDefaultWaitTimeoutMicros) {}
+
+HTTPConnectionPool::HostPool::HostPool() : num_connections(0) {}
+
+HTTPConnectionPool::Handle::Handle(
+    HTTPConnectionPool* _pool) :
+    pool(_pool) {}
+
 HTTPConnectionPool::HTTPConnectionPool(
     stx::TaskScheduler* scheduler,
-    HTTPClientStats* stats) :
+    HTTPClientStats* stats,
+    const HTTPConnectionPoolOptions& opts) :
     scheduler_(scheduler),
-    stats_(stats) {}
+    opts_(opts),
+    eviction_scheduled_(false),
+    next_waiter_id_(1),
+    handle_(new Handle(this)),
+    stats_(stats) {
+  auto num_shards = opts_.num_shards > 0 ? opts_.num_shards : 1;
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+HTTPConnectionPool::~HTTPConnectionPool() {
+  // callbacks that start from now on see the null pointer, wait for the ones
+  // that are already running
+  {
+    std::unique_lock<std::mutex> lk(handle_->mutex);
+    handle_->pool = nullptr;
+
+    // a callback that destroys the pool would wait for itself forever
+    auto& running = handle_->running;
+    if (std::find(running.begin(), running.end(), std::this_thread::get_id()) !=
+        running.end()) {
+      logEmergency(
+          "http.client",
+          "HTTPConnectionPool was destroyed from one of its own callbacks");
+      abort();
+    }
+
+    while (!running.empty()) {
+      handle_->cv.wait(lk);
+    }
+  }
+
+  Vector<HTTPClientConnection*> idle;
+  Vector<Promise<HTTPResponse>> waiters;
+
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+
+    for (auto& host : shard->hosts) {
+      for (const auto& idle_conn : host.second.idle) {
+        idle.emplace_back(idle_conn.conn);
+      }
+
+      for (const auto& waiter : host.second.waiters) {
+        waiters.emplace_back(waiter.promise);
+      }
+    }
+
+    shard->hosts.clear();
+  }
+
+  for (auto conn : idle) {
+    delete conn;
+  }
+
+  if (stats_ != nullptr) {
+    stats_->pool_idle_connections.decr(idle.size());
+  }
+
+  for (auto& promise : waiters) {
+    promise.failure(
+        Status(eIOError, "HTTPConnectionPool was destroyed"));
+  }
+}
+
+bool HTTPConnectionPool::withPool(
+    RefPtr<Handle> handle,
+    Function<void (HTTPConnectionPool* pool)> fn) {
+  auto thread_id = std::this_thread::get_id();
+  HTTPConnectionPool* pool;
+  {
+    std::unique_lock<std::mutex> lk(handle->mutex);
+    pool = handle->pool;
+    if (pool == nullptr) {
+      return false;
+    }
+
+    handle->running.emplace_back(thread_id);
+  }
+
+  try {
+    fn(pool);
+  } catch (...) {
+    handle->callbackDone(thread_id);
+    throw;
+  }
+
+  handle->callbackDone(thread_id);
+  return true;
+}
+
+void HTTPConnectionPool::Handle::callbackDone(std::thread::id thread_id) {
+  std::unique_lock<std::mutex> lk(mutex);
+  running.erase(std::find(running.begin(), running.end(), thread_id));
+  cv.notify_all();
+}
 
 Future<HTTPResponse> HTTPConnectionPool::executeRequest(
     const HTTPRequest& req) {
@@ -46,12 +172,44 @@ Future<HTTPResponse> HTTPConnectionPool::executeRequest(
     RAISE(kRuntimeError, "missing Host header");
   }
 
-  auto addr = dns_cache_.resolve(req.getHeader("Host"));
-  if (!addr.hasPort()) {
-    addr.setPort(80);
+  Promise<HTTPResponse> promise;
+
+  /* fast path: the address is cached, don't go through the resolver pool */
+  auto cached = dns_cache_.lookup(req.getHeader("Host"));
+  if (!cached.isEmpty()) {
+    auto addr = cached.get();
+    if (!addr.hasPort()) {
+      addr.setPort(80);
+    }
+
+    dispatchRequest(req, addr, promise, factory);
+    return promise.future();
   }
 
-  return executeRequest(req, addr, factory);
+  auto resolved = dns_cache_.resolveAsync(req.getHeader("Host"));
+
+  auto handle = handle_;
+  resolved.onSuccess([handle, req, promise, factory] (
+      const InetAddr& res) mutable {
+    auto addr = res;
+    if (!addr.hasPort()) {
+      addr.setPort(80);
+    }
+
+    auto dispatched = withPool(handle, [&] (HTTPConnectionPool* pool) {
+      pool->dispatchRequest(req, addr, promise, factory);
+    });
+
+    if (!dispatched) {
+      promise.failure(Status(eIOError, "HTTPConnectionPool was destroyed"));
+    }
+  });
+
+  resolved.onFailure([promise] (const Status& status) mutable {
+    promise.failure(status);
+  });
+
+  return promise.future();
 }
 
 Future<HTTPResponse> HTTPConnectionPool::executeRequest(
@@ -59,6 +217,20 @@ Future<HTTPResponse> HTTPConnectionPool::executeRequest(
     const stx::InetAddr& addr,
     Function<HTTPResponseFuture* (Promise<HTTPResponse> promise)> factory) {
   Promise<HTTPResponse> promise;
+  dispatchRequest(req, addr, promise, factory);
+  return promise.future();
+}
+
+void HTTPConnectionPool::dispatchRequest(
+    const HTTPRequest& req,
+    const stx::InetAddr& addr,
+    Promise<HTTPResponse> promise,
+    Function<HTTPResponseFuture* (Promise<HTTPResponse> promise)> factory) {
+  auto pipelining_depth = pipeliningDepth(addr);
+  if (pipelining_depth > 1 &&
+      pipelineRequest(req, addr, pipelining_depth, promise, factory)) {
+    return;
+  }
 
   leaseConnection(
       addr,
@@ -72,73 +244,514 @@ Future<HTTPResponse> HTTPConnectionPool::executeRequest(
       http_future->onError(e);
     }
   });
+}
 
-  return promise.future();
+/**
+ * Counts the outstanding connection attempts of a prewarm call
+ */
+struct PrewarmState : public RefCounted {
+  PrewarmState(size_t num) : num_pending(num), num_opened(0) {}
+
+  void attemptFinished(bool opened) {
+    if (opened) {
+      ++num_opened;
+    }
+
+    if (--num_pending == 0) {
+      promise.success(num_opened.load());
+    }
+  }
+
+  Promise<size_t> promise;
+  std::atomic<size_t> num_pending;
+  std::atomic<size_t> num_opened;
+};
+
+Future<size_t> HTTPConnectionPool::prewarm(
+    const stx::InetAddr& addr,
+    size_t num_connections) {
+  auto key = addr.ipAndPort();
+  auto shard = getShard(key);
+  size_t num_new = 0;
+
+  {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+    auto& host = shard->hosts[key];
+
+    while (num_new < num_connections &&
+        host.num_connections < opts_.max_idle_connections_per_host &&
+        (opts_.max_connections_per_host == 0 ||
+         host.num_connections < opts_.max_connections_per_host)) {
+      ++host.num_connections;
+      ++num_new;
+    }
+  }
+
+  if (num_new == 0) {
+    Promise<size_t> promise;
+    promise.success(0);
+    return promise.future();
+  }
+
+  auto handle = handle_;
+  auto state = mkRef(new PrewarmState(num_new));
+  for (size_t i = 0; i < num_new; ++i) {
+    openConnection(
+        addr,
+        [this, addr, state] (ScopedPtr<HTTPClientConnection> conn) {
+          parkConnection(conn.release(), addr);
+          state->attemptFinished(true);
+        },
+        [handle, addr, state] (const std::exception& e) {
+          logDebug("http.client", e, "prewarm connection failed");
+          withPool(handle, [&addr] (HTTPConnectionPool* pool) {
+            pool->releaseConnectionSlot(addr);
+          });
+
+          state->attemptFinished(false);
+        });
+  }
+
+  return state->promise.future();
+}
+
+bool HTTPConnectionPool::pipelineRequest(
+    const HTTPRequest& req,
+    const stx::InetAddr& addr,
+    size_t pipelining_depth,
+    Promise<HTTPResponse> promise,
+    Function<HTTPResponseFuture* (Promise<HTTPResponse> promise)> factory) {
+  auto key = addr.ipAndPort();
+  auto shard = getShard(key);
+  std::unique_lock<std::mutex> lk(shard->mutex);
+  auto& host = shard->hosts[key];
+
+  // idle connections are always preferred
+  if (!host.idle.empty()) {
+    return false;
+  }
+
+  HTTPClientConnection* conn = nullptr;
+  size_t conn_load = pipelining_depth;
+  for (auto c : host.active) {
+    auto load = c->numPendingRequests();
+    if (load < conn_load && c->canPipeline()) {
+      conn = c;
+      conn_load = load;
+    }
+  }
+
+  if (conn == nullptr) {
+    return false;
+  }
+
+  // N.B. we must hold the shard lock until the request is enqueued so the
+  // connection can't be parked or deleted in the meantime
+  auto pipelined = conn->tryPipelineRequest(req, [promise, factory] {
+    return factory(promise);
+  });
+
+  lk.unlock();
+
+  if (pipelined && stats_ != nullptr) {
+    stats_->pool_pipelined.incr(1);
+  }
+
+  return pipelined;
+}
+
+HTTPConnectionPool::Shard* HTTPConnectionPool::getShard(const String& key) {
+  return shards_[std::hash<String>()(key) % shards_.size()].get();
+}
+
+size_t HTTPConnectionPool::pipeliningDepth(const stx::InetAddr& addr) const {
+  const auto& overrides = opts_.host_pipelining_depth;
+  if (overrides.empty()) {
+    return opts_.pipelining_depth;
+  }
+
+  auto iter = overrides.find(addr.hostAndPort());
+  if (iter == overrides.end()) {
+    iter = overrides.find(addr.ipAndPort());
+  }
+
+  if (iter == overrides.end()) {
+    return opts_.pipelining_depth;
+  }
+
+  return iter->second;
+}
+
+HTTPClientConnection::Protocol HTTPConnectionPool::protocol(
+    const stx::InetAddr& addr) const {
+  const auto& overrides = opts_.host_protocol;
+  if (overrides.empty()) {
+    return HTTPClientConnection::Protocol::HTTP1;
+  }
+
+  auto iter = overrides.find(addr.hostAndPort());
+  if (iter == overrides.end()) {
+    iter = overrides.find(addr.ipAndPort());
+  }
+
+  if (iter == overrides.end()) {
+    return HTTPClientConnection::Protocol::HTTP1;
+  }
+
+  return iter->second;
 }
 
 void HTTPConnectionPool::parkConnection(
     HTTPClientConnection* conn,
     InetAddr addr) {
-  if (conn->isIdle()) {
-    std::unique_lock<std::mutex> l(connection_cache_mutex_);
-    connection_cache_.emplace(addr.ipAndPort(), conn);
-  } else {
+  if (pipeliningDepth(addr) > 1) {
+    auto shard = getShard(addr.ipAndPort());
+    std::unique_lock<std::mutex> lk(shard->mutex);
+    shard->hosts[addr.ipAndPort()].active.remove(conn);
+  }
+
+  if (!conn->isReusable()) {
+    delete conn;
+    releaseConnectionSlot(addr);
+    return;
+  }
+
+  auto key = addr.ipAndPort();
+  auto shard = getShard(key);
+  std::unique_lock<std::mutex> lk(shard->mutex);
+  auto& host = shard->hosts[key];
+
+  // hand the connection straight to the oldest queued request
+  if (!host.waiters.empty()) {
+    auto waiter = host.waiters.front();
+    host.waiters.pop_front();
+    lk.unlock();
+
+    if (stats_ != nullptr) {
+      stats_->pool_hits.incr(1);
+    }
+
+    dispatchConnection(conn, addr, waiter.callback);
+    return;
+  }
+
+  if (host.idle.size() >= opts_.max_idle_connections_per_host) {
+    --host.num_connections;
+    lk.unlock();
     delete conn;
+    return;
   }
+
+  host.idle.emplace_back(IdleConnection { conn, monotonicMicros() });
+  lk.unlock();
+
+  if (stats_ != nullptr) {
+    stats_->pool_idle_connections.incr(1);
+  }
+
+  scheduleIdleEviction();
 }
 
 void HTTPConnectionPool::leaseConnection(
     const stx::InetAddr& addr,
     Promise<HTTPResponse> promise,
     Function<void (HTTPClientConnection* conn)> callback) {
-  std::unique_lock<std::mutex> lk(connection_cache_mutex_);
-  auto iter = connection_cache_.find(addr.ipAndPort());
+  auto key = addr.ipAndPort();
+  auto shard = getShard(key);
+  Vector<HTTPClientConnection*> stale;
+  HTTPClientConnection* conn = nullptr;
+  bool connect = false;
+  uint64_t waiter_id = 0;
 
-  if (iter != connection_cache_.end()) {
-    ScopedPtr<HTTPClientConnection> conn(iter->second);
-    connection_cache_.erase(iter);
-    lk.unlock();
+  std::unique_lock<std::mutex> lk(shard->mutex);
+  auto& host = shard->hosts[key];
 
-    scheduler_->runOnNextWakeup(
-        std::bind(&HTTPConnectionPool::parkConnection, this, conn.get(), addr),
-        conn->onReady());
+  // most recently parked connections first, they are the least likely to
+  // have been closed by the server
+  while (!host.idle.empty()) {
+    auto idle_conn = host.idle.back().conn;
+    host.idle.pop_back();
 
-    callback(conn.release());
-  } else {
-    lk.unlock();
+    if (idle_conn->isReusable()) {
+      conn = idle_conn;
+      break;
+    }
+
+    stale.emplace_back(idle_conn);
+    --host.num_connections;
+  }
+
+  if (conn == nullptr) {
+    if (opts_.max_connections_per_host == 0 ||
+        host.num_connections < opts_.max_connections_per_host) {
+      ++host.num_connections;
+      connect = true;
+    } else {
+      waiter_id = next_waiter_id_++;
+      host.waiters.emplace_back(Waiter { waiter_id, promise, callback });
+    }
+  }
+
+  lk.unlock();
+
+  for (auto c : stale) {
+    delete c;
+  }
+
+  if (stats_ != nullptr) {
+    stats_->pool_idle_connections.decr(stale.size() + (conn ? 1 : 0));
+    stats_->pool_evictions.incr(stale.size());
+
+    if (conn) {
+      stats_->pool_hits.incr(1);
+    } else if (connect) {
+      stats_->pool_misses.incr(1);
+    } else {
+      stats_->pool_waits.incr(1);
+    }
+  }
+
+  if (conn) {
+    dispatchConnection(conn, addr, callback);
+    return;
+  }
+
+  auto handle = handle_;
+  if (connect) {
+    openConnection(
+        addr,
+        [this, addr, callback] (ScopedPtr<HTTPClientConnection> conn) {
+          dispatchConnection(conn.release(), addr, callback);
+        },
+        [handle, addr, promise] (const std::exception& e) mutable {
+          withPool(handle, [&addr] (HTTPConnectionPool* pool) {
+            pool->releaseConnectionSlot(addr);
+          });
+
+          promise.failure(e);
+        });
+  }
+
+  if (waiter_id > 0 && opts_.wait_timeout_micros > 0) {
+    scheduler_->runAfter(
+        [handle, addr, waiter_id] {
+          withPool(handle, [&addr, waiter_id] (HTTPConnectionPool* pool) {
+            pool->expireWaiter(addr, waiter_id);
+          });
+        },
+        opts_.wait_timeout_micros);
+  }
+}
+
+void HTTPConnectionPool::dispatchConnection(
+    HTTPClientConnection* conn,
+    const stx::InetAddr& addr,
+    Function<void (HTTPClientConnection* conn)> callback) {
+  if (pipeliningDepth(addr) > 1) {
+    auto shard = getShard(addr.ipAndPort());
+    std::unique_lock<std::mutex> lk(shard->mutex);
+    shard->hosts[addr.ipAndPort()].active.emplace_back(conn);
+  }
+
+  auto handle = handle_;
+  scheduler_->runOnNextWakeup(
+      [handle, conn, addr] {
+        auto parked = withPool(handle, [conn, &addr] (
+            HTTPConnectionPool* pool) {
+          pool->parkConnection(conn, addr);
+        });
+
+        if (!parked) {
+          delete conn;
+        }
+      },
+      conn->onReady());
+
+  callback(conn);
+}
+
+void HTTPConnectionPool::openConnection(
+    const stx::InetAddr& addr,
+    Function<void (ScopedPtr<HTTPClientConnection> conn)> callback,
+    Function<void (const std::exception& e)> on_error) {
+  auto handle = handle_;
+  auto conn_protocol = protocol(addr);
+  try {
+    net::TCPConnection::connectAsync(
+        addr,
+        scheduler_,
+        [handle, callback, on_error, conn_protocol] (
+            ScopedPtr<net::TCPConnection> tcp_conn) {
+          auto connected = withPool(handle, [&] (HTTPConnectionPool* pool) {
+            ScopedPtr<HTTPClientConnection> conn;
 
-    try {
-      net::TCPConnection::connectAsync(
-          addr,
-          scheduler_,
-          [this, promise, callback, addr] (
-              ScopedPtr<net::TCPConnection> tcp_conn) mutable {
             try {
               tcp_conn->checkErrors();
 
-              ScopedPtr<HTTPClientConnection> conn(
+              conn.reset(
                   new HTTPClientConnection(
                       std::move(tcp_conn),
-                      scheduler_,
-                      stats_));
-
-              scheduler_->runOnNextWakeup(
-                  std::bind(
-                      &HTTPConnectionPool::parkConnection,
-                      this,
-                      conn.get(),
-                      addr),
-                  conn->onReady());
-
-              callback(conn.release());
+                      pool->scheduler_,
+                      pool->stats_,
+                      conn_protocol));
             } catch (const std::exception& e) {
-              promise.failure(e);
+              on_error(e);
+              return;
             }
+
+            callback(std::move(conn));
           });
-    } catch (const std::exception& e) {
-      promise.failure(e);
+
+          if (!connected) {
+            on_error(
+                Exception(kIOError, "HTTPConnectionPool was destroyed"));
+          }
+        });
+  } catch (const std::exception& e) {
+    on_error(e);
+  }
+}
+
+void HTTPConnectionPool::releaseConnectionSlot(const stx::InetAddr& addr) {
+  auto key = addr.ipAndPort();
+  auto shard = getShard(key);
+  std::unique_lock<std::mutex> lk(shard->mutex);
+  auto& host = shard->hosts[key];
+
+  if (host.waiters.empty()) {
+    --host.num_connections;
+    return;
+  }
+
+  // the slot is passed on to the oldest queued request
+  auto waiter = host.waiters.front();
+  host.waiters.pop_front();
+  lk.unlock();
+
+  if (stats_ != nullptr) {
+    stats_->pool_misses.incr(1);
+  }
+
+  auto promise = waiter.promise;
+  auto callback = waiter.callback;
+  auto handle = handle_;
+  openConnection(
+      addr,
+      [this, addr, callback] (ScopedPtr<HTTPClientConnection> conn) {
+        dispatchConnection(conn.release(), addr, callback);
+      },
+      [handle, addr, promise] (const std::exception& e) mutable {
+        withPool(handle, [&addr] (HTTPConnectionPool* pool) {
+          pool->releaseConnectionSlot(addr);
+        });
+
+        promise.failure(e);
+      });
+}
+
+void HTTPConnectionPool::expireWaiter(
+    const stx::InetAddr& addr,
+    uint64_t waiter_id) {
+  auto key = addr.ipAndPort();
+  auto shard = getShard(key);
+  std::unique_lock<std::mutex> lk(shard->mutex);
+  auto& waiters = shard->hosts[key].waiters;
+
+  for (auto iter = waiters.begin(); iter != waiters.end(); ++iter) {
+    if (iter->id != waiter_id) {
+      continue;
+    }
+
+    auto promise = iter->promise;
+    waiters.erase(iter);
+    lk.unlock();
+
+    if (stats_ != nullptr) {
+      stats_->pool_wait_timeouts.incr(1);
+    }
+
+    promise.failure(
+        Status(eIOError, "timed out waiting for a pooled connection"));
+    return;
+  }
+}
+
+void HTTPConnectionPool::scheduleIdleEviction() {
+  if (opts_.idle_timeout_micros == 0) {
+    return;
+  }
+
+  if (eviction_scheduled_.exchange(true)) {
+    return;
+  }
+
+  auto handle = handle_;
+  scheduler_->runAfter(
+      [handle] {
+        withPool(handle, [] (HTTPConnectionPool* pool) {
+          pool->evictIdleConnections();
+        });
+      },
+      opts_.idle_timeout_micros);
+}
+
+void HTTPConnectionPool::evictIdleConnections() {
+  eviction_scheduled_ = false;
+
+  auto now = monotonicMicros();
+  uint64_t next_expiry = 0;
+  Vector<HTTPClientConnection*> evicted;
+
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+
+    for (auto host = shard->hosts.begin(); host != shard->hosts.end(); ) {
+      auto& idle = host->second.idle;
+
+      for (auto iter = idle.begin(); iter != idle.end(); ) {
+        auto expiry = iter->idle_since + opts_.idle_timeout_micros;
+        if (expiry <= now || !iter->conn->isReusable()) {
+          evicted.emplace_back(iter->conn);
+          --host->second.num_connections;
+          iter = idle.erase(iter);
+        } else {
+          if (next_expiry == 0 || expiry < next_expiry) {
+            next_expiry = expiry;
+          }
+
+          ++iter;
+        }
+      }
+
+      if (host->second.num_connections == 0 &&
+          host->second.waiters.empty() &&
+          host->second.active.empty()) {
+        host = shard->hosts.erase(host);
+      } else {
+        ++host;
+      }
     }
   }
+
+  for (auto conn : evicted) {
+    delete conn;
+  }
+
+  if (stats_ != nullptr) {
+    stats_->pool_idle_connections.decr(evicted.size());
+    stats_->pool_evictions.incr(evicted.size());
+  }
+
+  if (next_expiry > 0 && !eviction_scheduled_.exchange(true)) {
+    auto handle = handle_;
+    scheduler_->runAfter(
+        [handle] {
+          withPool(handle, [] (HTTPConnectionPool* pool) {
+            pool->evictIdleConnections();
+          });
+        },
+        next_expiry > now ? next_expiry - now : 0);
+  }
 }
 
 HTTPClientStats* HTTPConnectionPool::stats() {
@@ -9,10 +9,15 @@
  */
 #ifndef _FNORDM_HTTPCONNECTIONPOOL_H
 #define _FNORDM_HTTPCONNECTIONPOOL_H
+#include <atomic>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <string>
 #include "stx/stdtypes.h"
+#include "stx/time_constants.h"
 #include "stx/thread/taskscheduler.h"
 #include "stx/net/dnscache.h"
 #include "stx/http/httprequest.h"
@@ -23,11 +28,91 @@
 namespace stx {
 namespace http {
 
+struct HTTPConnectionPoolOptions {
+  static const size_t kDefaultNumShards = 16;
+  static const size_t kDefaultMaxConnectionsPerHost = 128;
+  static const size_t kDefaultMaxIdleConnectionsPerHost = 32;
+  static const uint64_t kDefaultIdleTimeoutMicros = 30 * kMicrosPerSecond;
+  static const size_t kDefaultPipeliningDepth = 1;
+  static const uint64_t kDefaultWaitTimeoutMicros = 30 * kMicrosPerSecond;
+
+  HTTPConnectionPoolOptions();
+
+  /**
+   * Number of independently locked shards the per-host pools are spread over
+   */
+  size_t num_shards;
+
+  /**
+   * Maximum number of open (idle, leased or connecting) connections per host.
+   * Requests that would exceed the limit are queued until a connection is
+   * returned to the pool. 0 means unlimited
+   */
+  size_t max_connections_per_host;
+
+  /**
+   * Maximum number of idle connections that are kept open per host
+   */
+  size_t max_idle_connections_per_host;
+
+  /**
+   * Idle connections are closed after this many microseconds. 0 means idle
+   * connections are never evicted
+   */
+  uint64_t idle_timeout_micros;
+
+  /**
+   * Maximum number of requests in flight on a single connection. Values
+   * greater than 1 enable HTTP pipelining: if there is no idle connection,
+   * new requests are queued on the least loaded busy connection before a new
+   * connection is opened. Only enable this for servers that are known to
+   * support pipelining and for idempotent requests
+   */
+  size_t pipelining_depth;
+
+  /**
+   * Overrides pipelining_depth for single hosts, keyed by "hostname:port" or
+   * "ip:port". This allows to enable pipelining only for the backends that
+   * are known to support it
+   */
+  HashMap<String, size_t> host_pipelining_depth;
+
+  /**
+   * The protocol to use for new connections to single hosts, keyed like
+   * host_pipelining_depth. Hosts that are not listed are spoken to in
+   * HTTP/1.1. On a HTTP/2 connection, the pipelining depth is the maximum
+   * number of concurrent streams
+   */
+  HashMap<String, HTTPClientConnection::Protocol> host_protocol;
+
+  /**
+   * Requests that are queued because the host is at max_connections_per_host
+   * fail if they didn't get a connection within this many microseconds. 0
+   * means queued requests wait forever
+   */
+  uint64_t wait_timeout_micros;
+};
+
 class HTTPConnectionPool {
 public:
   HTTPConnectionPool(
       stx::TaskScheduler* scheduler,
-      HTTPClientStats* stats);
+      HTTPClientStats* stats,
+      const HTTPConnectionPoolOptions& opts = HTTPConnectionPoolOptions());
+
+  /**
+   * Closes all idle connections and fails all queued requests. Requests that
+   * are in flight complete, their connections are closed afterwards
+   *
+   * Waits for the pool's callbacks that are running on other threads. The
+   * pool must not be destroyed from a callback that the pool runs, e.g. from
+   * a response future's callback when a connection couldn't be opened. That
+   * would wait for itself, so the process is aborted instead
+   */
+  ~HTTPConnectionPool();
+
+  HTTPConnectionPool(const HTTPConnectionPool& other) = delete;
+  HTTPConnectionPool& operator=(const HTTPConnectionPool& other) = delete;
 
   Future<HTTPResponse> executeRequest(const HTTPRequest& req);
 
@@ -44,23 +129,113 @@ public:
       const stx::InetAddr& addr,
       Function<HTTPResponseFuture* (Promise<HTTPResponse> promise)> factory);
 
+  /**
+   * Open connections to the provided address ahead of time so that the first
+   * requests don't pay for the TCP handshake. Never opens more connections
+   * than max_connections_per_host or max_idle_connections_per_host allow.
+   * The returned future resolves with the number of connections that were
+   * opened once all connection attempts finished
+   */
+  Future<size_t> prewarm(const stx::InetAddr& addr, size_t num_connections);
+
   HTTPClientStats* stats();
 
 protected:
 
+  struct IdleConnection {
+    HTTPClientConnection* conn;
+    uint64_t idle_since;
+  };
+
+  struct Waiter {
+    uint64_t id;
+    Promise<HTTPResponse> promise;
+    Function<void (HTTPClientConnection* conn)> callback;
+  };
+
+  struct HostPool {
+    HostPool();
+    List<IdleConnection> idle;
+    List<HTTPClientConnection*> active;
+    List<Waiter> waiters;
+    size_t num_connections;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    HashMap<String, HostPool> hosts;
+  };
+
+  /**
+   * Callbacks from the scheduler and the resolver go through the handle, so
+   * that they are ignored once the pool is destroyed. Callbacks don't hold
+   * the mutex while they run, the destructor waits until no callback is
+   * running any more
+   */
+  struct Handle : public RefCounted {
+    Handle(HTTPConnectionPool* pool);
+    void callbackDone(std::thread::id thread_id);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    HTTPConnectionPool* pool;
+    Vector<std::thread::id> running;
+  };
+
+  /**
+   * Returns false if the pool was already destroyed
+   */
+  static bool withPool(
+      RefPtr<Handle> handle,
+      Function<void (HTTPConnectionPool* pool)> fn);
+
+  Shard* getShard(const String& key);
+
+  size_t pipeliningDepth(const stx::InetAddr& addr) const;
+  HTTPClientConnection::Protocol protocol(const stx::InetAddr& addr) const;
+
   void parkConnection(HTTPClientConnection* conn, InetAddr addr);
 
+  void dispatchRequest(
+      const HTTPRequest& req,
+      const stx::InetAddr& addr,
+      Promise<HTTPResponse> promise,
+      Function<HTTPResponseFuture* (Promise<HTTPResponse> promise)> factory);
+
+  bool pipelineRequest(
+      const HTTPRequest& req,
+      const stx::InetAddr& addr,
+      size_t pipelining_depth,
+      Promise<HTTPResponse> promise,
+      Function<HTTPResponseFuture* (Promise<HTTPResponse> promise)> factory);
+
   void leaseConnection(
       const stx::InetAddr& addr,
       Promise<HTTPResponse> promise,
       Function<void (HTTPClientConnection* conn)> callback);
 
-  stx::TaskScheduler* scheduler_;
+  void dispatchConnection(
+      HTTPClientConnection* conn,
+      const stx::InetAddr& addr,
+      Function<void (HTTPClientConnection* conn)> callback);
 
-  std::multimap<
-      std::string,
-      HTTPClientConnection*> connection_cache_;
-  std::mutex connection_cache_mutex_;
+  void openConnection(
+      const stx::InetAddr& addr,
+      Function<void (ScopedPtr<HTTPClientConnection> conn)> callback,
+      Function<void (const std::exception& e)> on_error);
+
+  void releaseConnectionSlot(const stx::InetAddr& addr);
+  void expireWaiter(const stx::InetAddr& addr, uint64_t waiter_id);
+
+  void scheduleIdleEviction();
+  void evictIdleConnections();
+
+  stx::TaskScheduler* scheduler_;
+  HTTPConnectionPoolOptions opts_;
+  Vector<ScopedPtr<Shard>> shards_;
+  std::atomic<bool> eviction_scheduled_;
+  std::atomic<uint64_t> next_waiter_id_;
+  RefPtr<Handle> handle_;
 
   stx::net::DNSCache dns_cache_;
   HTTPClientStats* stats_;
@@ -7,9 +7,12 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <mutex>
+#include <time.h>
 #include <stx/exception.h>
 #include <stx/stringutil.h>
 #include <stx/http/httpgenerator.h>
+#include <stx/http/status.h>
 
 using stx::OutputStream;
 
@@ -56,6 +59,10 @@ void HTTPGenerator::generate(const HTTPResponse& res, OutputStream* os) {
     os->write(StringUtil::format("$0: $1\r\n", header.first, header.second));
   }
 
+  if (res.headerTemplate()) {
+    os->write(res.headerTemplate()->serialized());
+  }
+
   os->write("\r\n");
 
   const auto& body = res.body();
@@ -64,5 +71,129 @@ void HTTPGenerator::generate(const HTTPResponse& res, OutputStream* os) {
   }
 }
 
+namespace {
+
+struct StatusLineTable {
+  static const int kMaxStatusCode = 600;
+
+  StatusLineTable() : lines(kMaxStatusCode), names(kMaxStatusCode) {
+    const HTTPStatus statuses[] = {
+      kStatusOK,
+      kStatusCreated,
+      kStatusNoContent,
+      kStatusBadRequest,
+      kStatusUnauthorized,
+      kStatusForbidden,
+      kStatusNotFound,
+      kStatusMovedPermanently,
+      kStatusFound,
+      kStatusNotModified,
+      kStatusInternalServerError,
+      kStatusBadGateway,
+      kStatusServiceUnavailable
+    };
+
+    for (const auto& status : statuses) {
+      names[status.code] = status.name;
+      lines[status.code] = StringUtil::format(
+          "HTTP/1.1 $0 $1\r\n",
+          status.code,
+          status.name);
+    }
+  }
+
+  const String* get(const HTTPResponse& res) const {
+    auto code = res.statusCode();
+    if (code < 0 ||
+        code >= kMaxStatusCode ||
+        lines[code].empty() ||
+        names[code] != res.statusName() ||
+        res.version() != "HTTP/1.1") {
+      return nullptr;
+    }
+
+    return &lines[code];
+  }
+
+  Vector<String> lines;
+  Vector<String> names;
+};
+
+struct DateCache {
+  DateCache() : second(0) {}
+
+  std::mutex mutex;
+  time_t second;
+  char line[64];
+  size_t line_size;
+};
+
+}
+
+void HTTPGenerator::generate(
+    const HTTPResponse& res,
+    Buffer* buf,
+    bool add_date_header /* = false */) {
+  static const StatusLineTable status_lines;
+
+  auto status_line = status_lines.get(res);
+  if (status_line) {
+    buf->append(*status_line);
+  } else {
+    if (res.version().length() < 4) {
+      RAISEF(kRuntimeError, "invalid http version: $0", res.version());
+    }
+
+    buf->append(res.version());
+    buf->append(' ');
+    buf->append(StringUtil::toString(res.statusCode()));
+    buf->append(' ');
+    buf->append(res.statusName());
+    buf->append("\r\n");
+  }
+
+  for (const auto& header : res.headers()) {
+    buf->append(header.first);
+    buf->append(": ");
+    buf->append(header.second);
+    buf->append("\r\n");
+  }
+
+  if (res.headerTemplate()) {
+    buf->append(res.headerTemplate()->serialized());
+  }
+
+  if (add_date_header && !res.hasHeader("Date")) {
+    appendDateHeader(buf);
+  }
+
+  buf->append("\r\n");
+
+  const auto& body = res.body();
+  if (body.size() > 0) {
+    buf->append(body);
+  }
+}
+
+void HTTPGenerator::appendDateHeader(Buffer* buf) {
+  static DateCache cache;
+
+  auto now = time(nullptr);
+  std::unique_lock<std::mutex> lk(cache.mutex);
+  if (now != cache.second) {
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    cache.line_size = strftime(
+        cache.line,
+        sizeof(cache.line),
+        "date: %a, %d %b %Y %H:%M:%S GMT\r\n",
+        &tm);
+
+    cache.second = now;
+  }
+
+  buf->append(cache.line, cache.line_size);
+}
+
 }
 }
@@ -25,6 +25,22 @@ class HTTPGenerator {
 public:
   static void generate(const HTTPRequest& req, OutputStream* os);
   static void generate(const HTTPResponse& res, OutputStream* os);
+
+  /**
+   * Serialize the response directly into the buffer. Status lines for the
+   * statuses in status.h are precomputed. If add_date_header is true and the
+   * response has no Date header, the current date is added
+   */
+  static void generate(
+      const HTTPResponse& res,
+      Buffer* buf,
+      bool add_date_header = false);
+
+  /**
+   * Append a "date: ..." header line for the current time. The formatted
+   * date is cached and only updated once per second
+   */
+  static void appendDateHeader(Buffer* buf);
 };
 
 }
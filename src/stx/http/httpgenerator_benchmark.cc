@@ -0,0 +1,81 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include "stx/stdtypes.h"
+#include "stx/io/outputstream.h"
+#include "stx/http/httpgenerator.h"
+#include "stx/http/HTTPHeaderTemplate.h"
+#include "stx/test/benchmark.h"
+
+using namespace stx;
+
+/**
+ * Compares serializing a small JSON response through the OutputStream
+ * interface vs. directly into a buffer, with and without a header template
+ */
+
+static const size_t kNumIterations = 500000;
+
+static void benchmarkGenerator(
+    const String& label,
+    Function<void (Buffer* buf)> fn,
+    bool append) {
+  Buffer buf;
+  buf.reserve(4096);
+
+  auto res = Benchmark::benchmark([&buf, fn] {
+    buf.clear();
+    fn(&buf);
+  }, kNumIterations);
+
+  Benchmark::printResultTable(label, res, append);
+}
+
+int main(int argc, const char** argv) {
+  http::HTTPResponse res;
+  res.setStatus(http::kStatusOK);
+  res.setVersion("HTTP/1.1");
+  res.addHeader("Content-Type", "application/json; charset=utf-8");
+  res.addHeader("Cache-Control", "no-cache");
+  res.addHeader("Access-Control-Allow-Origin", "*");
+  res.addBody("{ \"id\": 12345, \"name\": \"example\", \"active\": true }");
+  res.addHeader("Content-Length", StringUtil::toString(res.body().size()));
+
+  auto tpl = mkRef(new http::HTTPHeaderTemplate());
+  tpl->addHeader("Content-Type", "application/json; charset=utf-8");
+  tpl->addHeader("Cache-Control", "no-cache");
+  tpl->addHeader("Access-Control-Allow-Origin", "*");
+
+  http::HTTPResponse tpl_res;
+  tpl_res.setStatus(http::kStatusOK);
+  tpl_res.setVersion("HTTP/1.1");
+  tpl_res.setHeaderTemplate(tpl);
+  tpl_res.addBody(res.body());
+  tpl_res.addHeader("Content-Length", res.getHeader("Content-Length"));
+
+  benchmarkGenerator("outputstream", [&res] (Buffer* buf) {
+    BufferOutputStream os(buf);
+    http::HTTPGenerator::generate(res, &os);
+  }, false);
+
+  benchmarkGenerator("buffer", [&res] (Buffer* buf) {
+    http::HTTPGenerator::generate(res, buf);
+  }, true);
+
+  benchmarkGenerator("buffer + date", [&res] (Buffer* buf) {
+    http::HTTPGenerator::generate(res, buf, true);
+  }, true);
+
+  benchmarkGenerator("buffer + date + template", [&tpl_res] (Buffer* buf) {
+    http::HTTPGenerator::generate(tpl_res, buf, true);
+  }, true);
+
+  return 0;
+}
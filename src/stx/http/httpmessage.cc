@@ -44,6 +44,13 @@ const std::string& HTTPMessage::getHeader(const std::string& key) const {
     }
   }
 
+  if (header_template_.get()) {
+    auto value = header_template_->getHeader(key_low);
+    if (value) {
+      return *value;
+    }
+  }
+
   return kEmptyHeader;
 }
 
@@ -57,6 +64,10 @@ bool HTTPMessage::hasHeader(const std::string& key) const {
     }
   }
 
+  if (header_template_.get()) {
+    return header_template_->getHeader(key_low) != nullptr;
+  }
+
   return false;
 }
 
@@ -80,8 +91,31 @@ void HTTPMessage::setHeader(const std::string& key, const std::string& value) {
   headers_.emplace_back(key_low, value);
 }
 
+void HTTPMessage::removeHeader(const std::string& key) {
+  auto key_low = key;
+  std::transform(key_low.begin(), key_low.end(), key_low.begin(), ::tolower);
+
+  for (auto iter = headers_.begin(); iter != headers_.end(); ) {
+    if (iter->first == key_low) {
+      iter = headers_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
 void HTTPMessage::clearHeaders() {
   headers_.clear();
+  header_template_ = nullptr;
+}
+
+void HTTPMessage::setHeaderTemplate(
+    RefPtr<HTTPHeaderTemplate> header_template) {
+  header_template_ = header_template;
+}
+
+const HTTPHeaderTemplate* HTTPMessage::headerTemplate() const {
+  return header_template_.get();
 }
 
 const Buffer& HTTPMessage::body() const {
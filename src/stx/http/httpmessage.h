@@ -15,6 +15,7 @@
 #include <stx/buffer.h>
 #include <stx/io/inputstream.h>
 #include <stx/io/outputstream.h>
+#include <stx/http/HTTPHeaderTemplate.h>
 
 namespace stx {
 namespace http {
@@ -45,8 +46,16 @@ public:
   bool hasHeader(const std::string& key) const;
   void addHeader(const std::string& key, const std::string& value);
   void setHeader(const std::string& key, const std::string& value);
+  void removeHeader(const std::string& key);
   void clearHeaders();
 
+  /**
+   * Send the headers of the provided template in addition to the headers of
+   * this message (see HTTPHeaderTemplate)
+   */
+  void setHeaderTemplate(RefPtr<HTTPHeaderTemplate> header_template);
+  const HTTPHeaderTemplate* headerTemplate() const;
+
   const Buffer& body() const;
   void addBody(const std::string& body);
   void addBody(const Buffer& buf);
@@ -61,6 +70,7 @@ protected:
   std::string version_;
   static std::string kEmptyHeader;
   std::vector<std::pair<std::string, std::string>> headers_;
+  RefPtr<HTTPHeaderTemplate> header_template_;
   Buffer body_;
 };
 
@@ -18,6 +18,7 @@ namespace http {
 
 const char HTTPParser::kContentLengthHeader[] = "Content-Length";
 const char HTTPParser::kConnectionHeader[] = "Connection";
+const char HTTPParser::kTransferEncodingHeader[] = "Transfer-Encoding";
 
 HTTPParser::HTTPParser(
     kParserMode mode,
@@ -31,9 +32,14 @@ HTTPParser::HTTPParser(
     on_headers_complete_cb_(nullptr),
     on_body_chunk_cb_(nullptr),
     mode_(mode),
+    buffer_size_(buffer_size),
     body_bytes_read_(0),
     body_bytes_expected_(0),
-    expect_body_(true) {
+    expect_body_(true),
+    has_content_length_(false),
+    chunked_(false),
+    chunk_state_(CHUNK_SIZE),
+    chunk_bytes_left_(0) {
   switch (mode) {
     case PARSE_HTTP_REQUEST:
       state_ = S_REQ_METHOD;
@@ -51,6 +57,10 @@ HTTPParser::kParserState HTTPParser::state() const {
   return state_;
 }
 
+size_t HTTPParser::bodyBytesRead() const {
+  return body_bytes_read_;
+}
+
 void HTTPParser::onMethod(
     std::function<void(HTTPMessage::kHTTPMethod)> callback) {
   on_method_cb_ = callback;
@@ -92,10 +102,14 @@ void HTTPParser::onBodyChunk(
   on_body_chunk_cb_ = callback;
 }
 
-void HTTPParser::parse(const char* data, size_t size) {
+size_t HTTPParser::parse(const char* data, size_t size) {
   const char* begin = data;
   const char* end = data + size;
 
+  if (buf_.allocSize() == 0) {
+    buf_.reserve(buffer_size_);
+  }
+
   while (begin < end) {
     switch (state_) {
       case S_REQ_METHOD:
@@ -120,8 +134,12 @@ void HTTPParser::parse(const char* data, size_t size) {
         parseHeader(&begin, end);
         break;
       case S_DONE:
-        if (mode_ == PARSE_HTTP_REQUEST) {
-          RAISE(kParseError, "invalid trailing bytes");
+        // the remaining bytes belong to the next message
+        if (mode_ == PARSE_HTTP_REQUEST ||
+            has_content_length_ ||
+            chunked_ ||
+            !expect_body_) {
+          return begin - data;
         }
         /* fallthrough */
       case S_BODY:
@@ -130,6 +148,8 @@ void HTTPParser::parse(const char* data, size_t size) {
 
     }
   }
+
+  return begin - data;
 }
 
 void HTTPParser::eof() {
@@ -142,6 +162,10 @@ void HTTPParser::eof() {
     case S_RES_STATUS_NAME:
     case S_HEADER:
     case S_BODY:
+      if (chunked_) {
+        RAISE(kParseError, "unexpected end of file");
+      }
+
       if (body_bytes_expected_ != -1 &&
           body_bytes_read_ < body_bytes_expected_) {
         RAISE(kParseError, "unexpected end of file");
@@ -285,6 +309,12 @@ void HTTPParser::parseResponseStatusCode(const char** begin, const char* end) {
       RAISEF(kParseError, "invalid http status code: $0", status_code_str);
     }
 
+    // 1xx, 204 and 304 responses never have a body
+    if (status_code < 200 || status_code == 204 || status_code == 304) {
+      expect_body_ = false;
+      body_bytes_expected_ = 0;
+    }
+
     if (on_status_code_cb_) {
       on_status_code_cb_(status_code);
     }
@@ -341,7 +371,9 @@ void HTTPParser::parseHeader(const char** begin, const char* end) {
       buf_.clear();
       state_ = S_HEADER;
     } else {
-      if (body_bytes_expected_ == 0) {
+      if (chunked_ && expect_body_) {
+        state_ = S_BODY;
+      } else if (body_bytes_expected_ == 0 || !expect_body_) {
         state_ = S_DONE;
       } else {
         state_ = S_BODY;
@@ -372,11 +404,22 @@ void HTTPParser::processHeader(
     std::string content_length_str(val, val_len);
     try {
       body_bytes_expected_ = std::stoul(content_length_str);
+      has_content_length_ = true;
     } catch (const std::exception& e) {
       RAISEF(kParseError, "invalid content length: $0", content_length_str);
     }
   }
 
+  // the chunked transfer coding overrides any Content-Length (RFC 7230 3.3.3)
+  if (expect_body_ &&
+      key_len == strlen(kTransferEncodingHeader) &&
+      strncasecmp(key, kTransferEncodingHeader, key_len) == 0) {
+    auto chunked_len = sizeof("chunked") - 1;
+    chunked_ =
+        val_len >= chunked_len &&
+        strncasecmp(val + val_len - chunked_len, "chunked", chunked_len) == 0;
+  }
+
   if (mode_ == PARSE_HTTP_RESPONSE &&
       expect_body_ &&
       key_len == strlen(kConnectionHeader) &&
@@ -392,7 +435,21 @@ void HTTPParser::processHeader(
 }
 
 void HTTPParser::readBody(const char** begin, const char* end) {
-  body_bytes_read_ += end - *begin;
+  if (chunked_) {
+    readChunkedBody(begin, end);
+    return;
+  }
+
+  size_t size = end - *begin;
+
+  // don't read past the end of a length-delimited body
+  if (state_ == S_BODY &&
+      body_bytes_expected_ != size_t(-1) &&
+      body_bytes_read_ + size > body_bytes_expected_) {
+    size = body_bytes_expected_ - body_bytes_read_;
+  }
+
+  body_bytes_read_ += size;
 
   if (body_bytes_read_ == body_bytes_expected_) {
     state_ = HTTPParser::S_DONE;
@@ -404,10 +461,109 @@ void HTTPParser::readBody(const char** begin, const char* end) {
   //}
 
   if (on_body_chunk_cb_) {
-    on_body_chunk_cb_(*begin, end - *begin);
+    on_body_chunk_cb_(*begin, size);
   }
 
-  *begin = end;
+  *begin += size;
+}
+
+void HTTPParser::readChunkedBody(const char** begin, const char* end) {
+  while (*begin < end && state_ == S_BODY) {
+    switch (chunk_state_) {
+
+      case CHUNK_SIZE: {
+        if (!readUntil(begin, end, '\n')) {
+          if (buf_.size() > kMaxHeaderSize) {
+            RAISE(kParseError, "HTTP chunk size line too large");
+          }
+
+          return;
+        }
+
+        (*begin)++;
+        BufferUtil::stripTrailingBytes(&buf_, '\r');
+        auto size_str = buf_.toString();
+        buf_.clear();
+
+        // ignore chunk extensions
+        size_str = size_str.substr(0, size_str.find(';'));
+        size_t pos = 0;
+        try {
+          chunk_bytes_left_ = std::stoul(size_str, &pos, 16);
+        } catch (const std::exception& e) {
+          pos = 0;
+        }
+
+        if (pos == 0 || size_str.find_first_not_of(" \t", pos) != String::npos) {
+          RAISEF(kParseError, "invalid HTTP chunk size: $0", size_str);
+        }
+
+        chunk_state_ = chunk_bytes_left_ > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+        break;
+      }
+
+      case CHUNK_DATA: {
+        auto size = std::min(size_t(end - *begin), chunk_bytes_left_);
+        chunk_bytes_left_ -= size;
+        body_bytes_read_ += size;
+        if (chunk_bytes_left_ == 0) {
+          chunk_state_ = CHUNK_DATA_END;
+        }
+
+        if (on_body_chunk_cb_) {
+          on_body_chunk_cb_(*begin, size);
+        }
+
+        *begin += size;
+        break;
+      }
+
+      case CHUNK_DATA_END: {
+        if (!readUntil(begin, end, '\n')) {
+          if (buf_.size() > 1) {
+            RAISE(kParseError, "missing CRLF after HTTP chunk");
+          }
+
+          return;
+        }
+
+        (*begin)++;
+        BufferUtil::stripTrailingBytes(&buf_, '\r');
+        if (buf_.size() > 0) {
+          RAISE(kParseError, "missing CRLF after HTTP chunk");
+        }
+
+        chunk_state_ = CHUNK_SIZE;
+        break;
+      }
+
+      // trailer fields are ignored, an empty line ends the message
+      case CHUNK_TRAILER: {
+        if (!readUntil(begin, end, '\n')) {
+          if (buf_.size() > kMaxHeaderSize) {
+            RAISE(kParseError, "HTTP trailer too large");
+          }
+
+          return;
+        }
+
+        (*begin)++;
+        BufferUtil::stripTrailingBytes(&buf_, '\r');
+        auto last_line = buf_.size() == 0;
+        buf_.clear();
+
+        if (last_line) {
+          state_ = S_DONE;
+          if (on_body_chunk_cb_) {
+            on_body_chunk_cb_(*begin, 0);
+          }
+        }
+
+        break;
+      }
+
+    }
+  }
 }
 
 bool HTTPParser::readUntil(const char** begin, const char* end, char search) {
@@ -418,6 +574,12 @@ bool HTTPParser::readUntil(const char** begin, const char* end, char search) {
   return cur != end && *cur == search;
 }
 
+void HTTPParser::freeBuffer() {
+  if (buf_.size() == 0) {
+    buf_ = Buffer();
+  }
+}
+
 void HTTPParser::reset() {
   switch (mode_) {
     case PARSE_HTTP_REQUEST:
@@ -433,6 +595,10 @@ void HTTPParser::reset() {
   body_bytes_read_ = 0;
   body_bytes_expected_ = 0;
   expect_body_ = true;
+  has_content_length_ = false;
+  chunked_ = false;
+  chunk_state_ = CHUNK_SIZE;
+  chunk_bytes_left_ = 0;
 }
 
 void HTTPParser::ignoreBody() {
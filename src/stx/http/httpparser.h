@@ -27,6 +27,7 @@ public:
   static const size_t kMaxHeaderSize = 65535;
   static const char kContentLengthHeader[];
   static const char kConnectionHeader[];
+  static const char kTransferEncodingHeader[];
 
   enum kParserMode {
     PARSE_HTTP_REQUEST,
@@ -48,11 +49,34 @@ public:
   HTTPParser(kParserMode mode, size_t buffer_size = kDefaultBufferSize);
 
   kParserState state() const;
-  void parse(const char* data, size_t size);
+
+  /**
+   * Returns the number of body bytes of the current message read so far
+   */
+  size_t bodyBytesRead() const;
+
+  /**
+   * Parse the provided chunk of input and return the number of bytes that were
+   * consumed. Parsing stops at the end of the current message if its length is
+   * known (i.e. it is a request, has a Content-Length, uses the chunked
+   * transfer coding or can not have a body), so the remaining bytes belong to
+   * the next pipelined message. Call reset before passing them in.
+   *
+   * Chunked bodies are passed to the body chunk callback without the chunk
+   * framing. Once the last chunk was read, the callback is called with an
+   * empty chunk and the parser is in state S_DONE
+   */
+  size_t parse(const char* data, size_t size);
   void eof();
   void reset();
   void ignoreBody();
 
+  /**
+   * Free the internal parse buffer if it doesn't hold a partial token, e.g.
+   * while a connection is idle. It is reallocated on the next call to parse
+   */
+  void freeBuffer();
+
   void onMethod(std::function<void(HTTPMessage::kHTTPMethod)> callback);
   void onURI(std::function<void(const char* data, size_t size)> callback);
   void onVersion(std::function<void(const char* data, size_t size)> callback);
@@ -76,6 +100,7 @@ protected:
   void parseResponseStatusName(const char** begin, const char* end);
   void parseHeader(const char** begin, const char* end);
   void readBody(const char** begin, const char* end);
+  void readChunkedBody(const char** begin, const char* end);
   bool readUntil(const char** begin, const char* end, char search);
   void processHeader(
       const char* key,
@@ -99,9 +124,22 @@ protected:
   kParserMode mode_;
   kParserState state_;
   Buffer buf_;
+  size_t buffer_size_;
   size_t body_bytes_read_;
   size_t body_bytes_expected_;
   bool expect_body_;
+  bool has_content_length_;
+
+  enum kChunkState {
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_DATA_END,
+    CHUNK_TRAILER
+  };
+
+  bool chunked_;
+  kChunkState chunk_state_;
+  size_t chunk_bytes_left_;
 };
 
 }
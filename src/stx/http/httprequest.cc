@@ -147,5 +147,39 @@ std::vector<std::pair<std::string, std::string>> HTTPRequest::cookies() const {
   return Cookies::parseCookieHeader(getHeader("Cookie"));
 }
 
+bool HTTPRequest::getRouteParam(
+    const std::string& key,
+    std::string* value) const {
+  for (const auto& param : route_params_) {
+    if (param.first == key) {
+      *value = param.second;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void HTTPRequest::setRouteParam(
+    const std::string& key,
+    const std::string& value) {
+  for (auto& param : route_params_) {
+    if (param.first == key) {
+      param.second = value;
+      return;
+    }
+  }
+
+  route_params_.emplace_back(key, value);
+}
+
+const std::string& HTTPRequest::routeLabel() const {
+  return route_label_;
+}
+
+void HTTPRequest::setRouteLabel(const std::string& label) {
+  route_label_ = label;
+}
+
 }
 }
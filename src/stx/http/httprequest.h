@@ -58,9 +58,25 @@ public:
   bool keepalive() const;
   std::vector<std::pair<std::string, std::string>> cookies() const;
 
+  /**
+   * Route params are set by HTTPRouter for parametrized path routes (e.g.
+   * "id" for "/users/:id")
+   */
+  bool getRouteParam(const std::string& key, std::string* value) const;
+  void setRouteParam(const std::string& key, const std::string& value);
+
+  /**
+   * The route label is set by HTTPRouter to the prefix, path or id of the
+   * matched route and is used to break down server stats by route
+   */
+  const std::string& routeLabel() const;
+  void setRouteLabel(const std::string& label);
+
 protected:
   kHTTPMethod method_;
   std::string url_;
+  std::vector<std::pair<std::string, std::string>> route_params_;
+  std::string route_label_;
 };
 
 }
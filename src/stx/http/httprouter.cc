@@ -26,44 +26,101 @@ void HTTPRouter::addRoute(
     std::function<bool (HTTPRequest*)> predicate,
     StreamingHTTPService* service,
     TaskScheduler* scheduler) {
-  auto factory = [service, scheduler] (
+  predicate_routes_.emplace_back(
+      addFactory(mkFactory(service, scheduler)),
+      predicate);
+}
+
+void HTTPRouter::addRoute(
+    std::function<bool (HTTPRequest*)> predicate,
+    StreamingHTTPService* service,
+    TaskScheduler* scheduler,
+    HTTPAdmissionController* admission) {
+  predicate_routes_.emplace_back(
+      addFactory(mkFactory(service, scheduler, admission)),
+      predicate);
+}
+
+void HTTPRouter::addRoute(
+    std::function<bool (HTTPRequest*)> predicate,
+    HTTPHandlerFactory* handler_factory) {
+  predicate_routes_.emplace_back(
+      addFactory(mkFactory(handler_factory)),
+      predicate);
+}
+
+std::unique_ptr<HTTPHandler> HTTPRouter::getHandler(
+    HTTPServerConnection* conn,
+    HTTPRequest* req) {
+  HTTPRouteTrie::ParamList params;
+  auto route_id = trie_.lookup(req->method(), req->uri(), &params);
+
+  for (const auto& route : predicate_routes_) {
+    if (route.first > route_id) {
+      break;
+    }
+
+    if (route.second(req)) {
+      route_id = route.first;
+      params.clear();
+      break;
+    }
+  }
+
+  if (route_id == HTTPRouteTrie::kNoRoute) {
+    req->setRouteLabel("not_found");
+    return std::unique_ptr<HTTPHandler>(new NoSuchRouteHandler(conn, req));
+  }
+
+  req->setRouteLabel(route_labels_[route_id]);
+
+  for (const auto& param : params) {
+    req->setRouteParam(param.first, param.second);
+  }
+
+  return factories_[route_id](conn, req);
+}
+
+HTTPRouter::FactoryFnType HTTPRouter::mkFactory(
+    StreamingHTTPService* service,
+    TaskScheduler* scheduler /* = nullptr */,
+    HTTPAdmissionController* admission /* = nullptr */) {
+  return [service, scheduler, admission] (
       HTTPServerConnection* conn,
       HTTPRequest* req) -> std::unique_ptr<HTTPHandler> {
     auto handler = new HTTPServiceHandler(
         service,
         scheduler,
         conn,
-        req);
+        req,
+        admission);
 
     return std::unique_ptr<HTTPHandler>(handler);
   };
-
-  routes_.emplace_back(predicate, factory);
 }
 
-void HTTPRouter::addRoute(
-    std::function<bool (HTTPRequest*)> predicate,
+HTTPRouter::FactoryFnType HTTPRouter::mkFactory(
     HTTPHandlerFactory* handler_factory) {
-
-  auto factory = [handler_factory] (
+  return [handler_factory] (
       HTTPServerConnection* conn,
-      HTTPRequest* req) ->std::unique_ptr<HTTPHandler> {
+      HTTPRequest* req) -> std::unique_ptr<HTTPHandler> {
     return handler_factory->getHandler(conn, req);
   };
-
-  routes_.emplace_back(predicate, factory);
 }
 
-std::unique_ptr<HTTPHandler> HTTPRouter::getHandler(
-    HTTPServerConnection* conn,
-    HTTPRequest* req) {
-  for (const auto& route : routes_) {
-    if (route.first(req)) {
-      return route.second(conn, req);
-    }
+size_t HTTPRouter::addFactory(
+    FactoryFnType factory,
+    const String& label /* = "" */) {
+  auto route_id = factories_.size();
+  factories_.emplace_back(factory);
+
+  if (label.empty()) {
+    route_labels_.emplace_back(StringUtil::format("route$0", route_id));
+  } else {
+    route_labels_.emplace_back(label);
   }
 
-  return std::unique_ptr<HTTPHandler>(new NoSuchRouteHandler(conn, req));
+  return route_id;
 }
 
 HTTPRouter::NoSuchRouteHandler::NoSuchRouteHandler(
@@ -11,6 +11,7 @@
 #define _libstx_HTTPROUTER_H
 
 #include "stx/http/httphandler.h"
+#include "stx/http/HTTPRouteTrie.h"
 #include "stx/http/httprequest.h"
 #include "stx/http/httpresponse.h"
 #include "stx/thread/taskscheduler.h"
@@ -18,6 +19,7 @@
 namespace stx {
 namespace http {
 class StreamingHTTPService;
+class HTTPAdmissionController;
 
 class HTTPRouter : public HTTPHandlerFactory {
 public:
@@ -33,6 +35,22 @@ public:
       const std::string& prefix,
       HandlerArgs... handler);
 
+  /**
+   * Route requests for the provided path (the query string is ignored). Path
+   * segments of the form ":name" match any single segment, the matched values
+   * are available from HTTPRequest::getRouteParam
+   */
+  template <typename... HandlerArgs>
+  void addRouteByPath(
+      const std::string& path,
+      HandlerArgs... handler);
+
+  template <typename... HandlerArgs>
+  void addRouteByPath(
+      HTTPMessage::kHTTPMethod method,
+      const std::string& path,
+      HandlerArgs... handler);
+
   void addRoute(
       PredicateFnType predicate,
       StreamingHTTPService* service);
@@ -42,6 +60,16 @@ public:
       StreamingHTTPService* service,
       TaskScheduler* scheduler);
 
+  /**
+   * Requests for this route are admitted by the provided controller. Routes
+   * that share a controller form one route class
+   */
+  void addRoute(
+      PredicateFnType predicate,
+      StreamingHTTPService* service,
+      TaskScheduler* scheduler,
+      HTTPAdmissionController* admission);
+
   void addRoute(
       PredicateFnType predicate,
       HTTPHandlerFactory* factory);
@@ -63,7 +91,27 @@ protected:
   };
 
 
-  std::vector<std::pair<PredicateFnType, FactoryFnType>> routes_;
+  static FactoryFnType mkFactory(
+      StreamingHTTPService* service,
+      TaskScheduler* scheduler = nullptr,
+      HTTPAdmissionController* admission = nullptr);
+
+  static FactoryFnType mkFactory(HTTPHandlerFactory* factory);
+
+  /**
+   * Register a route, the label defaults to "route<id>"
+   */
+  size_t addFactory(FactoryFnType factory, const String& label = "");
+
+  /**
+   * Prefix and path routes are compiled into the trie, predicate routes are
+   * only evaluated if they were registered before the best compiled match.
+   * Route ids are indexes into factories_ and reflect the registration order
+   */
+  HTTPRouteTrie trie_;
+  Vector<Pair<size_t, PredicateFnType>> predicate_routes_;
+  Vector<FactoryFnType> factories_;
+  Vector<String> route_labels_;
 };
 
 }
@@ -0,0 +1,97 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include "stx/stdtypes.h"
+#include "stx/stringutil.h"
+#include "stx/http/httprouter.h"
+#include "stx/test/benchmark.h"
+
+using namespace stx;
+
+/**
+ * Compares HTTPRouter lookups for a large route set registered as predicate
+ * routes (the only option before routes were compiled) vs. as prefix and path
+ * routes that are compiled into the route trie
+ */
+
+static const size_t kNumRoutes = 200;
+static const size_t kNumIterations = 200000;
+
+class NullHandlerFactory : public http::HTTPHandlerFactory {
+public:
+  std::unique_ptr<http::HTTPHandler> getHandler(
+      http::HTTPServerConnection* conn,
+      http::HTTPRequest* req) override {
+    return std::unique_ptr<http::HTTPHandler>(nullptr);
+  }
+};
+
+static void benchmarkRouter(
+    const String& label,
+    http::HTTPRouter* router,
+    Vector<http::HTTPRequest>& requests,
+    bool append) {
+  size_t i = 0;
+  auto res = Benchmark::benchmark([router, &requests, &i] {
+    router->getHandler(nullptr, &requests[i++ % requests.size()]);
+  }, kNumIterations);
+
+  Benchmark::printResultTable(label, res, append);
+}
+
+int main(int argc, const char** argv) {
+  NullHandlerFactory factory;
+  http::HTTPRouter predicate_router;
+  http::HTTPRouter compiled_router;
+
+  for (size_t i = 0; i < kNumRoutes; ++i) {
+    auto prefix = StringUtil::format("/api/v$0/static/", i);
+    auto path = StringUtil::format("/api/v$0/objects", i);
+
+    predicate_router.addRoute([prefix] (http::HTTPRequest* req) {
+      return StringUtil::beginsWith(req->uri(), prefix);
+    }, &factory);
+
+    predicate_router.addRoute([path] (http::HTTPRequest* req) {
+      auto uri = req->uri();
+      return uri.substr(0, uri.find("?")) == path;
+    }, &factory);
+
+    compiled_router.addRouteByPrefixMatch(prefix, &factory);
+    compiled_router.addRouteByPath(path, &factory);
+  }
+
+  Vector<http::HTTPRequest> first_routes;
+  Vector<http::HTTPRequest> last_routes;
+  Vector<http::HTTPRequest> all_routes;
+  for (size_t i = 0; i < kNumRoutes; ++i) {
+    auto req = http::HTTPRequest(
+        http::HTTPMessage::M_GET,
+        StringUtil::format("/api/v$0/objects?limit=10", i));
+
+    if (i < 10) {
+      first_routes.emplace_back(req);
+    }
+
+    if (i >= kNumRoutes - 10) {
+      last_routes.emplace_back(req);
+    }
+
+    all_routes.emplace_back(req);
+  }
+
+  benchmarkRouter("predicate; first routes", &predicate_router, first_routes, false);
+  benchmarkRouter("compiled; first routes", &compiled_router, first_routes, true);
+  benchmarkRouter("predicate; last routes", &predicate_router, last_routes, true);
+  benchmarkRouter("compiled; last routes", &compiled_router, last_routes, true);
+  benchmarkRouter("predicate; all routes", &predicate_router, all_routes, true);
+  benchmarkRouter("compiled; all routes", &compiled_router, all_routes, true);
+  return 0;
+}
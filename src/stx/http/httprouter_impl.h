@@ -16,11 +16,31 @@ template <typename... HandlerArgs>
 void HTTPRouter::addRouteByPrefixMatch(
     const std::string& prefix,
     HandlerArgs... handler_args) {
-  auto pred = [prefix] (HTTPRequest* req) -> bool {
-    return StringUtil::beginsWith(req->uri(), prefix);
-  };
+  trie_.insertPrefix(
+      prefix,
+      None<HTTPMessage::kHTTPMethod>(),
+      addFactory(mkFactory(handler_args...), prefix));
+}
 
-  addRoute(pred, handler_args...);
+template <typename... HandlerArgs>
+void HTTPRouter::addRouteByPath(
+    const std::string& path,
+    HandlerArgs... handler_args) {
+  trie_.insertPath(
+      path,
+      None<HTTPMessage::kHTTPMethod>(),
+      addFactory(mkFactory(handler_args...), path));
+}
+
+template <typename... HandlerArgs>
+void HTTPRouter::addRouteByPath(
+    HTTPMessage::kHTTPMethod method,
+    const std::string& path,
+    HandlerArgs... handler_args) {
+  trie_.insertPath(
+      path,
+      Some(method),
+      addFactory(mkFactory(handler_args...), path));
 }
 
 }
@@ -27,19 +27,78 @@ TODO:
 namespace stx {
 namespace http {
 
+HTTPServerOptions::HTTPServerOptions() :
+    max_connections(kDefaultMaxConnections),
+    buffer_pool_size(kDefaultBufferPoolSize),
+    max_response_buffer_bytes(kDefaultMaxResponseBufferBytes),
+    max_total_response_buffer_bytes(kDefaultMaxTotalResponseBufferBytes),
+    header_read_timeout_micros(kDefaultHeaderReadTimeoutMicros),
+    body_read_timeout_micros(kDefaultBodyReadTimeoutMicros),
+    idle_timeout_micros(kDefaultIdleTimeoutMicros),
+    write_timeout_micros(kDefaultWriteTimeoutMicros),
+    enable_h2c(true),
+    http2_max_concurrent_streams(kDefaultHTTP2MaxConcurrentStreams) {}
+
 HTTPServer::HTTPServer(
     HTTPHandlerFactory* handler_factory,
-    TaskScheduler* scheduler) :
+    TaskScheduler* scheduler,
+    const HTTPServerOptions& opts) :
+    opts_(opts),
     handler_factory_(handler_factory),
     scheduler_(scheduler),
-    ssock_(scheduler) {
-  ssock_.onConnection([this] (std::unique_ptr<net::TCPConnection> conn) {
-    HTTPServerConnection::start(
-        handler_factory_,
-        std::move(conn),
-        scheduler_,
-        &stats_);
-  });
+    ssock_(scheduler),
+    accept_paused_(false),
+    response_budget_(opts_.max_total_response_buffer_bytes, &stats_) {
+  if (opts_.buffer_pool_size > 0) {
+    buffer_pool_.reset(
+        new BufferPool(
+            HTTPServerConnection::kMinBufferSize,
+            opts_.buffer_pool_size));
+  }
+
+  ssock_.onConnection(
+      std::bind(&HTTPServer::onConnection, this, std::placeholders::_1));
+}
+
+void HTTPServer::onConnection(std::unique_ptr<net::TCPConnection> conn) {
+  HTTPServerConnection::start(
+      handler_factory_,
+      std::move(conn),
+      scheduler_,
+      &opts_,
+      &stats_,
+      buffer_pool_.get(),
+      &response_budget_);
+
+  if (opts_.max_connections == 0 ||
+      stats_.current_connections.get() < opts_.max_connections) {
+    return;
+  }
+
+  bool paused = false;
+  if (accept_paused_.compare_exchange_strong(paused, true)) {
+    logWarning(
+        "http.server",
+        "Connection limit of $0 reached, pausing accept",
+        opts_.max_connections);
+
+    stats_.accept_pauses.incr(1);
+    ssock_.pause();
+    scheduler_->runAfter(
+        std::bind(&HTTPServer::checkConnectionLimit, this),
+        kAcceptResumeIntervalMicros);
+  }
+}
+
+void HTTPServer::checkConnectionLimit() {
+  if (stats_.current_connections.get() < opts_.max_connections) {
+    accept_paused_ = false;
+    ssock_.resume();
+  } else {
+    scheduler_->runAfter(
+        std::bind(&HTTPServer::checkConnectionLimit, this),
+        kAcceptResumeIntervalMicros);
+  }
 }
 
 void HTTPServer::listen(int port) {
@@ -51,5 +110,9 @@ HTTPServerStats* HTTPServer::stats() {
   return &stats_;
 }
 
+const HTTPServerOptions& HTTPServer::options() const {
+  return opts_;
+}
+
 }
 }
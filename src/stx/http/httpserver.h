@@ -9,14 +9,17 @@
  */
 #ifndef _libstx_WEB_HTTPSERVER_H
 #define _libstx_WEB_HTTPSERVER_H
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <stx/http/httprequest.h>
 #include <stx/http/httphandler.h>
 #include "stx/http/httpserverconnection.h"
+#include <stx/http/HTTPServerOptions.h>
 #include <stx/http/httpstats.h>
 #include <stx/net/tcpserver.h>
 #include <stx/thread/taskscheduler.h>
+#include <stx/time_constants.h>
 
 namespace stx {
 namespace http {
@@ -25,19 +28,30 @@ using stx::TaskScheduler;
 
 class HTTPServer {
 public:
+  static const uint64_t kAcceptResumeIntervalMicros = 10 * kMicrosPerMilli;
+
   HTTPServer(
       HTTPHandlerFactory* handler_factory,
-      TaskScheduler* scheduler);
+      TaskScheduler* scheduler,
+      const HTTPServerOptions& opts = HTTPServerOptions());
 
   void listen(int port);
 
   HTTPServerStats* stats();
+  const HTTPServerOptions& options() const;
 
 protected:
+  void onConnection(std::unique_ptr<net::TCPConnection> conn);
+  void checkConnectionLimit();
+
+  HTTPServerOptions opts_;
   HTTPServerStats stats_;
   HTTPHandlerFactory* handler_factory_;
   TaskScheduler* scheduler_;
   net::TCPServer ssock_;
+  std::atomic<bool> accept_paused_;
+  ScopedPtr<BufferPool> buffer_pool_;
+  HTTPResponseBufferBudget response_budget_;
 };
 
 }
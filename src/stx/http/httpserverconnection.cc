@@ -7,11 +7,15 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <string.h>
+#include <time.h>
 #include "stx/exception.h"
 #include "stx/inspect.h"
 #include "stx/logging.h"
 #include "stx/http/httpserverconnection.h"
 #include "stx/http/httpgenerator.h"
+#include "stx/http/HTTP2Frame.h"
+#include "stx/http/HTTP2ServerConnection.h"
 
 namespace stx {
 
@@ -22,16 +26,35 @@ std::string inspect(const http::HTTPServerConnection& conn) {
 
 namespace http {
 
+/**
+ * All timestamps of a connection are taken from the monotonic clock so that
+ * deadlines and latencies don't jump with the wall clock
+ */
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    RAISE_ERRNO(kRuntimeError, "clock_gettime() failed");
+  }
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
 void HTTPServerConnection::start(
     HTTPHandlerFactory* handler_factory,
     ScopedPtr<net::TCPConnection> conn,
     TaskScheduler* scheduler,
-    HTTPServerStats* stats) {
+    const HTTPServerOptions* opts,
+    HTTPServerStats* stats,
+    BufferPool* buffer_pool /* = nullptr */,
+    HTTPResponseBufferBudget* response_budget /* = nullptr */) {
   auto http_conn = new HTTPServerConnection(
       handler_factory,
       std::move(conn),
       scheduler,
-      stats);
+      opts,
+      stats,
+      buffer_pool,
+      response_budget);
 
   // N.B. we don't leak the connection here. it is ref counted and will
   // free itself
@@ -43,20 +66,47 @@ HTTPServerConnection::HTTPServerConnection(
     HTTPHandlerFactory* handler_factory,
     ScopedPtr<net::TCPConnection> conn,
     TaskScheduler* scheduler,
-    HTTPServerStats* stats) :
+    const HTTPServerOptions* opts,
+    HTTPServerStats* stats,
+    BufferPool* buffer_pool,
+    HTTPResponseBufferBudget* response_budget) :
     handler_factory_(handler_factory),
     conn_(std::move(conn)),
     scheduler_(scheduler),
     parser_(HTTPParser::PARSE_HTTP_REQUEST),
     on_write_completed_cb_(nullptr),
+    write_chunk_pos_(0),
     closed_(false),
-    stats_(stats) {
+    keepalive_(false),
+    h2c_maybe_(opts->enable_h2c),
+    upgrade_h2c_(false),
+    body_claimed_(false),
+    body_paused_(false),
+    body_read_pending_(false),
+    body_complete_(false),
+    request_start_(0),
+    idle_since_(0),
+    read_started_(0),
+    deadline_kind_(Deadline::NONE),
+    deadline_(0),
+    deadline_timer_at_(0),
+    first_byte_at_(0),
+    response_body_bytes_(0),
+    route_stats_(nullptr),
+    opts_(opts),
+    stats_(stats),
+    buffer_pool_(buffer_pool),
+    response_budget_(response_budget),
+    idle_bytes_(0) {
   logTrace("http.server", "New HTTP connection: $0", inspect(*this));
   stats_->total_connections.incr(1);
   stats_->current_connections.incr(1);
 
   conn_->setNonblocking(true);
-  read_buf_.reserve(kMinBufferSize);
+  conn_->setNoDelay(true);
+  if (!buffer_pool_) {
+    read_buf_.reserve(kMinBufferSize);
+  }
 
   parser_.onMethod([this] (HTTPMessage::kHTTPMethod method) {
     cur_request_->setMethod(method);
@@ -84,20 +134,79 @@ HTTPServerConnection::HTTPServerConnection(
       std::bind(&HTTPServerConnection::dispatchRequest, this));
 }
 
+HTTPServerConnection::HTTPServerConnection(
+    HTTPHandlerFactory* handler_factory,
+    TaskScheduler* scheduler,
+    const HTTPServerOptions* opts,
+    HTTPServerStats* stats,
+    HTTPResponseBufferBudget* response_budget,
+    ScopedPtr<HTTPRequest> request) :
+    handler_factory_(handler_factory),
+    scheduler_(scheduler),
+    parser_(HTTPParser::PARSE_HTTP_REQUEST),
+    on_write_completed_cb_(nullptr),
+    write_chunk_pos_(0),
+    cur_request_(std::move(request)),
+    closed_(false),
+    keepalive_(false),
+    h2c_maybe_(false),
+    upgrade_h2c_(false),
+    body_claimed_(false),
+    body_paused_(false),
+    body_read_pending_(false),
+    body_complete_(false),
+    request_start_(0),
+    idle_since_(0),
+    read_started_(0),
+    deadline_kind_(Deadline::NONE),
+    deadline_(0),
+    deadline_timer_at_(0),
+    first_byte_at_(0),
+    response_body_bytes_(0),
+    route_stats_(nullptr),
+    opts_(opts),
+    stats_(stats),
+    buffer_pool_(nullptr),
+    response_budget_(response_budget),
+    idle_bytes_(0) {}
+
 HTTPServerConnection::~HTTPServerConnection() {
-  stats_->current_connections.decr(1);
+  // N.B. a connection that was upgraded to HTTP/2 passed its socket (and its
+  // slot in current_connections) on to the HTTP/2 connection
+  if (conn_.get()) {
+    stats_->current_connections.decr(1);
+  }
+
+  stats_->idle_connection_bytes.decr(idle_bytes_);
 }
 
 void HTTPServerConnection::read() {
   std::unique_lock<std::recursive_mutex> lk(mutex_);
+  deadline_ = 0;
 
-  size_t len;
-  try {
-    len = conn_->read(read_buf_.data(), read_buf_.allocSize());
-    stats_->received_bytes.incr(len);
-  } catch (Exception& e) {
-    if (e.ofType(kWouldBlockError)) {
-      return awaitRead();
+  // with a buffer pool, the read buffer is only borrowed for the duration of
+  // this call. N.B. processInput may free the connection, so we keep a copy
+  // of the pool pointer
+  auto buffer_pool = buffer_pool_;
+  auto read_buf = &read_buf_;
+  Buffer pooled_read_buf;
+  if (buffer_pool) {
+    acquireBuffer(&pooled_read_buf);
+    read_buf = &pooled_read_buf;
+  }
+
+  auto res = conn_->tryRead(read_buf->data(), read_buf->allocSize());
+  if (res.wouldBlock()) {
+    if (buffer_pool) {
+      buffer_pool->release(&pooled_read_buf);
+    }
+
+    return awaitRead();
+  }
+
+  if (res.failed()) {
+    if (buffer_pool) {
+      buffer_pool->release(&pooled_read_buf);
     }
 
     if (on_error_cb_) {
@@ -105,25 +214,95 @@ void HTTPServerConnection::read() {
     }
 
     lk.unlock();
-    logDebug("http.server", e, "read() failed, closing...");
+    logDebug(
+        "http.server",
+        res.toException("read() failed"),
+        "read() failed, closing...");
 
     close();
     return;
   }
 
-  try {
-    if (len == 0) {
+  size_t len = res.bytes;
+  stats_->received_bytes.incr(len);
+
+  if (len == 0) {
+    try {
       parser_.eof();
+    } catch (Exception& e) {
+      logDebug("http.server", e, "HTTP parse error, closing...");
+    }
 
-      if (on_error_cb_) {
-        on_error_cb_();
-      }
+    if (on_error_cb_) {
+      on_error_cb_();
+    }
+
+    lk.unlock();
+    close();
+    return;
+  }
 
-      lk.unlock();
-      close();
-      return;
+  stats_->idle_connection_bytes.decr(idle_bytes_);
+  idle_bytes_ = 0;
+
+  if (read_started_ == 0) {
+    read_started_ = monotonicMicros();
+  }
+
+  processInput((char *) read_buf->data(), len, &lk);
+
+  if (buffer_pool) {
+    buffer_pool->release(&pooled_read_buf);
+  }
+}
+
+void HTTPServerConnection::readPendingInput() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  if (closed_) {
+    return;
+  }
+
+  if (read_started_ == 0) {
+    read_started_ = monotonicMicros();
+  }
+
+  Buffer input(std::move(pending_input_));
+  processInput((char *) input.data(), input.size(), &lk);
+}
+
+// precondition: lk must be locked
+void HTTPServerConnection::processInput(
+    const char* data,
+    size_t size,
+    std::unique_lock<std::recursive_mutex>* lk) {
+  // a HTTP/2 client with prior knowledge starts with the connection preface
+  // instead of a request line
+  if (h2c_maybe_) {
+    pending_input_.append(data, size);
+    auto len = std::min(
+        pending_input_.size(),
+        HTTP2Frame::kConnectionPrefaceSize);
+
+    if (memcmp(pending_input_.data(), HTTP2Frame::kConnectionPreface, len)) {
+      h2c_maybe_ = false;
+      Buffer input(std::move(pending_input_));
+      pending_input_.clear();
+      processInput((const char*) input.data(), input.size(), lk);
+    } else if (len == HTTP2Frame::kConnectionPrefaceSize) {
+      upgradeToHTTP2(lk);
     } else {
-      parser_.parse((char *) read_buf_.data(), len);
+      awaitRead();
+    }
+
+    return;
+  }
+
+  try {
+    auto consumed = parser_.parse(data, size);
+
+    // the remainder belongs to the next pipelined request
+    if (consumed < size) {
+      pending_input_.append(data + consumed, size - consumed);
     }
   } catch (Exception& e) {
     logDebug("http.server", e, "HTTP parse error, closing...");
@@ -132,33 +311,50 @@ void HTTPServerConnection::read() {
       on_error_cb_();
     }
 
-    lk.unlock();
+    lk->unlock();
     close();
     return;
   }
 
+  if (upgrade_h2c_) {
+    upgradeToHTTP2(lk);
+    return;
+  }
+
   if (parser_.state() != HTTPParser::S_DONE) {
-    awaitRead();
+    // until a handler claimed the body, don't read more than we buffered
+    if (body_paused_ || (!body_claimed_ && body_buf_.size() > 0)) {
+      body_read_pending_ = true;
+    } else {
+      awaitRead();
+    }
   }
 }
 
 void HTTPServerConnection::write() {
   std::unique_lock<std::recursive_mutex> lk(mutex_);
+  deadline_ = 0;
 
-  auto data = ((char *) write_buf_.data()) + write_buf_.mark();
-  auto size = write_buf_.size() - write_buf_.mark();
+  const char* data;
+  size_t size;
+  if (write_chunk_.get()) {
+    data = ((const char*) write_chunk_->data()) + write_chunk_pos_;
+    size = write_chunk_->size() - write_chunk_pos_;
+  } else {
+    data = ((const char*) write_buf_.data()) + write_buf_.mark();
+    size = write_buf_.size() - write_buf_.mark();
+  }
 
-  size_t len;
-  try {
-    len = conn_->write(data, size);
-    write_buf_.setMark(write_buf_.mark() + len);
-    stats_->sent_bytes.incr(len);
-  } catch (Exception& e) {
-    if (e.ofType(kWouldBlockError)) {
-      return awaitWrite();
-    }
+  auto res = conn_->tryWrite(data, size);
+  if (res.wouldBlock()) {
+    return awaitWrite();
+  }
 
-    logDebug("http.server", e, "write() failed, closing...");
+  if (res.failed()) {
+    logDebug(
+        "http.server",
+        res.toException("write() failed"),
+        "write() failed, closing...");
     if (on_error_cb_) {
       on_error_cb_();
     }
@@ -168,13 +364,28 @@ void HTTPServerConnection::write() {
     return;
   }
 
-  if (write_buf_.mark() < write_buf_.size()) {
+  stats_->sent_bytes.incr(res.bytes);
+
+  if (res.bytes < size) {
+    if (write_chunk_.get()) {
+      write_chunk_pos_ += res.bytes;
+    } else {
+      write_buf_.setMark(write_buf_.mark() + res.bytes);
+    }
+
     awaitWrite();
   } else {
+    write_chunk_ = nullptr;
+    write_chunk_pos_ = 0;
     write_buf_.clear();
+    releaseBuffer(&write_buf_);
+
+    // the callback may start the next request, which resets
+    // on_write_completed_cb_, so don't call it in place
+    auto on_write_completed = on_write_completed_cb_;
     lk.unlock();
-    if (on_write_completed_cb_) {
-      on_write_completed_cb_();
+    if (on_write_completed) {
+      on_write_completed();
     }
   }
 }
@@ -185,6 +396,26 @@ void HTTPServerConnection::awaitRead() {
     RAISE(kIllegalStateError, "read() on closed HTTP connection");
   }
 
+  if (parser_.state() == HTTPParser::S_BODY) {
+    if (opts_->body_read_timeout_micros > 0) {
+      setDeadline(
+          Deadline::BODY_READ,
+          monotonicMicros() + opts_->body_read_timeout_micros);
+    }
+  } else if (read_started_ == 0) {
+    if (opts_->idle_timeout_micros > 0) {
+      setDeadline(
+          Deadline::IDLE,
+          idle_since_ + opts_->idle_timeout_micros);
+    }
+  } else {
+    if (opts_->header_read_timeout_micros > 0) {
+      setDeadline(
+          Deadline::HEADER_READ,
+          read_started_ + opts_->header_read_timeout_micros);
+    }
+  }
+
   scheduler_->runOnReadable(
       std::bind(&HTTPServerConnection::read, this),
       *conn_);
@@ -196,6 +427,12 @@ void HTTPServerConnection::awaitWrite() {
     RAISE(kIllegalStateError, "write() on closed HTTP connection");
   }
 
+  if (opts_->write_timeout_micros > 0) {
+    setDeadline(
+        Deadline::WRITE,
+        monotonicMicros() + opts_->write_timeout_micros);
+  }
+
   scheduler_->runOnWritable(
       std::bind(&HTTPServerConnection::write, this),
       *conn_);
@@ -207,24 +444,123 @@ void HTTPServerConnection::nextRequest() {
   cur_handler_.reset(nullptr);
   on_write_completed_cb_ = nullptr;
   on_error_cb_ = nullptr;
+  body_callback_ = nullptr;
+  body_claimed_ = false;
+  body_paused_ = false;
+  body_read_pending_ = false;
+  body_complete_ = false;
   body_buf_.clear();
+  keepalive_ = false;
+  idle_since_ = monotonicMicros();
+  read_started_ = 0;
 
   parser_.onBodyChunk([this] (const char* data, size_t size) {
     std::unique_lock<std::recursive_mutex> lk(mutex_);
+    acquireBuffer(&body_buf_);
     body_buf_.append(data, size);
   });
 
-  awaitRead();
+  if (pending_input_.size() > 0) {
+    incRef();
+    scheduler_->runAsync([this] {
+      readPendingInput();
+      decRef();
+    });
+  } else {
+    // the connection is idle until the next request arrives
+    if (buffer_pool_) {
+      releaseBuffer(&body_buf_);
+      releaseBuffer(&write_buf_);
+      releaseBuffer(&pending_input_);
+      parser_.freeBuffer();
+    }
+
+    stats_->idle_connection_bytes.decr(idle_bytes_);
+    idle_bytes_ =
+        read_buf_.allocSize() +
+        write_buf_.allocSize() +
+        body_buf_.allocSize() +
+        pending_input_.allocSize();
+
+    stats_->idle_connection_bytes.incr(idle_bytes_);
+    awaitRead();
+  }
 }
 
 void HTTPServerConnection::dispatchRequest() {
-  stats_->total_requests.incr(1);
-  stats_->current_requests.incr(1);
+  h2c_maybe_ = false;
 
+  // the request is answered on stream 1 once we switched to HTTP/2
+  if (isUpgradeRequest()) {
+    upgrade_h2c_ = true;
+    return;
+  }
+
+  startRequest();
   cur_handler_= handler_factory_->getHandler(this, cur_request_.get());
   cur_handler_->handleHTTPRequest();
 }
 
+// precondition: must hold mutex
+bool HTTPServerConnection::isUpgradeRequest() const {
+  if (!opts_->enable_h2c ||
+      cur_request_->version() != "HTTP/1.1" ||
+      !cur_request_->hasHeader("HTTP2-Settings")) {
+    return false;
+  }
+
+  // a request body would have to be read as HTTP/1.1 before we can switch,
+  // we just answer such requests with HTTP/1.1
+  const auto& content_length = cur_request_->getHeader("Content-Length");
+  if (cur_request_->hasHeader("Transfer-Encoding") ||
+      !(content_length.empty() || content_length == "0")) {
+    return false;
+  }
+
+  auto protocols = StringUtil::split(cur_request_->getHeader("Upgrade"), ",");
+  for (const auto& protocol : protocols) {
+    auto name = StringUtil::stripShell(protocol);
+    StringUtil::toLower(&name);
+    if (name == "h2c") {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// precondition: lk must be locked
+void HTTPServerConnection::upgradeToHTTP2(
+    std::unique_lock<std::recursive_mutex>* lk) {
+  logTrace("http.server", "HTTP connection upgrade: $0", inspect(*this));
+
+  // the HTTP/2 connection takes over the socket and whatever we read past
+  // the preface or the upgrade request
+  closed_ = true;
+  deadline_ = 0;
+  ScopedPtr<net::TCPConnection> conn(std::move(conn_));
+  ScopedPtr<HTTPRequest> upgrade_request;
+  if (upgrade_h2c_) {
+    upgrade_request = std::move(cur_request_);
+  }
+
+  Buffer input(std::move(pending_input_));
+  pending_input_.clear();
+  lk->unlock();
+
+  HTTP2ServerConnection::start(
+      handler_factory_,
+      std::move(conn),
+      scheduler_,
+      opts_,
+      stats_,
+      response_budget_,
+      std::move(upgrade_request),
+      input);
+
+  decRef();
+}
+
 void HTTPServerConnection::readRequestBody(
     Function<void (const void*, size_t, bool)> callback,
     Function<void()> on_error) {
@@ -246,11 +582,18 @@ void HTTPServerConnection::readRequestBody(
 
   auto read_body_chunk_fn = [this, callback] (const char* data, size_t size) {
     std::unique_lock<std::recursive_mutex> lk(mutex_);
-    body_buf_.append(data, size);
+    if (size > 0) {
+      acquireBuffer(&body_buf_);
+      body_buf_.append(data, size);
+    }
+
     auto last_chunk = parser_.state() == HTTPParser::S_DONE;
 
     if (last_chunk || body_buf_.size() > 0) {
       BufferRef chunk(new Buffer(body_buf_));
+      if (last_chunk) {
+        on_error_cb_ = nullptr;
+      }
 
       scheduler_->runAsync([callback, chunk, last_chunk] {
         callback(
@@ -260,13 +603,116 @@ void HTTPServerConnection::readRequestBody(
       });
 
       body_buf_.clear();
+      releaseBuffer(&body_buf_);
     }
   };
 
   parser_.onBodyChunk(read_body_chunk_fn);
   on_error_cb_ = on_error;
-  lk.unlock();
   read_body_chunk_fn(nullptr, 0);
+  claimRequestBody();
+}
+
+void HTTPServerConnection::streamRequestBody(
+    Function<void (const void*, size_t, bool)> callback,
+    Function<void()> on_error) {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+
+  switch (parser_.state()) {
+    case HTTPParser::S_REQ_METHOD:
+    case HTTPParser::S_REQ_URI:
+    case HTTPParser::S_REQ_VERSION:
+    case HTTPParser::S_RES_VERSION:
+    case HTTPParser::S_RES_STATUS_CODE:
+    case HTTPParser::S_RES_STATUS_NAME:
+    case HTTPParser::S_HEADER:
+      RAISE(kIllegalStateError, "can't read body before headers are parsed");
+    case HTTPParser::S_BODY:
+    case HTTPParser::S_DONE:
+      break;
+  }
+
+  body_callback_ = callback;
+  on_error_cb_ = on_error;
+
+  // whatever arrived together with the headers was already buffered. we
+  // still hold the lock, so no new chunks can overtake it
+  if (body_buf_.size() > 0) {
+    callback(body_buf_.data(), body_buf_.size(), false);
+    body_buf_.clear();
+    releaseBuffer(&body_buf_);
+  }
+
+  if (parser_.state() == HTTPParser::S_DONE) {
+    finishRequestBody();
+    return;
+  }
+
+  parser_.onBodyChunk([this] (const char* data, size_t size) {
+    if (size > 0 && body_callback_) {
+      body_callback_(data, size, false);
+    }
+
+    if (parser_.state() == HTTPParser::S_DONE) {
+      finishRequestBody();
+    }
+  });
+
+  claimRequestBody();
+}
+
+void HTTPServerConnection::pauseRequestBody() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  body_paused_ = true;
+}
+
+void HTTPServerConnection::resumeRequestBody() {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  if (!body_paused_) {
+    return;
+  }
+
+  body_paused_ = false;
+  if (closed_) {
+    return;
+  }
+
+  if (body_complete_) {
+    finishRequestBody();
+  }
+
+  if (body_read_pending_) {
+    body_read_pending_ = false;
+    awaitRead();
+  }
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::claimRequestBody() {
+  body_claimed_ = true;
+  if (body_paused_ || !body_read_pending_ || closed_) {
+    return;
+  }
+
+  body_read_pending_ = false;
+  awaitRead();
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::finishRequestBody() {
+  body_complete_ = true;
+  if (body_paused_ || !body_callback_) {
+    return;
+  }
+
+  // the last chunk callback usually writes the response and may thus start
+  // the next request, so it must not run from within the parser
+  auto callback = body_callback_;
+  body_callback_ = nullptr;
+  on_error_cb_ = nullptr;
+  scheduler_->runAsync([callback] {
+    callback(nullptr, 0, true);
+  });
 }
 
 void HTTPServerConnection::discardRequestBody(
@@ -289,8 +735,31 @@ void HTTPServerConnection::writeResponse(
     RAISE(kIllegalStateError, "can't write response before request is read");
   }
 
-  BufferOutputStream os(&write_buf_);
-  HTTPGenerator::generate(resp, &os);
+  acquireBuffer(&write_buf_);
+
+  // we can only keep the connection open if the client can tell where the
+  // response ends without waiting for us to close the connection
+  auto status = resp.statusCode();
+  keepalive_ =
+      cur_request_->keepalive() &&
+      resp.getHeader("Connection") != "close" &&
+      (resp.hasHeader("Content-Length") ||
+       resp.getHeader("Transfer-Encoding") == "chunked" ||
+       cur_request_->method() == HTTPMessage::M_HEAD ||
+       status < 200 ||
+       status == 204 ||
+       status == 304);
+
+  if (!keepalive_ && resp.getHeader("Connection") != "close") {
+    HTTPResponse close_resp(resp);
+    close_resp.setHeader("Connection", "close");
+    HTTPGenerator::generate(close_resp, &write_buf_, true);
+  } else {
+    HTTPGenerator::generate(resp, &write_buf_, true);
+  }
+
+  markFirstByte();
+  response_body_bytes_ += resp.body().size();
   on_write_completed_cb_ = ready_callback;
   on_error_cb_ = on_error;
   awaitWrite();
@@ -307,19 +776,78 @@ void HTTPServerConnection::writeResponseBody(
     RAISE(kIllegalStateError, "can't write response before request is read");
   }
 
+  acquireBuffer(&write_buf_);
   write_buf_.append(data, size);
+  response_body_bytes_ += size;
   on_write_completed_cb_ = ready_callback;
   on_error_cb_ = on_error;
   awaitWrite();
 }
 
+void HTTPServerConnection::writeResponseBody(
+    BufferRef chunk,
+    Function<void()> ready_callback,
+    Function<void()> on_error) {
+  std::lock_guard<std::recursive_mutex> lk(mutex_);
+
+  // only a chunk that starts a new write can be written in place
+  if (write_buf_.size() > 0 || write_chunk_.get()) {
+    writeResponseBody(chunk->data(), chunk->size(), ready_callback, on_error);
+    return;
+  }
+
+  if (parser_.state() != HTTPParser::S_DONE) {
+    RAISE(kIllegalStateError, "can't write response before request is read");
+  }
+
+  write_chunk_ = chunk;
+  write_chunk_pos_ = 0;
+  response_body_bytes_ += chunk->size();
+  on_write_completed_cb_ = ready_callback;
+  on_error_cb_ = on_error;
+  awaitWrite();
+}
+
+void HTTPServerConnection::rejectRequest(const HTTPResponse& resp) {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+
+  if (parser_.state() == HTTPParser::S_DONE) {
+    lk.unlock();
+    writeResponse(
+        resp,
+        std::bind(&HTTPServerConnection::finishResponse, this),
+        [] {});
+    return;
+  }
+
+  // the unread body would be parsed as the next request, so we can't keep
+  // the connection alive. drop body chunks that arrive in the meantime
+  parser_.onBodyChunk([] (const char* data, size_t size) {});
+  keepalive_ = false;
+
+  HTTPResponse close_resp(resp);
+  close_resp.setHeader("Connection", "close");
+  acquireBuffer(&write_buf_);
+  HTTPGenerator::generate(close_resp, &write_buf_, true);
+
+  markFirstByte();
+  response_body_bytes_ += resp.body().size();
+  on_write_completed_cb_ =
+      std::bind(&HTTPServerConnection::finishResponse, this);
+  on_error_cb_ = nullptr;
+  awaitWrite();
+}
+
 void HTTPServerConnection::finishResponse() {
   stats_->current_requests.decr(1);
 
-  if (false && cur_request_->keepalive()) {
-    std::lock_guard<std::recursive_mutex> lk(mutex_);
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  recordRouteStats(parser_.bodyBytesRead());
+
+  if (keepalive_ && !closed_ && parser_.state() == HTTPParser::S_DONE) {
     nextRequest();
   } else {
+    lk.unlock();
     close();
   }
 }
@@ -342,11 +870,155 @@ void HTTPServerConnection::close() {
   decRef();
 }
 
+// precondition: must hold mutex
+void HTTPServerConnection::setDeadline(Deadline kind, uint64_t deadline) {
+  deadline_kind_ = kind;
+  deadline_ = deadline;
+
+  // there is at most one timer per connection unless the deadline moves
+  // closer. a timer that fires early just re-arms itself
+  if (deadline_timer_at_ != 0 && deadline_timer_at_ <= deadline) {
+    return;
+  }
+
+  deadline_timer_at_ = deadline;
+  auto now = monotonicMicros();
+
+  incRef();
+  scheduler_->runAfter(
+      std::bind(&HTTPServerConnection::checkDeadline, this, deadline),
+      deadline > now ? deadline - now : 0);
+}
+
+void HTTPServerConnection::checkDeadline(uint64_t timer_at) {
+  std::unique_lock<std::recursive_mutex> lk(mutex_);
+  if (deadline_timer_at_ == timer_at) {
+    deadline_timer_at_ = 0;
+  }
+
+  if (closed_ || deadline_ == 0) {
+    lk.unlock();
+    decRef();
+    return;
+  }
+
+  if (deadline_ > monotonicMicros()) {
+    if (deadline_timer_at_ == 0) {
+      setDeadline(deadline_kind_, deadline_);
+    }
+
+    lk.unlock();
+    decRef();
+    return;
+  }
+
+  switch (deadline_kind_) {
+    case Deadline::IDLE:
+      stats_->idle_timeouts.incr(1);
+      break;
+    case Deadline::HEADER_READ:
+      stats_->header_read_timeouts.incr(1);
+      break;
+    case Deadline::BODY_READ:
+      stats_->body_read_timeouts.incr(1);
+      break;
+    case Deadline::WRITE:
+      stats_->write_timeouts.incr(1);
+      break;
+    case Deadline::NONE:
+      break;
+  }
+
+  logDebug("http.server", "HTTP connection timed out: $0", inspect(*this));
+
+  // N.B. we can't close the connection here since a read or write is still
+  // pending on it. shutting down the socket makes that read or write fail,
+  // which then closes the connection as usual
+  deadline_ = 0;
+  conn_->shutdown();
+
+  lk.unlock();
+  decRef();
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::acquireBuffer(Buffer* buf) {
+  if (!buffer_pool_ || buf->allocSize() > 0) {
+    return;
+  }
+
+  if (buffer_pool_->acquire(buf)) {
+    stats_->buffer_pool_hits.incr(1);
+  } else {
+    stats_->buffer_pool_misses.incr(1);
+  }
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::releaseBuffer(Buffer* buf) {
+  if (buffer_pool_) {
+    buffer_pool_->release(buf);
+  }
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::startRequest() {
+  stats_->total_requests.incr(1);
+  stats_->current_requests.incr(1);
+  request_start_ = monotonicMicros();
+  first_byte_at_ = 0;
+  response_body_bytes_ = 0;
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::markFirstByte() {
+  if (first_byte_at_ == 0) {
+    first_byte_at_ = monotonicMicros();
+  }
+}
+
+// precondition: must hold mutex
+void HTTPServerConnection::recordRouteStats(size_t request_bytes) {
+  auto now = std::max(monotonicMicros(), request_start_);
+  auto first_byte_at = std::max(first_byte_at_, request_start_);
+  if (first_byte_at_ == 0) {
+    first_byte_at = now;
+  }
+
+  // keepalive connections usually hit the same route over and over again
+  const auto& label = cur_request_->routeLabel();
+  if (route_stats_ == nullptr || label != route_label_) {
+    route_label_ = label;
+    route_stats_ = stats_->routeStats(label.empty() ? "default" : label);
+  }
+
+  route_stats_->ttfb_micros->record(first_byte_at - request_start_);
+  route_stats_->total_micros->record(now - request_start_);
+  route_stats_->request_bytes->record(request_bytes);
+  route_stats_->response_bytes->record(response_body_bytes_);
+}
+
 bool HTTPServerConnection::isClosed() const {
   std::unique_lock<std::recursive_mutex> lk(mutex_);
   return closed_;
 }
 
+const HTTPRequest* HTTPServerConnection::request() const {
+  return cur_request_.get();
+}
+
+const HTTPServerOptions* HTTPServerConnection::options() const {
+  return opts_;
+}
+
+HTTPServerStats* HTTPServerConnection::stats() const {
+  return stats_;
+}
+
+HTTPResponseBufferBudget* HTTPServerConnection::responseBufferBudget() const {
+  return response_budget_;
+}
+
 } // namespace http
 } // namespace stx
 
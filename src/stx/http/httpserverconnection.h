@@ -18,6 +18,9 @@
 #include <stx/http/httprequest.h>
 #include <stx/http/httpresponse.h>
 #include <stx/http/httpstats.h>
+#include <stx/BufferPool.h>
+#include <stx/http/HTTPResponseBufferBudget.h>
+#include <stx/http/HTTPServerOptions.h>
 #include <stx/net/tcpconnection.h>
 #include <stx/thread/taskscheduler.h>
 
@@ -49,6 +52,25 @@ public:
    * call the finishResponse method from the callback that is passed to the
    * writeResponse methods.
    *
+   * The connection is kept open for the next request if the client asked for
+   * it and the response has a Content-Length (or can't have a body).
+   * Pipelined requests are buffered and processed strictly in order.
+   *
+   * If a buffer pool is provided, the connection borrows its read, write and
+   * body buffers from the pool only while data is in flight and returns them
+   * while it is idle.
+   *
+   * If a response buffer budget is provided, HTTPResponseStreams on this
+   * connection account their buffered body bytes against it.
+   *
+   * The connection is shut down if one of the read, idle or write timeouts in
+   * opts expires while it is waiting for the client.
+   *
+   * Unless opts disable it, clients can switch the connection to HTTP/2 by
+   * starting with the HTTP/2 connection preface (prior knowledge) or with an
+   * "Upgrade: h2c" request. Each HTTP/2 stream is then passed to the handler
+   * as its own HTTPServerConnection (see HTTP2ServerConnection).
+   *
    * Here is a simple example:
    *
    *    HTTPServerConnection::start(
@@ -71,11 +93,14 @@ public:
       HTTPHandlerFactory* handler_factory,
       ScopedPtr<net::TCPConnection> conn,
       TaskScheduler* scheduler,
-      HTTPServerStats* stats);
+      const HTTPServerOptions* opts,
+      HTTPServerStats* stats,
+      BufferPool* buffer_pool = nullptr,
+      HTTPResponseBufferBudget* response_budget = nullptr);
 
-  ~HTTPServerConnection();
+  virtual ~HTTPServerConnection();
 
-  void readRequestBody(
+  virtual void readRequestBody(
       Function<void (
           const void* data,
           size_t size,
@@ -86,37 +111,144 @@ public:
       Function<void ()> ready_callback,
       Function<void()> on_error);
 
-  void writeResponse(
+  /**
+   * Stream the request body without copying it. The callback is called from
+   * the connection's I/O thread, with the connection's lock held, with slices
+   * of the read buffer that are only valid until the callback returns. The
+   * callback must not block; consumers that do I/O should copy the chunk,
+   * call pauseRequestBody and hand it to another thread (see
+   * HTTPRequestStream::readBody). The socket is not read while the callback
+   * runs or while the body is paused, so slow consumers apply TCP
+   * backpressure to the client instead of buffering the body in memory.
+   * Until the body is claimed by readRequestBody or streamRequestBody, at most
+   * one read worth of body bytes is buffered.
+   *
+   * Once the body was fully read, the callback is called one last time with
+   * last_chunk = true and no data from the task scheduler. The on_error
+   * callback is dropped before that last call, so it is only called for
+   * errors while the body is being read
+   */
+  virtual void streamRequestBody(
+      Function<void (
+          const void* data,
+          size_t size,
+          bool last_chunk)> callback,
+      Function<void()> on_error);
+
+  /**
+   * Stop reading the request body from the socket until resumeRequestBody is
+   * called. Chunks that were already read are still passed to the callback.
+   * Usually called from the streamRequestBody callback to hand a chunk to
+   * another thread
+   */
+  virtual void pauseRequestBody();
+  virtual void resumeRequestBody();
+
+  virtual void writeResponse(
       const HTTPResponse& resp,
       Function<void()> ready_callback,
       Function<void()> on_error);
 
-  void writeResponseBody(
+  virtual void writeResponseBody(
       const void* data,
       size_t size,
       Function<void()> ready_callback,
       Function<void()> on_error);
 
-  void finishResponse();
+  /**
+   * Write a body chunk without copying it. The connection keeps a reference
+   * to the chunk until it was written to the socket, so the same chunk can be
+   * written to many connections at once. The chunk must not be modified
+   * after it was passed to this method
+   */
+  virtual void writeResponseBody(
+      BufferRef chunk,
+      Function<void()> ready_callback,
+      Function<void()> on_error);
 
-  bool isClosed() const;
+  virtual void finishResponse();
+
+  /**
+   * Respond to the current request without reading its body and finish the
+   * response. If the request body wasn't fully read, the connection is closed
+   * once the response is written
+   */
+  virtual void rejectRequest(const HTTPResponse& resp);
+
+  virtual bool isClosed() const;
+
+  /**
+   * Returns the request that is currently being processed on this connection
+   */
+  const HTTPRequest* request() const;
+
+  const HTTPServerOptions* options() const;
+  HTTPServerStats* stats() const;
+  HTTPResponseBufferBudget* responseBufferBudget() const;
 
 protected:
+
+  enum class Deadline { NONE, IDLE, HEADER_READ, BODY_READ, WRITE };
+
   HTTPServerConnection(
       HTTPHandlerFactory* handler_factory,
       ScopedPtr<net::TCPConnection> conn,
       TaskScheduler* scheduler,
-      HTTPServerStats* stats);
+      const HTTPServerOptions* opts,
+      HTTPServerStats* stats,
+      BufferPool* buffer_pool,
+      HTTPResponseBufferBudget* response_budget);
+
+  /**
+   * A connection that isn't backed by its own socket, i.e. a HTTP/2 stream.
+   * It isn't counted in the connection stats
+   */
+  HTTPServerConnection(
+      HTTPHandlerFactory* handler_factory,
+      TaskScheduler* scheduler,
+      const HTTPServerOptions* opts,
+      HTTPServerStats* stats,
+      HTTPResponseBufferBudget* response_budget,
+      ScopedPtr<HTTPRequest> request);
 
   void nextRequest();
   void dispatchRequest();
 
+  // precondition: must hold mutex
+  bool isUpgradeRequest() const;
+
+  // precondition: lk must be locked, unlocks it
+  void upgradeToHTTP2(std::unique_lock<std::recursive_mutex>* lk);
+
   void read();
+  void readPendingInput();
+  void processInput(
+      const char* data,
+      size_t size,
+      std::unique_lock<std::recursive_mutex>* lk);
   void write();
   void awaitRead();
   void awaitWrite();
   void close();
 
+  // precondition: must hold mutex
+  void finishRequestBody();
+
+  // precondition: must hold mutex
+  void claimRequestBody();
+
+  // precondition: must hold mutex
+  void setDeadline(Deadline kind, uint64_t deadline);
+  void checkDeadline(uint64_t timer_at);
+
+  // precondition: must hold mutex
+  void acquireBuffer(Buffer* buf);
+  void releaseBuffer(Buffer* buf);
+
+  void startRequest();
+  void markFirstByte();
+  void recordRouteStats(size_t request_bytes);
+
   HTTPHandlerFactory* handler_factory_;
   ScopedPtr<net::TCPConnection> conn_;
   TaskScheduler* scheduler_;
@@ -125,12 +257,37 @@ protected:
   Function<void ()> on_error_cb_;
   Buffer read_buf_;
   Buffer write_buf_;
+  BufferRef write_chunk_;
+  size_t write_chunk_pos_;
   Buffer body_buf_;
+  Buffer pending_input_;
   ScopedPtr<HTTPRequest> cur_request_;
   ScopedPtr<HTTPHandler> cur_handler_;
   mutable std::recursive_mutex mutex_;
   bool closed_;
+  bool keepalive_;
+  bool h2c_maybe_;
+  bool upgrade_h2c_;
+  Function<void (const void*, size_t, bool)> body_callback_;
+  bool body_claimed_;
+  bool body_paused_;
+  bool body_read_pending_;
+  bool body_complete_;
+  uint64_t request_start_;
+  uint64_t idle_since_;
+  uint64_t read_started_;
+  Deadline deadline_kind_;
+  uint64_t deadline_;
+  uint64_t deadline_timer_at_;
+  uint64_t first_byte_at_;
+  size_t response_body_bytes_;
+  String route_label_;
+  const HTTPRouteStats* route_stats_;
+  const HTTPServerOptions* opts_;
   HTTPServerStats* stats_;
+  BufferPool* buffer_pool_;
+  HTTPResponseBufferBudget* response_budget_;
+  size_t idle_bytes_;
 };
 
 }
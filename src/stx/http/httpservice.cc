@@ -9,6 +9,7 @@
  */
 #include <stx/inspect.h>
 #include <stx/logging.h>
+#include <stx/wallclock.h>
 #include "stx/http/httpserverconnection.h"
 #include <stx/http/httpservice.h>
 #include <stx/http/HTTPResponseStream.h>
@@ -38,17 +39,28 @@ HTTPServiceHandler::HTTPServiceHandler(
     StreamingHTTPService* service,
     TaskScheduler* scheduler,
     HTTPServerConnection* conn,
-    HTTPRequest* req) :
+    HTTPRequest* req,
+    HTTPAdmissionController* admission /* = nullptr */) :
     service_(service),
     scheduler_(scheduler),
     conn_(conn),
-    req_(req) {}
+    req_(req),
+    admission_(admission) {}
 
 void HTTPServiceHandler::handleHTTPRequest() {
+  // reject before reading the body so that shedding a request stays cheap
+  if (admission_ && !admission_->admit()) {
+    rejectRequest();
+    return;
+  }
+
   if (service_->isStreaming()) {
     dispatchRequest();
   } else {
-    conn_->readRequestBody([this] (
+    // N.B. the connection drops the error callback once the body is complete,
+    // so after dispatchRequest only the runnable releases the admission
+    auto admission = admission_;
+    conn_->streamRequestBody([this] (
         const void* data,
         size_t size,
         bool last_chunk) {
@@ -58,12 +70,30 @@ void HTTPServiceHandler::handleHTTPRequest() {
         dispatchRequest();
       }
     },
-    [] {});
+    [admission] {
+      if (admission) {
+        admission->release();
+      }
+    });
   }
 }
 
 void HTTPServiceHandler::dispatchRequest() {
-  auto runnable = [this] () {
+  auto enqueued_at = WallClock::unixMicros();
+
+  // N.B. the handler may be freed as soon as the response is finished, so
+  // don't access members after the service returned
+  auto admission = admission_;
+  auto runnable = [this, admission, enqueued_at] () {
+    if (admission) {
+      auto queue_delay = WallClock::unixMicros() - enqueued_at;
+      if (!admission->dequeue(queue_delay)) {
+        admission->release();
+        rejectRequest();
+        return;
+      }
+    }
+
     auto res_stream = mkRef(new HTTPResponseStream(conn_));
     auto req_stream = mkRef(new HTTPRequestStream(*req_, conn_));
 
@@ -86,6 +116,10 @@ void HTTPServiceHandler::dispatchRequest() {
         logError("http.server", e, "Connection Error");
       }
     }
+
+    if (admission) {
+      admission->release();
+    }
   };
 
   if (scheduler_ == nullptr) {
@@ -95,6 +129,28 @@ void HTTPServiceHandler::dispatchRequest() {
   }
 }
 
+void HTTPServiceHandler::rejectRequest() {
+  conn_->stats()->shed_requests.incr(1);
+
+  HTTPResponse res;
+  res.populateFromRequest(*req_);
+  res.setStatus(kStatusServiceUnavailable);
+  res.addHeader("Content-Type", "text/plain");
+  res.addBody("Service Unavailable");
+  res.setHeader("Content-Length", StringUtil::toString(res.body().size()));
+
+  auto retry_after = admission_->options().retry_after_seconds;
+  if (retry_after > 0) {
+    res.setHeader("Retry-After", StringUtil::toString(retry_after));
+  }
+
+  try {
+    conn_->rejectRequest(res);
+  } catch (const std::exception& e) {
+    logError("http.server", e, "Connection Error");
+  }
+}
+
 }
 }
 
@@ -14,6 +14,7 @@
 #include <stx/http/httpresponse.h>
 #include <stx/http/HTTPRequestStream.h>
 #include <stx/http/HTTPResponseStream.h>
+#include <stx/http/HTTPAdmissionController.h>
 #include "stx/thread/taskscheduler.h"
 
 namespace stx {
@@ -59,17 +60,20 @@ public:
       StreamingHTTPService* service,
       TaskScheduler* scheduler,
       HTTPServerConnection* conn,
-      HTTPRequest* req);
+      HTTPRequest* req,
+      HTTPAdmissionController* admission = nullptr);
 
   void handleHTTPRequest() override;
 
 protected:
   void dispatchRequest();
+  void rejectRequest();
 
   StreamingHTTPService* service_;
   TaskScheduler* scheduler_;
   HTTPServerConnection* conn_;
   HTTPRequest* req_;
+  HTTPAdmissionController* admission_;
 };
 
 }
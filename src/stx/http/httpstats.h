@@ -13,6 +13,7 @@
 #include "stx/io/fileutil.h"
 #include "stx/stdtypes.h"
 #include "stx/stats/counter.h"
+#include "stx/stats/histogram.h"
 #include "stx/stats/multicounter.h"
 #include "stx/stats/statsrepository.h"
 
@@ -27,6 +28,18 @@ struct HTTPClientStats {
   stats::Counter<uint64_t> total_requests;
   stats::Counter<uint64_t> received_bytes;
   stats::Counter<uint64_t> sent_bytes;
+  stats::Counter<uint64_t> decompressed_responses;
+  stats::Counter<uint64_t> decompression_bytes_in;
+  stats::Counter<uint64_t> decompression_bytes_out;
+  stats::Counter<uint64_t> decompression_cpu_micros;
+  stats::Counter<uint64_t> pool_hits;
+  stats::Counter<uint64_t> pool_misses;
+  stats::Counter<uint64_t> pool_waits;
+  stats::Counter<uint64_t> pool_wait_timeouts;
+  stats::Counter<uint64_t> pool_evictions;
+  stats::Counter<uint64_t> pool_pipelined;
+  stats::Counter<uint64_t> pool_idle_connections;
+  stats::Counter<uint64_t> http2_connections;
 
   HTTPClientStats() :
       status_codes(("http_status")) {}
@@ -73,10 +86,80 @@ struct HTTPClientStats {
         FileUtil::joinPaths(path_prefix, "sent_bytes"),
         &sent_bytes,
         stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "decompressed_responses"),
+        &decompressed_responses,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "decompression_bytes_in"),
+        &decompression_bytes_in,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "decompression_bytes_out"),
+        &decompression_bytes_out,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "decompression_cpu_micros"),
+        &decompression_cpu_micros,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_hits"),
+        &pool_hits,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_misses"),
+        &pool_misses,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_waits"),
+        &pool_waits,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_wait_timeouts"),
+        &pool_wait_timeouts,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_evictions"),
+        &pool_evictions,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_pipelined"),
+        &pool_pipelined,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "pool_idle_connections"),
+        &pool_idle_connections,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "http2_connections"),
+        &http2_connections,
+        stats::ExportMode::EXPORT_DELTA);
   }
 
 };
 
+/**
+ * The histograms of a single route, see HTTPServerStats::routeStats
+ */
+struct HTTPRouteStats {
+  stats::WindowedHistogram* ttfb_micros;
+  stats::WindowedHistogram* total_micros;
+  stats::WindowedHistogram* request_bytes;
+  stats::WindowedHistogram* response_bytes;
+};
+
 struct HTTPServerStats {
   stats::Counter<uint64_t> current_connections;
   stats::Counter<uint64_t> total_connections;
@@ -85,10 +168,57 @@ struct HTTPServerStats {
   stats::Counter<uint64_t> total_requests;
   stats::Counter<uint64_t> received_bytes;
   stats::Counter<uint64_t> sent_bytes;
+  stats::Counter<uint64_t> compressed_responses;
+  stats::Counter<uint64_t> compression_bytes_in;
+  stats::Counter<uint64_t> compression_bytes_out;
+  stats::Counter<uint64_t> compression_cpu_micros;
+  stats::Counter<uint64_t> shed_requests;
+  stats::Counter<uint64_t> accept_pauses;
+  stats::Counter<uint64_t> buffer_pool_hits;
+  stats::Counter<uint64_t> buffer_pool_misses;
+  stats::Counter<uint64_t> idle_connection_bytes;
+  stats::Counter<uint64_t> response_buffered_bytes;
+  stats::Counter<uint64_t> response_writer_suspends;
+  stats::Counter<uint64_t> header_read_timeouts;
+  stats::Counter<uint64_t> body_read_timeouts;
+  stats::Counter<uint64_t> idle_timeouts;
+  stats::Counter<uint64_t> write_timeouts;
+  stats::Counter<uint64_t> http2_connections;
+  stats::Counter<uint64_t> http2_streams;
+
+  /**
+   * Per-route histograms, keyed by the HTTPRouter route label. They cover the
+   * last one to two minutes, not the lifetime of the server
+   */
+  stats::MultiHistogram route_ttfb_micros;
+  stats::MultiHistogram route_total_micros;
+  stats::MultiHistogram route_request_bytes;
+  stats::MultiHistogram route_response_bytes;
 
   HTTPServerStats() :
       status_codes(("http_status")) {}
 
+  /**
+   * Returns the histograms of the route with the provided label. The result
+   * is valid for the lifetime of the stats, so it only needs to be looked up
+   * once per route
+   */
+  const HTTPRouteStats* routeStats(const String& label) {
+    std::unique_lock<std::mutex> lk(route_stats_mutex_);
+
+    auto& route = route_stats_[label];
+    if (route.get() == nullptr) {
+      route.reset(new HTTPRouteStats {
+        route_ttfb_micros.get(label),
+        route_total_micros.get(label),
+        route_request_bytes.get(label),
+        route_response_bytes.get(label)
+      });
+    }
+
+    return route.get();
+  }
+
   void exportStats(
       const String& path_prefix = "/fnord/http/client/",
       stats::StatsRepository* stats_repo = nullptr) {
@@ -132,7 +262,116 @@ struct HTTPServerStats {
         &sent_bytes,
         stats::ExportMode::EXPORT_DELTA);
 
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "compressed_responses"),
+        &compressed_responses,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "compression_bytes_in"),
+        &compression_bytes_in,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "compression_bytes_out"),
+        &compression_bytes_out,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "compression_cpu_micros"),
+        &compression_cpu_micros,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "shed_requests"),
+        &shed_requests,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "accept_pauses"),
+        &accept_pauses,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "buffer_pool_hits"),
+        &buffer_pool_hits,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "buffer_pool_misses"),
+        &buffer_pool_misses,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "idle_connection_bytes"),
+        &idle_connection_bytes,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "response_buffered_bytes"),
+        &response_buffered_bytes,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "response_writer_suspends"),
+        &response_writer_suspends,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "header_read_timeouts"),
+        &header_read_timeouts,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "body_read_timeouts"),
+        &body_read_timeouts,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "idle_timeouts"),
+        &idle_timeouts,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "write_timeouts"),
+        &write_timeouts,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "http2_connections"),
+        &http2_connections,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "http2_streams"),
+        &http2_streams,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "route_ttfb_micros"),
+        &route_ttfb_micros,
+        stats::ExportMode::EXPORT_VALUE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "route_total_micros"),
+        &route_total_micros,
+        stats::ExportMode::EXPORT_VALUE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "route_request_bytes"),
+        &route_request_bytes,
+        stats::ExportMode::EXPORT_VALUE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "route_response_bytes"),
+        &route_response_bytes,
+        stats::ExportMode::EXPORT_VALUE);
+
   }
+
+protected:
+  HashMap<String, ScopedPtr<HTTPRouteStats>> route_stats_;
+  std::mutex route_stats_mutex_;
 };
 
 }
@@ -28,6 +28,7 @@ const HTTPStatus kStatusForbidden(403, "Forbidden");
 const HTTPStatus kStatusNotFound(404, "Not found");
 const HTTPStatus kStatusMovedPermanently(301, "Moved permanently");
 const HTTPStatus kStatusFound(302, "Found");
+const HTTPStatus kStatusNotModified(304, "Not Modified");
 const HTTPStatus kStatusInternalServerError(500, "Internal Server Error");
 const HTTPStatus kStatusBadGateway(502, "Bad Gateway");
 const HTTPStatus kStatusServiceUnavailable(503, "Service unavailable");
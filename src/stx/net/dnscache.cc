@@ -7,23 +7,321 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <condition_variable>
+#include "stx/exception.h"
+#include "stx/stringutil.h"
+#include "stx/wallclock.h"
 #include "stx/net/dnscache.h"
 
 namespace stx {
 namespace net {
 
+DNSCacheOptions::DNSCacheOptions() :
+    num_threads(kDefaultNumThreads),
+    ttl_micros(kDefaultTTLMicros),
+    negative_ttl_micros(kDefaultNegativeTTLMicros),
+    refresh_ahead(kDefaultRefreshAhead),
+    resolver(&DNSCache::resolveWithGetAddrInfo) {}
+
+Vector<String> DNSCache::resolveWithGetAddrInfo(const String& hostname) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo* res = nullptr;
+  auto rc = getaddrinfo(hostname.c_str(), nullptr, &hints, &res);
+  if (rc != 0) {
+    RAISEF(
+        kResolveError,
+        "getaddrinfo($0) failed: $1",
+        hostname,
+        String(gai_strerror(rc)));
+  }
+
+  Vector<String> ips;
+  for (auto cur = res; cur != nullptr; cur = cur->ai_next) {
+    char ip[INET_ADDRSTRLEN];
+    auto sin = (const struct sockaddr_in*) cur->ai_addr;
+    if (inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip)) == nullptr) {
+      continue;
+    }
+
+    String ip_str(ip);
+    if (std::find(ips.begin(), ips.end(), ip_str) == ips.end()) {
+      ips.emplace_back(ip_str);
+    }
+  }
+
+  freeaddrinfo(res);
+  return ips;
+}
+
+DNSCache::DNSCache(
+    const DNSCacheOptions& opts /* = DNSCacheOptions() */) :
+    opts_(opts) {}
+
+DNSCache::~DNSCache() {
+  if (resolver_pool_.get() != nullptr) {
+    resolver_pool_->stop();
+  }
+}
+
 InetAddr DNSCache::resolve(const std::string& addr_str) {
-  std::unique_lock<std::mutex> lk(mutex_);
+  String hostname;
+  unsigned port;
+  splitAddr(addr_str, &hostname, &port);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  String ip;
+  String error;
+
+  resolveImpl(
+      hostname,
+      [&mutex, &cv, &done, &ip, &error] (
+          const Vector<String>& ips,
+          const String& err,
+          size_t rr) {
+        std::unique_lock<std::mutex> lk(mutex);
+        if (err.empty()) {
+          ip = ips[rr % ips.size()];
+        } else {
+          error = err;
+        }
+
+        done = true;
+        cv.notify_all();
+      });
+
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!done) {
+    cv.wait(lk);
+  }
+
+  if (!error.empty()) {
+    RAISE(kResolveError, error);
+  }
+
+  return InetAddr::mkResolved(hostname, ip, port);
+}
+
+Future<InetAddr> DNSCache::resolveAsync(const std::string& addr_str) {
+  Promise<InetAddr> promise;
+
+  String hostname;
+  unsigned port;
+  try {
+    splitAddr(addr_str, &hostname, &port);
+  } catch (const std::exception& e) {
+    promise.failure(e);
+    return promise.future();
+  }
+
+  resolveImpl(
+      hostname,
+      [promise, hostname, port] (
+          const Vector<String>& ips,
+          const String& error,
+          size_t rr) mutable {
+        if (error.empty()) {
+          promise.success(
+              InetAddr::mkResolved(hostname, ips[rr % ips.size()], port));
+        } else {
+          promise.failure(Status(eIOError, error));
+        }
+      });
+
+  return promise.future();
+}
+
+Future<Vector<InetAddr>> DNSCache::resolveAll(const std::string& addr_str) {
+  Promise<Vector<InetAddr>> promise;
+
+  String hostname;
+  unsigned port;
+  try {
+    splitAddr(addr_str, &hostname, &port);
+  } catch (const std::exception& e) {
+    promise.failure(e);
+    return promise.future();
+  }
+
+  resolveImpl(
+      hostname,
+      [promise, hostname, port] (
+          const Vector<String>& ips,
+          const String& error,
+          size_t rr) mutable {
+        if (!error.empty()) {
+          promise.failure(Status(eIOError, error));
+          return;
+        }
+
+        Vector<InetAddr> addrs;
+        for (const auto& ip : ips) {
+          addrs.emplace_back(InetAddr::mkResolved(hostname, ip, port));
+        }
+
+        promise.success(std::move(addrs));
+      });
+
+  return promise.future();
+}
+
+Option<InetAddr> DNSCache::lookup(const std::string& addr_str) {
+  String hostname;
+  unsigned port;
+  try {
+    splitAddr(addr_str, &hostname, &port);
+  } catch (const std::exception& e) {
+    return None<InetAddr>();
+  }
 
-  auto iter = cache_.find(addr_str);
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto iter = cache_.find(hostname);
   if (iter == cache_.end()) {
+    return None<InetAddr>();
+  }
+
+  auto& entry = iter->second;
+  auto now = WallClock::unixMicros();
+  if (entry.ips.empty() || now >= entry.expires_at) {
+    return None<InetAddr>();
+  }
+
+  auto ip = entry.ips[entry.next++ % entry.ips.size()];
+  if (now >= entry.refresh_at && !entry.resolving) {
+    entry.resolving = true;
+    startLookup(hostname);
+  }
+
+  lk.unlock();
+
+  return Some(InetAddr::mkResolved(hostname, ip, port));
+}
+
+void DNSCache::splitAddr(
+    const std::string& addr_str,
+    String* hostname,
+    unsigned* port) {
+  auto parts = StringUtil::split(addr_str, ":");
+
+  switch (parts.size()) {
+    case 1:
+      *hostname = parts[0];
+      *port = 0;
+      break;
+
+    case 2:
+      *hostname = parts[0];
+      *port = std::stoi(parts[1]);
+      break;
+
+    default:
+      RAISEF(kResolveError, "invalid address: $0", addr_str);
+  }
+}
+
+void DNSCache::resolveImpl(const String& hostname, Callback callback) {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  auto& entry = cache_[hostname];
+  auto now = WallClock::unixMicros();
+
+  /* cache hit: answer from the cache, maybe refresh in the background */
+  if (now < entry.expires_at) {
+    auto rr = entry.next++;
+    if (now >= entry.refresh_at && !entry.resolving) {
+      entry.resolving = true;
+      startLookup(hostname);
+    }
+
+    auto ips = entry.ips;
+    auto error = entry.error;
     lk.unlock();
-    auto addr = InetAddr::resolve(addr_str);
-    lk.lock();
-    cache_.emplace(addr_str, addr);
-    return addr;
+    callback(ips, error, rr);
+    return;
+  }
+
+  /* cache miss: wait for the pending lookup or start a new one */
+  entry.waiters.emplace_back(callback);
+  if (!entry.resolving) {
+    entry.resolving = true;
+    startLookup(hostname);
+  }
+}
+
+/* must be called with mutex_ held */
+void DNSCache::startLookup(const String& hostname) {
+  if (resolver_pool_.get() == nullptr) {
+    thread::ThreadPoolOptions tpopts;
+    tpopts.thread_name = Some(String("dnscache"));
+    resolver_pool_.reset(
+        new thread::FixedSizeThreadPool(tpopts, opts_.num_threads));
+    resolver_pool_->start();
+  }
+
+  resolver_pool_->run([this, hostname] {
+    Vector<String> ips;
+    String error;
+
+    try {
+      ips = opts_.resolver(hostname);
+      if (ips.empty()) {
+        error = StringUtil::format("no addresses found for $0", hostname);
+      }
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+
+    finishLookup(hostname, ips, error);
+  });
+}
+
+void DNSCache::finishLookup(
+    const String& hostname,
+    const Vector<String>& ips,
+    const String& error) {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  auto& entry = cache_[hostname];
+  auto now = WallClock::unixMicros();
+  entry.resolving = false;
+
+  if (!error.empty() && !entry.ips.empty() && now < entry.expires_at) {
+    /* failed refresh: keep serving the old addresses until they expire */
+    entry.refresh_at = entry.expires_at;
+  } else if (error.empty()) {
+    entry.ips = ips;
+    entry.error.clear();
+    entry.expires_at = now + opts_.ttl_micros;
+    entry.refresh_at = now + opts_.ttl_micros * opts_.refresh_ahead;
   } else {
-    return iter->second;
+    entry.ips.clear();
+    entry.error = error;
+    entry.expires_at = now + opts_.negative_ttl_micros;
+    entry.refresh_at = entry.expires_at;
+  }
+
+  Vector<Pair<Callback, size_t>> waiters;
+  for (auto& waiter : entry.waiters) {
+    waiters.emplace_back(std::move(waiter), entry.next++);
+  }
+  entry.waiters.clear();
+
+  auto cur_ips = entry.ips;
+  auto cur_error = entry.error;
+  lk.unlock();
+
+  for (auto& waiter : waiters) {
+    waiter.first(cur_ips, cur_error, waiter.second);
   }
 }
 
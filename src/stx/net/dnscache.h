@@ -11,20 +11,138 @@
 #define _STX_NET_DNSCACHE_H
 #include <mutex>
 #include <string>
-#include <unordered_map>
+#include "stx/stdtypes.h"
+#include "stx/option.h"
+#include "stx/time_constants.h"
 #include "stx/net/inetaddr.h"
+#include "stx/thread/future.h"
+#include "stx/thread/FixedSizeThreadPool.h"
 
 namespace stx {
 namespace net {
 
+struct DNSCacheOptions {
+  static const size_t kDefaultNumThreads = 2;
+  static const uint64_t kDefaultTTLMicros = 60 * kMicrosPerSecond;
+  static const uint64_t kDefaultNegativeTTLMicros = 5 * kMicrosPerSecond;
+  static constexpr double kDefaultRefreshAhead = 0.8;
+
+  DNSCacheOptions();
+
+  /**
+   * Number of threads that run blocking lookups. The threads are started on
+   * the first lookup that misses the cache
+   */
+  size_t num_threads;
+
+  /**
+   * How long successful lookups are cached
+   */
+  uint64_t ttl_micros;
+
+  /**
+   * How long failed lookups are cached
+   */
+  uint64_t negative_ttl_micros;
+
+  /**
+   * An entry that is used after this fraction of its TTL has passed is
+   * refreshed in the background while the cached addresses are still
+   * returned. If the refresh fails, the old addresses are kept until they
+   * expire
+   */
+  double refresh_ahead;
+
+  /**
+   * Returns the IPv4 addresses of a hostname or throws a kResolveError. The
+   * default resolver uses getaddrinfo. Replace it to resolve from a stub,
+   * e.g. a hosts file or a fixed map in tests
+   */
+  Function<Vector<String> (const String& hostname)> resolver;
+};
+
+/**
+ * Caches hostname lookups. Lookups that miss the cache run on a small pool
+ * of resolver threads, so resolveAsync never blocks the caller. Concurrent
+ * lookups for the same hostname share a single resolver call.
+ *
+ * A hostname may resolve to multiple addresses. resolve and resolveAsync
+ * return them in round robin order so that connections are spread over all
+ * of them.
+ *
+ * Addresses are "hostname" or "hostname:port". All methods are thread safe.
+ */
 class DNSCache {
 public:
 
+  /**
+   * The default resolver: getaddrinfo, IPv4 only
+   */
+  static Vector<String> resolveWithGetAddrInfo(const String& hostname);
+
+  DNSCache(const DNSCacheOptions& opts = DNSCacheOptions());
+  ~DNSCache();
+
+  DNSCache(const DNSCache& other) = delete;
+  DNSCache& operator=(const DNSCache& other) = delete;
+
+  /**
+   * Resolve an address, blocking until the lookup completes. Throws a
+   * kResolveError if the lookup fails
+   */
   InetAddr resolve(const std::string& addr_str);
 
+  Future<InetAddr> resolveAsync(const std::string& addr_str);
+
+  /**
+   * Returns all addresses of a hostname
+   */
+  Future<Vector<InetAddr>> resolveAll(const std::string& addr_str);
+
+  /**
+   * Returns the address if it is cached. Returns None on a miss without
+   * starting a lookup
+   */
+  Option<InetAddr> lookup(const std::string& addr_str);
+
 protected:
-  std::unordered_map<std::string, InetAddr> cache_;
+
+  /**
+   * Called with the resolved addresses or an error message, and the round
+   * robin position for this caller
+   */
+  using Callback = Function<void (
+      const Vector<String>& ips,
+      const String& error,
+      size_t rr)>;
+
+  struct Entry {
+    Entry() : expires_at(0), refresh_at(0), next(0), resolving(false) {}
+    Vector<String> ips;
+    String error;
+    uint64_t expires_at;
+    uint64_t refresh_at;
+    size_t next;
+    bool resolving;
+    Vector<Callback> waiters;
+  };
+
+  static void splitAddr(
+      const std::string& addr_str,
+      String* hostname,
+      unsigned* port);
+
+  void resolveImpl(const String& hostname, Callback callback);
+  void startLookup(const String& hostname);
+  void finishLookup(
+      const String& hostname,
+      const Vector<String>& ips,
+      const String& error);
+
+  DNSCacheOptions opts_;
+  HashMap<String, Entry> cache_;
   std::mutex mutex_;
+  ScopedPtr<thread::FixedSizeThreadPool> resolver_pool_;
 };
 
 }
@@ -78,6 +78,13 @@ InetAddr InetAddr::resolve(const std::string& addr_str) {
   return InetAddr(hostname, ip, port);
 }
 
+InetAddr InetAddr::mkResolved(
+    const std::string& hostname,
+    const std::string& ip,
+    unsigned port) {
+  return InetAddr(hostname, ip, port);
+}
+
 InetAddr::InetAddr(
     const std::string& hostname,
     const std::string& ip,
@@ -18,6 +18,14 @@ public:
 
   static InetAddr resolve(const std::string& addr_str);
 
+  /**
+   * Returns an address that is already resolved to the provided ip
+   */
+  static InetAddr mkResolved(
+      const std::string& hostname,
+      const std::string& ip,
+      unsigned port);
+
   InetAddr(
       const std::string& hostname,
       unsigned port);
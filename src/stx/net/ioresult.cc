@@ -0,0 +1,85 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include "stx/net/ioresult.h"
+
+namespace stx {
+namespace net {
+
+IOResult IOResult::mkOK(size_t bytes) {
+  IOResult res;
+  res.status = OK;
+  res.bytes = bytes;
+  res.error = 0;
+  return res;
+}
+
+IOResult IOResult::mkWouldBlock() {
+  IOResult res;
+  res.status = WOULD_BLOCK;
+  res.bytes = 0;
+  res.error = 0;
+  return res;
+}
+
+IOResult IOResult::mkEOF() {
+  IOResult res;
+  res.status = END_OF_FILE;
+  res.bytes = 0;
+  res.error = 0;
+  return res;
+}
+
+IOResult IOResult::mkError(int posix_errno) {
+  IOResult res;
+  res.status = ERROR;
+  res.bytes = 0;
+  res.error = posix_errno;
+  return res;
+}
+
+IOResult IOResult::fromSyscall(ssize_t res, bool is_read) {
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return mkWouldBlock();
+    } else {
+      return mkError(errno);
+    }
+  }
+
+  if (res == 0 && is_read) {
+    return mkEOF();
+  }
+
+  return mkOK(res);
+}
+
+bool IOResult::ok() const {
+  return status == OK;
+}
+
+bool IOResult::wouldBlock() const {
+  return status == WOULD_BLOCK;
+}
+
+bool IOResult::eof() const {
+  return status == END_OF_FILE;
+}
+
+bool IOResult::failed() const {
+  return status == ERROR;
+}
+
+Exception IOResult::toException(const String& message) const {
+  return Exception(message).setTypeName(kIOError).setErrno(error);
+}
+
+}
+}
@@ -0,0 +1,61 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_NET_IORESULT_H
+#define _STX_NET_IORESULT_H
+#include <stdlib.h>
+#include "stx/stdtypes.h"
+#include "stx/exception.h"
+
+namespace stx {
+namespace net {
+
+/**
+ * The outcome of a single non-blocking read or write. Returned by the
+ * TCPConnection::try* methods, which never throw, so that EAGAIN on a
+ * non-blocking socket doesn't cost an exception
+ */
+struct IOResult {
+  enum Status {
+    OK,
+    WOULD_BLOCK,
+    END_OF_FILE,
+    ERROR
+  };
+
+  static IOResult mkOK(size_t bytes);
+  static IOResult mkWouldBlock();
+  static IOResult mkEOF();
+  static IOResult mkError(int posix_errno);
+
+  /**
+   * Returns the result of a read(2)/write(2)-style call (-1 and errno on
+   * error). A read returning zero bytes is reported as END_OF_FILE
+   */
+  static IOResult fromSyscall(ssize_t res, bool is_read);
+
+  bool ok() const;
+  bool wouldBlock() const;
+  bool eof() const;
+  bool failed() const;
+
+  /**
+   * Returns a kIOError exception for a failed result, for callers that need
+   * to report the error to someone else
+   */
+  Exception toException(const String& message) const;
+
+  Status status;
+  size_t bytes;
+  int error;
+};
+
+}
+}
+#endif
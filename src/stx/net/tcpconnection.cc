@@ -9,6 +9,7 @@
  */
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -82,27 +83,72 @@ int TCPConnection::fd() const {
 }
 
 size_t TCPConnection::read(void* dst, size_t size) {
-  auto res = ::read(fd_, dst, size);
+  auto res = tryRead(dst, size);
 
-  if (res < 0) {
-    if (errno == EWOULDBLOCK) {
+  switch (res.status) {
+    case IOResult::WOULD_BLOCK:
       RAISE(kWouldBlockError);
-    } else {
-      RAISE_ERRNO(kIOError, "read() failed");
-    }
+    case IOResult::ERROR:
+      RAISE_EXCEPTION(res.toException("read() failed"));
+    default:
+      return res.bytes;
   }
-
-  return res;
 }
 
 size_t TCPConnection::write(const void* data, size_t size) {
-  auto res = ::write(fd_, data, size);
+  auto res = tryWrite(data, size);
 
-  if (res < 0) {
-    RAISE_ERRNO(kIOError, "write() failed");
+  switch (res.status) {
+    case IOResult::WOULD_BLOCK:
+      RAISE(kWouldBlockError);
+    case IOResult::ERROR:
+      RAISE_EXCEPTION(res.toException("write() failed"));
+    default:
+      return res.bytes;
   }
+}
+
+IOResult TCPConnection::tryRead(void* dst, size_t size) {
+  ssize_t res;
+  do {
+    res = ::read(fd_, dst, size);
+  } while (res < 0 && errno == EINTR);
+
+  return IOResult::fromSyscall(res, true);
+}
+
+IOResult TCPConnection::tryWrite(const void* data, size_t size) {
+  // MSG_NOSIGNAL: a write to a connection the peer has closed must fail with
+  // EPIPE instead of raising SIGPIPE
+  ssize_t res;
+  do {
+    res = ::send(fd_, data, size, MSG_NOSIGNAL);
+  } while (res < 0 && errno == EINTR);
+
+  return IOResult::fromSyscall(res, false);
+}
 
-  return res;
+IOResult TCPConnection::tryReadv(const struct iovec* iov, int iovcnt) {
+  ssize_t res;
+  do {
+    res = ::readv(fd_, iov, iovcnt);
+  } while (res < 0 && errno == EINTR);
+
+  return IOResult::fromSyscall(res, true);
+}
+
+IOResult TCPConnection::tryWritev(const struct iovec* iov, int iovcnt) {
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = const_cast<struct iovec*>(iov);
+  msg.msg_iovlen = iovcnt;
+
+  ssize_t res;
+  do {
+    res = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+  } while (res < 0 && errno == EINTR);
+
+  return IOResult::fromSyscall(res, false);
 }
 
 void TCPConnection::close() {
@@ -110,6 +156,10 @@ void TCPConnection::close() {
   ::close(fd_);
 }
 
+void TCPConnection::shutdown() {
+  ::shutdown(fd_, SHUT_RDWR);
+}
+
 void TCPConnection::setNonblocking(bool nonblocking) {
   int flags = fcntl(fd_, F_GETFL, 0);
 
@@ -124,6 +174,13 @@ void TCPConnection::setNonblocking(bool nonblocking) {
   }
 }
 
+void TCPConnection::setNoDelay(bool nodelay) {
+  int opt = nodelay ? 1 : 0;
+  if (setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0) {
+    RAISE_ERRNO(kIOError, "setsockopt(TCP_NODELAY) failed");
+  }
+}
+
 void TCPConnection::checkErrors() const {
 
 }
@@ -10,7 +10,9 @@
 #ifndef _STX_NET_TCPCONNECTION_H
 #define _STX_NET_TCPCONNECTION_H
 #include <stdlib.h>
+#include <sys/uio.h>
 #include "stx/net/inetaddr.h"
+#include "stx/net/ioresult.h"
 #include "stx/thread/taskscheduler.h"
 
 namespace stx {
@@ -39,11 +41,43 @@ public:
   ~TCPConnection();
   int fd() const;
 
+  /**
+   * Read or write and raise a kWouldBlockError if the connection is
+   * non-blocking and not ready. read returns 0 on EOF
+   */
   size_t read(void* dst, size_t size);
   size_t write(const void* data, size_t size);
+
+  /**
+   * Non-throwing read/write. EAGAIN is reported as IOResult::WOULD_BLOCK and
+   * errors as IOResult::ERROR with the errno. Interrupted calls are retried
+   */
+  IOResult tryRead(void* dst, size_t size);
+  IOResult tryWrite(const void* data, size_t size);
+
+  /**
+   * Scatter/gather variants of tryRead and tryWrite
+   */
+  IOResult tryReadv(const struct iovec* iov, int iovcnt);
+  IOResult tryWritev(const struct iovec* iov, int iovcnt);
+
   void close();
+
+  /**
+   * Shut down both directions of the connection without closing the fd. Any
+   * pending or future read or write on the connection fails or returns EOF
+   */
+  void shutdown();
+
   void setNonblocking(bool nonblocking = true);
 
+  /**
+   * Disable (or re-enable) Nagle's algorithm on this connection. Protocols
+   * that write whole messages at once (like pipelined HTTP) should disable it
+   * so that small writes aren't delayed until the previous write was acked
+   */
+  void setNoDelay(bool nodelay = true);
+
   /**
    * This will raise an exception if there are any pending errors on the
    * connection
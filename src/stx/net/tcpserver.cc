@@ -22,8 +22,11 @@ namespace net {
 
 TCPServer::TCPServer(
     TaskScheduler* scheduler) :
+    ssock_(-1),
     scheduler_(scheduler),
-    on_connection_cb_(nullptr) {}
+    on_connection_cb_(nullptr),
+    accepting_(false),
+    paused_(false) {}
 
 void TCPServer::onConnection(
     std::function<void (std::unique_ptr<TCPConnection>)> callback) {
@@ -44,6 +47,12 @@ void TCPServer::accept() {
     });
   }
 
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (paused_) {
+    accepting_ = false;
+    return;
+  }
+
   scheduler_->runOnReadable(std::bind(&TCPServer::accept, this), ssock_);
 }
 
@@ -85,7 +94,34 @@ void TCPServer::listen(int port) {
     RAISE_ERRNO(kIOError, "listen() failed");
   }
 
-  scheduler_->runOnReadable(std::bind(&TCPServer::accept, this), ssock_);
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (!paused_) {
+    accepting_ = true;
+    scheduler_->runOnReadable(std::bind(&TCPServer::accept, this), ssock_);
+  }
+}
+
+void TCPServer::pause() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  paused_ = true;
+}
+
+void TCPServer::resume() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (!paused_) {
+    return;
+  }
+
+  paused_ = false;
+  if (!accepting_ && ssock_ >= 0) {
+    accepting_ = true;
+    scheduler_->runOnReadable(std::bind(&TCPServer::accept, this), ssock_);
+  }
+}
+
+bool TCPServer::isPaused() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return paused_;
 }
 
 
@@ -9,7 +9,7 @@
  */
 #ifndef _STX_NET_TCPSERVER_H
 #define _STX_NET_TCPSERVER_H
-
+#include <mutex>
 #include "stx/thread/taskscheduler.h"
 #include "stx/net/tcpconnection.h"
 
@@ -27,12 +27,24 @@ public:
 
   void listen(int port);
 
+  /**
+   * Stop accepting new connections. Connections that arrive while the server
+   * is paused queue up in the listen backlog until resume() is called
+   */
+  void pause();
+  void resume();
+
+  bool isPaused() const;
+
 protected:
   void accept();
 
   int ssock_;
   TaskScheduler* scheduler_;
   std::function<void (std::unique_ptr<TCPConnection>)> on_connection_cb_;
+  mutable std::mutex mutex_;
+  bool accepting_;
+  bool paused_;
 };
 
 }
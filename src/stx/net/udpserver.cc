@@ -11,23 +11,59 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <unistd.h>
+#include <memory>
+#include <stx/sysconfig.h>
 #include <stx/exception.h>
+#include <stx/logging.h>
 #include <stx/net/udpserver.h>
 
 namespace stx {
 namespace net {
 
+/**
+ * A bound socket and its receive buffers. The buffer holds batch_size slots
+ * of max_message_size bytes and is reused for every batch. It is not zero
+ * filled, so small datagrams only ever touch the first page of their slot
+ */
+struct UDPServer::Socket {
+  int fd;
+  std::unique_ptr<char[]> buf;
+  Vector<struct iovec> iov;
+#ifdef HAVE_RECVMMSG
+  Vector<struct mmsghdr> hdrs;
+#endif
+  Vector<UDPMessage> messages;
+};
+
+UDPServerOptions::UDPServerOptions() :
+    num_sockets(kDefaultNumSockets),
+    batch_size(kDefaultBatchSize),
+    max_message_size(kDefaultMaxMessageSize) {}
+
 UDPServer::UDPServer(
     TaskScheduler* server_scheduler,
-    TaskScheduler* callback_scheduler) :
+    TaskScheduler* callback_scheduler,
+    const UDPServerOptions& opts /* = UDPServerOptions() */) :
     server_scheduler_(server_scheduler),
-    callback_scheduler_(callback_scheduler) {}
+    callback_scheduler_(callback_scheduler),
+    opts_(opts) {
+  if (opts_.num_sockets == 0) {
+    RAISE(kIllegalArgumentError, "num_sockets must be at least 1");
+  }
+
+  if (opts_.batch_size == 0) {
+    RAISE(kIllegalArgumentError, "batch_size must be at least 1");
+  }
+}
 
 UDPServer::~UDPServer() {
   // FIXPAUL cancel pending task
-  close(ssock_);
+  for (const auto& sock : sockets_) {
+    close(sock->fd);
+  }
 }
 
 void UDPServer::onMessage(
@@ -35,66 +71,184 @@ void UDPServer::onMessage(
   callback_ = callback; // FIXPAUL lock or doc
 }
 
+void UDPServer::onMessages(
+    std::function<void (const UDPMessage* messages, size_t size)> callback) {
+  batch_callback_ = callback;
+}
+
 void UDPServer::listen(int port) {
-  ssock_ = socket(AF_INET, SOCK_DGRAM, 0);
-  if (ssock_ == 0) {
-    RAISE(kIOError, "create socket() failed");
+  for (size_t i = 0; i < opts_.num_sockets; ++i) {
+    openSocket(port);
+  }
+
+  for (const auto& sock : sockets_) {
+    awaitRead(sock.get());
   }
+}
+
+void UDPServer::openSocket(int port) {
+  ScopedPtr<Socket> sock(new Socket());
+  sock->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock->fd < 0) {
+    RAISE_ERRNO(kIOError, "create socket() failed");
+  }
+
+  // the socket is owned by sockets_ from here on, so it's closed by the
+  // destructor if any of the calls below fail
+  auto fd = sock->fd;
+  sockets_.emplace_back(std::move(sock));
 
   int opt = 1;
-  if (setsockopt(ssock_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
     RAISE_ERRNO(kIOError, "setsockopt(SO_REUSEADDR) failed");
     return;
   }
 
+  if (opts_.num_sockets > 1) {
+    opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+      RAISE_ERRNO(kIOError, "setsockopt(SO_REUSEPORT) failed");
+      return;
+    }
+  }
+
   struct sockaddr_in addr;
   memset((char *) &addr, 0, sizeof(addr));
   addr.sin_family = AF_INET;
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
   addr.sin_port = htons(port);
-  if (bind(ssock_, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
     RAISE_ERRNO(kIOError, "bind() failed");
   }
 
-  int flags = fcntl(ssock_, F_GETFL, 0);
+  int flags = fcntl(fd, F_GETFL, 0);
   flags = flags | O_NONBLOCK;
 
-  if (fcntl(ssock_, F_SETFL, flags) != 0) {
-    RAISE_ERRNO(kIOError, "fnctl(%i) failed", ssock_);
+  if (fcntl(fd, F_SETFL, flags) != 0) {
+    RAISE_ERRNO(kIOError, "fnctl(%i) failed", fd);
+  }
+
+  auto s = sockets_.back().get();
+  s->buf.reset(new char[opts_.batch_size * opts_.max_message_size]);
+  s->iov.resize(opts_.batch_size);
+  s->messages.resize(opts_.batch_size);
+  for (size_t i = 0; i < opts_.batch_size; ++i) {
+    s->iov[i].iov_base = s->buf.get() + i * opts_.max_message_size;
+    s->iov[i].iov_len = opts_.max_message_size;
+    s->messages[i].data = s->buf.get() + i * opts_.max_message_size;
   }
 
+#ifdef HAVE_RECVMMSG
+  s->hdrs.resize(opts_.batch_size);
+  memset(s->hdrs.data(), 0, s->hdrs.size() * sizeof(struct mmsghdr));
+  for (size_t i = 0; i < opts_.batch_size; ++i) {
+    s->hdrs[i].msg_hdr.msg_iov = &s->iov[i];
+    s->hdrs[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+}
+
+void UDPServer::awaitRead(Socket* sock) {
   server_scheduler_->runOnReadable(
-      std::bind(&UDPServer::messageReceived, this),
-      ssock_);
+      std::bind(&UDPServer::messageReceived, this, sock),
+      sock->fd);
 }
 
-void UDPServer::messageReceived() {
-  struct sockaddr_in other_addr;
-  socklen_t other_addr_len = sizeof(other_addr);
+// the socket is only re-armed once the batch was delivered, so the receive
+// buffer of a socket is never used by two threads at once
+void UDPServer::messageReceived(Socket* sock) {
+  size_t num_messages;
+  try {
+    num_messages = receiveBatch(sock);
+  } catch (...) {
+    awaitRead(sock);
+    throw;
+  }
 
-  char buf[65535];
-  auto buf_len = recvfrom(
-      ssock_,
-      buf,
-      sizeof(buf),
-      0,
-      (struct sockaddr *) &other_addr,
-      &other_addr_len);
+  if (num_messages > 0) {
+    try {
+      if (batch_callback_) {
+        batch_callback_(sock->messages.data(), num_messages);
+      }
+
+      if (callback_) {
+        for (size_t i = 0; i < num_messages; ++i) {
+          Buffer msg(sock->messages[i].data, sock->messages[i].size);
+          callback_scheduler_->run([msg, this] () { this->callback_(msg); });
+        }
+      }
+    } catch (const std::exception& e) {
+      logError("net.udpserver", e, "error while processing UDP messages");
+    }
+  }
 
-  server_scheduler_->runOnReadable(
-      std::bind(&UDPServer::messageReceived, this),
-      ssock_);
+  awaitRead(sock);
+}
 
-  if (buf_len < 0) {
-    RAISE_ERRNO(kIOError, "read(%i) failed", ssock_);
+// returns the number of messages that were written to sock->messages
+size_t UDPServer::receiveBatch(Socket* sock) {
+  size_t num_messages = 0;
+
+#ifdef HAVE_RECVMMSG
+  int res;
+  do {
+    res = recvmmsg(
+        sock->fd,
+        sock->hdrs.data(),
+        sock->hdrs.size(),
+        MSG_DONTWAIT,
+        nullptr);
+  } while (res < 0 && errno == EINTR);
+
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+
+    RAISE_ERRNO(kIOError, "recvmmsg(%i) failed", sock->fd);
   }
 
-  if (callback_) {
-    Buffer msg(buf, buf_len);
-    callback_scheduler_->run([msg, this] () { this->callback_(msg); });
+  for (int i = 0; i < res; ++i) {
+    if (sock->hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      continue;
+    }
+
+    sock->messages[num_messages].data = (const char*) sock->iov[i].iov_base;
+    sock->messages[num_messages].size = sock->hdrs[i].msg_len;
+    ++num_messages;
   }
+#else
+  for (size_t i = 0; i < sock->iov.size(); ) {
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &sock->iov[i];
+    hdr.msg_iovlen = 1;
+
+    auto res = recvmsg(sock->fd, &hdr, MSG_DONTWAIT);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+
+      RAISE_ERRNO(kIOError, "recvmsg(%i) failed", sock->fd);
+    }
+
+    if ((hdr.msg_flags & MSG_TRUNC) == 0) {
+      sock->messages[num_messages].data = (const char*) sock->iov[i].iov_base;
+      sock->messages[num_messages].size = res;
+      ++num_messages;
+    }
+
+    ++i;
+  }
+#endif
+
+  return num_messages;
 }
 
 }
 }
-
@@ -10,30 +10,94 @@
 #ifndef _libstx_NET_UDPSERVER_H
 #define _libstx_NET_UDPSERVER_H
 #include <functional>
+#include <stx/stdtypes.h>
 #include <stx/buffer.h>
 #include <stx/thread/taskscheduler.h>
 
 namespace stx {
 namespace net {
 
+struct UDPServerOptions {
+  static const size_t kDefaultNumSockets = 1;
+  static const size_t kDefaultBatchSize = 16;
+  static const size_t kDefaultMaxMessageSize = 65535;
+
+  UDPServerOptions();
+
+  /**
+   * Number of sockets bound to the port. With more than one socket, the
+   * sockets are opened with SO_REUSEPORT and the kernel spreads incoming
+   * datagrams over them. Each socket is read by its own runOnReadable task,
+   * so with a ThreadPool server scheduler each socket is received from on a
+   * separate thread
+   */
+  size_t num_sockets;
+
+  /**
+   * Maximum number of datagrams received (with one recvmmsg call) and
+   * delivered to the onMessages callback at once
+   */
+  size_t batch_size;
+
+  /**
+   * Datagrams larger than this are dropped. Each socket reserves batch_size
+   * slots of this size (1MB with the defaults), but only the pages that
+   * received datagrams actually touch are backed by memory, so lower this if
+   * the largest expected datagram is known
+   */
+  size_t max_message_size;
+};
+
+/**
+ * A received datagram. data points into the receive buffer of the socket
+ * and is only valid for the duration of the onMessages callback
+ */
+struct UDPMessage {
+  const char* data;
+  size_t size;
+};
+
 class UDPServer {
 public:
   UDPServer(
       TaskScheduler* server_scheduler,
-      TaskScheduler* callback_scheduler);
+      TaskScheduler* callback_scheduler,
+      const UDPServerOptions& opts = UDPServerOptions());
 
   ~UDPServer();
 
+  /**
+   * Call the callback with a copy of each message. The callback is run on
+   * the callback scheduler
+   */
   void onMessage(std::function<void (const Buffer&)> callback);
+
+  /**
+   * Call the callback with each received batch of messages. The callback is
+   * run directly on the server scheduler without copying the messages, so it
+   * should be fast and must not keep references to the message data. With
+   * more than one socket, the callback is called concurrently
+   */
+  void onMessages(
+      std::function<void (const UDPMessage* messages, size_t size)> callback);
+
   void listen(int port);
 
 protected:
-  void messageReceived();
+
+  struct Socket;
+
+  void openSocket(int port);
+  void messageReceived(Socket* sock);
+  size_t receiveBatch(Socket* sock);
+  void awaitRead(Socket* sock);
 
   TaskScheduler* server_scheduler_;
   TaskScheduler* callback_scheduler_;
-  int ssock_;
+  UDPServerOptions opts_;
+  Vector<ScopedPtr<Socket>> sockets_;
   std::function<void (const stx::Buffer&)> callback_;
+  std::function<void (const UDPMessage* messages, size_t size)> batch_callback_;
 };
 
 
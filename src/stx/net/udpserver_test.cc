@@ -0,0 +1,87 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "stx/stringutil.h"
+#include "stx/test/unittest.h"
+#include "stx/thread/eventloop.h"
+#include "stx/net/udpserver.h"
+#include "stx/net/udpsocket.h"
+
+using namespace stx;
+using namespace stx::net;
+
+UNIT_TEST(UDPServerTest);
+
+TEST_CASE(UDPServerTest, TestReceiveBatchesAndDropOversizeMessages, [] () {
+  static const int kPort = 18601;
+  static const size_t kBatchSize = 4;
+  static const size_t kNumMessages = 10;
+
+  thread::EventLoop ev;
+  UDPServerOptions opts;
+  opts.batch_size = kBatchSize;
+  opts.max_message_size = 1024;
+  UDPServer server(&ev, &ev, opts);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  Vector<size_t> batches;
+  Vector<String> messages;
+  server.onMessages([&] (const UDPMessage* msgs, size_t size) {
+    std::unique_lock<std::mutex> lk(mutex);
+    batches.emplace_back(size);
+    for (size_t i = 0; i < size; ++i) {
+      messages.emplace_back(msgs[i].data, msgs[i].size);
+    }
+
+    cv.notify_all();
+  });
+
+  server.listen(kPort);
+
+  // all datagrams are queued on the socket before the event loop starts, so
+  // they are received in full batches. the oversize one is dropped
+  UDPSocket client;
+  auto addr = InetAddr::resolve(StringUtil::format("127.0.0.1:$0", kPort));
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    if (i == kBatchSize + 1) {
+      client.sendTo(Buffer(String(opts.max_message_size + 1, 'x')), addr);
+    }
+
+    client.sendTo(Buffer(StringUtil::format("msg-$0", i)), addr);
+  }
+
+  std::thread ev_thread([&ev] { ev.run(); });
+
+  {
+    std::unique_lock<std::mutex> lk(mutex);
+    cv.wait_for(lk, std::chrono::seconds(5), [&messages] {
+      return messages.size() >= kNumMessages;
+    });
+  }
+
+  // give a stray oversize message a chance to show up before checking
+  usleep(50000);
+  ev.shutdown();
+  ev_thread.join();
+
+  EXPECT_EQ(messages.size(), kNumMessages);
+  for (size_t i = 0; i < messages.size(); ++i) {
+    EXPECT_EQ(messages[i], StringUtil::format("msg-$0", i));
+  }
+
+  EXPECT_EQ(batches.size(), 3);
+  EXPECT_EQ(batches[0], kBatchSize);
+  EXPECT_EQ(batches[1], kBatchSize - 1);
+  EXPECT_EQ(batches[2], kNumMessages - 2 * kBatchSize + 1);
+});
@@ -14,6 +14,7 @@
 #include <sys/uio.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include "stx/sysconfig.h"
 #include "stx/exception.h"
 #include "stx/net/udpsocket.h"
 
@@ -32,12 +33,16 @@ UDPSocket::~UDPSocket() {
   close(fd_);
 }
 
+static void toSockAddr(const InetAddr& addr, struct sockaddr_in* saddr) {
+  saddr->sin_family = AF_INET;
+  saddr->sin_port = htons(addr.port());
+  inet_aton(addr.ip().c_str(), &(saddr->sin_addr));
+  memset(&(saddr->sin_zero), 0, 8);
+}
+
 void UDPSocket::sendTo(const Buffer& pkt, const InetAddr& addr) {
   struct sockaddr_in saddr;
-  saddr.sin_family = AF_INET;
-  saddr.sin_port = htons(addr.port());
-  inet_aton(addr.ip().c_str(), &(saddr.sin_addr));
-  memset(&(saddr.sin_zero), 0, 8);
+  toSockAddr(addr, &saddr);
 
   auto res = sendto(
       fd_,
@@ -52,5 +57,54 @@ void UDPSocket::sendTo(const Buffer& pkt, const InetAddr& addr) {
   }
 }
 
+void UDPSocket::sendTo(
+    const Vector<const Buffer*>& packets,
+    const InetAddr& addr) {
+  struct sockaddr_in saddr;
+  toSockAddr(addr, &saddr);
+
+#ifdef HAVE_SENDMMSG
+  Vector<struct iovec> iov(packets.size());
+  Vector<struct mmsghdr> hdrs(packets.size());
+  memset(hdrs.data(), 0, hdrs.size() * sizeof(struct mmsghdr));
+  for (size_t i = 0; i < packets.size(); ++i) {
+    iov[i].iov_base = packets[i]->data();
+    iov[i].iov_len = packets[i]->size();
+    hdrs[i].msg_hdr.msg_name = &saddr;
+    hdrs[i].msg_hdr.msg_namelen = sizeof(saddr);
+    hdrs[i].msg_hdr.msg_iov = &iov[i];
+    hdrs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // sendmmsg may send fewer packets than requested
+  for (size_t sent = 0; sent < hdrs.size(); ) {
+    auto res = sendmmsg(fd_, hdrs.data() + sent, hdrs.size() - sent, 0);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      RAISE_ERRNO(kIOError, "sendmmsg() failed");
+    }
+
+    sent += res;
+  }
+#else
+  for (const auto& pkt : packets) {
+    auto res = sendto(
+        fd_,
+        pkt->data(),
+        pkt->size(),
+        0,
+        (struct sockaddr *) &saddr,
+        sizeof(saddr));
+
+    if (res < 0) {
+      RAISE_ERRNO(kIOError, "sendTo() failed");
+    }
+  }
+#endif
+}
+
 }
 }
@@ -10,6 +10,7 @@
 #ifndef _STX_NET_UDPSOCKET_H
 #define _STX_NET_UDPSOCKET_H
 #include <stdlib.h>
+#include "stx/stdtypes.h"
 #include "stx/buffer.h"
 #include "stx/net/inetaddr.h"
 #include "stx/thread/taskscheduler.h"
@@ -25,6 +26,12 @@ public:
 
   void sendTo(const Buffer& packet, const InetAddr& addr);
 
+  /**
+   * Send multiple packets to the same address, with a single sendmmsg call
+   * where available
+   */
+  void sendTo(const Vector<const Buffer*>& packets, const InetAddr& addr);
+
 protected:
   int fd_;
 };
@@ -34,6 +34,11 @@ public:
   ReturnType call(ClassType* klass, ArgTypes... args) const;
   ReturnType call(ClassType* klass, const ArgPackType& args) const;
 
+  /**
+   * Call the method with the arguments moved out of the argument pack
+   */
+  ReturnType call(ClassType* klass, ArgPackType&& args) const;
+
   template <class ArgListType>
   ReturnType call(ClassType* klass, const ArgListType& args) const;
 
@@ -47,6 +52,12 @@ protected:
       const ArgPackType& args,
       IndexSequence<I...>) const;
 
+  template <int... I>
+  ReturnType call(
+      ClassType* klass,
+      ArgPackType&& args,
+      IndexSequence<I...>) const;
+
   template <class ArgListType, int... I>
   ReturnType call(
       ClassType* klass,
@@ -60,6 +60,25 @@ ReturnType MethodCall<ClassType, ReturnType, ArgTypes...>::call(
   return std::bind(fn_, klass, std::get<I>(args)...)();
 }
 
+template <typename ClassType, typename ReturnType, typename... ArgTypes>
+ReturnType MethodCall<ClassType, ReturnType, ArgTypes...>::call(
+    ClassType* klass,
+    ArgPackType&& args) const {
+  return call(
+      klass,
+      std::move(args),
+      typename MkIndexSequenceFor<ArgTypes...>::type());
+}
+
+template <typename ClassType, typename ReturnType, typename... ArgTypes>
+template <int... I>
+ReturnType MethodCall<ClassType, ReturnType, ArgTypes...>::call(
+    ClassType* klass,
+    ArgPackType&& args,
+    IndexSequence<I...>) const {
+  return (klass->*fn_)(std::get<I>(std::move(args))...);
+}
+
 template <typename ClassType, typename ReturnType, typename... ArgTypes>
 template <class ArgListType>
 ReturnType MethodCall<ClassType, ReturnType, ArgTypes...>::call(
@@ -0,0 +1,391 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <limits>
+#include "stx/logging.h"
+#include "stx/stringutil.h"
+#include "stx/wallclock.h"
+#include "stx/rpc/BinaryRPCClient.h"
+
+namespace stx {
+
+BinaryRPCClientOptions::BinaryRPCClientOptions() :
+    connections_per_host(kDefaultConnectionsPerHost),
+    default_timeout_micros(kDefaultTimeoutMicros),
+    timeout_check_interval_micros(kDefaultTimeoutCheckIntervalMicros),
+    max_frame_size(rpc::BinaryRPCFrame::kDefaultMaxFrameSize) {}
+
+BinaryRPCClient::Host::Host() : next(0), connecting(false) {}
+
+BinaryRPCClient::Handle::Handle(BinaryRPCClient* _client) : client(_client) {}
+
+BinaryRPCClient::BinaryRPCClient(
+    TaskScheduler* sched,
+    const BinaryRPCClientOptions& opts /* = BinaryRPCClientOptions() */) :
+    sched_(sched),
+    opts_(opts),
+    next_id_(1),
+    timeout_check_scheduled_(false),
+    handle_(new Handle(this)) {}
+
+BinaryRPCClient::~BinaryRPCClient() {
+  Vector<RefPtr<rpc::BinaryRPCConnection>> conns;
+
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    for (const auto& host : hosts_) {
+      for (const auto& conn : host.second.conns) {
+        conns.emplace_back(conn);
+      }
+    }
+  }
+
+  // fails all calls that are still in flight
+  for (auto& conn : conns) {
+    conn->close();
+  }
+
+  std::unique_lock<std::recursive_mutex> lk(handle_->mutex);
+  handle_->client = nullptr;
+}
+
+void BinaryRPCClient::withClient(
+    RefPtr<Handle> handle,
+    Function<void (BinaryRPCClient* client)> fn) {
+  std::unique_lock<std::recursive_mutex> lk(handle->mutex);
+  if (handle->client != nullptr) {
+    fn(handle->client);
+  }
+}
+
+void BinaryRPCClient::call(const URI& uri, RefPtr<AnyRPC> rpc) {
+  call(uri, rpc, opts_.default_timeout_micros);
+}
+
+void BinaryRPCClient::call(
+    const URI& uri,
+    RefPtr<AnyRPC> rpc,
+    uint64_t timeout_micros) {
+  rpc->encoded(); // raises if the rpc wasn't encoded
+
+  auto id = next_id_++;
+  PendingCall call;
+  call.rpc = rpc;
+  call.host = uri.hostAndPort();
+  call.deadline = 0;
+  call.timeout_ms = 0;
+  call.conn = nullptr;
+
+  if (timeout_micros > 0) {
+    call.deadline = WallClock::unixMicros() + timeout_micros;
+    call.timeout_ms = std::min(
+        (timeout_micros + kMicrosPerMilli - 1) / kMicrosPerMilli,
+        (uint64_t) std::numeric_limits<uint32_t>::max());
+  }
+
+  RefPtr<rpc::BinaryRPCConnection> conn;
+  bool connect_host = false;
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto& host = hosts_[call.host];
+  if (host.conns.empty()) {
+    host.queued.emplace_back(id);
+  } else {
+    conn = host.conns[host.next++ % host.conns.size()];
+    call.conn = conn.get();
+  }
+
+  if (!host.connecting && host.conns.size() < opts_.connections_per_host) {
+    host.connecting = true;
+    connect_host = true;
+  }
+
+  auto timeout_ms = call.timeout_ms;
+  auto host_str = call.host;
+  pending_.emplace(id, std::move(call));
+  lk.unlock();
+
+#ifndef STX_NOTRACE
+  stx::logTrace(
+      "rpc.client",
+      "executing RPC via binary RPC\n    id=$2\n    method=$1\n    uri=$0",
+      uri.toString(),
+      rpc->method(),
+      id);
+#endif
+
+  if (timeout_ms > 0) {
+    scheduleTimeoutCheck();
+  }
+
+  if (connect_host) {
+    connect(host_str);
+  }
+
+  if (conn.get() != nullptr) {
+    sendCall(id, conn, rpc, timeout_ms);
+  }
+}
+
+void BinaryRPCClient::sendCall(
+    uint64_t id,
+    RefPtr<rpc::BinaryRPCConnection> conn,
+    RefPtr<AnyRPC> rpc,
+    uint32_t timeout_ms) {
+  const auto& request = rpc->encoded();
+  auto sent = conn->sendFrame(
+      rpc::BinaryRPCFrameType::REQUEST,
+      id,
+      timeout_ms,
+      rpc->method(),
+      request.data(),
+      request.size());
+
+  if (!sent) {
+    failCall(id, Status(eIOError, "connection closed"));
+  }
+}
+
+void BinaryRPCClient::connect(const String& host) {
+  auto handle = handle_;
+  auto addr = dns_cache_.resolveAsync(host);
+
+  addr.onSuccess([handle, host] (const InetAddr& addr) {
+    withClient(handle, [&host, &addr] (BinaryRPCClient* client) {
+      client->connectTo(host, addr);
+    });
+  });
+
+  addr.onFailure([handle, host] (const Status& status) {
+    withClient(handle, [&host, &status] (BinaryRPCClient* client) {
+      client->onConnectError(host, status);
+    });
+  });
+}
+
+void BinaryRPCClient::connectTo(const String& host, const InetAddr& addr) {
+  auto handle = handle_;
+
+  try {
+    net::TCPConnection::connectAsync(
+        addr,
+        sched_,
+        [handle, host] (ScopedPtr<net::TCPConnection> conn) {
+      withClient(handle, [&host, &conn] (BinaryRPCClient* client) {
+        try {
+          conn->checkErrors();
+        } catch (const std::exception& e) {
+          client->onConnectError(host, Status(e));
+          return;
+        }
+
+        client->onConnected(host, std::move(conn));
+      });
+    });
+  } catch (const std::exception& e) {
+    onConnectError(host, Status(e));
+  }
+}
+
+void BinaryRPCClient::onConnected(
+    const String& host,
+    ScopedPtr<net::TCPConnection> tcp_conn) {
+  RefPtr<rpc::BinaryRPCConnection> conn;
+  try {
+    conn = mkRef(
+        new rpc::BinaryRPCConnection(
+            std::move(tcp_conn),
+            sched_,
+            opts_.max_frame_size));
+  } catch (const std::exception& e) {
+    onConnectError(host, Status(e));
+    return;
+  }
+
+  auto handle = handle_;
+  auto conn_ptr = conn.get();
+  conn->onFrame([handle] (const rpc::BinaryRPCFrame& frame) {
+    withClient(handle, [&frame] (BinaryRPCClient* client) {
+      client->onFrame(frame);
+    });
+  });
+
+  conn->onClose([handle, host, conn_ptr] (const Status& status) {
+    withClient(handle, [&host, conn_ptr, &status] (BinaryRPCClient* client) {
+      client->onClose(host, conn_ptr, status);
+    });
+  });
+
+  Vector<Pair<uint64_t, PendingCall>> queued;
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto& h = hosts_[host];
+  h.connecting = false;
+  h.conns.emplace_back(conn);
+
+  for (auto id : h.queued) {
+    auto iter = pending_.find(id);
+    if (iter != pending_.end()) {
+      iter->second.conn = conn_ptr;
+      queued.emplace_back(id, iter->second);
+    }
+  }
+
+  h.queued.clear();
+  lk.unlock();
+
+  conn->start();
+  for (const auto& call : queued) {
+    sendCall(call.first, conn, call.second.rpc, call.second.timeout_ms);
+  }
+}
+
+void BinaryRPCClient::onConnectError(const String& host, const Status& status) {
+  logDebug("rpc.client", "connection to $0 failed: $1", host, status);
+
+  Vector<uint64_t> queued;
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto& h = hosts_[host];
+  h.connecting = false;
+  queued.swap(h.queued);
+  lk.unlock();
+
+  for (auto id : queued) {
+    failCall(id, status);
+  }
+}
+
+void BinaryRPCClient::onFrame(const rpc::BinaryRPCFrame& frame) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto iter = pending_.find(frame.id);
+  if (iter == pending_.end()) {
+    return; // the call has timed out already
+  }
+
+  auto rpc = iter->second.rpc;
+  pending_.erase(iter);
+  lk.unlock();
+
+  switch (frame.type) {
+
+    case rpc::BinaryRPCFrameType::RESPONSE:
+      rpc->ready(frame.payload);
+      break;
+
+    case rpc::BinaryRPCFrameType::ERROR:
+      rpc->error(
+          Status(
+              eRPCError,
+              StringUtil::format(
+                  "$0: $1",
+                  frame.method,
+                  frame.payload.toString())));
+      break;
+
+    default:
+      rpc->error(Status(eRPCError, "invalid RPC response"));
+      break;
+
+  }
+}
+
+void BinaryRPCClient::onClose(
+    const String& host,
+    rpc::BinaryRPCConnection* conn,
+    const Status& status) {
+  Vector<RefPtr<AnyRPC>> failed;
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto host_iter = hosts_.find(host);
+  if (host_iter != hosts_.end()) {
+    auto& conns = host_iter->second.conns;
+    for (auto iter = conns.begin(); iter != conns.end(); ++iter) {
+      if (iter->get() == conn) {
+        conns.erase(iter);
+        break;
+      }
+    }
+  }
+
+  for (auto iter = pending_.begin(); iter != pending_.end(); ) {
+    if (iter->second.conn == conn) {
+      failed.emplace_back(iter->second.rpc);
+      iter = pending_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+
+  lk.unlock();
+
+  for (auto& rpc : failed) {
+    rpc->error(status);
+  }
+}
+
+void BinaryRPCClient::failCall(uint64_t id, const Status& status) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto iter = pending_.find(id);
+  if (iter == pending_.end()) {
+    return;
+  }
+
+  auto rpc = iter->second.rpc;
+  pending_.erase(iter);
+  lk.unlock();
+
+  rpc->error(status);
+}
+
+void BinaryRPCClient::scheduleTimeoutCheck() {
+  if (timeout_check_scheduled_.exchange(true)) {
+    return;
+  }
+
+  auto handle = handle_;
+  sched_->runAfter(
+      [handle] {
+        withClient(handle, [] (BinaryRPCClient* client) {
+          client->checkTimeouts();
+        });
+      },
+      opts_.timeout_check_interval_micros);
+}
+
+void BinaryRPCClient::checkTimeouts() {
+  timeout_check_scheduled_ = false;
+
+  auto now = WallClock::unixMicros();
+  Vector<RefPtr<AnyRPC>> expired;
+  bool reschedule = false;
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  for (auto iter = pending_.begin(); iter != pending_.end(); ) {
+    auto deadline = iter->second.deadline;
+    if (deadline > 0 && deadline <= now) {
+      expired.emplace_back(iter->second.rpc);
+      iter = pending_.erase(iter);
+    } else {
+      reschedule = reschedule || deadline > 0;
+      ++iter;
+    }
+  }
+
+  lk.unlock();
+
+  for (auto& rpc : expired) {
+    rpc->error(Status(eRPCError, "RPC deadline exceeded"));
+  }
+
+  if (reschedule) {
+    scheduleTimeoutCheck();
+  }
+}
+
+} // namespace stx
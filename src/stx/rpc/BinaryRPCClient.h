@@ -0,0 +1,147 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_RPC_BINARYRPCCLIENT_H
+#define _STX_RPC_BINARYRPCCLIENT_H
+#include <atomic>
+#include <mutex>
+#include "stx/stdtypes.h"
+#include "stx/time_constants.h"
+#include "stx/net/dnscache.h"
+#include "stx/rpc/RPCClient.h"
+#include "stx/rpc/BinaryRPCConnection.h"
+
+namespace stx {
+
+struct BinaryRPCClientOptions {
+  static const size_t kDefaultConnectionsPerHost = 1;
+  static const uint64_t kDefaultTimeoutMicros = 30 * kMicrosPerSecond;
+  static const uint64_t kDefaultTimeoutCheckIntervalMicros =
+      10 * kMicrosPerMilli;
+
+  BinaryRPCClientOptions();
+
+  /**
+   * Number of persistent connections per host. Calls are spread round robin
+   * over the connections and any number of calls may be in flight on each
+   * of them
+   */
+  size_t connections_per_host;
+
+  /**
+   * Deadline for calls that don't set their own. 0 means no deadline
+   */
+  uint64_t default_timeout_micros;
+
+  /**
+   * How often pending calls are checked for expired deadlines
+   */
+  uint64_t timeout_check_interval_micros;
+
+  size_t max_frame_size;
+};
+
+/**
+ * Executes RPCs over the binary RPC protocol (see rpc::BinaryRPCFrame)
+ * instead of one HTTP request per call. The RPC is sent as a single frame
+ * tagged with a request id over a persistent connection to the host of the
+ * URI; the method name is taken from the RPC and the path of the URI is
+ * ignored.
+ *
+ * Each call has a deadline. It is sent along with the request so that the
+ * server can skip calls that expired while queued, and the call fails with
+ * a kRPCError if no response arrived in time. Calls that are in flight when
+ * a connection fails are failed as well, they are never retried.
+ *
+ * The client must outlive all calls executed through it.
+ */
+class BinaryRPCClient : public RPCClient {
+public:
+
+  BinaryRPCClient(
+      TaskScheduler* sched,
+      const BinaryRPCClientOptions& opts = BinaryRPCClientOptions());
+
+  ~BinaryRPCClient();
+
+  BinaryRPCClient(const BinaryRPCClient& other) = delete;
+  BinaryRPCClient& operator=(const BinaryRPCClient& other) = delete;
+
+  void call(const URI& uri, RefPtr<AnyRPC> rpc) override;
+
+  /**
+   * Execute a call with its own deadline. 0 means no deadline
+   */
+  void call(const URI& uri, RefPtr<AnyRPC> rpc, uint64_t timeout_micros);
+
+protected:
+
+  struct PendingCall {
+    RefPtr<AnyRPC> rpc;
+    String host;
+    uint64_t deadline;
+    uint32_t timeout_ms;
+    rpc::BinaryRPCConnection* conn;
+  };
+
+  struct Host {
+    Host();
+    Vector<RefPtr<rpc::BinaryRPCConnection>> conns;
+    size_t next;
+    bool connecting;
+    Vector<uint64_t> queued;
+  };
+
+  /**
+   * Callbacks from the scheduler and the resolver go through the handle, so
+   * that they are ignored once the client is destroyed
+   */
+  struct Handle : public RefCounted {
+    Handle(BinaryRPCClient* client);
+    std::recursive_mutex mutex;
+    BinaryRPCClient* client;
+  };
+
+  static void withClient(
+      RefPtr<Handle> handle,
+      Function<void (BinaryRPCClient* client)> fn);
+
+  void connect(const String& host);
+  void connectTo(const String& host, const InetAddr& addr);
+  void onConnected(const String& host, ScopedPtr<net::TCPConnection> conn);
+  void onConnectError(const String& host, const Status& status);
+  void onFrame(const rpc::BinaryRPCFrame& frame);
+  void onClose(
+      const String& host,
+      rpc::BinaryRPCConnection* conn,
+      const Status& status);
+
+  void sendCall(
+      uint64_t id,
+      RefPtr<rpc::BinaryRPCConnection> conn,
+      RefPtr<AnyRPC> rpc,
+      uint32_t timeout_ms);
+
+  void failCall(uint64_t id, const Status& status);
+  void scheduleTimeoutCheck();
+  void checkTimeouts();
+
+  TaskScheduler* sched_;
+  BinaryRPCClientOptions opts_;
+  net::DNSCache dns_cache_;
+  std::atomic<uint64_t> next_id_;
+  std::atomic<bool> timeout_check_scheduled_;
+  std::mutex mutex_;
+  HashMap<uint64_t, PendingCall> pending_;
+  HashMap<String, Host> hosts_;
+  RefPtr<Handle> handle_;
+};
+
+} // namespace stx
+#endif
@@ -0,0 +1,230 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <unistd.h>
+#include "stx/exception.h"
+#include "stx/rpc/BinaryRPCConnection.h"
+
+namespace stx {
+namespace rpc {
+
+BinaryRPCConnection::BinaryRPCConnection(
+    ScopedPtr<net::TCPConnection> conn,
+    TaskScheduler* scheduler,
+    size_t max_frame_size /* = BinaryRPCFrame::kDefaultMaxFrameSize */) :
+    conn_(std::move(conn)),
+    scheduler_(scheduler),
+    parser_(max_frame_size),
+    read_buf_(kReadBufferSize),
+    writing_(false),
+    closed_(false) {
+  auto write_fd = dup(conn_->fd());
+  if (write_fd < 0) {
+    RAISE_ERRNO(kIOError, "dup() failed");
+  }
+
+  write_conn_.reset(new net::TCPConnection(write_fd));
+  conn_->setNonblocking(true);
+  conn_->setNoDelay(true);
+
+  parser_.onFrame([this] (const BinaryRPCFrame& frame) {
+    if (on_frame_) {
+      on_frame_(frame);
+    }
+  });
+}
+
+BinaryRPCConnection::~BinaryRPCConnection() {}
+
+void BinaryRPCConnection::onFrame(
+    Function<void (const BinaryRPCFrame& frame)> fn) {
+  on_frame_ = fn;
+}
+
+void BinaryRPCConnection::onClose(Function<void (const Status& status)> fn) {
+  on_close_ = fn;
+}
+
+void BinaryRPCConnection::start() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  awaitRead();
+}
+
+bool BinaryRPCConnection::sendFrame(
+    BinaryRPCFrameType type,
+    uint64_t id,
+    uint32_t timeout_ms,
+    const String& method,
+    const void* payload,
+    size_t payload_size) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (closed_) {
+    return false;
+  }
+
+  BinaryRPCFrame::write(
+      type,
+      id,
+      timeout_ms,
+      method,
+      payload,
+      payload_size,
+      &write_buf_);
+
+  if (writing_) {
+    return true; // the running write will pick up the new frame
+  }
+
+  auto res = write_conn_->tryWrite(write_buf_.data(), write_buf_.size());
+  if (res.failed()) {
+    lk.unlock();
+    closeWithStatus(Status(res.toException("write() failed")));
+    return true; // reported through onClose
+  }
+
+  if (res.ok() && res.bytes == write_buf_.size()) {
+    write_buf_.clear();
+    return true;
+  }
+
+  if (res.ok()) {
+    write_buf_.setMark(res.bytes);
+  }
+
+  awaitWrite();
+  return true;
+}
+
+void BinaryRPCConnection::close() {
+  closeWithStatus(Status(eIOError, "connection closed"));
+}
+
+bool BinaryRPCConnection::isClosed() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return closed_;
+}
+
+void BinaryRPCConnection::read() {
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    if (closed_) {
+      return;
+    }
+  }
+
+  auto res = conn_->tryRead(read_buf_.data(), read_buf_.allocSize());
+  if (res.wouldBlock()) {
+    std::unique_lock<std::mutex> lk(mutex_);
+    if (!closed_) {
+      awaitRead();
+    }
+
+    return;
+  }
+
+  if (res.failed()) {
+    closeWithStatus(Status(res.toException("read() failed")));
+    return;
+  }
+
+  if (res.bytes == 0) {
+    closeWithStatus(Status(eIOError, "connection closed by peer"));
+    return;
+  }
+
+  try {
+    parser_.parse((const char*) read_buf_.data(), res.bytes);
+  } catch (const std::exception& e) {
+    closeWithStatus(Status(e));
+    return;
+  }
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (!closed_) {
+    awaitRead();
+  }
+}
+
+void BinaryRPCConnection::write() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (closed_) {
+    return;
+  }
+
+  auto data = (const char*) write_buf_.data() + write_buf_.mark();
+  auto size = write_buf_.size() - write_buf_.mark();
+  auto res = write_conn_->tryWrite(data, size);
+  if (res.wouldBlock()) {
+    return awaitWrite();
+  }
+
+  if (res.failed()) {
+    lk.unlock();
+    closeWithStatus(Status(res.toException("write() failed")));
+    return;
+  }
+
+  if (res.bytes == size) {
+    write_buf_.clear();
+    writing_ = false;
+    return;
+  }
+
+  // don't let the buffer grow without bounds if new frames keep arriving
+  // before the old ones are written out
+  if (write_buf_.mark() + res.bytes > kReadBufferSize) {
+    Buffer rest(data + res.bytes, size - res.bytes);
+    write_buf_ = rest;
+  } else {
+    write_buf_.setMark(write_buf_.mark() + res.bytes);
+  }
+
+  awaitWrite();
+}
+
+// precondition: must hold mutex
+void BinaryRPCConnection::awaitRead() {
+  incRef();
+  scheduler_->runOnReadable([this] {
+    read();
+    decRef();
+  }, *conn_);
+}
+
+// precondition: must hold mutex
+void BinaryRPCConnection::awaitWrite() {
+  writing_ = true;
+  incRef();
+  scheduler_->runOnWritable([this] {
+    write();
+    decRef();
+  }, *write_conn_);
+}
+
+void BinaryRPCConnection::closeWithStatus(const Status& status) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  if (closed_) {
+    return;
+  }
+
+  // pending read and write callbacks fire on the shut down socket and drop
+  // their references, the descriptors are closed with the last reference
+  closed_ = true;
+  conn_->shutdown();
+  auto on_close = on_close_;
+  on_close_ = nullptr;
+  lk.unlock();
+
+  if (on_close) {
+    on_close(status);
+  }
+}
+
+} // namespace rpc
+} // namespace stx
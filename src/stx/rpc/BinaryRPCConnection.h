@@ -0,0 +1,102 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_RPC_BINARYRPCCONNECTION_H
+#define _STX_RPC_BINARYRPCCONNECTION_H
+#include <mutex>
+#include "stx/stdtypes.h"
+#include "stx/autoref.h"
+#include "stx/buffer.h"
+#include "stx/status.h"
+#include "stx/net/tcpconnection.h"
+#include "stx/rpc/BinaryRPCFrame.h"
+#include "stx/thread/taskscheduler.h"
+
+namespace stx {
+namespace rpc {
+
+/**
+ * A persistent, full duplex connection that carries binary RPC frames in
+ * both directions. Used by the client and the server side of the binary RPC
+ * transport.
+ *
+ * Frames can be sent from any thread. Frames that are sent while a write is
+ * in progress are appended to the write buffer and go out with the next
+ * write, so concurrent calls on one connection are batched into few
+ * syscalls.
+ *
+ * Reads and writes go through separate descriptors (the write side is a dup
+ * of the socket) so that a pending write never replaces the pending read
+ * callback in schedulers that keep one callback per descriptor.
+ *
+ * The onFrame and onClose callbacks are called from the scheduler without
+ * holding any locks. onClose is called exactly once, when the connection is
+ * closed by either side or fails
+ */
+class BinaryRPCConnection : public RefCounted {
+public:
+  static const size_t kReadBufferSize = 65536;
+
+  BinaryRPCConnection(
+      ScopedPtr<net::TCPConnection> conn,
+      TaskScheduler* scheduler,
+      size_t max_frame_size = BinaryRPCFrame::kDefaultMaxFrameSize);
+
+  ~BinaryRPCConnection();
+
+  BinaryRPCConnection(const BinaryRPCConnection& other) = delete;
+  BinaryRPCConnection& operator=(const BinaryRPCConnection& other) = delete;
+
+  void onFrame(Function<void (const BinaryRPCFrame& frame)> fn);
+  void onClose(Function<void (const Status& status)> fn);
+
+  /**
+   * Start reading frames. The callbacks must be set before
+   */
+  void start();
+
+  /**
+   * Send a frame. Returns false if the connection is closed
+   */
+  bool sendFrame(
+      BinaryRPCFrameType type,
+      uint64_t id,
+      uint32_t timeout_ms,
+      const String& method,
+      const void* payload,
+      size_t payload_size);
+
+  void close();
+
+  bool isClosed() const;
+
+protected:
+
+  void read();
+  void write();
+  void awaitRead();
+  void awaitWrite();
+  void closeWithStatus(const Status& status);
+
+  ScopedPtr<net::TCPConnection> conn_;
+  ScopedPtr<net::TCPConnection> write_conn_;
+  TaskScheduler* scheduler_;
+  BinaryRPCFrameParser parser_;
+  Buffer read_buf_;
+  Buffer write_buf_;
+  bool writing_;
+  bool closed_;
+  mutable std::mutex mutex_;
+  Function<void (const BinaryRPCFrame& frame)> on_frame_;
+  Function<void (const Status& status)> on_close_;
+};
+
+} // namespace rpc
+} // namespace stx
+#endif
@@ -0,0 +1,145 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "stx/exception.h"
+#include "stx/rpc/BinaryRPCFrame.h"
+
+namespace stx {
+namespace rpc {
+
+static void writeUInt16(uint16_t value, char* out) {
+  out[0] = (char) (value >> 8);
+  out[1] = (char) value;
+}
+
+static void writeUInt32(uint32_t value, char* out) {
+  out[0] = (char) (value >> 24);
+  out[1] = (char) (value >> 16);
+  out[2] = (char) (value >> 8);
+  out[3] = (char) value;
+}
+
+static uint16_t readUInt16(const char* data) {
+  auto bytes = (const uint8_t*) data;
+  return ((uint16_t) bytes[0] << 8) | (uint16_t) bytes[1];
+}
+
+static uint32_t readUInt32(const char* data) {
+  auto bytes = (const uint8_t*) data;
+  return
+      ((uint32_t) bytes[0] << 24) |
+      ((uint32_t) bytes[1] << 16) |
+      ((uint32_t) bytes[2] << 8) |
+      (uint32_t) bytes[3];
+}
+
+void BinaryRPCFrame::write(
+    BinaryRPCFrameType type,
+    uint64_t id,
+    uint32_t timeout_ms,
+    const String& method,
+    const void* payload,
+    size_t payload_size,
+    Buffer* out) {
+  if (method.size() > 0xffff) {
+    RAISEF(kIllegalArgumentError, "RPC method name too long: $0", method);
+  }
+
+  char hdr[kHeaderSize];
+  writeUInt32(kHeaderSize - 4 + method.size() + payload_size, hdr);
+  hdr[4] = (char) type;
+  writeUInt32(id >> 32, hdr + 5);
+  writeUInt32(id, hdr + 9);
+  writeUInt32(timeout_ms, hdr + 13);
+  writeUInt16(method.size(), hdr + 17);
+
+  out->append(hdr, kHeaderSize);
+  out->append(method.data(), method.size());
+  out->append(payload, payload_size);
+}
+
+BinaryRPCFrame::BinaryRPCFrame() :
+    type(BinaryRPCFrameType::REQUEST),
+    id(0),
+    timeout_ms(0) {}
+
+void BinaryRPCFrame::writeTo(Buffer* out) const {
+  write(type, id, timeout_ms, method, payload.data(), payload.size(), out);
+}
+
+BinaryRPCFrameParser::BinaryRPCFrameParser(
+    size_t max_frame_size /* = BinaryRPCFrame::kDefaultMaxFrameSize */) :
+    max_frame_size_(max_frame_size) {}
+
+void BinaryRPCFrameParser::onFrame(
+    Function<void (const BinaryRPCFrame& frame)> fn) {
+  on_frame_ = fn;
+}
+
+void BinaryRPCFrameParser::parse(const char* data, size_t size) {
+  // parse straight from the input if nothing is buffered, so that reads
+  // that contain only complete frames are never copied
+  const char* begin;
+  size_t avail;
+  if (buf_.size() == 0) {
+    begin = data;
+    avail = size;
+  } else {
+    buf_.append(data, size);
+    begin = (const char*) buf_.data();
+    avail = buf_.size();
+  }
+
+  size_t pos = 0;
+  while (avail - pos >= BinaryRPCFrame::kHeaderSize) {
+    auto hdr = begin + pos;
+    size_t len = readUInt32(hdr);
+    if (len > max_frame_size_) {
+      RAISEF(kParseError, "RPC frame too large: $0", len);
+    }
+
+    auto method_len = readUInt16(hdr + 17);
+    if (len < BinaryRPCFrame::kHeaderSize - 4 + method_len) {
+      RAISE(kParseError, "invalid RPC frame length");
+    }
+
+    if (avail - pos < len + 4) {
+      break;
+    }
+
+    frame_.type = (BinaryRPCFrameType) hdr[4];
+    frame_.id = ((uint64_t) readUInt32(hdr + 5) << 32) | readUInt32(hdr + 9);
+    frame_.timeout_ms = readUInt32(hdr + 13);
+    frame_.method.assign(hdr + BinaryRPCFrame::kHeaderSize, method_len);
+    frame_.payload.clear();
+    frame_.payload.append(
+        hdr + BinaryRPCFrame::kHeaderSize + method_len,
+        len + 4 - BinaryRPCFrame::kHeaderSize - method_len);
+
+    pos += len + 4;
+
+    if (on_frame_) {
+      on_frame_(frame_);
+    }
+  }
+
+  if (buf_.size() == 0) {
+    if (pos < avail) {
+      buf_.append(begin + pos, avail - pos);
+    }
+  } else if (pos == buf_.size()) {
+    buf_.clear();
+  } else if (pos > 0) {
+    Buffer rest(begin + pos, buf_.size() - pos);
+    buf_ = rest;
+  }
+}
+
+} // namespace rpc
+} // namespace stx
@@ -0,0 +1,90 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_RPC_BINARYRPCFRAME_H
+#define _STX_RPC_BINARYRPCFRAME_H
+#include "stx/stdtypes.h"
+#include "stx/buffer.h"
+
+namespace stx {
+namespace rpc {
+
+enum class BinaryRPCFrameType : uint8_t {
+  REQUEST = 0x1,
+  RESPONSE = 0x2,
+  ERROR = 0x3
+};
+
+/**
+ * A frame of the binary RPC protocol. All integers are big endian:
+ *
+ *   uint32  length of the rest of the frame
+ *   uint8   type
+ *   uint64  request id
+ *   uint32  timeout in milliseconds (requests only, 0 = no deadline)
+ *   uint16  method length
+ *   bytes   method
+ *   bytes   payload
+ *
+ * For ERROR frames the method field holds the exception type and the payload
+ * the error message. Responses carry the id of their request and may arrive
+ * in any order
+ */
+struct BinaryRPCFrame {
+  static const size_t kHeaderSize = 19;
+  static const size_t kDefaultMaxFrameSize = 64 * 1024 * 1024;
+
+  /**
+   * Append a frame to out without building a BinaryRPCFrame first
+   */
+  static void write(
+      BinaryRPCFrameType type,
+      uint64_t id,
+      uint32_t timeout_ms,
+      const String& method,
+      const void* payload,
+      size_t payload_size,
+      Buffer* out);
+
+  BinaryRPCFrame();
+
+  void writeTo(Buffer* out) const;
+
+  BinaryRPCFrameType type;
+  uint64_t id;
+  uint32_t timeout_ms;
+  String method;
+  Buffer payload;
+};
+
+/**
+ * Incremental frame parser. Calls the onFrame callback for each complete
+ * frame and buffers partial frames internally. Throws a kParseError if a
+ * frame is malformed or exceeds the maximum frame size
+ */
+class BinaryRPCFrameParser {
+public:
+
+  BinaryRPCFrameParser(
+      size_t max_frame_size = BinaryRPCFrame::kDefaultMaxFrameSize);
+
+  void onFrame(Function<void (const BinaryRPCFrame& frame)> fn);
+
+  void parse(const char* data, size_t size);
+
+protected:
+  size_t max_frame_size_;
+  Function<void (const BinaryRPCFrame& frame)> on_frame_;
+  Buffer buf_;
+  BinaryRPCFrame frame_;
+};
+
+} // namespace rpc
+} // namespace stx
+#endif
@@ -0,0 +1,154 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "stx/exception.h"
+#include "stx/logging.h"
+#include "stx/stringutil.h"
+#include "stx/time_constants.h"
+#include "stx/wallclock.h"
+#include "stx/rpc/BinaryRPCServer.h"
+
+namespace stx {
+namespace rpc {
+
+BinaryRPCServer::BinaryRPCServer(
+    TaskScheduler* scheduler,
+    size_t max_frame_size /* = BinaryRPCFrame::kDefaultMaxFrameSize */) :
+    scheduler_(scheduler),
+    max_frame_size_(max_frame_size),
+    ssock_(scheduler) {
+  ssock_.onConnection([this] (ScopedPtr<net::TCPConnection> conn) {
+    serveConnection(std::move(conn));
+  });
+}
+
+void BinaryRPCServer::registerMethod(
+    const String& method,
+    HandlerFn handler,
+    TaskScheduler* handler_scheduler /* = nullptr */) {
+  Method m;
+  m.handler = handler;
+  m.scheduler = handler_scheduler;
+  methods_[method] = m;
+}
+
+void BinaryRPCServer::listen(int port) {
+  logNotice("rpc.server", "Starting binary RPC server on port $0", port);
+  ssock_.listen(port);
+}
+
+void BinaryRPCServer::serveConnection(ScopedPtr<net::TCPConnection> conn) {
+  auto rpc_conn = new BinaryRPCConnection(
+      std::move(conn),
+      scheduler_,
+      max_frame_size_);
+
+  // the connection keeps itself alive until it is closed, calls that are
+  // still running hold their own reference
+  rpc_conn->incRef();
+
+  rpc_conn->onFrame([this, rpc_conn] (const BinaryRPCFrame& frame) {
+    dispatch(rpc_conn, frame);
+  });
+
+  rpc_conn->onClose([rpc_conn] (const Status& status) {
+    logTrace("rpc.server", "binary RPC connection closed: $0", status);
+    rpc_conn->decRef();
+  });
+
+  rpc_conn->start();
+}
+
+void BinaryRPCServer::dispatch(
+    BinaryRPCConnection* conn,
+    const BinaryRPCFrame& frame) {
+  if (frame.type != BinaryRPCFrameType::REQUEST) {
+    logDebug("rpc.server", "unexpected RPC frame, closing connection");
+    conn->close();
+    return;
+  }
+
+  auto iter = methods_.find(frame.method);
+  if (iter == methods_.end()) {
+    auto errmsg = StringUtil::format("no such method: $0", frame.method);
+    conn->sendFrame(
+        BinaryRPCFrameType::ERROR,
+        frame.id,
+        0,
+        kNoSuchMethodError,
+        errmsg.data(),
+        errmsg.size());
+    return;
+  }
+
+  uint64_t deadline = 0;
+  if (frame.timeout_ms > 0) {
+    deadline = WallClock::unixMicros() + frame.timeout_ms * kMicrosPerMilli;
+  }
+
+  const auto& method = iter->second;
+  if (method.scheduler == nullptr) {
+    runMethod(conn, method, frame.id, frame.payload, deadline);
+    return;
+  }
+
+  RefPtr<BinaryRPCConnection> conn_ref(conn);
+  auto id = frame.id;
+  auto request = frame.payload;
+  method.scheduler->run([conn_ref, method, id, request, deadline] {
+    runMethod(conn_ref, method, id, request, deadline);
+  });
+}
+
+void BinaryRPCServer::runMethod(
+    RefPtr<BinaryRPCConnection> conn,
+    const Method& method,
+    uint64_t id,
+    const Buffer& request,
+    uint64_t deadline) {
+  if (deadline > 0 && WallClock::unixMicros() > deadline) {
+    return; // the caller has given up already
+  }
+
+  Buffer response;
+  try {
+    method.handler(request, &response);
+  } catch (const Exception& e) {
+    auto errmsg = e.getMessage();
+    conn->sendFrame(
+        BinaryRPCFrameType::ERROR,
+        id,
+        0,
+        e.getTypeName(),
+        errmsg.data(),
+        errmsg.size());
+    return;
+  } catch (const std::exception& e) {
+    String errmsg(e.what());
+    conn->sendFrame(
+        BinaryRPCFrameType::ERROR,
+        id,
+        0,
+        kRuntimeError,
+        errmsg.data(),
+        errmsg.size());
+    return;
+  }
+
+  conn->sendFrame(
+      BinaryRPCFrameType::RESPONSE,
+      id,
+      0,
+      "",
+      response.data(),
+      response.size());
+}
+
+} // namespace rpc
+} // namespace stx
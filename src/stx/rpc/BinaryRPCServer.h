@@ -0,0 +1,88 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_RPC_BINARYRPCSERVER_H
+#define _STX_RPC_BINARYRPCSERVER_H
+#include "stx/stdtypes.h"
+#include "stx/buffer.h"
+#include "stx/net/tcpserver.h"
+#include "stx/rpc/BinaryRPCConnection.h"
+#include "stx/thread/taskscheduler.h"
+
+namespace stx {
+namespace rpc {
+
+/**
+ * Serves RPCs over the binary RPC protocol (see BinaryRPCFrame). Clients keep
+ * their connections open and may have any number of calls in flight on each
+ * connection; responses are sent as soon as the handler returns, regardless
+ * of request order.
+ *
+ * Handlers receive the encoded request (e.g. the body produced by
+ * AnyRPC::encoded) and write the encoded response. An exception thrown by a
+ * handler is returned to the caller as an error with the same type and
+ * message. Requests whose deadline passed before the handler was started are
+ * dropped without running the handler.
+ *
+ * All methods must be registered before listen() is called.
+ */
+class BinaryRPCServer {
+public:
+
+  using HandlerFn = Function<void (const Buffer& request, Buffer* response)>;
+
+  BinaryRPCServer(
+      TaskScheduler* scheduler,
+      size_t max_frame_size = BinaryRPCFrame::kDefaultMaxFrameSize);
+
+  BinaryRPCServer(const BinaryRPCServer& other) = delete;
+  BinaryRPCServer& operator=(const BinaryRPCServer& other) = delete;
+
+  /**
+   * Register a method. The handler runs on handler_scheduler or, if it is
+   * nullptr, directly on the connection's scheduler. Handlers that may block
+   * should always get their own scheduler
+   */
+  void registerMethod(
+      const String& method,
+      HandlerFn handler,
+      TaskScheduler* handler_scheduler = nullptr);
+
+  void listen(int port);
+
+  /**
+   * Serve RPCs on an already established connection
+   */
+  void serveConnection(ScopedPtr<net::TCPConnection> conn);
+
+protected:
+
+  struct Method {
+    HandlerFn handler;
+    TaskScheduler* scheduler;
+  };
+
+  void dispatch(BinaryRPCConnection* conn, const BinaryRPCFrame& frame);
+
+  static void runMethod(
+      RefPtr<BinaryRPCConnection> conn,
+      const Method& method,
+      uint64_t id,
+      const Buffer& request,
+      uint64_t deadline);
+
+  TaskScheduler* scheduler_;
+  size_t max_frame_size_;
+  net::TCPServer ssock_;
+  HashMap<String, Method> methods_;
+};
+
+} // namespace rpc
+} // namespace stx
+#endif
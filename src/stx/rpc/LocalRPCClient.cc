@@ -0,0 +1,63 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "stx/rpc/LocalRPCClient.h"
+
+namespace stx {
+
+LocalRPCClient::LocalRPCClient(
+    TaskScheduler* executor /* = nullptr */,
+    RPCClient* fallback /* = nullptr */) :
+    executor_(executor),
+    fallback_(fallback) {}
+
+void LocalRPCClient::registerMethod(const String& method_name, InvokeFn fn) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  methods_[method_name] = fn;
+}
+
+bool LocalRPCClient::hasMethod(const String& method_name) const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return methods_.count(method_name) > 0;
+}
+
+void LocalRPCClient::call(const URI& uri, RefPtr<AnyRPC> rpc) {
+  InvokeFn fn;
+
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    auto iter = methods_.find(rpc->method());
+    if (iter != methods_.end()) {
+      fn = iter->second;
+    }
+  }
+
+  if (!fn) {
+    if (fallback_ == nullptr) {
+      rpc->error(
+          Status(
+              eRPCError,
+              StringUtil::format("no local method: $0", rpc->method())));
+    } else {
+      fallback_->call(uri, rpc);
+    }
+
+    return;
+  }
+
+  if (executor_ == nullptr) {
+    fn(rpc.get());
+  } else {
+    executor_->run([fn, rpc] {
+      fn(rpc.get());
+    });
+  }
+}
+
+} // namespace stx
@@ -0,0 +1,96 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_RPC_LOCALRPCCLIENT_H
+#define _STX_RPC_LOCALRPCCLIENT_H
+#include <mutex>
+#include "stx/stdtypes.h"
+#include "stx/thread/taskscheduler.h"
+#include "stx/reflect/reflect.h"
+#include "stx/rpc/RPC.h"
+#include "stx/rpc/RPCClient.h"
+
+namespace stx {
+
+/**
+ * Executes RPCs against services that live in the same process. The method
+ * is called directly with the arguments moved out of the RPC, and the
+ * result is passed to the RPC as is, so the request is never encoded and
+ * the response never decoded.
+ *
+ * Services are registered like with JSONRPC::registerService, i.e. all
+ * methods that the service declares in its reflect() method are exported.
+ * The URI of a call is ignored; calls to methods that are not registered
+ * locally are passed on to the fallback client, or fail if there is none.
+ *
+ * Usage:
+ *
+ *   LocalRPCClient local(&executor, &http_rpc_client);
+ *   local.registerService(&my_service);
+ *
+ *   auto rpc = mkRPC<json::JSONRPCCodec>(&MyService::getFoo, foo_id);
+ *   local.call(uri, rpc.get());
+ *
+ */
+class LocalRPCClient : public RPCClient {
+public:
+
+  /**
+   * Local calls run on executor, or directly from call() if executor is
+   * nullptr
+   */
+  LocalRPCClient(
+      TaskScheduler* executor = nullptr,
+      RPCClient* fallback = nullptr);
+
+  template <class ServiceType>
+  void registerService(ServiceType* service);
+
+  template <class MethodType>
+  void registerMethod(
+      const String& method_name,
+      const MethodType* method_call,
+      typename MethodType::ClassType* service);
+
+  bool hasMethod(const String& method_name) const;
+
+  void call(const URI& uri, RefPtr<AnyRPC> rpc) override;
+
+protected:
+
+  template <class ClassType>
+  class ReflectionTarget {
+  public:
+    ReflectionTarget(LocalRPCClient* self, ClassType* service);
+
+    template <typename MethodType>
+    void method(MethodType* method_call);
+
+    template <typename RPCCallType>
+    void rpc(RPCCallType rpc_call);
+
+  protected:
+    LocalRPCClient* self_;
+    ClassType* service_;
+  };
+
+  using InvokeFn = Function<void (AnyRPC* rpc)>;
+
+  void registerMethod(const String& method_name, InvokeFn fn);
+
+  TaskScheduler* executor_;
+  RPCClient* fallback_;
+  mutable std::mutex mutex_;
+  HashMap<String, InvokeFn> methods_;
+};
+
+} // namespace stx
+
+#include "LocalRPCClient_impl.h"
+#endif
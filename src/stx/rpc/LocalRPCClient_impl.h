@@ -0,0 +1,93 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+namespace stx {
+
+template <class ServiceType>
+void LocalRPCClient::registerService(ServiceType* service) {
+  LocalRPCClient::ReflectionTarget<ServiceType> target(this, service);
+  reflect::MetaClass<ServiceType>::reflectMethods(&target);
+}
+
+template <class MethodType>
+void LocalRPCClient::registerMethod(
+    const String& method_name,
+    const MethodType* method_call,
+    typename MethodType::ClassType* service) {
+  using ResultType = typename MethodType::ReturnType;
+  using RPCType = RPC<ResultType, typename MethodType::ArgPackType>;
+
+  registerMethod(method_name, [method_name, method_call, service] (
+      AnyRPC* any_rpc) {
+    auto rpc = dynamic_cast<RPCType*>(any_rpc);
+    if (rpc == nullptr) {
+      any_rpc->error(
+          Status(
+              eRPCError,
+              StringUtil::format(
+                  "RPC type doesn't match local method: $0",
+                  method_name)));
+      return;
+    }
+
+    ScopedPtr<ResultType> result;
+    try {
+      result.reset(
+          new ResultType(method_call->call(service, rpc->takeArgs())));
+    } catch (const std::exception& e) {
+      rpc->error(e);
+      return;
+    }
+
+    rpc->success(std::move(result));
+  });
+}
+
+template <class ClassType>
+LocalRPCClient::ReflectionTarget<ClassType>::ReflectionTarget(
+    LocalRPCClient* self,
+    ClassType* service) :
+    self_(self),
+    service_(service) {}
+
+template <typename ClassType>
+template <typename MethodType>
+void LocalRPCClient::ReflectionTarget<ClassType>::method(
+    MethodType* method_call) {
+  self_->registerMethod(method_call->name(), method_call, service_);
+}
+
+template <typename ClassType>
+template <typename RPCCallType>
+void LocalRPCClient::ReflectionTarget<ClassType>::rpc(RPCCallType rpc_call) {
+  // asynchronous methods complete the RPC themselves
+  auto method_call = rpc_call.method();
+  auto service = service_;
+
+  self_->registerMethod(method_call->name(), [method_call, service] (
+      AnyRPC* any_rpc) {
+    using RPCType = typename std::remove_pointer<
+        typename RPCCallType::RPCType>::type;
+
+    auto rpc = dynamic_cast<RPCType*>(any_rpc);
+    if (rpc == nullptr) {
+      any_rpc->error(
+          Status(
+              eRPCError,
+              StringUtil::format(
+                  "RPC type doesn't match local method: $0",
+                  method_call->name())));
+      return;
+    }
+
+    method_call->call(service, rpc);
+  });
+}
+
+} // namespace stx
@@ -23,6 +23,13 @@ AnyRPC::AnyRPC(
 AnyRPC::~AnyRPC() {}
 
 const Buffer& AnyRPC::encoded() {
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    if (encoded_request_.size() == 0 && encode_fn_) {
+      encode_fn_(&encoded_request_);
+    }
+  }
+
   if (encoded_request_.size() == 0) {
     RAISE(kRPCError, "RPC request must be encoded first");
   }
@@ -43,6 +43,10 @@ public:
   bool isFailure() const;
   const Status& status() const;
 
+  /**
+   * Returns the encoded request. The request is encoded on first use, so
+   * RPCs that never leave the process (see LocalRPCClient) are never encoded
+   */
   const Buffer& encoded();
 
 protected:
@@ -55,6 +59,7 @@ protected:
   std::mutex mutex_;
   Wakeup ready_wakeup_;
   Buffer encoded_request_;
+  Function<void(Buffer*)> encode_fn_;
   Function<void(const Buffer&)> decode_fn_;
 };
 
@@ -80,6 +85,12 @@ public:
   const ResultType& result() const;
   const ArgPackType& args() const;
 
+  /**
+   * Move the arguments out of the RPC to pass them to a local method. The
+   * request must not be encoded after the arguments were taken
+   */
+  ArgPackType&& takeArgs();
+
 protected:
   ArgPackType args_;
   ScopedPtr<ResultType> result_;
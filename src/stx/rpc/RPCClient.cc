@@ -8,10 +8,61 @@
  * <http://www.gnu.org/licenses/>.
  */
 #include "stx/logging.h"
+#include "stx/wallclock.h"
 #include "stx/rpc/RPCClient.h"
 
 namespace stx {
 
+void RPCClient::callServerGroup(
+    ServerGroup* group,
+    const String& path,
+    RefPtr<AnyRPC> rpc) {
+  String addr;
+  try {
+    addr = group->getServerForNextRequest();
+  } catch (const std::exception& e) {
+    rpc->error(e);
+    return;
+  }
+
+  callServer(group, addr, path, rpc);
+}
+
+void RPCClient::callServerGroup(
+    ServerGroup* group,
+    const String& key,
+    const String& path,
+    RefPtr<AnyRPC> rpc) {
+  String addr;
+  try {
+    addr = group->getServerForKey(key);
+  } catch (const std::exception& e) {
+    rpc->error(e);
+    return;
+  }
+
+  callServer(group, addr, path, rpc);
+}
+
+void RPCClient::callServer(
+    ServerGroup* group,
+    const String& addr,
+    const String& path,
+    RefPtr<AnyRPC> rpc) {
+  // the rpc holds a reference to itself until it is ready
+  auto rpc_ptr = rpc.get();
+  auto started = WallClock::unixMicros();
+  rpc->onReady([group, addr, started, rpc_ptr] {
+    if (rpc_ptr->isSuccess()) {
+      group->reportSuccess(addr, WallClock::unixMicros() - started);
+    } else {
+      group->reportFailure(addr);
+    }
+  });
+
+  call(URI(StringUtil::format("http://$0$1", addr, path)), rpc);
+}
+
 HTTPRPCClient::HTTPRPCClient(
     TaskScheduler* sched) :
     http_pool_(sched, nullptr) {}
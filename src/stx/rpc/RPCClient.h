@@ -18,6 +18,7 @@
 #include "stx/thread/taskscheduler.h"
 #include "stx/uri.h"
 #include "stx/rpc/RPC.h"
+#include "stx/rpc/ServerGroup.h"
 #include "stx/http/httpconnectionpool.h"
 
 namespace stx {
@@ -28,6 +29,33 @@ public:
 
   virtual void call(const URI& uri, RefPtr<AnyRPC> rpc) = 0;
 
+  /**
+   * Call the server picked by the group. The latency or failure of the call
+   * is reported back to the group, which must outlive the call
+   */
+  void callServerGroup(
+      ServerGroup* group,
+      const String& path,
+      RefPtr<AnyRPC> rpc);
+
+  /**
+   * Call the server that the group picks for this key
+   * (see ServerGroup::getServerForKey)
+   */
+  void callServerGroup(
+      ServerGroup* group,
+      const String& key,
+      const String& path,
+      RefPtr<AnyRPC> rpc);
+
+protected:
+
+  void callServer(
+      ServerGroup* group,
+      const String& addr,
+      const String& path,
+      RefPtr<AnyRPC> rpc);
+
 };
 
 class HTTPRPCClient : public RPCClient {
@@ -30,6 +30,11 @@ const ArgPackType& RPC<ResultType, ArgPackType>::args() const {
   return args_;
 }
 
+template <typename ResultType, typename ArgPackType>
+ArgPackType&& RPC<ResultType, ArgPackType>::takeArgs() {
+  return std::move(args_);
+}
+
 template <typename ResultType, typename ArgPackType>
 const ResultType& RPC<ResultType, ArgPackType>::result() const {
   status_.raiseIfError();
@@ -59,7 +64,10 @@ void RPC<ResultType, ArgPackType>::onError(
 template <typename ResultType, typename ArgPackType>
 template <typename Codec>
 void RPC<ResultType, ArgPackType>::encode() {
-  Codec::encodeRPCRequest(this, &encoded_request_);
+  encode_fn_ = [this] (Buffer* buffer) {
+    Codec::encodeRPCRequest(this, buffer);
+  };
+
   decode_fn_ = [this] (const Buffer& buffer) {
     Codec::decodeRPCResponse(this, buffer);
   };
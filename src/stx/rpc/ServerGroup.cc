@@ -7,7 +7,11 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include "stx/exception.h"
+#include "stx/fnv.h"
+#include "stx/stringutil.h"
+#include "stx/wallclock.h"
 #include "stx/rpc/ServerGroup.h"
 
 namespace stx {
@@ -29,17 +33,53 @@ std::string ServerGroup::getServerForNextRequest() {
   return servers_[picked_index].addr;
 }
 
+std::string ServerGroup::getServerForKey(const std::string& key) {
+  return getServerForNextRequest();
+}
+
 void ServerGroup::addServer(const std::string& addr) {
   std::unique_lock<std::mutex> lk(mutex_);
   servers_.emplace_back(addr);
+  onServersChanged(servers_);
 }
 
 void ServerGroup::removeServer(const std::string& addr) {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  for (auto iter = servers_.begin(); iter != servers_.end(); ) {
+    if (iter->addr == addr) {
+      iter = servers_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+
+  onServerRemoved(addr);
+  onServersChanged(servers_);
 }
 
 void ServerGroup::markServerAsDown(const std::string& addr) {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  for (auto& server : servers_) {
+    if (server.addr == addr) {
+      server.state = S_DOWN;
+    }
+  }
+
+  onServersChanged(servers_);
 }
 
+void ServerGroup::reportSuccess(
+    const std::string& addr,
+    uint64_t latency_micros) {}
+
+void ServerGroup::reportFailure(const std::string& addr) {}
+
+void ServerGroup::onServerRemoved(const std::string& addr) {}
+
+void ServerGroup::onServersChanged(const std::vector<Server>& servers) {}
+
 ServerGroup::Server::Server(
     const std::string& _addr) :
     addr(_addr),
@@ -62,4 +102,333 @@ int RoundRobinServerGroup::pickServerForNextRequest(
   return -1;
 }
 
+LatencyAwareServerGroupOptions::LatencyAwareServerGroupOptions() :
+    latency_decay(0.3),
+    consecutive_failures(kDefaultConsecutiveFailures),
+    latency_outlier_factor(3.0),
+    min_outlier_samples(kDefaultMinOutlierSamples),
+    base_ejection_micros(kDefaultBaseEjectionMicros),
+    max_ejection_micros(kDefaultMaxEjectionMicros),
+    max_ejected_ratio(0.5) {}
+
+LatencyAwareServerGroup::ServerStats::ServerStats() :
+    latency(0),
+    num_samples(0),
+    in_flight(0),
+    consecutive_failures(0),
+    num_ejections(0),
+    ejected(false),
+    probing(false),
+    ejected_until(0) {}
+
+LatencyAwareServerGroup::LatencyAwareServerGroup(
+    const LatencyAwareServerGroupOptions& opts
+        /* = LatencyAwareServerGroupOptions() */) :
+    opts_(opts),
+    num_ejected_(0) {}
+
+int LatencyAwareServerGroup::pickServerForNextRequest(
+    const std::vector<Server>& servers) {
+  auto now = WallClock::unixMicros();
+  std::unique_lock<std::mutex> lk(stats_mutex_);
+
+  size_t num_candidates = 0;
+  for (int i = 0; i < servers.size(); ++i) {
+    if (servers[i].state != S_UP) {
+      continue;
+    }
+
+    auto& stats = stats_[servers[i].addr];
+    if (!stats.ejected) {
+      ++num_candidates;
+      continue;
+    }
+
+    // the ejection expired, send a single probe request
+    if (!stats.probing && now >= stats.ejected_until) {
+      stats.probing = true;
+      ++stats.in_flight;
+      return i;
+    }
+  }
+
+  if (num_candidates == 0) {
+    return -1;
+  }
+
+  // pick two distinct candidates at random
+  size_t choice1 = rnd_.random64() % num_candidates;
+  size_t choice2 = choice1;
+  if (num_candidates > 1) {
+    choice2 = rnd_.random64() % (num_candidates - 1);
+    if (choice2 >= choice1) {
+      ++choice2;
+    }
+  }
+
+  // ties go to the first choice so that they are broken at random
+  int picked[2] = { -1, -1 };
+  ServerStats* picked_stats[2] = { nullptr, nullptr };
+  size_t n = 0;
+  for (int i = 0; i < servers.size(); ++i) {
+    if (servers[i].state != S_UP) {
+      continue;
+    }
+
+    auto& stats = stats_[servers[i].addr];
+    if (stats.ejected) {
+      continue;
+    }
+
+    if (n == choice1) {
+      picked[0] = i;
+      picked_stats[0] = &stats;
+    }
+
+    if (n == choice2) {
+      picked[1] = i;
+      picked_stats[1] = &stats;
+    }
+
+    ++n;
+  }
+
+  auto idx = cost(*picked_stats[1]) < cost(*picked_stats[0]) ? 1 : 0;
+  ++picked_stats[idx]->in_flight;
+  return picked[idx];
+}
+
+void LatencyAwareServerGroup::reportSuccess(
+    const std::string& addr,
+    uint64_t latency_micros) {
+  reportResult(addr, true, latency_micros);
+}
+
+void LatencyAwareServerGroup::reportFailure(const std::string& addr) {
+  reportResult(addr, false, 0);
+}
+
+void LatencyAwareServerGroup::reportResult(
+    const std::string& addr,
+    bool success,
+    uint64_t latency_micros) {
+  auto now = WallClock::unixMicros();
+  std::unique_lock<std::mutex> lk(stats_mutex_);
+
+  auto iter = stats_.find(addr);
+  if (iter == stats_.end()) {
+    return;
+  }
+
+  auto& stats = iter->second;
+  if (stats.in_flight > 0) {
+    --stats.in_flight;
+  }
+
+  if (stats.probing) {
+    stats.probing = false;
+
+    if (success) {
+      stats.ejected = false;
+      stats.consecutive_failures = 0;
+      stats.latency = latency_micros;
+      stats.num_samples = 1;
+      --num_ejected_;
+    } else {
+      eject(&stats, now);
+    }
+
+    return;
+  }
+
+  // late results of requests that were sent before the ejection
+  if (stats.ejected) {
+    return;
+  }
+
+  if (!success) {
+    if (++stats.consecutive_failures >= opts_.consecutive_failures) {
+      eject(&stats, now);
+    }
+
+    return;
+  }
+
+  stats.consecutive_failures = 0;
+  if (stats.num_samples == 0) {
+    stats.latency = latency_micros;
+  } else {
+    stats.latency =
+        opts_.latency_decay * latency_micros +
+        (1.0 - opts_.latency_decay) * stats.latency;
+  }
+
+  ++stats.num_samples;
+
+  // forget one past ejection for every min_outlier_samples healthy requests
+  if (stats.num_ejections > 0 &&
+      stats.num_samples % opts_.min_outlier_samples == 0) {
+    --stats.num_ejections;
+  }
+
+  if (isLatencyOutlier(stats)) {
+    eject(&stats, now);
+  }
+}
+
+bool LatencyAwareServerGroup::isLatencyOutlier(const ServerStats& stats) const {
+  if (opts_.latency_outlier_factor <= 0 ||
+      stats.num_samples < opts_.min_outlier_samples) {
+    return false;
+  }
+
+  double latency_sum = 0;
+  size_t num_servers = 0;
+  for (const auto& other : stats_) {
+    if (&other.second == &stats ||
+        other.second.ejected ||
+        other.second.num_samples < opts_.min_outlier_samples) {
+      continue;
+    }
+
+    latency_sum += other.second.latency;
+    ++num_servers;
+  }
+
+  if (num_servers == 0) {
+    return false;
+  }
+
+  return stats.latency > opts_.latency_outlier_factor *
+      (latency_sum / num_servers);
+}
+
+void LatencyAwareServerGroup::eject(ServerStats* stats, uint64_t now) {
+  if (!stats->ejected) {
+    if (num_ejected_ + 1 > opts_.max_ejected_ratio * stats_.size()) {
+      return;
+    }
+
+    stats->ejected = true;
+    ++num_ejected_;
+  }
+
+  auto duration = opts_.base_ejection_micros;
+  for (size_t i = 0;
+      i < stats->num_ejections && duration < opts_.max_ejection_micros;
+      ++i) {
+    duration *= 2;
+  }
+
+  if (duration > opts_.max_ejection_micros) {
+    duration = opts_.max_ejection_micros;
+  }
+
+  stats->ejected_until = now + duration;
+  stats->consecutive_failures = 0;
+  ++stats->num_ejections;
+}
+
+double LatencyAwareServerGroup::cost(const ServerStats& stats) const {
+  return (stats.latency + 1.0) * (stats.in_flight + 1);
+}
+
+void LatencyAwareServerGroup::onServerRemoved(const std::string& addr) {
+  std::unique_lock<std::mutex> lk(stats_mutex_);
+
+  auto iter = stats_.find(addr);
+  if (iter == stats_.end()) {
+    return;
+  }
+
+  if (iter->second.ejected) {
+    --num_ejected_;
+  }
+
+  stats_.erase(iter);
+}
+
+ConsistentHashServerGroup::ConsistentHashServerGroup(
+    size_t virtual_nodes /* = kDefaultVirtualNodes */) :
+    virtual_nodes_(virtual_nodes),
+    ring_(std::make_shared<Ring>()) {}
+
+std::string ConsistentHashServerGroup::getServerForKey(const std::string& key) {
+  auto ring = std::atomic_load(&ring_);
+  if (ring->points.empty()) {
+    RAISE(kRPCError, "no available servers for this request, giving up");
+  }
+
+  auto point = std::lower_bound(
+      ring->points.begin(),
+      ring->points.end(),
+      std::make_pair(hash(key), (size_t) 0));
+
+  if (point == ring->points.end()) {
+    point = ring->points.begin();
+  }
+
+  return ring->servers[point->second];
+}
+
+int ConsistentHashServerGroup::pickServerForNextRequest(
+    const std::vector<Server>& servers) {
+  size_t num_up = 0;
+  for (const auto& server : servers) {
+    if (server.state == S_UP) {
+      ++num_up;
+    }
+  }
+
+  if (num_up == 0) {
+    return -1;
+  }
+
+  auto choice = rnd_.random64() % num_up;
+  for (int i = 0; i < servers.size(); ++i) {
+    if (servers[i].state == S_UP && choice-- == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void ConsistentHashServerGroup::onServersChanged(
+    const std::vector<Server>& servers) {
+  auto ring = std::make_shared<Ring>();
+
+  for (const auto& server : servers) {
+    if (server.state != S_UP) {
+      continue;
+    }
+
+    auto idx = ring->servers.size();
+    ring->servers.emplace_back(server.addr);
+
+    for (size_t i = 0; i < virtual_nodes_; ++i) {
+      ring->points.emplace_back(
+          hash(StringUtil::format("$0#$1", server.addr, i)),
+          idx);
+    }
+  }
+
+  std::sort(ring->points.begin(), ring->points.end());
+  std::atomic_store(&ring_, std::shared_ptr<const Ring>(ring));
+}
+
+uint64_t ConsistentHashServerGroup::hash(const std::string& str) {
+  FNV<uint64_t> fnv;
+  auto h = fnv.hash(str);
+
+  // FNV-1a alone places similar strings close together, so mix the bits
+  // (the MurmurHash3 finalizer) to spread the virtual nodes over the ring
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
 }
@@ -10,12 +10,16 @@
 #ifndef _STX_COMM_LBGROUP_H
 #define _STX_COMM_LBGROUP_H
 #include <functional>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <stdlib.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include "stx/stdtypes.h"
+#include "stx/random.h"
+#include "stx/time_constants.h"
 #include "stx/net/inetaddr.h"
 
 namespace stx {
@@ -23,13 +27,29 @@ namespace stx {
 class ServerGroup {
 public:
   ServerGroup();
+  virtual ~ServerGroup() {}
 
   std::string getServerForNextRequest();
 
+  /**
+   * Returns the server for requests with this key. Groups that don't route
+   * by key return the same as getServerForNextRequest
+   */
+  virtual std::string getServerForKey(const std::string& key);
+
   void addServer(const std::string& addr);
   void removeServer(const std::string& addr);
   void markServerAsDown(const std::string& addr);
 
+  /**
+   * Report the outcome of a request to a server that was returned by
+   * getServerForNextRequest. Groups that balance by load or latency expect
+   * every picked server to be reported back exactly once. The default
+   * implementation ignores the reports
+   */
+  virtual void reportSuccess(const std::string& addr, uint64_t latency_micros);
+  virtual void reportFailure(const std::string& addr);
+
 protected:
   enum kServerState {
     S_UP,
@@ -48,6 +68,17 @@ protected:
   virtual int pickServerForNextRequest(
       const std::vector<Server>& servers) = 0;
 
+  /**
+   * Called with the group locked after a server was removed
+   */
+  virtual void onServerRemoved(const std::string& addr);
+
+  /**
+   * Called with the group locked after a server was added, removed or marked
+   * as down
+   */
+  virtual void onServersChanged(const std::vector<Server>& servers);
+
 private:
   std::mutex mutex_;
   std::vector<Server> servers_;
@@ -61,5 +92,140 @@ protected:
   unsigned last_index_;
 };
 
+struct LatencyAwareServerGroupOptions {
+  static const size_t kDefaultConsecutiveFailures = 5;
+  static const size_t kDefaultMinOutlierSamples = 10;
+  static const uint64_t kDefaultBaseEjectionMicros = 1 * kMicrosPerSecond;
+  static const uint64_t kDefaultMaxEjectionMicros = 60 * kMicrosPerSecond;
+
+  LatencyAwareServerGroupOptions();
+
+  /**
+   * Weight of the newest sample in the latency moving average
+   */
+  double latency_decay;
+
+  /**
+   * A server is ejected after this many failures in a row
+   */
+  size_t consecutive_failures;
+
+  /**
+   * A server is ejected if its average latency is more than this many times
+   * the average latency of the other servers. 0 disables latency ejection
+   */
+  double latency_outlier_factor;
+
+  /**
+   * Servers with fewer latency samples are not considered for latency
+   * ejection
+   */
+  size_t min_outlier_samples;
+
+  /**
+   * The first ejection of a server lasts base_ejection_micros, every further
+   * ejection twice as long as the one before, up to max_ejection_micros
+   */
+  uint64_t base_ejection_micros;
+  uint64_t max_ejection_micros;
+
+  /**
+   * Never eject more than this share of the servers at the same time
+   */
+  double max_ejected_ratio;
+};
+
+/**
+ * Picks servers with the "power of two choices": two random servers are
+ * compared and the one with the lower expected cost, i.e. moving average
+ * latency times requests in flight, gets the request. Slow or overloaded
+ * servers get less traffic without a single fast server being flooded.
+ *
+ * Servers that fail repeatedly or are much slower than the rest are ejected
+ * for an exponentially growing period. Once the period expires the server
+ * gets a single probe request and is readmitted if the probe succeeds.
+ *
+ * Every server returned by getServerForNextRequest must be reported back
+ * with reportSuccess or reportFailure (RPCClient::callServerGroup does this),
+ * otherwise it looks busy forever.
+ */
+class LatencyAwareServerGroup : public ServerGroup {
+public:
+
+  LatencyAwareServerGroup(
+      const LatencyAwareServerGroupOptions& opts =
+          LatencyAwareServerGroupOptions());
+
+  void reportSuccess(const std::string& addr, uint64_t latency_micros) override;
+  void reportFailure(const std::string& addr) override;
+
+protected:
+
+  struct ServerStats {
+    ServerStats();
+    double latency;
+    size_t num_samples;
+    size_t in_flight;
+    size_t consecutive_failures;
+    size_t num_ejections;
+    bool ejected;
+    bool probing;
+    uint64_t ejected_until;
+  };
+
+  int pickServerForNextRequest(const std::vector<Server>& servers) override;
+  void onServerRemoved(const std::string& addr) override;
+
+  void reportResult(
+      const std::string& addr,
+      bool success,
+      uint64_t latency_micros);
+
+  bool isLatencyOutlier(const ServerStats& stats) const;
+  void eject(ServerStats* stats, uint64_t now);
+  double cost(const ServerStats& stats) const;
+
+  LatencyAwareServerGroupOptions opts_;
+  std::mutex stats_mutex_;
+  HashMap<std::string, ServerStats> stats_;
+  size_t num_ejected_;
+  Random rnd_;
+};
+
+/**
+ * Routes requests with the same key to the same server using a hash ring
+ * with virtual nodes. When a server is added or removed only the keys on
+ * its share of the ring move to another server.
+ *
+ * The ring is rebuilt on every membership change and swapped in as an
+ * immutable snapshot, so getServerForKey never takes the group's lock and
+ * can be called from many threads at once. Requests without a key are
+ * spread at random.
+ */
+class ConsistentHashServerGroup : public ServerGroup {
+public:
+  static const size_t kDefaultVirtualNodes = 100;
+
+  ConsistentHashServerGroup(size_t virtual_nodes = kDefaultVirtualNodes);
+
+  std::string getServerForKey(const std::string& key) override;
+
+protected:
+
+  struct Ring {
+    Vector<std::string> servers;
+    Vector<Pair<uint64_t, size_t>> points;
+  };
+
+  static uint64_t hash(const std::string& str);
+
+  int pickServerForNextRequest(const std::vector<Server>& servers) override;
+  void onServersChanged(const std::vector<Server>& servers) override;
+
+  size_t virtual_nodes_;
+  std::shared_ptr<const Ring> ring_;
+  Random rnd_;
+};
+
 }
 #endif
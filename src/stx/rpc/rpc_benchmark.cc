@@ -0,0 +1,134 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <signal.h>
+#include <thread>
+#include "stx/stdtypes.h"
+#include "stx/exception.h"
+#include "stx/wallclock.h"
+#include "stx/http/httprouter.h"
+#include "stx/http/httpserver.h"
+#include "stx/http/httpservice.h"
+#include "stx/rpc/RPC.h"
+#include "stx/rpc/RPCClient.h"
+#include "stx/rpc/BinaryRPCClient.h"
+#include "stx/rpc/BinaryRPCServer.h"
+#include "stx/test/benchmark.h"
+#include "stx/thread/eventloop.h"
+
+using namespace stx;
+
+/**
+ * Compares the HTTP and the binary RPC transport. Each round issues batches
+ * of concurrent echo RPCs against a local server and waits for all responses
+ * before starting the next batch.
+ */
+
+static const int kHTTPPort = 18422;
+static const int kBinaryPort = 18423;
+static const size_t kNumBatches = 200;
+static const size_t kBatchSize = 64;
+
+struct RawCodec {
+  template <typename RPCType>
+  static void encodeRPCRequest(RPCType* rpc, Buffer* buffer) {
+    buffer->append(std::get<0>(rpc->args()));
+  }
+
+  template <typename RPCType>
+  static void decodeRPCResponse(RPCType* rpc, const Buffer& buffer) {
+    rpc->success(mkScoped(new String(buffer.toString())));
+  }
+};
+
+class EchoService : public http::HTTPService {
+public:
+  void handleHTTPRequest(
+      http::HTTPRequest* req,
+      http::HTTPResponse* res) override {
+    res->setStatus(http::kStatusOK);
+    res->addBody(req->body());
+  }
+};
+
+static Benchmark::BenchmarkResult benchmarkTransport(
+    RPCClient* client,
+    const URI& uri) {
+  String payload(128, 'x');
+  auto t0 = WallClock::unixMicros();
+
+  for (size_t i = 0; i < kNumBatches; ++i) {
+    Vector<RefPtr<RPC<String, std::tuple<String>>>> rpcs;
+    for (size_t j = 0; j < kBatchSize; ++j) {
+      auto rpc = mkRPC<RawCodec, String>("echo", payload);
+      client->call(uri, rpc.get());
+      rpcs.emplace_back(rpc);
+    }
+
+    for (auto& rpc : rpcs) {
+      rpc->wait();
+      if (rpc->result().size() != payload.size()) {
+        RAISE(kRuntimeError, "invalid response");
+      }
+    }
+  }
+
+  auto t1 = WallClock::unixMicros();
+
+  return Benchmark::BenchmarkResult(
+      (t1 - t0) * 1000,
+      kNumBatches * kBatchSize);
+}
+
+int main(int argc, const char** argv) {
+  signal(SIGPIPE, SIG_IGN);
+
+  thread::EventLoop server_ev;
+  EchoService echo_service;
+  http::HTTPRouter router;
+  router.addRouteByPrefixMatch("/rpc", &echo_service, &server_ev);
+  http::HTTPServer http_server(&router, &server_ev);
+  http_server.listen(kHTTPPort);
+
+  rpc::BinaryRPCServer rpc_server(&server_ev);
+  rpc_server.registerMethod("echo", [] (const Buffer& req, Buffer* res) {
+    res->append(req);
+  });
+  rpc_server.listen(kBinaryPort);
+
+  std::thread server_thread([&server_ev] { server_ev.run(); });
+
+  thread::EventLoop client_ev;
+  std::thread client_thread([&client_ev] { client_ev.run(); });
+
+  {
+    HTTPRPCClient http_client(&client_ev);
+    Benchmark::printResultTable(
+        "http transport",
+        benchmarkTransport(
+            &http_client,
+            URI(StringUtil::format("http://127.0.0.1:$0/rpc", kHTTPPort))),
+        false);
+
+    BinaryRPCClient binary_client(&client_ev);
+    Benchmark::printResultTable(
+        "binary transport",
+        benchmarkTransport(
+            &binary_client,
+            URI(StringUtil::format("http://127.0.0.1:$0/", kBinaryPort))),
+        true);
+  }
+
+  client_ev.shutdown();
+  server_ev.shutdown();
+  client_thread.join();
+  server_thread.join();
+  return 0;
+}
@@ -0,0 +1,440 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <thread>
+#include "stx/exception.h"
+#include "stx/rpc/RPC.h"
+#include "stx/rpc/BinaryRPCClient.h"
+#include "stx/rpc/BinaryRPCFrame.h"
+#include "stx/rpc/BinaryRPCServer.h"
+#include "stx/rpc/LocalRPCClient.h"
+#include "stx/rpc/ServerGroup.h"
+#include "stx/test/unittest.h"
+#include "stx/thread/eventloop.h"
+#include "stx/thread/FixedSizeThreadPool.h"
+
+using namespace stx;
+
+UNIT_TEST(RPCTest);
+
+/**
+ * Sends the single string argument as the request and decodes the response
+ * as a string
+ */
+struct RawCodec {
+  template <typename RPCType>
+  static void encodeRPCRequest(RPCType* rpc, Buffer* buffer) {
+    buffer->append(std::get<0>(rpc->args()));
+  }
+
+  template <typename RPCType>
+  static void decodeRPCResponse(RPCType* rpc, const Buffer& buffer) {
+    rpc->success(mkScoped(new String(buffer.toString())));
+  }
+};
+
+using RawRPC = RPC<String, std::tuple<String>>;
+
+static RefPtr<RawRPC> mkRawRPC(const String& method, const String& arg) {
+  return mkRPC<RawCodec, String>(method, arg);
+}
+
+static const int kBinaryRPCTestPort = 18431;
+
+/**
+ * Counts how often RPCs are encoded, to check that local calls never encode
+ */
+struct CountingCodec {
+  static size_t num_encoded;
+
+  template <typename RPCType>
+  static void encodeRPCRequest(RPCType* rpc, Buffer* buffer) {
+    ++num_encoded;
+  }
+
+  template <typename RPCType>
+  static void decodeRPCResponse(RPCType* rpc, const Buffer& buffer) {}
+};
+
+size_t CountingCodec::num_encoded = 0;
+
+static RefPtr<RPC<String, std::tuple<uint64_t>>> mkMismatchedRPC(
+    const String& method) {
+  return mkRPC<CountingCodec, String>(method, (uint64_t) 1);
+}
+
+class TestLocalService {
+public:
+
+  String greet(String name) {
+    return "hello " + name;
+  }
+
+  uint64_t divide(uint64_t a, uint64_t b) {
+    if (b == 0) {
+      RAISE(kIllegalArgumentError, "division by zero");
+    }
+
+    return a / b;
+  }
+
+  template <typename T>
+  static void reflect(T* meta) {
+    meta->method("greet", &TestLocalService::greet, "name");
+    meta->method("divide", &TestLocalService::divide, "a", "b");
+  }
+};
+
+TEST_CASE(RPCTest, TestBinaryRPCFrameParser, [] () {
+  Buffer buf;
+  rpc::BinaryRPCFrame::write(
+      rpc::BinaryRPCFrameType::REQUEST,
+      0x1234567890ull,
+      250,
+      "echo",
+      "hello",
+      5,
+      &buf);
+
+  rpc::BinaryRPCFrame error;
+  error.type = rpc::BinaryRPCFrameType::ERROR;
+  error.id = 7;
+  error.method = kNotFoundError;
+  error.payload.append("not found");
+  error.writeTo(&buf);
+
+  Vector<rpc::BinaryRPCFrame> frames;
+  rpc::BinaryRPCFrameParser parser;
+  parser.onFrame([&frames] (const rpc::BinaryRPCFrame& frame) {
+    frames.emplace_back(frame);
+  });
+
+  // feed the frames byte by byte to test reassembly
+  auto data = (const char*) buf.data();
+  for (size_t i = 0; i < buf.size(); ++i) {
+    parser.parse(data + i, 1);
+  }
+
+  EXPECT_EQ(frames.size(), 2);
+  EXPECT_TRUE(frames[0].type == rpc::BinaryRPCFrameType::REQUEST);
+  EXPECT_EQ(frames[0].id, 0x1234567890ull);
+  EXPECT_EQ(frames[0].timeout_ms, 250);
+  EXPECT_EQ(frames[0].method, "echo");
+  EXPECT_EQ(frames[0].payload.toString(), "hello");
+  EXPECT_TRUE(frames[1].type == rpc::BinaryRPCFrameType::ERROR);
+  EXPECT_EQ(frames[1].id, 7);
+  EXPECT_EQ(frames[1].method, kNotFoundError);
+  EXPECT_EQ(frames[1].payload.toString(), "not found");
+
+  rpc::BinaryRPCFrameParser small_parser(16);
+  try {
+    small_parser.parse(data, buf.size());
+    EXPECT_TRUE(false);
+  } catch (Exception& e) {
+    EXPECT_TRUE(e.ofType(kParseError));
+  }
+});
+
+TEST_CASE(RPCTest, TestBinaryRPCEndToEnd, [] () {
+  signal(SIGPIPE, SIG_IGN);
+
+  thread::EventLoop ev;
+  thread::FixedSizeThreadPool handler_tp(thread::ThreadPoolOptions{}, 1);
+  handler_tp.start();
+
+  rpc::BinaryRPCServer server(&ev);
+  server.registerMethod("echo", [] (const Buffer& req, Buffer* res) {
+    res->append(req);
+  });
+
+  server.registerMethod("fail", [] (const Buffer& req, Buffer* res) {
+    RAISE(kIllegalArgumentError, "invalid argument");
+  });
+
+  server.registerMethod("slow", [] (const Buffer& req, Buffer* res) {
+    usleep(200000);
+    res->append(req);
+  }, &handler_tp);
+
+  server.listen(kBinaryRPCTestPort);
+  std::thread ev_thread([&ev] { ev.run(); });
+
+  {
+    BinaryRPCClient client(&ev);
+    URI uri(StringUtil::format("http://127.0.0.1:$0/", kBinaryRPCTestPort));
+
+    // many concurrent calls share one connection
+    Vector<RefPtr<RawRPC>> rpcs;
+    for (size_t i = 0; i < 100; ++i) {
+      auto rpc = mkRawRPC("echo", StringUtil::toString(i));
+      client.call(uri, rpc.get());
+      rpcs.emplace_back(rpc);
+    }
+
+    for (size_t i = 0; i < rpcs.size(); ++i) {
+      rpcs[i]->wait();
+      EXPECT_EQ(rpcs[i]->result(), StringUtil::toString(i));
+    }
+
+    auto failed = mkRawRPC("fail", "x");
+    client.call(uri, failed.get());
+    try {
+      failed->wait();
+      EXPECT_TRUE(false);
+    } catch (const std::exception& e) {
+      EXPECT_TRUE(failed->isFailure());
+    }
+
+    EXPECT_TRUE(
+        StringUtil::beginsWith(failed->status().message(), "IllegalArgument"));
+
+    auto missing = mkRawRPC("missing", "x");
+    client.call(uri, missing.get());
+    try {
+      missing->wait();
+      EXPECT_TRUE(false);
+    } catch (const std::exception& e) {
+      EXPECT_TRUE(missing->isFailure());
+    }
+
+    // the call times out on the client while the handler is still running
+    auto slow = mkRawRPC("slow", "x");
+    client.call(uri, slow.get(), 20 * kMicrosPerMilli);
+    try {
+      slow->wait();
+      EXPECT_TRUE(false);
+    } catch (const std::exception& e) {
+      EXPECT_EQ(slow->status().message(), "RPC deadline exceeded");
+    }
+
+    // the late response is ignored and the connection stays usable
+    usleep(250000);
+    auto after = mkRawRPC("echo", "after");
+    client.call(uri, after.get());
+    after->wait();
+    EXPECT_EQ(after->result(), "after");
+  }
+
+  ev.shutdown();
+  ev_thread.join();
+  handler_tp.stop();
+});
+
+TEST_CASE(RPCTest, TestLocalRPCClient, [] () {
+  TestLocalService service;
+  LocalRPCClient client;
+  client.registerService(&service);
+  EXPECT_TRUE(client.hasMethod("greet"));
+  EXPECT_TRUE(client.hasMethod("divide"));
+  EXPECT_FALSE(client.hasMethod("missing"));
+
+  URI uri("http://localhost/rpc");
+
+  auto greet = mkRPC<CountingCodec>(
+      &TestLocalService::greet,
+      String("world"));
+  client.call(uri, greet.get());
+  greet->wait();
+  EXPECT_EQ(greet->result(), "hello world");
+
+  auto divide = mkRPC<CountingCodec>(
+      &TestLocalService::divide,
+      (uint64_t) 42,
+      (uint64_t) 6);
+  client.call(uri, divide.get());
+  divide->wait();
+  EXPECT_EQ(divide->result(), 7);
+
+  auto failed = mkRPC<CountingCodec>(
+      &TestLocalService::divide,
+      (uint64_t) 1,
+      (uint64_t) 0);
+  client.call(uri, failed.get());
+  try {
+    failed->wait();
+    EXPECT_TRUE(false);
+  } catch (const std::exception& e) {
+    EXPECT_TRUE(failed->isFailure());
+  }
+
+  // a method with the same name but a different signature is not called
+  auto mismatch = mkMismatchedRPC("greet");
+  client.call(uri, mismatch.get());
+  try {
+    mismatch->wait();
+    EXPECT_TRUE(false);
+  } catch (const std::exception& e) {
+    EXPECT_TRUE(mismatch->isFailure());
+  }
+
+  auto missing = mkRawRPC("missing", "x");
+  client.call(uri, missing.get());
+  try {
+    missing->wait();
+    EXPECT_TRUE(false);
+  } catch (const std::exception& e) {
+    EXPECT_TRUE(missing->isFailure());
+  }
+
+  EXPECT_EQ(CountingCodec::num_encoded, 0);
+});
+
+TEST_CASE(RPCTest, TestLatencyAwareServerGroup, [] () {
+  LatencyAwareServerGroup group;
+  group.addServer("fast1:80");
+  group.addServer("fast2:80");
+  group.addServer("slow:80");
+
+  // once its latency is known the slow server loses every comparison
+  size_t slow_picks = 0;
+  for (size_t i = 0; i < 600; ++i) {
+    auto addr = group.getServerForNextRequest();
+    if (addr == "slow:80") {
+      group.reportSuccess(addr, 100 * kMicrosPerMilli);
+      if (i >= 300) {
+        ++slow_picks;
+      }
+    } else {
+      group.reportSuccess(addr, 1 * kMicrosPerMilli);
+    }
+  }
+
+  EXPECT_EQ(slow_picks, 0);
+});
+
+TEST_CASE(RPCTest, TestLatencyAwareServerGroupEjection, [] () {
+  LatencyAwareServerGroupOptions opts;
+  opts.consecutive_failures = 3;
+  opts.base_ejection_micros = 50 * kMicrosPerMilli;
+
+  LatencyAwareServerGroup group(opts);
+  group.addServer("a:80");
+  group.addServer("b:80");
+
+  for (size_t i = 0; i < 10; ++i) {
+    auto addr = group.getServerForNextRequest();
+    group.reportSuccess(addr, 1 * kMicrosPerMilli);
+  }
+
+  for (size_t i = 0; i < 3; ++i) {
+    group.reportFailure("b:80");
+  }
+
+  // at most half of the servers are ejected
+  for (size_t i = 0; i < 3; ++i) {
+    group.reportFailure("a:80");
+  }
+
+  for (size_t i = 0; i < 100; ++i) {
+    auto addr = group.getServerForNextRequest();
+    EXPECT_EQ(addr, "a:80");
+    group.reportSuccess(addr, 1 * kMicrosPerMilli);
+  }
+
+  // the first request after the ejection expired probes the server
+  usleep(60 * kMicrosPerMilli);
+  EXPECT_EQ(group.getServerForNextRequest(), "b:80");
+  group.reportSuccess("b:80", 1 * kMicrosPerMilli);
+
+  size_t b_picks = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    auto addr = group.getServerForNextRequest();
+    if (addr == "b:80") {
+      ++b_picks;
+    }
+
+    group.reportSuccess(addr, 1 * kMicrosPerMilli);
+  }
+
+  EXPECT_TRUE(b_picks > 0);
+
+  // a failed probe ejects the server for twice as long
+  for (size_t i = 0; i < 3; ++i) {
+    group.reportFailure("b:80");
+  }
+
+  usleep(60 * kMicrosPerMilli);
+  EXPECT_EQ(group.getServerForNextRequest(), "b:80");
+  group.reportFailure("b:80");
+
+  usleep(60 * kMicrosPerMilli);
+  for (size_t i = 0; i < 10; ++i) {
+    auto addr = group.getServerForNextRequest();
+    EXPECT_EQ(addr, "a:80");
+    group.reportSuccess(addr, 1 * kMicrosPerMilli);
+  }
+});
+
+using KeyPlacement = HashMap<String, String>;
+using KeyCounts = HashMap<String, size_t>;
+
+TEST_CASE(RPCTest, TestConsistentHashServerGroup, [] () {
+  ConsistentHashServerGroup group;
+  group.addServer("a:80");
+  group.addServer("b:80");
+  group.addServer("c:80");
+  group.addServer("d:80");
+
+  KeyPlacement placement;
+  KeyCounts num_keys;
+  for (size_t i = 0; i < 4000; ++i) {
+    auto key = StringUtil::format("key$0", i);
+    auto addr = group.getServerForKey(key);
+    EXPECT_EQ(group.getServerForKey(key), addr);
+    placement[key] = addr;
+    ++num_keys[addr];
+  }
+
+  EXPECT_EQ(num_keys.size(), 4);
+  for (const auto& n : num_keys) {
+    EXPECT_TRUE(n.second > 500);
+    EXPECT_TRUE(n.second < 1500);
+  }
+
+  // only the keys of the removed server move
+  group.removeServer("b:80");
+  for (const auto& p : placement) {
+    auto addr = group.getServerForKey(p.first);
+    EXPECT_TRUE(addr != "b:80");
+    if (p.second != "b:80") {
+      EXPECT_EQ(addr, p.second);
+    }
+  }
+
+  // and they move back once the server returns
+  group.addServer("b:80");
+  for (const auto& p : placement) {
+    EXPECT_EQ(group.getServerForKey(p.first), p.second);
+  }
+
+  group.markServerAsDown("c:80");
+  for (const auto& p : placement) {
+    auto addr = group.getServerForKey(p.first);
+    EXPECT_TRUE(addr != "c:80");
+    if (p.second != "c:80") {
+      EXPECT_EQ(addr, p.second);
+    }
+  }
+
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_TRUE(group.getServerForNextRequest() != "c:80");
+  }
+
+  ConsistentHashServerGroup empty_group;
+  try {
+    empty_group.getServerForKey("key");
+    EXPECT_TRUE(false);
+  } catch (Exception& e) {
+    EXPECT_TRUE(e.ofType(kRPCError));
+  }
+});
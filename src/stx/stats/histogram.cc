@@ -0,0 +1,178 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+#include "stx/exception.h"
+#include "stx/stringutil.h"
+#include "stx/io/fileutil.h"
+#include "stx/stats/histogram.h"
+
+namespace stx {
+namespace stats {
+
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    RAISE_ERRNO(kRuntimeError, "clock_gettime() failed");
+  }
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+WindowedHistogram::WindowedHistogram(
+    uint64_t interval_micros) :
+    interval_micros_(interval_micros) {
+  intervals_[0] = 0;
+  intervals_[1] = 0;
+}
+
+// interval numbers start at one, zero marks an unused histogram
+uint64_t WindowedHistogram::currentInterval() const {
+  return monotonicMicros() / interval_micros_ + 1;
+}
+
+void WindowedHistogram::record(uint64_t value) {
+  auto interval = currentInterval();
+  auto idx = interval % 2;
+
+  // only ever rotate forward, a thread that read the clock before the last
+  // rotation records into the newer interval
+  if (intervals_[idx].load() < interval) {
+    std::unique_lock<std::mutex> lk(rotate_mutex_);
+    if (intervals_[idx].load() < interval) {
+      histograms_[idx].reset();
+      intervals_[idx] = interval;
+    }
+  }
+
+  histograms_[idx].record(value);
+}
+
+void WindowedHistogram::snapshot(util::LatencyHistogram* histogram) const {
+  auto interval = currentInterval();
+  for (size_t i = 0; i < 2; ++i) {
+    auto histogram_interval = intervals_[i].load();
+    if (histogram_interval == interval ||
+        histogram_interval + 1 == interval) {
+      histogram->merge(histograms_[i]);
+    }
+  }
+}
+
+void HistogramStat::exportHistogram(
+    const WindowedHistogram& windowed_histogram,
+    const String& path,
+    StatsSink* sink) {
+  util::LatencyHistogram histogram;
+  windowed_histogram.snapshot(&histogram);
+
+  sink->addStatValue(FileUtil::joinPaths(path, "count"), histogram.count());
+  sink->addStatValue(FileUtil::joinPaths(path, "max"), histogram.max());
+  sink->addStatValue(
+      FileUtil::joinPaths(path, "p50"),
+      histogram.percentile(50));
+  sink->addStatValue(
+      FileUtil::joinPaths(path, "p90"),
+      histogram.percentile(90));
+  sink->addStatValue(
+      FileUtil::joinPaths(path, "p99"),
+      histogram.percentile(99));
+  sink->addStatValue(
+      FileUtil::joinPaths(path, "p999"),
+      histogram.percentile(99.9));
+}
+
+HistogramStat::HistogramStat(
+    uint64_t interval_micros) :
+    histogram_(interval_micros) {}
+
+void HistogramStat::exportAll(const String& path, StatsSink* sink) const {
+  exportHistogram(histogram_, path, sink);
+}
+
+WindowedHistogram* HistogramStat::histogram() {
+  return &histogram_;
+}
+
+Histogram::Histogram(
+    uint64_t interval_micros) :
+    stat_(new HistogramStat(interval_micros)) {}
+
+void Histogram::record(uint64_t value) {
+  stat_->histogram()->record(value);
+}
+
+WindowedHistogram* Histogram::histogram() const {
+  return stat_->histogram();
+}
+
+RefPtr<Stat> Histogram::getStat() const {
+  return RefPtr<Stat>(stat_.get());
+}
+
+MultiHistogramStat::MultiHistogramStat(
+    uint64_t interval_micros) :
+    interval_micros_(interval_micros) {}
+
+WindowedHistogram* MultiHistogramStat::get(const String& label) {
+  ScopedLock<std::mutex> lk(mutex_);
+
+  auto& histogram = histograms_[label];
+  if (histogram.get() == nullptr) {
+    histogram.reset(new WindowedHistogram(interval_micros_));
+  }
+
+  return histogram.get();
+}
+
+void MultiHistogramStat::exportAll(
+    const String& path,
+    StatsSink* sink) const {
+  ScopedLock<std::mutex> lk(mutex_);
+
+  for (const auto& histogram : histograms_) {
+    auto label = histogram.first;
+    while (StringUtil::beginsWith(label, "/")) {
+      label.erase(0, 1);
+    }
+
+    while (StringUtil::endsWith(label, "/")) {
+      label.pop_back();
+    }
+
+    StringUtil::replaceAll(&label, "/", ".");
+    if (label.empty()) {
+      label = "root";
+    }
+
+    HistogramStat::exportHistogram(
+        *histogram.second,
+        FileUtil::joinPaths(path, label),
+        sink);
+  }
+}
+
+MultiHistogram::MultiHistogram(
+    uint64_t interval_micros) :
+    stat_(new MultiHistogramStat(interval_micros)) {}
+
+void MultiHistogram::record(const String& label, uint64_t value) {
+  stat_->get(label)->record(value);
+}
+
+WindowedHistogram* MultiHistogram::get(const String& label) const {
+  return stat_->get(label);
+}
+
+RefPtr<Stat> MultiHistogram::getStat() const {
+  return RefPtr<Stat>(stat_.get());
+}
+
+}
+}
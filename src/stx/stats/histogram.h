@@ -0,0 +1,133 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_STATS_HISTOGRAM_H
+#define _STX_STATS_HISTOGRAM_H
+#include <atomic>
+#include <mutex>
+#include "stx/stdtypes.h"
+#include "stx/time_constants.h"
+#include "stx/stats/stat.h"
+#include "stx/util/LatencyHistogram.h"
+
+namespace stx {
+namespace stats {
+
+/**
+ * Records values into one LatencyHistogram per interval and keeps the
+ * previous interval around, so exports cover the last one to two intervals
+ * instead of the whole lifetime of the process. Recording is lock free except
+ * for the first value of an interval, which recycles the oldest histogram
+ */
+class WindowedHistogram {
+public:
+  static const uint64_t kDefaultIntervalMicros = 60 * kMicrosPerSecond;
+
+  WindowedHistogram(uint64_t interval_micros = kDefaultIntervalMicros);
+
+  WindowedHistogram(const WindowedHistogram& other) = delete;
+  WindowedHistogram& operator=(const WindowedHistogram& other) = delete;
+
+  void record(uint64_t value);
+
+  /**
+   * Add the values recorded in the current and the previous interval to the
+   * provided histogram
+   */
+  void snapshot(util::LatencyHistogram* histogram) const;
+
+protected:
+  uint64_t currentInterval() const;
+
+  const uint64_t interval_micros_;
+  util::LatencyHistogram histograms_[2];
+  std::atomic<uint64_t> intervals_[2];
+  std::mutex rotate_mutex_;
+};
+
+/**
+ * Exports the count, max and the 50th, 90th, 99th and 99.9th percentile of a
+ * histogram as <path>/count, <path>/max, <path>/p50, ..., <path>/p999
+ */
+class HistogramStat : public Stat {
+public:
+
+  static void exportHistogram(
+      const WindowedHistogram& histogram,
+      const String& path,
+      StatsSink* sink);
+
+  HistogramStat(uint64_t interval_micros);
+
+  void exportAll(const String& path, StatsSink* sink) const override;
+
+  WindowedHistogram* histogram();
+
+protected:
+  WindowedHistogram histogram_;
+};
+
+class Histogram : public StatRef {
+public:
+  Histogram(
+      uint64_t interval_micros = WindowedHistogram::kDefaultIntervalMicros);
+
+  void record(uint64_t value);
+
+  WindowedHistogram* histogram() const;
+
+  RefPtr<Stat> getStat() const override;
+
+protected:
+  RefPtr<HistogramStat> stat_;
+};
+
+/**
+ * A set of histograms keyed by a label. Each histogram is exported as
+ * <path>/<label>/p99 etc. Labels should have a low cardinality, "/" in labels
+ * is replaced with "."
+ */
+class MultiHistogramStat : public Stat {
+public:
+
+  MultiHistogramStat(uint64_t interval_micros);
+
+  /**
+   * Returns the histogram for the provided label, creating it if it doesn't
+   * exist yet. The returned pointer is valid for the lifetime of the stat, so
+   * callers on a hot path should look it up once and keep it
+   */
+  WindowedHistogram* get(const String& label);
+
+  void exportAll(const String& path, StatsSink* sink) const override;
+
+protected:
+  const uint64_t interval_micros_;
+  HashMap<String, ScopedPtr<WindowedHistogram>> histograms_;
+  mutable std::mutex mutex_;
+};
+
+class MultiHistogram : public StatRef {
+public:
+  MultiHistogram(
+      uint64_t interval_micros = WindowedHistogram::kDefaultIntervalMicros);
+
+  void record(const String& label, uint64_t value);
+
+  WindowedHistogram* get(const String& label) const;
+
+  RefPtr<Stat> getStat() const override;
+
+protected:
+  RefPtr<MultiHistogramStat> stat_;
+};
+
+}
+}
+#endif
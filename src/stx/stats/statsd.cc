@@ -7,6 +7,9 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stx/exception.h>
 #include <stx/inspect.h>
 #include <stx/logging.h>
@@ -15,16 +18,20 @@
 namespace stx {
 namespace statsd {
 
-StatsdServer::StatsdServer(
-    stx::TaskScheduler* server_scheduler,
-    stx::TaskScheduler* work_scheduler) :
-    udp_server_(server_scheduler, work_scheduler) {
+String StatsdString::toString() const {
+  return String(data, size);
+}
 
-  udp_server_.onMessage([this] (const stx::Buffer& msg) {
-    this->messageReceived(msg);
-  });
+bool StatsdString::operator==(const char* str) const {
+  return strlen(str) == size && memcmp(data, str, size) == 0;
 }
 
+StatsdServer::StatsdServer(
+    stx::TaskScheduler* server_scheduler,
+    stx::TaskScheduler* work_scheduler,
+    const net::UDPServerOptions& udp_opts /* = net::UDPServerOptions() */) :
+    udp_server_(server_scheduler, work_scheduler, udp_opts) {}
+
 void StatsdServer::listen(int port) {
   udp_server_.listen(port);
 }
@@ -34,6 +41,21 @@ void StatsdServer::onSample(std::function<void (
     double,
     const std::vector<std::pair<std::string, std::string>>&)> callback) {
   callback_ = callback;
+
+  udp_server_.onMessage([this] (const stx::Buffer& msg) {
+    this->messageReceived(msg);
+  });
+}
+
+void StatsdServer::onSamples(
+    std::function<void (const StatsdSample* samples, size_t size)> callback) {
+  batch_callback_ = callback;
+
+  udp_server_.onMessages([this] (
+      const net::UDPMessage* messages,
+      size_t size) {
+    this->messagesReceived(messages, size);
+  });
 }
 
 enum StatsdParseState {
@@ -44,30 +66,259 @@ enum StatsdParseState {
 };
 
 void StatsdServer::messageReceived(const stx::Buffer& msg) {
-  std::string key;
-  std::string value;
   std::vector<std::pair<std::string, std::string>> labels;
 
-  auto msg_str = msg.toString();
-  char const* begin = msg_str.c_str();
-  char const* end = begin + msg_str.size();
+  auto begin = (char const*) msg.data();
+  auto end = begin + msg.size();
 
+  StatsdSample sample;
   while (begin < end) {
-    begin = parseStatsdSample(begin, end, &key, &value, &labels);
+    bool valid;
+    begin = parseStatsdLine(begin, end, &sample, &valid);
+    if (!valid || !callback_) {
+      continue;
+    }
+
+    labels.clear();
+    for (size_t i = 0; i < sample.num_labels; ++i) {
+      labels.emplace_back(
+          sample.label_keys[i].toString(),
+          sample.label_values[i].toString());
+    }
+
+    callback_(sample.key.toString(), sample.value, labels);
+  }
+}
 
-    double float_value;
-    try {
-      float_value = std::stod(value);
-    } catch (std::exception& e) {
-      return;
+void StatsdServer::messagesReceived(
+    const net::UDPMessage* messages,
+    size_t size) {
+  StatsdSample samples[kMaxSamplesPerBatch];
+  size_t num_samples = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    auto begin = messages[i].data;
+    auto end = begin + messages[i].size;
+
+    while (begin < end) {
+      bool valid;
+      begin = parseStatsdLine(begin, end, &samples[num_samples], &valid);
+      if (!valid) {
+        continue;
+      }
+
+      if (++num_samples == kMaxSamplesPerBatch) {
+        batch_callback_(samples, num_samples);
+        num_samples = 0;
+      }
     }
+  }
+
+  if (num_samples > 0) {
+    batch_callback_(samples, num_samples);
+  }
+}
+
+static const double kPowersOfTen[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+  1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Parses a decimal number. Numbers with at most 15 significant digits and
+ * a small exponent (like all values sent by StatsdAgent) are computed
+ * exactly from the integer mantissa. Everything else, including "nan" and
+ * "inf", is handed to strtod.
+ */
+static bool parseDouble(char const* begin, char const* end, double* value) {
+  char const* cur = begin;
+  bool negative = false;
+  if (cur < end && (*cur == '-' || *cur == '+')) {
+    negative = *cur == '-';
+    ++cur;
+  }
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  bool any_digits = false;
+  bool exact = true;
 
-    if (callback_) {
-      callback_(key, float_value, labels);
+  for (; cur < end && *cur >= '0' && *cur <= '9'; ++cur) {
+    any_digits = true;
+    if (digits < 15) {
+      mantissa = mantissa * 10 + (*cur - '0');
+      digits += mantissa > 0;
+    } else {
+      exact = false;
     }
+  }
 
-    labels.clear();
+  if (cur < end && *cur == '.') {
+    for (++cur; cur < end && *cur >= '0' && *cur <= '9'; ++cur) {
+      any_digits = true;
+      if (digits < 15) {
+        mantissa = mantissa * 10 + (*cur - '0');
+        digits += mantissa > 0;
+        --exponent;
+      } else {
+        exact = false;
+      }
+    }
   }
+
+  if (any_digits && cur < end && (*cur == 'e' || *cur == 'E')) {
+    ++cur;
+    bool negative_exp = false;
+    if (cur < end && (*cur == '-' || *cur == '+')) {
+      negative_exp = *cur == '-';
+      ++cur;
+    }
+
+    int exp = 0;
+    bool any_exp_digits = false;
+    for (; cur < end && *cur >= '0' && *cur <= '9'; ++cur) {
+      any_exp_digits = true;
+      if (exp < 10000) {
+        exp = exp * 10 + (*cur - '0');
+      }
+    }
+
+    if (!any_exp_digits) {
+      return false;
+    }
+
+    exponent += negative_exp ? -exp : exp;
+  }
+
+  if (any_digits && cur == end && exact && exponent >= -22 && exponent <= 22) {
+    double v = mantissa;
+    if (exponent < 0) {
+      v /= kPowersOfTen[-exponent];
+    } else {
+      v *= kPowersOfTen[exponent];
+    }
+
+    *value = negative ? -v : v;
+    return true;
+  }
+
+  char buf[64];
+  size_t len = end - begin;
+  if (len == 0 || len >= sizeof(buf)) {
+    return false;
+  }
+
+  memcpy(buf, begin, len);
+  buf[len] = 0;
+
+  char* num_end;
+  *value = strtod(buf, &num_end);
+  return num_end == buf + len;
+}
+
+char const* StatsdServer::parseStatsdLine(
+    char const* begin,
+    char const* end,
+    StatsdSample* sample,
+    bool* valid) {
+  auto eol = (char const*) memchr(begin, '\n', end - begin);
+  auto next = eol ? eol + 1 : end;
+  auto line_end = eol ? eol : end;
+  if (line_end > begin && *(line_end - 1) == '\r') {
+    --line_end;
+  }
+
+  *valid = false;
+  sample->num_labels = 0;
+  sample->type = StatsdSampleType::UNTYPED;
+  sample->sample_rate = 1.0;
+  sample->delta = false;
+
+  // key
+  char const* cur = begin;
+  for (; cur < line_end && *cur != '[' && *cur != ':'; ++cur) {
+    if (*cur == '=') {
+      return next;
+    }
+  }
+
+  if (cur == begin || cur == line_end) {
+    return next;
+  }
+
+  sample->key.data = begin;
+  sample->key.size = cur - begin;
+
+  // labels
+  while (*cur == '[') {
+    auto label_begin = ++cur;
+    char const* split = nullptr;
+    for (; cur < line_end && *cur != ']'; ++cur) {
+      if (*cur == '=' && split == nullptr) {
+        split = cur;
+      }
+    }
+
+    if (cur == line_end ||
+        split == nullptr ||
+        split + 1 >= cur ||
+        sample->num_labels == StatsdSample::kMaxLabels) {
+      return next;
+    }
+
+    auto n = sample->num_labels++;
+    sample->label_keys[n].data = label_begin;
+    sample->label_keys[n].size = split - label_begin;
+    sample->label_values[n].data = split + 1;
+    sample->label_values[n].size = cur - (split + 1);
+
+    if (++cur == line_end) {
+      return next;
+    }
+  }
+
+  if (*cur != ':') {
+    return next;
+  }
+
+  // value
+  auto value_begin = ++cur;
+  for (; cur < line_end && *cur != '|'; ++cur);
+  if (!parseDouble(value_begin, cur, &sample->value)) {
+    return next;
+  }
+
+  // type and sample rate
+  while (cur < line_end) {
+    auto field_begin = ++cur;
+    for (; cur < line_end && *cur != '|'; ++cur);
+    auto field_size = cur - field_begin;
+
+    if (field_size > 1 && *field_begin == '@') {
+      if (!parseDouble(field_begin + 1, cur, &sample->sample_rate) ||
+          !(sample->sample_rate > 0 && sample->sample_rate <= 1)) {
+        return next;
+      }
+    } else if (field_size == 1 && *field_begin == 'c') {
+      sample->type = StatsdSampleType::COUNTER;
+    } else if (field_size == 1 && *field_begin == 'g') {
+      sample->type = StatsdSampleType::GAUGE;
+    } else if (field_size == 2 && memcmp(field_begin, "ms", 2) == 0) {
+      sample->type = StatsdSampleType::TIMER;
+    } else if (field_size == 1 && *field_begin == 'h') {
+      sample->type = StatsdSampleType::HISTOGRAM;
+    } else {
+      return next;
+    }
+  }
+
+  sample->delta =
+      sample->type == StatsdSampleType::GAUGE &&
+      (*value_begin == '+' || *value_begin == '-');
+
+  *valid = true;
+  return next;
 }
 
 char const* StatsdServer::parseStatsdSample(
@@ -7,6 +7,9 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#ifndef _STX_STATS_STATSD_H
+#define _STX_STATS_STATSD_H
+#include <stx/stdtypes.h>
 #include <stx/buffer.h>
 #include <stx/net/udpserver.h>
 #include <stx/thread/taskscheduler.h>
@@ -14,20 +17,90 @@
 namespace stx {
 namespace statsd {
 
+/**
+ * A string in a received packet. Only valid as long as the packet
+ */
+struct StatsdString {
+  const char* data;
+  size_t size;
+
+  String toString() const;
+  bool operator==(const char* str) const;
+};
+
+enum class StatsdSampleType : uint8_t {
+  UNTYPED,   // no type suffix
+  COUNTER,   // |c
+  GAUGE,     // |g
+  TIMER,     // |ms
+  HISTOGRAM  // |h
+};
+
+/**
+ * A sample in the format key[label=value]...:value[|type][|@sample_rate]
+ */
+struct StatsdSample {
+  static const size_t kMaxLabels = 16;
+
+  StatsdString key;
+  StatsdString label_keys[kMaxLabels];
+  StatsdString label_values[kMaxLabels];
+  size_t num_labels;
+  double value;
+  StatsdSampleType type;
+  double sample_rate;
+
+  /**
+   * True for gauges with an explicit sign (e.g. "-5|g"), which change the
+   * gauge by value instead of setting it
+   */
+  bool delta;
+};
+
 class StatsdServer {
 public:
 
+  /**
+   * Maximum number of samples delivered to the onSamples callback at once
+   */
+  static const size_t kMaxSamplesPerBatch = 64;
+
   StatsdServer(
       stx::TaskScheduler* server_scheduler,
-      stx::TaskScheduler* work_scheduler);
+      stx::TaskScheduler* work_scheduler,
+      const net::UDPServerOptions& udp_opts = net::UDPServerOptions());
 
   void listen(int port);
 
+  /**
+   * Call the callback for each sample. The callback is run on the work
+   * scheduler
+   */
   void onSample(std::function<void (
       const std::string&,
       double,
       const std::vector<std::pair<std::string, std::string>>&)> callback);
 
+  /**
+   * Call the callback with batches of parsed samples. The callback is run
+   * directly on the server scheduler and the samples point into the receive
+   * buffer, so it must copy anything it wants to keep. Malformed lines are
+   * skipped
+   */
+  void onSamples(
+      std::function<void (const StatsdSample* samples, size_t size)> callback);
+
+  /**
+   * Parse the next line of a packet into sample without allocating. Returns
+   * a pointer to the start of the next line and sets *valid to false if the
+   * line is malformed (or empty)
+   */
+  static char const* parseStatsdLine(
+      char const* begin,
+      char const* end,
+      StatsdSample* sample,
+      bool* valid);
+
   static char const* parseStatsdSample(
       char const* begin,
       char const* end,
@@ -38,6 +111,7 @@ public:
 protected:
 
   void messageReceived(const stx::Buffer& msg);
+  void messagesReceived(const net::UDPMessage* messages, size_t size);
 
   stx::net::UDPServer udp_server_;
 
@@ -45,8 +119,12 @@ protected:
       const std::string&,
       double,
       const std::vector<std::pair<std::string, std::string>>&)> callback_;
+
+  std::function<void (const StatsdSample* samples, size_t size)>
+      batch_callback_;
 };
 
 
 }
 }
+#endif
@@ -0,0 +1,108 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include "stx/stdtypes.h"
+#include "stx/stringutil.h"
+#include "stx/stats/statsd.h"
+#include "stx/test/benchmark.h"
+
+using namespace stx;
+using namespace stx::statsd;
+
+/**
+ * Parses realistic ~1400 byte packets (as sent by StatsdAgent and typical
+ * statsd clients) with the string based parser and the zero allocation
+ * parser. Each iteration parses one packet
+ */
+
+static const size_t kNumIterations = 100000;
+
+static String buildPacket() {
+  String pkt;
+  for (size_t i = 0; pkt.size() < 1400; ++i) {
+    switch (i % 4) {
+      case 0:
+        pkt += StringUtil::format(
+            "/fnord/http/requests_total[host=web$0][status=200]:$1|c\n",
+            i % 16,
+            i * 3);
+        break;
+      case 1:
+        pkt += StringUtil::format(
+            "/fnord/http/latency[host=web$0]:$1.$2|ms|@0.1\n",
+            i % 16,
+            i,
+            i % 1000);
+        break;
+      case 2:
+        pkt += StringUtil::format(
+            "/fnord/mem/heap_bytes:$0|g\n",
+            i * 4096);
+        break;
+      case 3:
+        pkt += StringUtil::format(
+            "/fnord/queue/length[queue=q$0]:$1.25\n",
+            i % 4,
+            i);
+        break;
+    }
+  }
+
+  return pkt;
+}
+
+int main(int argc, const char** argv) {
+  auto pkt = buildPacket();
+  auto begin = pkt.data();
+  auto end = begin + pkt.size();
+
+  size_t num_samples = 0;
+  double sum = 0;
+
+  auto string_parser = Benchmark::benchmark([&] {
+    std::string key;
+    std::string value;
+    std::vector<std::pair<std::string, std::string>> labels;
+
+    for (auto cur = begin; cur < end; ) {
+      cur = StatsdServer::parseStatsdSample(cur, end, &key, &value, &labels);
+      sum += std::stod(value.substr(0, value.find('|')));
+      ++num_samples;
+      labels.clear();
+    }
+  }, kNumIterations);
+
+  auto zero_alloc_parser = Benchmark::benchmark([&] {
+    StatsdSample sample;
+    for (auto cur = begin; cur < end; ) {
+      bool valid;
+      cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+      if (valid) {
+        sum += sample.value;
+        ++num_samples;
+      }
+    }
+  }, kNumIterations);
+
+  printf(
+      "packet size: %lu bytes, %lu samples per packet\n",
+      pkt.size(),
+      num_samples / (kNumIterations * 2));
+
+  Benchmark::printResultTable("parseStatsdSample + stod", string_parser);
+  Benchmark::printResultTable("parseStatsdLine", zero_alloc_parser, true);
+
+  printf(
+      "samples/sec: %.0f (parseStatsdSample), %.0f (parseStatsdLine)\n",
+      string_parser.ratePerSecond() * num_samples / (kNumIterations * 2),
+      zero_alloc_parser.ratePerSecond() * num_samples / (kNumIterations * 2));
+
+  return sum == 0;
+}
@@ -7,10 +7,17 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
-#include <metricdb/statsd.h>
-#include <util/unittest.h>
+#include <math.h>
+#include <unistd.h>
+#include <stx/stats/counter.h>
+#include <stx/stats/statsd.h>
+#include <stx/stats/statsdagent.h>
+#include <stx/stats/statsdaggregator.h>
+#include <stx/stats/statsrepository.h>
+#include <stx/test/unittest.h>
 
-using namespace stxmetric::metricdb;
+using namespace stx;
+using namespace stx::statsd;
 
 UNIT_TEST(StatsdTest);
 
@@ -172,3 +179,368 @@ TEST_CASE(StatsdTest, TestParseFromStatsdFormatWithMultipleSmplLabels, [] () {
   EXPECT_EQ(labels.size(), 1);
   EXPECT_EQ(value, "4.6");
 });
+
+TEST_CASE(StatsdTest, TestParseStatsdLine, [] () {
+  String pkt =
+      "/fnord/requests[host=a][dc=eu]:42|c|@0.5\n"
+      "/fnord/latency:1.25e2|ms\r\n"
+      "\n"
+      "/fnord/load:-0.75|g\n"
+      "/fnord/broken[x]:1\n"
+      "/fnord/size:1024";
+
+  auto cur = pkt.data();
+  auto end = cur + pkt.size();
+
+  StatsdSample sample;
+  bool valid;
+  cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+  EXPECT_TRUE(valid);
+  EXPECT_TRUE(sample.key == "/fnord/requests");
+  EXPECT_EQ(sample.num_labels, 2);
+  EXPECT_TRUE(sample.label_keys[0] == "host");
+  EXPECT_TRUE(sample.label_values[0] == "a");
+  EXPECT_TRUE(sample.label_keys[1] == "dc");
+  EXPECT_TRUE(sample.label_values[1] == "eu");
+  EXPECT_EQ(sample.value, 42);
+  EXPECT_TRUE(sample.type == StatsdSampleType::COUNTER);
+  EXPECT_EQ(sample.sample_rate, 0.5);
+
+  cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+  EXPECT_TRUE(valid);
+  EXPECT_TRUE(sample.key == "/fnord/latency");
+  EXPECT_EQ(sample.value, 125);
+  EXPECT_TRUE(sample.type == StatsdSampleType::TIMER);
+
+  cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+  EXPECT_FALSE(valid);
+
+  cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+  EXPECT_TRUE(valid);
+  EXPECT_EQ(sample.value, -0.75);
+  EXPECT_TRUE(sample.type == StatsdSampleType::GAUGE);
+  EXPECT_TRUE(sample.delta);
+
+  cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+  EXPECT_FALSE(valid);
+
+  cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+  EXPECT_TRUE(valid);
+  EXPECT_TRUE(sample.key == "/fnord/size");
+  EXPECT_EQ(sample.value, 1024);
+  EXPECT_TRUE(sample.type == StatsdSampleType::UNTYPED);
+  EXPECT_EQ(sample.sample_rate, 1.0);
+  EXPECT_TRUE(cur == end);
+});
+
+static const char* kValidNumbers[] = {
+  "0", "3.14159", "-273.15", "0.1", "123456789012345", "1234567890123456789",
+  "1e-30", "6.02214076e23", "0.000000000000000000000000001", nullptr
+};
+
+static const char* kInvalidNumbers[] = {
+  "", "abc", "1.2.3", "1e", "--1", nullptr
+};
+
+TEST_CASE(StatsdTest, TestParseStatsdLineNumbers, [] () {
+  for (auto v = kValidNumbers; *v; ++v) {
+    auto line = String("k:") + *v;
+    StatsdSample sample;
+    bool valid;
+    StatsdServer::parseStatsdLine(
+        line.data(),
+        line.data() + line.size(),
+        &sample,
+        &valid);
+
+    EXPECT_TRUE(valid);
+    EXPECT_EQ(sample.value, strtod(*v, nullptr));
+  }
+
+  for (auto v = kInvalidNumbers; *v; ++v) {
+    auto line = String("k:") + *v;
+    StatsdSample sample;
+    bool valid;
+    StatsdServer::parseStatsdLine(
+        line.data(),
+        line.data() + line.size(),
+        &sample,
+        &valid);
+
+    EXPECT_FALSE(valid);
+  }
+});
+
+using AggregateMap = HashMap<String, StatsdAggregate>;
+
+static void addStatsdPacket(StatsdAggregator* aggregator, const String& pkt) {
+  auto cur = pkt.data();
+  auto end = cur + pkt.size();
+  while (cur < end) {
+    StatsdSample sample;
+    bool valid;
+    cur = StatsdServer::parseStatsdLine(cur, end, &sample, &valid);
+    if (valid) {
+      aggregator->addSample(sample);
+    }
+  }
+}
+
+TEST_CASE(StatsdTest, TestAggregator, [] () {
+  StatsdAggregatorOptions opts;
+  opts.num_shards = 1;
+  opts.max_keys = 4;
+  opts.idle_expiry_micros = 0;
+  StatsdAggregator aggregator(opts);
+
+  String pkt;
+  for (int i = 1; i <= 100; ++i) {
+    pkt += StringUtil::format("latency[host=a]:$0|ms\n", i);
+  }
+
+  pkt +=
+      "requests[host=a]:1|c\n"
+      "requests[host=a]:2|c|@0.5\n"
+      "requests[host=b]:5|c\n"
+      "load:0.5|g\n"
+      "load:+0.25|g\n"
+      "load:3|c\n"
+      "other:1|c\n";
+
+  addStatsdPacket(&aggregator, pkt);
+  EXPECT_EQ(aggregator.numKeys(), 4);
+  EXPECT_EQ(aggregator.stats()->dropped_samples.get(), 2);
+
+  AggregateMap aggrs;
+  aggregator.flush([&aggrs] (const StatsdAggregate& aggr) {
+    auto key = aggr.key;
+    for (const auto& l : aggr.labels) {
+      key += "[" + l.first + "=" + l.second + "]";
+    }
+
+    aggrs[key] = aggr;
+  });
+
+  EXPECT_EQ(aggrs.size(), 4);
+  EXPECT_EQ(aggrs["requests[host=a]"].value, 5);
+  EXPECT_EQ(aggrs["requests[host=b]"].value, 5);
+  EXPECT_EQ(aggrs["load"].value, 0.75);
+  EXPECT_TRUE(aggrs["load"].type == StatsdSampleType::GAUGE);
+
+  const auto& latency = aggrs["latency[host=a]"];
+  EXPECT_TRUE(latency.type == StatsdSampleType::TIMER);
+  EXPECT_EQ(latency.value, 100);
+  EXPECT_EQ(latency.min, 1);
+  EXPECT_EQ(latency.max, 100);
+  EXPECT_EQ(latency.mean, 50.5);
+  EXPECT_EQ(latency.percentiles.size(), 3);
+  EXPECT_EQ(latency.percentiles[2].first, 99);
+  EXPECT_TRUE(fabs(latency.percentiles[2].second - 99) <= 1);
+
+  // counters and timers without new samples are not reported again, gauges
+  // are
+  aggrs.clear();
+  aggregator.flush([&aggrs] (const StatsdAggregate& aggr) {
+    aggrs[aggr.key] = aggr;
+  });
+
+  EXPECT_EQ(aggrs.size(), 1);
+  EXPECT_EQ(aggrs["load"].value, 0.75);
+});
+
+TEST_CASE(StatsdTest, TestAggregatorExpiry, [] () {
+  StatsdAggregatorOptions opts;
+  opts.idle_expiry_micros = 1;
+  StatsdAggregator aggregator(opts);
+
+  addStatsdPacket(&aggregator, "load:1|g\nrequests:1|c\n");
+  EXPECT_EQ(aggregator.numKeys(), 2);
+
+  usleep(1000);
+  size_t num_aggrs = 0;
+  aggregator.flush([&num_aggrs] (const StatsdAggregate& aggr) {
+    ++num_aggrs;
+  });
+
+  EXPECT_EQ(num_aggrs, 0);
+  EXPECT_EQ(aggregator.numKeys(), 0);
+  EXPECT_EQ(aggregator.stats()->expired_keys.get(), 2);
+});
+
+/**
+ * Runs single reports and returns the packets instead of waiting for the
+ * report interval. Nothing listens on the target port
+ */
+class TestStatsdAgent : public stats::StatsdAgent {
+public:
+  TestStatsdAgent(stats::StatsRepository* repo) :
+      stats::StatsdAgent(
+          InetAddr::resolve("127.0.0.1:18602"),
+          kMicrosPerSecond,
+          repo) {}
+
+  using stats::StatsdAgent::formatValue;
+
+  Vector<String> reportPackets() {
+    report();
+
+    Vector<String> packets;
+    for (size_t i = 0; i < num_packets_; ++i) {
+      packets.emplace_back(packets_[i].toString());
+    }
+
+    return packets;
+  }
+};
+
+/**
+ * Exports the values in the order they were set
+ */
+class TestStat : public stats::Stat, public stats::StatRef {
+public:
+  void exportAll(const String& path, stats::StatsSink* sink) const override {
+    for (const auto& v : values) {
+      sink->addStatValue(path + v.first, v.second);
+    }
+  }
+
+  RefPtr<stats::Stat> getStat() const override {
+    return RefPtr<stats::Stat>(const_cast<TestStat*>(this));
+  }
+
+  Vector<Pair<String, uint64_t>> values;
+};
+
+TEST_CASE(StatsdTest, TestAgentFormatValue, [] () {
+  Vector<double> values;
+  values.emplace_back(0);
+  values.emplace_back(-0.0);
+  values.emplace_back(1);
+  values.emplace_back(-1);
+  values.emplace_back(42);
+  values.emplace_back(-1234567);
+  values.emplace_back(0.5);
+  values.emplace_back(-2.25);
+  values.emplace_back(123.456);
+  values.emplace_back(1e15);
+  values.emplace_back(9007199254740991.0);
+  values.emplace_back(9007199254740992.0);
+  values.emplace_back(-9007199254740992.0);
+  values.emplace_back(1e20);
+
+  for (auto v : values) {
+    char buf[128];
+    auto len = TestStatsdAgent::formatValue(v, buf, sizeof(buf));
+    EXPECT_EQ(String(buf, len), StringUtil::toString(v));
+  }
+});
+
+TEST_CASE(StatsdTest, TestAgentReportsDeltas, [] () {
+  stats::StatsRepository repo;
+  stats::Counter<uint64_t> requests;
+  stats::Counter<uint64_t> connections;
+  stats::Counter<uint64_t> hidden;
+  repo.exportStat(
+      "/requests",
+      &requests,
+      stats::ExportMode::EXPORT_DELTA);
+  repo.exportStat(
+      "/connections",
+      &connections,
+      stats::ExportMode::EXPORT_VALUE);
+  repo.exportStat(
+      "/hidden",
+      &hidden,
+      stats::ExportMode::EXPORT_NONE);
+
+  TestStatsdAgent agent(&repo);
+  requests.incr(5);
+  connections.set(7);
+  hidden.set(1);
+
+  auto packets = agent.reportPackets();
+  EXPECT_EQ(packets.size(), 1);
+  EXPECT_EQ(packets[0], "/requests:5.0\n/connections:7.0\n");
+
+  // the last value is carried over to the next report
+  requests.incr(3);
+  packets = agent.reportPackets();
+  EXPECT_EQ(packets.size(), 1);
+  EXPECT_EQ(packets[0], "/requests:3.0\n/connections:7.0\n");
+
+  packets = agent.reportPackets();
+  EXPECT_EQ(packets[0], "/requests:0.0\n/connections:7.0\n");
+
+  requests.decr(2);
+  connections.set(6);
+  packets = agent.reportPackets();
+  EXPECT_EQ(packets[0], "/requests:-2.0\n/connections:6.0\n");
+});
+
+TEST_CASE(StatsdTest, TestAgentExportOrderChanges, [] () {
+  stats::StatsRepository repo;
+  TestStat stat;
+  stat.incRef();
+  stat.values.emplace_back("/x", 1);
+  stat.values.emplace_back("/y", 2);
+  repo.exportStat("/stat", &stat, stats::ExportMode::EXPORT_DELTA);
+
+  TestStatsdAgent agent(&repo);
+  auto packets = agent.reportPackets();
+  EXPECT_EQ(packets[0], "/stat/x:1.0\n/stat/y:2.0\n");
+
+  // a new value in front of the others and the others swapped, the deltas
+  // must still be computed against the value of the same path
+  stat.values.clear();
+  stat.values.emplace_back("/z", 5);
+  stat.values.emplace_back("/y", 4);
+  stat.values.emplace_back("/x", 3);
+  packets = agent.reportPackets();
+  EXPECT_EQ(packets[0], "/stat/z:5.0\n/stat/y:2.0\n/stat/x:2.0\n");
+
+  stat.values.clear();
+  stat.values.emplace_back("/x", 10);
+  stat.values.emplace_back("/z", 6);
+  packets = agent.reportPackets();
+  EXPECT_EQ(packets[0], "/stat/x:7.0\n/stat/z:1.0\n");
+});
+
+TEST_CASE(StatsdTest, TestAgentSplitsPackets, [] () {
+  static const size_t kNumValues = 4000;
+
+  stats::StatsRepository repo;
+  TestStat stat;
+  stat.incRef();
+  String expected;
+  for (size_t i = 0; i < kNumValues; ++i) {
+    auto path = StringUtil::format("/some/long/metric/name/$0", i);
+    stat.values.emplace_back(path, i);
+    expected += StringUtil::format("/stat$0:$1.0\n", path, i);
+  }
+
+  repo.exportStat("/stat", &stat, stats::ExportMode::EXPORT_VALUE);
+
+  TestStatsdAgent agent(&repo);
+  auto packets = agent.reportPackets();
+  EXPECT_TRUE(expected.size() > stats::StatsdAgent::kMaxPacketSize * 2);
+  EXPECT_TRUE(packets.size() >= 3);
+
+  // lines are never split across packets and no packet is too large
+  String received;
+  for (const auto& pkt : packets) {
+    EXPECT_TRUE(pkt.size() < stats::StatsdAgent::kMaxPacketSize);
+    EXPECT_TRUE(pkt.size() > 0 && pkt.back() == '\n');
+    received += pkt;
+  }
+
+  EXPECT_EQ(received, expected);
+
+  // the packet buffers are reused by the next report
+  packets = agent.reportPackets();
+  received.clear();
+  for (const auto& pkt : packets) {
+    received += pkt;
+  }
+
+  EXPECT_EQ(received, expected);
+});
@@ -7,6 +7,7 @@
  * copy of the GNU General Public License along with this program. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <math.h>
 #include <unistd.h>
 #include "stx/logging.h"
 #include "stx/stats/statsdagent.h"
@@ -27,7 +28,8 @@ StatsdAgent::StatsdAgent(
     addr_(addr),
     stats_repo_(stats_repo),
     report_interval_(report_interval),
-    running_(false) {}
+    running_(false),
+    num_packets_(0) {}
 
 StatsdAgent::~StatsdAgent() {
   if (running_) {
@@ -63,75 +65,172 @@ void StatsdAgent::stop() {
   thread_.join();
 }
 
-void StatsdAgent::report() {
-  Vector<String> lines;
+/**
+ * Passes the values exported by a stat to StatsdAgent::reportValue along with
+ * their position in the export order
+ */
+class StatsdAgent::ReportSink : public StatsSink {
+public:
+
+  ReportSink(
+      StatsdAgent* agent,
+      ReportedStat* slot,
+      ExportMode export_mode) :
+      agent_(agent),
+      slot_(slot),
+      export_mode_(export_mode),
+      index_(0) {}
+
+  void addStatValue(
+      const String& path,
+      uint64_t value) override {
+    agent_->reportValue(slot_, index_++, path, value, export_mode_);
+  }
 
-  stats_repo_->forEachStat([this, &lines] (const ExportedStat& stat) {
-    switch (stat.export_mode) {
+  void addStatValue(
+      const String& path,
+      const Labels& labels,
+      uint64_t value) override {}
 
-      case ExportMode::EXPORT_VALUE:
-        reportValue(stat.path, stat.stat, &lines);
-        break;
+protected:
+  StatsdAgent* agent_;
+  ReportedStat* slot_;
+  ExportMode export_mode_;
+  size_t index_;
+};
 
-      case ExportMode::EXPORT_DELTA:
-        reportDelta(stat.path, stat.stat, &lines);
-        break;
+void StatsdAgent::report() {
+  num_packets_ = 0;
+
+  // stats are only ever appended to the repository, so the position of a
+  // stat identifies it between reports
+  size_t slot_idx = 0;
+  stats_repo_->forEachStat([this, &slot_idx] (const ExportedStat& stat) {
+    if (slot_idx == slots_.size()) {
+      slots_.emplace_back();
+    }
 
-      case ExportMode::EXPORT_NONE:
-        break;
+    auto slot = &slots_[slot_idx++];
+    if (slot->stat != stat.stat) {
+      slot->stat = stat.stat;
+      slot->values.clear();
+    }
 
+    if (stat.export_mode == ExportMode::EXPORT_NONE) {
+      return;
     }
+
+    ReportSink sink(this, slot, stat.export_mode);
+    stat.stat->exportAll(stat.path, &sink);
   });
 
-  sendToStatsd(lines);
+  sendToStatsd();
 }
 
 void StatsdAgent::reportValue(
+    ReportedStat* slot,
+    size_t index,
     const String& path,
-    Stat* stat,
-    Vector<String>* out) {
-  BufferStatsSinkStatsSink stats_sink;
-  stat->exportAll(path,&stats_sink);
+    double value,
+    ExportMode export_mode) {
+  auto matches = [&path] (const ReportedValue& v) {
+    return
+        v.prefix.size() == path.size() + 1 &&
+        v.prefix.compare(0, path.size(), path) == 0;
+  };
+
+  // values are usually exported in the same order on every report. if not
+  // (e.g. a new label was added), look the path up in the other values
+  ReportedValue* reported = nullptr;
+  if (index < slot->values.size() && matches(slot->values[index])) {
+    reported = &slot->values[index];
+  } else {
+    for (auto& v : slot->values) {
+      if (matches(v)) {
+        reported = &v;
+        break;
+      }
+    }
+  }
 
-  for (const auto& pair : stats_sink.values()) {
-    out->emplace_back(StringUtil::format("$0:$1", pair.first, pair.second));
+  if (reported == nullptr) {
+    slot->values.emplace_back(ReportedValue { path + ":", 0 });
+    reported = &slot->values.back();
   }
+
+  if (export_mode == ExportMode::EXPORT_DELTA) {
+    auto delta = value - reported->last_value;
+    reported->last_value = value;
+    value = delta;
+  }
+
+  appendLine(reported->prefix, value);
 }
 
-void StatsdAgent::reportDelta(
-    const String& path,
-    Stat* stat,
-    Vector<String>* out) {
-  BufferStatsSinkStatsSink stats_sink;
-  stat->exportAll(path,&stats_sink);
-
-  for (const auto& pair : stats_sink.values()) {
-    auto delta = pair.second - last_values_[pair.first];
-    last_values_[pair.first] = pair.second;
-    out->emplace_back(StringUtil::format("$0:$1", pair.first, delta));
+size_t StatsdAgent::formatValue(double value, char* buf, size_t buf_size) {
+  if (value != floor(value) ||
+      fabs(value) >= 9007199254740992.0 ||
+      (value == 0 && signbit(value))) {
+    auto str = StringUtil::toString(value);
+    auto len = std::min(str.size(), buf_size);
+    memcpy(buf, str.data(), len);
+    return len;
+  }
+
+  char digits[20];
+  size_t num_digits = 0;
+  auto abs_value = (uint64_t) fabs(value);
+  do {
+    digits[num_digits++] = '0' + abs_value % 10;
+    abs_value /= 10;
+  } while (abs_value > 0);
+
+  size_t len = 0;
+  if (value < 0) {
+    buf[len++] = '-';
+  }
+
+  while (num_digits > 0) {
+    buf[len++] = digits[--num_digits];
   }
+
+  buf[len++] = '.';
+  buf[len++] = '0';
+  return len;
 }
 
-void StatsdAgent::sendToStatsd(const Vector<String>& lines) {
-  Vector<Buffer> pkts;
+void StatsdAgent::appendLine(const String& prefix, double value) {
+  char value_str[128];
+  auto value_len = formatValue(value, value_str, sizeof(value_str));
+  auto line_len = prefix.size() + value_len;
 
-  for (const auto& line : lines) {
-    if (pkts.size() == 0 ||
-        pkts.back().size() + line.length() + 2 >= kMaxPacketSize) {
-      pkts.emplace_back();
+  if (num_packets_ == 0 ||
+      packets_[num_packets_ - 1].size() + line_len + 2 >= kMaxPacketSize) {
+    if (num_packets_ == packets_.size()) {
+      packets_.emplace_back();
+      packets_.back().reserve(kMaxPacketSize);
     }
 
-    pkts.back().append(line);
-    pkts.back().append("\n");
+    packets_[num_packets_++].clear();
   }
 
-  for (const auto& pkt : pkts) {
-    sendToStatsd(pkt);
-  }
+  auto& pkt = packets_[num_packets_ - 1];
+  pkt.append(prefix.data(), prefix.size());
+  pkt.append(value_str, value_len);
+  pkt.append('\n');
 }
 
-void StatsdAgent::sendToStatsd(const Buffer& packet) {
-  sock_.sendTo(packet, addr_);
+void StatsdAgent::sendToStatsd() {
+  if (num_packets_ == 0) {
+    return;
+  }
+
+  send_packets_.clear();
+  for (size_t i = 0; i < num_packets_; ++i) {
+    send_packets_.emplace_back(&packets_[i]);
+  }
+
+  sock_.sendTo(send_packets_, addr_);
 }
 
 }
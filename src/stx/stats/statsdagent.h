@@ -40,12 +40,43 @@ public:
   void stop();
 
 protected:
+  class ReportSink;
+
+  /**
+   * A value exported by a stat. The "path:" line prefix is built once and
+   * the last value is kept for delta reporting
+   */
+  struct ReportedValue {
+    String prefix;
+    double last_value;
+  };
+
+  /**
+   * The values exported by the stat in the same position of the
+   * StatsRepository, in export order
+   */
+  struct ReportedStat {
+    Stat* stat;
+    Vector<ReportedValue> values;
+  };
+
   void report();
-  void reportValue(const String& path, Stat* stat, Vector<String>* out);
-  void reportDelta(const String& path, Stat* stat, Vector<String>* out);
+  void reportValue(
+      ReportedStat* slot,
+      size_t index,
+      const String& path,
+      double value,
+      ExportMode export_mode);
+
+  void appendLine(const String& prefix, double value);
+
+  /**
+   * Formats the value like StringUtil::toString(double) does, but without
+   * going through snprintf for integral values
+   */
+  static size_t formatValue(double value, char* buf, size_t buf_size);
 
-  void sendToStatsd(const Vector<String>& lines);
-  void sendToStatsd(const Buffer& packet);
+  void sendToStatsd();
 
   net::UDPSocket sock_;
   InetAddr addr_;
@@ -54,7 +85,10 @@ protected:
   StatsRepository* stats_repo_;
   Duration report_interval_;
 
-  HashMap<String, double> last_values_;
+  Vector<ReportedStat> slots_;
+  Deque<Buffer> packets_;
+  size_t num_packets_;
+  Vector<const Buffer*> send_packets_;
 };
 
 
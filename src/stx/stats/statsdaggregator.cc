@@ -0,0 +1,250 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <unistd.h>
+#include "stx/exception.h"
+#include "stx/fnv.h"
+#include "stx/logging.h"
+#include "stx/wallclock.h"
+#include "stx/stats/statsdaggregator.h"
+
+namespace stx {
+namespace statsd {
+
+StatsdAggregatorOptions::StatsdAggregatorOptions() :
+    flush_interval_micros(kDefaultFlushIntervalMicros),
+    num_shards(kDefaultNumShards),
+    max_keys(kDefaultMaxKeys),
+    idle_expiry_micros(kDefaultIdleExpiryMicros),
+    percentiles({ 50, 90, 99 }),
+    relative_accuracy(util::QuantileSketch::kDefaultRelativeAccuracy) {}
+
+StatsdAggregator::StatsdAggregator(
+    const StatsdAggregatorOptions& opts /* = StatsdAggregatorOptions() */) :
+    opts_(opts),
+    running_(false) {
+  if (opts_.num_shards == 0) {
+    RAISE(kIllegalArgumentError, "num_shards must be at least 1");
+  }
+
+  for (size_t i = 0; i < opts_.num_shards; ++i) {
+    shards_.emplace_back(new Shard());
+  }
+
+  max_keys_per_shard_ =
+      (opts_.max_keys + opts_.num_shards - 1) / opts_.num_shards;
+}
+
+StatsdAggregator::~StatsdAggregator() {
+  if (running_) {
+    stop();
+  }
+}
+
+void StatsdAggregator::addSample(const StatsdSample& sample) {
+  // the key and labels are stored back to back in the packet, so the
+  // "key[label=value]..." string identifies the key
+  auto key_end = sample.key.data + sample.key.size;
+  if (sample.num_labels > 0) {
+    const auto& last_label = sample.label_values[sample.num_labels - 1];
+    key_end = last_label.data + last_label.size + 1;
+  }
+
+  auto key_size = key_end - sample.key.data;
+
+  FNV<uint64_t> fnv;
+  auto shard_idx = fnv.hash(sample.key.data, key_size) % shards_.size();
+  auto shard = shards_[shard_idx].get();
+
+  std::unique_lock<std::mutex> lk(shard->mutex);
+  shard->lookup_key.assign(sample.key.data, key_size);
+
+  auto entry = findOrCreateEntry(shard, sample);
+  if (entry == nullptr) {
+    stats_.dropped_samples.incr(1);
+    return;
+  }
+
+  switch (sample.type) {
+    case StatsdSampleType::COUNTER:
+      entry->value += sample.value / sample.sample_rate;
+      break;
+
+    case StatsdSampleType::UNTYPED:
+    case StatsdSampleType::GAUGE:
+      if (sample.delta) {
+        entry->value += sample.value;
+      } else {
+        entry->value = sample.value;
+      }
+      break;
+
+    case StatsdSampleType::TIMER:
+    case StatsdSampleType::HISTOGRAM:
+      entry->sketch->add(sample.value, 1.0 / sample.sample_rate);
+      break;
+  }
+
+  entry->updated = true;
+  entry->last_update = WallClock::unixMicros();
+  stats_.samples.incr(1);
+}
+
+void StatsdAggregator::addSamples(const StatsdSample* samples, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    addSample(samples[i]);
+  }
+}
+
+// precondition: must hold shard->mutex, shard->lookup_key is set
+StatsdAggregator::Entry* StatsdAggregator::findOrCreateEntry(
+    Shard* shard,
+    const StatsdSample& sample) {
+  auto type = sample.type == StatsdSampleType::UNTYPED
+      ? StatsdSampleType::GAUGE
+      : sample.type;
+
+  auto iter = shard->entries.find(shard->lookup_key);
+  if (iter != shard->entries.end()) {
+    return iter->second.type == type ? &iter->second : nullptr;
+  }
+
+  if (shard->entries.size() >= max_keys_per_shard_) {
+    return nullptr;
+  }
+
+  auto& entry = shard->entries[shard->lookup_key];
+  entry.key = sample.key.toString();
+  for (size_t i = 0; i < sample.num_labels; ++i) {
+    entry.labels.emplace_back(
+        sample.label_keys[i].toString(),
+        sample.label_values[i].toString());
+  }
+
+  entry.type = type;
+  entry.value = 0;
+  entry.updated = false;
+  entry.last_update = 0;
+  if (type == StatsdSampleType::TIMER || type == StatsdSampleType::HISTOGRAM) {
+    entry.sketch.reset(new util::QuantileSketch(opts_.relative_accuracy));
+  }
+
+  stats_.keys.incr(1);
+  return &entry;
+}
+
+void StatsdAggregator::flush(Function<void (const StatsdAggregate& aggr)> fn) {
+  auto now = WallClock::unixMicros();
+
+  for (const auto& shard : shards_) {
+    Vector<StatsdAggregate> aggrs;
+
+    std::unique_lock<std::mutex> lk(shard->mutex);
+    for (auto iter = shard->entries.begin(); iter != shard->entries.end(); ) {
+      auto& entry = iter->second;
+
+      if (opts_.idle_expiry_micros > 0 &&
+          entry.last_update + opts_.idle_expiry_micros < now) {
+        iter = shard->entries.erase(iter);
+        stats_.keys.decr(1);
+        stats_.expired_keys.incr(1);
+        continue;
+      }
+
+      if (entry.updated || entry.type == StatsdSampleType::GAUGE) {
+        StatsdAggregate aggr;
+        aggr.key = entry.key;
+        aggr.labels = entry.labels;
+        aggr.type = entry.type;
+        aggr.value = entry.value;
+        aggr.min = 0;
+        aggr.max = 0;
+        aggr.mean = 0;
+
+        if (entry.sketch.get() != nullptr) {
+          aggr.value = entry.sketch->count();
+          aggr.min = entry.sketch->min();
+          aggr.max = entry.sketch->max();
+          aggr.mean = entry.sketch->mean();
+          for (auto p : opts_.percentiles) {
+            aggr.percentiles.emplace_back(p, entry.sketch->percentile(p));
+          }
+
+          entry.sketch->reset();
+        }
+
+        aggrs.emplace_back(std::move(aggr));
+      }
+
+      if (entry.type == StatsdSampleType::COUNTER) {
+        entry.value = 0;
+      }
+
+      entry.updated = false;
+      ++iter;
+    }
+
+    lk.unlock();
+
+    if (fn) {
+      for (const auto& aggr : aggrs) {
+        fn(aggr);
+      }
+    }
+  }
+}
+
+void StatsdAggregator::onFlush(Function<void (const StatsdAggregate& aggr)> fn) {
+  on_flush_ = fn;
+}
+
+void StatsdAggregator::start() {
+  running_ = true;
+
+  thread_ = std::thread([this] () {
+    auto last_flush = WallClock::unixMicros();
+
+    while (running_) {
+      auto next_flush = last_flush + opts_.flush_interval_micros;
+      while (running_ && WallClock::unixMicros() < next_flush) {
+        usleep(100000);
+      }
+
+      last_flush = WallClock::unixMicros();
+
+      try {
+        flush(on_flush_);
+      } catch (const StandardException& e) {
+        stx::logError("fnord.statsd_aggregator", e, "flush failed");
+      }
+    }
+  });
+}
+
+void StatsdAggregator::stop() {
+  running_ = false;
+  thread_.join();
+}
+
+size_t StatsdAggregator::numKeys() const {
+  size_t num_keys = 0;
+  for (const auto& shard : shards_) {
+    std::unique_lock<std::mutex> lk(shard->mutex);
+    num_keys += shard->entries.size();
+  }
+
+  return num_keys;
+}
+
+StatsdAggregatorStats* StatsdAggregator::stats() {
+  return &stats_;
+}
+
+}
+}
@@ -0,0 +1,217 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_STATS_STATSDAGGREGATOR_H
+#define _STX_STATS_STATSDAGGREGATOR_H
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "stx/stdtypes.h"
+#include "stx/io/fileutil.h"
+#include "stx/time_constants.h"
+#include "stx/stats/counter.h"
+#include "stx/stats/statsd.h"
+#include "stx/stats/statsrepository.h"
+#include "stx/util/QuantileSketch.h"
+
+namespace stx {
+namespace statsd {
+
+struct StatsdAggregatorOptions {
+  static const uint64_t kDefaultFlushIntervalMicros = 10 * kMicrosPerSecond;
+  static const size_t kDefaultNumShards = 16;
+  static const size_t kDefaultMaxKeys = 100000;
+  static const uint64_t kDefaultIdleExpiryMicros = 300 * kMicrosPerSecond;
+
+  StatsdAggregatorOptions();
+
+  /**
+   * How often the background thread started with start() flushes
+   */
+  uint64_t flush_interval_micros;
+
+  /**
+   * Keys are spread over this many independently locked shards by key hash
+   */
+  size_t num_shards;
+
+  /**
+   * Maximum number of distinct keys (metric name plus labels). Samples for
+   * new keys are dropped once the limit is reached. The limit is enforced
+   * per shard (max_keys / num_shards), so fewer keys may be accepted if they
+   * are unevenly distributed
+   */
+  size_t max_keys;
+
+  /**
+   * Keys that didn't receive a sample for this long are removed on the next
+   * flush. Zero disables expiry
+   */
+  uint64_t idle_expiry_micros;
+
+  /**
+   * Percentiles reported for timers and histograms, e.g. 99.9
+   */
+  Vector<double> percentiles;
+
+  /**
+   * Relative error of the reported percentiles
+   */
+  double relative_accuracy;
+};
+
+/**
+ * The aggregated value of one key over a flush interval
+ */
+struct StatsdAggregate {
+  String key;
+  Vector<Pair<String, String>> labels;
+  StatsdSampleType type;
+
+  /**
+   * Counters: the sum of all values, scaled by their sample rates
+   * Gauges: the current value
+   * Timers and histograms: the number of values, scaled by their sample rates
+   */
+  double value;
+
+  /**
+   * Timers and histograms only
+   */
+  double min;
+  double max;
+  double mean;
+  Vector<Pair<double, double>> percentiles;
+};
+
+struct StatsdAggregatorStats {
+  stats::Counter<uint64_t> keys;
+  stats::Counter<uint64_t> samples;
+  stats::Counter<uint64_t> dropped_samples;
+  stats::Counter<uint64_t> expired_keys;
+
+  void exportStats(
+      const String& path_prefix = "/fnord/statsd/aggregator/",
+      stats::StatsRepository* stats_repo = nullptr) {
+    if (stats_repo == nullptr) {
+      stats_repo = stats::StatsRepository::get();
+    }
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "keys"),
+        &keys,
+        stats::ExportMode::EXPORT_NONE);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "samples"),
+        &samples,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "dropped_samples"),
+        &dropped_samples,
+        stats::ExportMode::EXPORT_DELTA);
+
+    stats_repo->exportStat(
+        FileUtil::joinPaths(path_prefix, "expired_keys"),
+        &expired_keys,
+        stats::ExportMode::EXPORT_DELTA);
+  }
+};
+
+/**
+ * Aggregates statsd samples per key (metric name plus labels) and flush
+ * interval. Counters are summed, gauges keep their last value (untyped
+ * samples are treated as gauges) and timers and histograms are summarized
+ * as count, min, max, mean and percentiles. Samples for a key with a
+ * different type than the first sample of that key are dropped.
+ *
+ * Counters, timers and histograms are only reported if they received a
+ * sample during the interval. Gauges are reported on every flush until they
+ * expire.
+ *
+ * addSample(s) and flush may be called concurrently from any thread.
+ *
+ * Usage:
+ *
+ *   StatsdAggregator aggregator;
+ *   aggregator.onFlush([] (const StatsdAggregate& aggr) { ... });
+ *   aggregator.start();
+ *
+ *   statsd_server.onSamples([&aggregator] (
+ *       const StatsdSample* samples,
+ *       size_t size) {
+ *     aggregator.addSamples(samples, size);
+ *   });
+ *
+ */
+class StatsdAggregator {
+public:
+
+  StatsdAggregator(
+      const StatsdAggregatorOptions& opts = StatsdAggregatorOptions());
+
+  ~StatsdAggregator();
+
+  StatsdAggregator(const StatsdAggregator& other) = delete;
+  StatsdAggregator& operator=(const StatsdAggregator& other) = delete;
+
+  void addSample(const StatsdSample& sample);
+  void addSamples(const StatsdSample* samples, size_t size);
+
+  /**
+   * Call fn with the aggregate of every key that is due and start a new
+   * interval. fn is called without holding any locks
+   */
+  void flush(Function<void (const StatsdAggregate& aggr)> fn);
+
+  /**
+   * Start/stop a thread that flushes to the onFlush callback every
+   * flush_interval_micros
+   */
+  void onFlush(Function<void (const StatsdAggregate& aggr)> fn);
+  void start();
+  void stop();
+
+  size_t numKeys() const;
+
+  StatsdAggregatorStats* stats();
+
+protected:
+
+  struct Entry {
+    String key;
+    Vector<Pair<String, String>> labels;
+    StatsdSampleType type;
+    double value;
+    bool updated;
+    uint64_t last_update;
+    ScopedPtr<util::QuantileSketch> sketch;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    HashMap<String, Entry> entries;
+    String lookup_key;
+  };
+
+  Entry* findOrCreateEntry(Shard* shard, const StatsdSample& sample);
+
+  StatsdAggregatorOptions opts_;
+  Vector<ScopedPtr<Shard>> shards_;
+  size_t max_keys_per_shard_;
+  StatsdAggregatorStats stats_;
+  Function<void (const StatsdAggregate& aggr)> on_flush_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+}
+}
+#endif
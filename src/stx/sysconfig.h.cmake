@@ -58,6 +58,7 @@
 #cmakedefine HAVE_AIO_H
 #cmakedefine HAVE_LIBAIO_H
 #cmakedefine HAVE_ZLIB_H
+#cmakedefine HAVE_LIBZ
 #cmakedefine HAVE_BZLIB_H
 #cmakedefine HAVE_GNUTLS_H
 #cmakedefine HAVE_LUA_H
@@ -90,6 +91,8 @@
 #cmakedefine HAVE_PATHCONF
 #cmakedefine HAVE_ACCEPT4
 #cmakedefine HAVE_PIPE2
+#cmakedefine HAVE_RECVMMSG
+#cmakedefine HAVE_SENDMMSG
 #cmakedefine HAVE_DUP2
 #cmakedefine HAVE_FORK
 #cmakedefine HAVE_BACKTRACE
@@ -0,0 +1,91 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2014 Paul Asmuth, Google Inc.
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include "stx/wallclock.h"
+#include "stx/stringutil.h"
+#include "stx/test/benchmark.h"
+
+namespace stx {
+
+Benchmark::BenchmarkResult::BenchmarkResult(
+    uint64_t total_time_nanos,
+    uint64_t num_iterations) :
+    total_time_nanos_(total_time_nanos),
+    num_iterations_(num_iterations) {}
+
+uint64_t Benchmark::BenchmarkResult::meanRuntimeNanos() const {
+  if (num_iterations_ == 0) {
+    return 0;
+  }
+
+  return total_time_nanos_ / num_iterations_;
+}
+
+double Benchmark::BenchmarkResult::ratePerSecond() const {
+  if (total_time_nanos_ == 0) {
+    return 0;
+  }
+
+  return num_iterations_ / (total_time_nanos_ / 1000000000.0);
+}
+
+uint64_t Benchmark::BenchmarkResult::numIterations() const {
+  return num_iterations_;
+}
+
+Benchmark::BenchmarkResult Benchmark::benchmark(
+    std::function<void()> subject,
+    uint64_t num_iterations) {
+  auto t0 = WallClock::unixMicros();
+
+  for (uint64_t i = 0; i < num_iterations; ++i) {
+    subject();
+  }
+
+  auto t1 = WallClock::unixMicros();
+  return BenchmarkResult(
+      (t1 - t0) * 1000,
+      num_iterations);
+}
+
+void Benchmark::benchmarkAndPrint(
+    std::function<void()> subject,
+    uint64_t num_iterations,
+    uint64_t num_rounds) {
+  for (uint64_t i = 0; i < num_rounds; ++i) {
+    auto res = benchmark(subject, num_iterations);
+    printResultTable(StringUtil::format("round $0", i + 1), res, i > 0);
+  }
+}
+
+void Benchmark::printResultTable(
+    const std::string& label,
+    const BenchmarkResult& result,
+    bool append /* = false */) {
+  if (!append) {
+    printf(
+        "%-32s %14s %14s %14s\n",
+        "benchmark",
+        "iterations",
+        "mean (ns)",
+        "rate (1/s)");
+  }
+
+  printf(
+      "%-32s %14llu %14llu %14.1f\n",
+      label.c_str(),
+      (unsigned long long) result.numIterations(),
+      (unsigned long long) result.meanRuntimeNanos(),
+      result.ratePerSecond());
+
+  fflush(stdout);
+}
+
+}
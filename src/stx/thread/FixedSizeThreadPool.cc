@@ -39,7 +39,8 @@ FixedSizeThreadPool::FixedSizeThreadPool(
     nthreads_(nthreads),
     error_handler_(std::move(error_handler)),
     queue_(maxqueuelen),
-    block_(block) {}
+    block_(block),
+    timers_(this) {}
 
 void FixedSizeThreadPool::start() {
   running_ = true;
@@ -79,6 +80,12 @@ void FixedSizeThreadPool::run(std::function<void()> task) {
   queue_.insert(task, block_);
 }
 
+void FixedSizeThreadPool::runAfter(
+    std::function<void()> task,
+    uint64_t delay_us) {
+  timers_.runAfter(task, delay_us);
+}
+
 void FixedSizeThreadPool::runOnReadable(std::function<void()> task, int fd) {
   RAISE(
       kNotImplementedError,
@@ -17,6 +17,7 @@
 #include "stx/thread/task.h"
 #include "stx/thread/queue.h"
 #include "stx/thread/taskscheduler.h"
+#include "stx/thread/TimerQueue.h"
 #include "stx/thread/wakeup.h"
 #include "stx/thread/threadpool.h"
 #include "stx/exceptionhandler.h"
@@ -75,6 +76,12 @@ public:
       Wakeup* wakeup,
       long generation) override;
 
+  /**
+   * Run the provided task on the pool once the delay has elapsed. Pending
+   * timers are kept by a single timer thread and dropped with the pool
+   */
+  void runAfter(std::function<void()> task, uint64_t delay_us) override;
+
 protected:
   ThreadPoolOptions opts_;
   size_t nthreads_;
@@ -83,6 +90,7 @@ protected:
   bool block_;
   std::atomic<bool> running_;
   Vector<std::thread> threads_;
+  TimerQueue timers_;
 };
 
 }
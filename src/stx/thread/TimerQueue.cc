@@ -0,0 +1,92 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+#include "stx/exception.h"
+#include "stx/thread/TimerQueue.h"
+
+namespace stx {
+namespace thread {
+
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    RAISE_ERRNO(kRuntimeError, "clock_gettime() failed");
+  }
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+TimerQueue::TimerQueue(
+    TaskScheduler* target) :
+    target_(target),
+    running_(true),
+    started_(false) {}
+
+TimerQueue::~TimerQueue() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  running_ = false;
+  lk.unlock();
+  wakeup_.notify_all();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TimerQueue::runAfter(std::function<void()> task, uint64_t delay_us) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto deadline = monotonicMicros() + delay_us;
+  auto is_first = timers_.empty() || deadline < timers_.begin()->first;
+  timers_.emplace(deadline, task);
+
+  if (!started_) {
+    started_ = true;
+    thread_ = std::thread(std::bind(&TimerQueue::runTimers, this));
+  }
+
+  lk.unlock();
+
+  if (is_first) {
+    wakeup_.notify_all();
+  }
+}
+
+size_t TimerQueue::numPendingTimers() const {
+  std::unique_lock<std::mutex> lk(mutex_);
+  return timers_.size();
+}
+
+void TimerQueue::runTimers() {
+  std::unique_lock<std::mutex> lk(mutex_);
+
+  while (running_) {
+    if (timers_.empty()) {
+      wakeup_.wait(lk);
+      continue;
+    }
+
+    auto now = monotonicMicros();
+    auto next = timers_.begin()->first;
+    if (next > now) {
+      wakeup_.wait_for(lk, std::chrono::microseconds(next - now));
+      continue;
+    }
+
+    auto task = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+
+    lk.unlock();
+    target_->run(task);
+    lk.lock();
+  }
+}
+
+}
+}
@@ -0,0 +1,59 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _libstx_THREAD_TIMERQUEUE_H
+#define _libstx_THREAD_TIMERQUEUE_H
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "stx/thread/taskscheduler.h"
+
+namespace stx {
+namespace thread {
+
+/**
+ * Implements TaskScheduler::runAfter for schedulers that can't wait on a
+ * timeout themselves. A single thread sleeps until the earliest pending
+ * timer expires and then hands the task to the target scheduler with run(),
+ * so a pending timer never occupies one of the target's threads.
+ *
+ * The thread is started with the first timer. Timers that are still pending
+ * when the queue is destroyed are dropped.
+ */
+class TimerQueue {
+public:
+
+  TimerQueue(TaskScheduler* target);
+  ~TimerQueue();
+
+  TimerQueue(const TimerQueue& other) = delete;
+  TimerQueue& operator=(const TimerQueue& other) = delete;
+
+  void runAfter(std::function<void()> task, uint64_t delay_us);
+
+  size_t numPendingTimers() const;
+
+protected:
+
+  void runTimers();
+
+  TaskScheduler* target_;
+  mutable std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::multimap<uint64_t, std::function<void()>> timers_;
+  bool running_;
+  bool started_;
+  std::thread thread_;
+};
+
+}
+}
+#endif
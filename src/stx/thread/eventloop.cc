@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 #include <thread>
 #include <unistd.h>
 #include "stx/exception.h"
@@ -21,11 +22,21 @@
 namespace stx {
 namespace thread {
 
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    RAISE_ERRNO(kRuntimeError, "clock_gettime() failed");
+  }
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
 EventLoop::EventLoop() :
     max_fd_(1),
     running_(true),
     threadid_(std::this_thread::get_id()),
-    callbacks_(FD_SETSIZE + 1, nullptr),
+    read_callbacks_(FD_SETSIZE + 1, nullptr),
+    write_callbacks_(FD_SETSIZE + 1, nullptr),
     num_fds_(0) {
   FD_ZERO(&op_read_);
   FD_ZERO(&op_write_);
@@ -92,11 +103,13 @@ void EventLoop::runOnReadable(std::function<void()> task, int fd) {
     max_fd_ = fd;
   }
 
-  FD_SET(fd, &op_read_);
-  FD_SET(fd, &op_error_);
-  ++num_fds_;
+  if (!FD_ISSET(fd, &op_read_)) {
+    FD_SET(fd, &op_read_);
+    ++num_fds_;
+  }
 
-  callbacks_[fd] = task;
+  FD_SET(fd, &op_error_);
+  read_callbacks_[fd] = task;
 }
 
 void EventLoop::runOnWritable(std::function<void()> task, int fd) {
@@ -116,11 +129,13 @@ void EventLoop::runOnWritable(std::function<void()> task, int fd) {
     max_fd_ = fd;
   }
 
-  FD_SET(fd, &op_write_);
-  FD_SET(fd, &op_error_);
-  ++num_fds_;
+  if (!FD_ISSET(fd, &op_write_)) {
+    FD_SET(fd, &op_write_);
+    ++num_fds_;
+  }
 
-  callbacks_[fd] = task;
+  FD_SET(fd, &op_error_);
+  write_callbacks_[fd] = task;
 }
 
 void EventLoop::cancelFD(int fd) {
@@ -144,14 +159,19 @@ void EventLoop::cancelFD(int fd) {
     return;
   }
 
-  if (FD_ISSET(fd, &op_read_) || FD_ISSET(fd, &op_write_)) {
+  if (FD_ISSET(fd, &op_read_)) {
+    --num_fds_;
+  }
+
+  if (FD_ISSET(fd, &op_write_)) {
     --num_fds_;
   }
 
   FD_CLR(fd, &op_read_);
   FD_CLR(fd, &op_write_);
   FD_CLR(fd, &op_error_);
-  callbacks_[fd] = nullptr;
+  read_callbacks_[fd] = nullptr;
+  write_callbacks_[fd] = nullptr;
 }
 
 void EventLoop::poll() {
@@ -161,9 +181,24 @@ void EventLoop::poll() {
   memcpy(&op_write, &op_write_, sizeof(fd_set));
   memcpy(&op_error, &op_error_, sizeof(fd_set));
 
-  int res = select(max_fd_ + 1, &op_read, &op_write, &op_error, NULL);
+  struct timeval timeout;
+  struct timeval* timeout_ptr = NULL;
+  {
+    std::unique_lock<std::mutex> lk(runq_mutex_);
+    if (!timers_.empty()) {
+      auto now = monotonicMicros();
+      auto next = timers_.begin()->first;
+      auto wait = next > now ? next - now : 0;
+      timeout.tv_sec = wait / 1000000;
+      timeout.tv_usec = wait % 1000000;
+      timeout_ptr = &timeout;
+    }
+  }
+
+  int res = select(max_fd_ + 1, &op_read, &op_write, &op_error, timeout_ptr);
 
   if (res == 0) {
+    runTimers();
     return;
   }
 
@@ -185,25 +220,63 @@ void EventLoop::poll() {
       continue;
     }
 
-    if (FD_ISSET(fd, &op_read)) {
+    // an fd may wait for both directions at once, each with its own
+    // callback. the read callback may cancel the write, so check that the
+    // write is still armed before running it
+    if (FD_ISSET(fd, &op_read) && FD_ISSET(fd, &op_read_)) {
       FD_CLR(fd, &op_read_);
-      FD_CLR(fd, &op_error_);
       --num_fds_;
-
-      if (callbacks_[fd]) {
-        callbacks_[fd]();
-      }
+      runFDCallback(fd, &read_callbacks_);
     }
 
-    else if (FD_ISSET(fd, &op_write)) {
+    if (FD_ISSET(fd, &op_write) && FD_ISSET(fd, &op_write_)) {
       FD_CLR(fd, &op_write_);
-      FD_CLR(fd, &op_error_);
       --num_fds_;
+      runFDCallback(fd, &write_callbacks_);
+    }
+  }
 
-      if (callbacks_[fd]) {
-        callbacks_[fd]();
-      }
+  runTimers();
+}
+
+void EventLoop::runFDCallback(
+    int fd,
+    std::vector<std::function<void()>>* callbacks) {
+  if (!FD_ISSET(fd, &op_read_) && !FD_ISSET(fd, &op_write_)) {
+    FD_CLR(fd, &op_error_);
+  }
+
+  // the callback may register the next one for the same fd
+  auto callback = std::move((*callbacks)[fd]);
+  (*callbacks)[fd] = nullptr;
+  if (callback) {
+    callback();
+  }
+}
+
+void EventLoop::runAfter(std::function<void()> task, uint64_t delay_us) {
+  std::unique_lock<std::mutex> lk(runq_mutex_);
+  timers_.emplace(monotonicMicros() + delay_us, task);
+  lk.unlock();
+  wakeup();
+}
+
+void EventLoop::runTimers() {
+  std::list<std::function<void()>> tasks;
+
+  {
+    std::unique_lock<std::mutex> lk(runq_mutex_);
+    auto now = monotonicMicros();
+    auto end = timers_.upper_bound(now);
+    for (auto iter = timers_.begin(); iter != end; ++iter) {
+      tasks.emplace_back(iter->second);
     }
+
+    timers_.erase(timers_.begin(), end);
+  }
+
+  for (const auto& task : tasks) {
+    task();
   }
 }
 
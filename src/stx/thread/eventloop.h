@@ -10,6 +10,7 @@
 #ifndef libstx_EV_EVENTLOOP_H
 #define libstx_EV_EVENTLOOP_H
 #include <list>
+#include <map>
 #include <sys/select.h>
 #include <thread>
 #include <vector>
@@ -29,6 +30,12 @@ public:
       Wakeup* wakeup,
       long wakeup_generation) override;
 
+  /**
+   * Run the provided task from the event loop thread once the delay has
+   * elapsed. Pending timers do not keep runOnce from returning
+   */
+  void runAfter(std::function<void()> task, uint64_t delay_us) override;
+
   void cancelFD(int fd) override;
 
   EventLoop();
@@ -41,9 +48,11 @@ public:
 protected:
 
   void poll();
+  void runFDCallback(int fd, std::vector<std::function<void()>>* callbacks);
   void setupRunQWakeupPipe();
   void onRunQWakeup();
   void appendToRunQ(std::function<void()> task);
+  void runTimers();
 
   fd_set op_read_;
   fd_set op_write_;
@@ -52,9 +61,11 @@ protected:
   std::atomic<bool> running_;
   int runq_wakeup_pipe_[2];
   std::list<std::function<void()>> runq_;
+  std::multimap<uint64_t, std::function<void()>> timers_;
   std::mutex runq_mutex_;
   std::thread::id threadid_;
-  std::vector<std::function<void()>> callbacks_;
+  std::vector<std::function<void()>> read_callbacks_;
+  std::vector<std::function<void()>> write_callbacks_;
   size_t num_fds_;
 };
 
@@ -83,6 +83,11 @@ public:
       Wakeup* wakeup,
       long wakeup_generation) = 0;
 
+  /**
+   * Run the provided task once the provided delay (in microseconds) has
+   * elapsed. A pending timer must not occupy a thread of the scheduler
+   */
+  virtual void runAfter(std::function<void()> task, uint64_t delay_us) = 0;
 
   virtual void cancelFD(int fd) {};
 
@@ -41,7 +41,8 @@ ThreadPool::ThreadPool(
     opts_(opts),
     max_cached_threads_(max_cached_threads),
     num_threads_(0),
-    free_threads_(0) {}
+    free_threads_(0),
+    timers_(this) {}
 
 void ThreadPool::run(std::function<void()> task) {
   std::unique_lock<std::mutex> l(runq_mutex_);
@@ -108,6 +109,10 @@ void ThreadPool::runOnWakeup(
   });
 }
 
+void ThreadPool::runAfter(std::function<void()> task, uint64_t delay_us) {
+  timers_.runAfter(task, delay_us);
+}
+
 void ThreadPool::startThread() {
   bool cache = false;
   if (++num_threads_ <= max_cached_threads_) {
@@ -15,6 +15,7 @@
 #include <list>
 #include "stx/thread/task.h"
 #include "stx/thread/taskscheduler.h"
+#include "stx/thread/TimerQueue.h"
 #include "stx/thread/wakeup.h"
 #include "stx/exceptionhandler.h"
 #include "stx/option.h"
@@ -50,6 +51,12 @@ public:
       Wakeup* wakeup,
       long generation) override;
 
+  /**
+   * Run the provided task on the pool once the delay has elapsed. Pending
+   * timers are kept by a single timer thread and dropped with the pool
+   */
+  void runAfter(std::function<void()> task, uint64_t delay_us) override;
+
 protected:
   void startThread();
 
@@ -61,6 +68,7 @@ protected:
   std::mutex runq_mutex_;
   std::list<std::function<void()>> runq_;
   std::condition_variable wakeup_;
+  TimerQueue timers_;
 };
 
 using CachedThreadPool = ThreadPool;
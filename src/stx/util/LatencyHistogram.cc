@@ -0,0 +1,117 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include "stx/util/LatencyHistogram.h"
+
+namespace stx {
+namespace util {
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+void LatencyHistogram::record(uint64_t value, uint64_t count /* = 1 */) {
+  buckets_[bucketIndex(value)].fetch_add(count, std::memory_order_relaxed);
+  count_.fetch_add(count, std::memory_order_relaxed);
+  sum_.fetch_add(value * count, std::memory_order_relaxed);
+
+  auto cur_max = max_.load(std::memory_order_relaxed);
+  while (value > cur_max &&
+      !max_.compare_exchange_weak(cur_max, value)) {}
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    auto n = other.buckets_[i].load(std::memory_order_relaxed);
+    if (n > 0) {
+      buckets_[i].fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+  count_.fetch_add(other.count_.load(), std::memory_order_relaxed);
+  sum_.fetch_add(other.sum_.load(), std::memory_order_relaxed);
+
+  auto other_max = other.max_.load();
+  auto cur_max = max_.load(std::memory_order_relaxed);
+  while (other_max > cur_max &&
+      !max_.compare_exchange_weak(cur_max, other_max)) {}
+}
+
+void LatencyHistogram::reset() {
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    buckets_[i] = 0;
+  }
+
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+}
+
+uint64_t LatencyHistogram::count() const {
+  return count_.load();
+}
+
+uint64_t LatencyHistogram::max() const {
+  return max_.load();
+}
+
+double LatencyHistogram::mean() const {
+  auto n = count_.load();
+  if (n == 0) {
+    return 0;
+  }
+
+  return sum_.load() / (double) n;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  auto total = count_.load();
+  if (total == 0) {
+    return 0;
+  }
+
+  auto threshold = (uint64_t) (total * (p / 100.0));
+  if (threshold == 0) {
+    threshold = 1;
+  }
+
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    if (cumulative >= threshold) {
+      return std::min(bucketUpperBound(i), max_.load());
+    }
+  }
+
+  return max_.load();
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+
+  size_t msb = 63 - __builtin_clzll(value);
+  size_t shift = msb - kSubBucketsBits;
+  return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+
+  size_t shift = index / kSubBuckets - 1;
+  uint64_t sub_bucket = index % kSubBuckets + kSubBuckets;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+}
+}
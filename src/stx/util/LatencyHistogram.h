@@ -0,0 +1,68 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_UTIL_LATENCYHISTOGRAM_H
+#define _STX_UTIL_LATENCYHISTOGRAM_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include "stx/stdtypes.h"
+
+namespace stx {
+namespace util {
+
+/**
+ * A fixed size, log-linear histogram of integer values (e.g. latencies in
+ * microseconds). Values below kSubBuckets are recorded exactly, larger values
+ * with a relative error of at most 1/kSubBuckets. Recording is lock free and
+ * may be called concurrently from any number of threads.
+ */
+class LatencyHistogram {
+public:
+  static const size_t kSubBucketsBits = 5;
+  static const size_t kSubBuckets = 1 << kSubBucketsBits;
+  static const size_t kNumBuckets = (64 - kSubBucketsBits + 1) * kSubBuckets;
+
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram& other) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram& other) = delete;
+
+  void record(uint64_t value, uint64_t count = 1);
+
+  /**
+   * Add all values recorded in other to this histogram
+   */
+  void merge(const LatencyHistogram& other);
+
+  void reset();
+
+  uint64_t count() const;
+  uint64_t max() const;
+  double mean() const;
+
+  /**
+   * Returns the (upper bound of the) value below which the provided
+   * percentage of recorded values fall, e.g. percentile(99.9)
+   */
+  uint64_t percentile(double p) const;
+
+protected:
+  static size_t bucketIndex(uint64_t value);
+  static uint64_t bucketUpperBound(size_t index);
+
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+}
+}
+#endif
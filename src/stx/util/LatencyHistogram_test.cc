@@ -0,0 +1,63 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include "stx/test/unittest.h"
+#include "stx/util/LatencyHistogram.h"
+
+using namespace stx;
+using namespace stx::util;
+
+UNIT_TEST(LatencyHistogramTest);
+
+TEST_CASE(LatencyHistogramTest, TestSmallValuesAreExact, [] () {
+  LatencyHistogram hist;
+  for (uint64_t i = 1; i <= 20; ++i) {
+    hist.record(i);
+  }
+
+  EXPECT_EQ(hist.count(), 20);
+  EXPECT_EQ(hist.max(), 20);
+  EXPECT_EQ(hist.percentile(50), 10);
+  EXPECT_EQ(hist.percentile(100), 20);
+  EXPECT_TRUE(hist.mean() == 10.5);
+});
+
+TEST_CASE(LatencyHistogramTest, TestPercentiles, [] () {
+  LatencyHistogram hist;
+  for (uint64_t i = 1; i <= 100000; ++i) {
+    hist.record(i);
+  }
+
+  auto p50 = hist.percentile(50);
+  auto p99 = hist.percentile(99);
+  auto p999 = hist.percentile(99.9);
+  EXPECT_TRUE(p50 >= 50000 && p50 <= 50000 * 1.04);
+  EXPECT_TRUE(p99 >= 99000 && p99 <= 99000 * 1.04);
+  EXPECT_TRUE(p999 >= 99900 && p999 <= 100000);
+  EXPECT_EQ(hist.percentile(100), 100000);
+});
+
+TEST_CASE(LatencyHistogramTest, TestMerge, [] () {
+  LatencyHistogram a;
+  LatencyHistogram b;
+  a.record(10, 99);
+  b.record(1000000);
+
+  a.merge(b);
+  EXPECT_EQ(a.count(), 100);
+  EXPECT_EQ(a.max(), 1000000);
+  EXPECT_EQ(a.percentile(99), 10);
+  EXPECT_EQ(a.percentile(100), 1000000);
+
+  a.reset();
+  EXPECT_EQ(a.count(), 0);
+  EXPECT_EQ(a.percentile(99), 0);
+});
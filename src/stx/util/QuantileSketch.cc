@@ -0,0 +1,155 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <math.h>
+#include <algorithm>
+#include "stx/exception.h"
+#include "stx/util/QuantileSketch.h"
+
+namespace stx {
+namespace util {
+
+// values closer to zero than this are counted as zero
+static const double kMinValue = 1e-9;
+
+constexpr double QuantileSketch::kDefaultRelativeAccuracy;
+
+QuantileSketch::QuantileSketch(
+    double relative_accuracy /* = kDefaultRelativeAccuracy */) :
+    relative_accuracy_(relative_accuracy) {
+  if (!(relative_accuracy > 0 && relative_accuracy < 1)) {
+    RAISE(kIllegalArgumentError, "relative accuracy must be in (0, 1)");
+  }
+
+  gamma_ = (1 + relative_accuracy) / (1 - relative_accuracy);
+  log_gamma_ = log(gamma_);
+  reset();
+}
+
+void QuantileSketch::add(double value, double weight /* = 1 */) {
+  if (!isfinite(value) || !(weight > 0)) {
+    return;
+  }
+
+  if (value > kMinValue) {
+    positive_[bucketIndex(value)] += weight;
+  } else if (value < -kMinValue) {
+    negative_[bucketIndex(-value)] += weight;
+  } else {
+    zero_count_ += weight;
+  }
+
+  count_ += weight;
+  sum_ += value * weight;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+  if (other.relative_accuracy_ != relative_accuracy_) {
+    RAISE(
+        kIllegalArgumentError,
+        "can't merge sketches with different accuracies");
+  }
+
+  for (const auto& bucket : other.positive_) {
+    positive_[bucket.first] += bucket.second;
+  }
+
+  for (const auto& bucket : other.negative_) {
+    negative_[bucket.first] += bucket.second;
+  }
+
+  zero_count_ += other.zero_count_;
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void QuantileSketch::reset() {
+  positive_.clear();
+  negative_.clear();
+  zero_count_ = 0;
+  count_ = 0;
+  sum_ = 0;
+  min_ = INFINITY;
+  max_ = -INFINITY;
+}
+
+double QuantileSketch::count() const {
+  return count_;
+}
+
+double QuantileSketch::sum() const {
+  return sum_;
+}
+
+double QuantileSketch::min() const {
+  return count_ > 0 ? min_ : 0;
+}
+
+double QuantileSketch::max() const {
+  return count_ > 0 ? max_ : 0;
+}
+
+double QuantileSketch::mean() const {
+  return count_ > 0 ? sum_ / count_ : 0;
+}
+
+double QuantileSketch::percentile(double p) const {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  if (p >= 100) {
+    return max_;
+  }
+
+  // (value, weight) of all buckets in ascending order of value
+  Vector<Pair<double, double>> buckets;
+  buckets.reserve(negative_.size() + positive_.size() + 1);
+  for (const auto& bucket : negative_) {
+    buckets.emplace_back(-bucketValue(bucket.first), bucket.second);
+  }
+
+  if (zero_count_ > 0) {
+    buckets.emplace_back(0, zero_count_);
+  }
+
+  for (const auto& bucket : positive_) {
+    buckets.emplace_back(bucketValue(bucket.first), bucket.second);
+  }
+
+  std::sort(buckets.begin(), buckets.end());
+
+  auto threshold = count_ * (p / 100.0);
+  double cumulative = 0;
+  for (const auto& bucket : buckets) {
+    cumulative += bucket.second;
+    if (cumulative >= threshold) {
+      return std::max(min_, std::min(bucket.first, max_));
+    }
+  }
+
+  return max_;
+}
+
+// bucket i holds the values in (gamma^(i-1), gamma^i]
+int32_t QuantileSketch::bucketIndex(double value) const {
+  return (int32_t) ceil(log(value) / log_gamma_);
+}
+
+// the value with the same relative distance to both bucket bounds
+double QuantileSketch::bucketValue(int32_t index) const {
+  return 2 * pow(gamma_, index) / (gamma_ + 1);
+}
+
+}
+}
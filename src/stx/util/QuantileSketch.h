@@ -0,0 +1,78 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef _STX_UTIL_QUANTILESKETCH_H
+#define _STX_UTIL_QUANTILESKETCH_H
+#include <stdlib.h>
+#include <stdint.h>
+#include "stx/stdtypes.h"
+
+namespace stx {
+namespace util {
+
+/**
+ * A sparse, log-bucketed histogram of (possibly negative or fractional)
+ * values. Percentiles are returned with a relative error of at most
+ * relative_accuracy. Only buckets that received a value are allocated, so a
+ * sketch of values spanning a few orders of magnitude stays small.
+ *
+ * Sketches with the same accuracy can be merged. The sketch is not thread
+ * safe.
+ */
+class QuantileSketch {
+public:
+  static constexpr double kDefaultRelativeAccuracy = 0.01;
+
+  QuantileSketch(double relative_accuracy = kDefaultRelativeAccuracy);
+
+  /**
+   * Record a value. A weight other than one records the value as if it was
+   * seen weight times (e.g. 1 / sample_rate). Non-finite values are ignored
+   */
+  void add(double value, double weight = 1);
+
+  /**
+   * Add all values recorded in other to this sketch. Throws a
+   * kIllegalArgumentError if the sketches have different accuracies
+   */
+  void merge(const QuantileSketch& other);
+
+  void reset();
+
+  double count() const;
+  double sum() const;
+  double min() const;
+  double max() const;
+  double mean() const;
+
+  /**
+   * Returns the value below which the provided percentage of recorded values
+   * fall, e.g. percentile(99.9)
+   */
+  double percentile(double p) const;
+
+protected:
+  int32_t bucketIndex(double value) const;
+  double bucketValue(int32_t index) const;
+
+  double relative_accuracy_;
+  double gamma_;
+  double log_gamma_;
+  HashMap<int32_t, double> positive_;
+  HashMap<int32_t, double> negative_;
+  double zero_count_;
+  double count_;
+  double sum_;
+  double min_;
+  double max_;
+};
+
+}
+}
+#endif
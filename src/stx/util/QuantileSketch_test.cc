@@ -0,0 +1,77 @@
+/**
+ * This file is part of the "libstx" project
+ *   Copyright (c) 2015 Paul Asmuth
+ *
+ * libstx is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License v3.0. You should have received a
+ * copy of the GNU General Public License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "stx/test/unittest.h"
+#include "stx/util/QuantileSketch.h"
+
+using namespace stx;
+using namespace stx::util;
+
+UNIT_TEST(QuantileSketchTest);
+
+static bool isClose(double value, double expected, double accuracy) {
+  return fabs(value - expected) <= fabs(expected) * accuracy;
+}
+
+TEST_CASE(QuantileSketchTest, TestPercentiles, [] () {
+  QuantileSketch sketch(0.01);
+  for (int i = 1; i <= 100000; ++i) {
+    sketch.add(i * 0.5);
+  }
+
+  EXPECT_EQ(sketch.count(), 100000);
+  EXPECT_EQ(sketch.min(), 0.5);
+  EXPECT_EQ(sketch.max(), 50000);
+  EXPECT_TRUE(isClose(sketch.mean(), 25000.25, 1e-9));
+  EXPECT_TRUE(isClose(sketch.percentile(50), 25000, 0.01));
+  EXPECT_TRUE(isClose(sketch.percentile(99), 49500, 0.01));
+  EXPECT_TRUE(isClose(sketch.percentile(99.9), 49950, 0.01));
+  EXPECT_EQ(sketch.percentile(100), 50000);
+});
+
+TEST_CASE(QuantileSketchTest, TestNegativeValuesAndWeights, [] () {
+  QuantileSketch sketch;
+  sketch.add(-100, 10);
+  sketch.add(0, 10);
+  sketch.add(100, 80);
+
+  EXPECT_EQ(sketch.count(), 100);
+  EXPECT_EQ(sketch.min(), -100);
+  EXPECT_TRUE(isClose(sketch.percentile(5), -100, 0.01));
+  EXPECT_EQ(sketch.percentile(15), 0);
+  EXPECT_TRUE(isClose(sketch.percentile(50), 100, 0.01));
+});
+
+TEST_CASE(QuantileSketchTest, TestMerge, [] () {
+  QuantileSketch a;
+  QuantileSketch b;
+  QuantileSketch all;
+  for (int i = 1; i <= 1000; ++i) {
+    (i % 2 ? a : b).add(i);
+    all.add(i);
+  }
+
+  a.merge(b);
+  EXPECT_EQ(a.count(), all.count());
+  EXPECT_EQ(a.max(), all.max());
+  EXPECT_EQ(a.percentile(90), all.percentile(90));
+
+  QuantileSketch other(0.05);
+  bool raised = false;
+  try {
+    a.merge(other);
+  } catch (const Exception& e) {
+    raised = true;
+  }
+
+  EXPECT_TRUE(raised);
+});